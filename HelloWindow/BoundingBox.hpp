@@ -0,0 +1,60 @@
+#ifndef BoundingBox_hpp
+#define BoundingBox_hpp
+
+#include <glm/glm.hpp>
+
+#include <cfloat>
+
+namespace gps {
+
+    //axis aligned bounding box, empty when min > max
+    struct AABB {
+        glm::vec3 min = glm::vec3(FLT_MAX);
+        glm::vec3 max = glm::vec3(-FLT_MAX);
+
+        bool isEmpty() const {
+            return min.x > max.x;
+        }
+
+        void expand(const glm::vec3& point) {
+            min = glm::min(min, point);
+            max = glm::max(max, point);
+        }
+
+        void expand(const AABB& other) {
+            min = glm::min(min, other.min);
+            max = glm::max(max, other.max);
+        }
+
+        glm::vec3 center() const {
+            return (min + max) * 0.5f;
+        }
+
+        glm::vec3 extents() const {
+            return (max - min) * 0.5f;
+        }
+
+        //bounds of the box after an affine transform (Arvo's method)
+        AABB transformed(const glm::mat4& matrix) const {
+            AABB result;
+            if (isEmpty()) {
+                return result;
+            }
+            glm::vec3 translation = glm::vec3(matrix[3]);
+            result.min = translation;
+            result.max = translation;
+            for (int column = 0; column < 3; column++) {
+                for (int row = 0; row < 3; row++) {
+                    float a = matrix[column][row] * min[column];
+                    float b = matrix[column][row] * max[column];
+                    result.min[row] += a < b ? a : b;
+                    result.max[row] += a < b ? b : a;
+                }
+            }
+            return result;
+        }
+    };
+
+}
+
+#endif /* BoundingBox_hpp */
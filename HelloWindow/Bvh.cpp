@@ -0,0 +1,490 @@
+#include "Bvh.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace gps {
+
+    static float surfaceArea(const AABB& box) {
+        glm::vec3 size = box.max - box.min;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    static AABB unionOf(const AABB& a, const AABB& b) {
+        AABB result = a;
+        result.expand(b);
+        return result;
+    }
+
+    static bool overlaps(const AABB& a, const AABB& b) {
+        return a.min.x <= b.max.x && a.min.y <= b.max.y && a.min.z <= b.max.z &&
+            b.min.x <= a.max.x && b.min.y <= a.max.y && b.min.z <= a.max.z;
+    }
+
+    //entry distance of the ray into the box, false when it misses or enters beyond maxDistance
+    static bool rayEntersBox(const AABB& box, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance, float& entry) {
+        glm::vec3 t1 = (box.min - origin) * inverseDirection;
+        glm::vec3 t2 = (box.max - origin) * inverseDirection;
+        glm::vec3 tNear = glm::min(t1, t2);
+        glm::vec3 tFar = glm::max(t1, t2);
+        float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+        entry = enter;
+        return enter <= exit;
+    }
+
+    int Bvh::allocateNode() {
+        int node;
+        if (!freeNodes.empty()) {
+            node = freeNodes.back();
+            freeNodes.pop_back();
+        }
+        else {
+            node = (int)nodes.size();
+            nodes.push_back(Node());
+        }
+        nodes[node].parent = BVH_NULL_NODE;
+        nodes[node].left = BVH_NULL_NODE;
+        nodes[node].right = BVH_NULL_NODE;
+        nodes[node].item = 0;
+        nodes[node].used = true;
+        return node;
+    }
+
+    void Bvh::freeNode(int node) {
+        nodes[node].used = false;
+        freeNodes.push_back(node);
+    }
+
+    int Bvh::insert(const AABB& bounds, size_t item) {
+        int leaf = allocateNode();
+        nodes[leaf].bounds = bounds;
+        nodes[leaf].item = item;
+        insertLeaf(leaf);
+        leafCount++;
+        return leaf;
+    }
+
+    void Bvh::remove(int leaf) {
+        removeLeaf(leaf);
+        freeNode(leaf);
+        leafCount--;
+    }
+
+    bool Bvh::update(int leaf, const AABB& bounds) {
+        const AABB& stored = nodes[leaf].bounds;
+        if (glm::all(glm::lessThanEqual(stored.min, bounds.min)) && glm::all(glm::lessThanEqual(bounds.max, stored.max))) {
+            return false;
+        }
+
+        AABB grown = bounds;
+        grown.min -= glm::vec3(BVH_LEAF_MARGIN);
+        grown.max += glm::vec3(BVH_LEAF_MARGIN);
+        //a short move keeps the place in the tree, a jump looks for a new sibling
+        if (overlaps(stored, grown)) {
+            nodes[leaf].bounds = grown;
+            refitAncestors(nodes[leaf].parent);
+        }
+        else {
+            removeLeaf(leaf);
+            nodes[leaf].bounds = grown;
+            insertLeaf(leaf);
+        }
+        return true;
+    }
+
+    void Bvh::clear() {
+        nodes.clear();
+        freeNodes.clear();
+        root = BVH_NULL_NODE;
+        leafCount = 0;
+    }
+
+    //walks down to the sibling whose enlargement, plus the growth of its ancestors, is the smallest
+    void Bvh::insertLeaf(int leaf) {
+        if (root == BVH_NULL_NODE) {
+            root = leaf;
+            nodes[leaf].parent = BVH_NULL_NODE;
+            return;
+        }
+
+        AABB leafBounds = nodes[leaf].bounds;
+        int index = root;
+        while (nodes[index].left != BVH_NULL_NODE) {
+            int left = nodes[index].left;
+            int right = nodes[index].right;
+            float area = surfaceArea(nodes[index].bounds);
+            float combinedArea = surfaceArea(unionOf(nodes[index].bounds, leafBounds));
+            //pairing with this node, and the growth every node below pays on the way down
+            float cost = 2.0f * combinedArea;
+            float inheritedCost = 2.0f * (combinedArea - area);
+
+            float leftCost = surfaceArea(unionOf(nodes[left].bounds, leafBounds)) + inheritedCost;
+            if (nodes[left].left != BVH_NULL_NODE) {
+                leftCost -= surfaceArea(nodes[left].bounds);
+            }
+            float rightCost = surfaceArea(unionOf(nodes[right].bounds, leafBounds)) + inheritedCost;
+            if (nodes[right].left != BVH_NULL_NODE) {
+                rightCost -= surfaceArea(nodes[right].bounds);
+            }
+
+            if (cost < leftCost && cost < rightCost) {
+                break;
+            }
+            index = leftCost < rightCost ? left : right;
+        }
+
+        int sibling = index;
+        int oldParent = nodes[sibling].parent;
+        int newParent = allocateNode();
+        nodes[newParent].parent = oldParent;
+        nodes[newParent].bounds = unionOf(nodes[sibling].bounds, leafBounds);
+        nodes[newParent].left = sibling;
+        nodes[newParent].right = leaf;
+        nodes[sibling].parent = newParent;
+        nodes[leaf].parent = newParent;
+
+        if (oldParent == BVH_NULL_NODE) {
+            root = newParent;
+        }
+        else {
+            if (nodes[oldParent].left == sibling) {
+                nodes[oldParent].left = newParent;
+            }
+            else {
+                nodes[oldParent].right = newParent;
+            }
+            refitAncestors(oldParent);
+        }
+    }
+
+    void Bvh::removeLeaf(int leaf) {
+        if (leaf == root) {
+            root = BVH_NULL_NODE;
+            return;
+        }
+
+        int parent = nodes[leaf].parent;
+        int grandParent = nodes[parent].parent;
+        int sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+        nodes[leaf].parent = BVH_NULL_NODE;
+
+        //the sibling takes the parent's place
+        if (grandParent == BVH_NULL_NODE) {
+            root = sibling;
+            nodes[sibling].parent = BVH_NULL_NODE;
+            freeNode(parent);
+            return;
+        }
+        if (nodes[grandParent].left == parent) {
+            nodes[grandParent].left = sibling;
+        }
+        else {
+            nodes[grandParent].right = sibling;
+        }
+        nodes[sibling].parent = grandParent;
+        freeNode(parent);
+        refitAncestors(grandParent);
+    }
+
+    void Bvh::refitAncestors(int node) {
+        while (node != BVH_NULL_NODE) {
+            nodes[node].bounds = unionOf(nodes[nodes[node].left].bounds, nodes[nodes[node].right].bounds);
+            node = nodes[node].parent;
+        }
+    }
+
+    void Bvh::build() {
+        std::vector<int> leaves;
+        for (size_t i = 0; i < nodes.size(); i++) {
+            if (!nodes[i].used) {
+                continue;
+            }
+            if (nodes[i].left == BVH_NULL_NODE) {
+                leaves.push_back((int)i);
+            }
+            else {
+                freeNode((int)i);
+            }
+        }
+
+        root = BVH_NULL_NODE;
+        if (!leaves.empty()) {
+            root = buildRange(leaves, 0, leaves.size());
+            nodes[root].parent = BVH_NULL_NODE;
+        }
+    }
+
+    void Bvh::build(const std::vector<AABB>& bounds) {
+        clear();
+        for (size_t i = 0; i < bounds.size(); i++) {
+            int leaf = allocateNode();
+            nodes[leaf].bounds = bounds[i];
+            nodes[leaf].item = i;
+        }
+        leafCount = bounds.size();
+        build();
+    }
+
+    int Bvh::buildRange(std::vector<int>& leaves, size_t first, size_t count) {
+        if (count == 1) {
+            return leaves[first];
+        }
+
+        AABB bounds;
+        AABB centroidBounds;
+        for (size_t i = first; i < first + count; i++) {
+            bounds.expand(nodes[leaves[i]].bounds);
+            centroidBounds.expand(nodes[leaves[i]].bounds.center());
+        }
+
+        //the split between bins with the smallest area weighted leaf count on both sides
+        int bestAxis = -1;
+        int bestSplit = 0;
+        float bestCost = count * surfaceArea(bounds);
+        for (int axis = 0; axis < 3; axis++) {
+            float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+            if (extent <= 0.0f) {
+                continue;
+            }
+            size_t binCounts[BVH_SAH_BINS] = {};
+            AABB binBounds[BVH_SAH_BINS];
+            for (size_t i = first; i < first + count; i++) {
+                const AABB& leafBounds = nodes[leaves[i]].bounds;
+                int bin = std::min(BVH_SAH_BINS - 1, (int)((leafBounds.center()[axis] - centroidBounds.min[axis]) / extent * BVH_SAH_BINS));
+                binCounts[bin]++;
+                binBounds[bin].expand(leafBounds);
+            }
+
+            //areas and counts right of each split, swept from the last bin
+            float rightAreas[BVH_SAH_BINS];
+            size_t rightCounts[BVH_SAH_BINS];
+            AABB right;
+            size_t rightCount = 0;
+            for (int bin = BVH_SAH_BINS - 1; bin > 0; bin--) {
+                right.expand(binBounds[bin]);
+                rightCount += binCounts[bin];
+                rightAreas[bin] = right.isEmpty() ? 0.0f : surfaceArea(right);
+                rightCounts[bin] = rightCount;
+            }
+            AABB left;
+            size_t leftCount = 0;
+            for (int split = 0; split < BVH_SAH_BINS - 1; split++) {
+                left.expand(binBounds[split]);
+                leftCount += binCounts[split];
+                if (leftCount == 0 || rightCounts[split + 1] == 0) {
+                    continue;
+                }
+                float cost = leftCount * surfaceArea(left) + rightCounts[split + 1] * rightAreas[split + 1];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = split;
+                }
+            }
+        }
+
+        size_t middle = count / 2;
+        if (bestAxis >= 0) {
+            float extent = centroidBounds.max[bestAxis] - centroidBounds.min[bestAxis];
+            float minimum = centroidBounds.min[bestAxis];
+            std::vector<int>::iterator split = std::partition(leaves.begin() + first, leaves.begin() + first + count,
+                [&](int leaf) {
+                    int bin = std::min(BVH_SAH_BINS - 1, (int)((nodes[leaf].bounds.center()[bestAxis] - minimum) / extent * BVH_SAH_BINS));
+                    return bin <= bestSplit;
+                });
+            middle = split - (leaves.begin() + first);
+        }
+        //no split beats a single node, or the centroids coincide: halve the range
+        if (middle == 0 || middle == count) {
+            middle = count / 2;
+        }
+
+        int left = buildRange(leaves, first, middle);
+        int right = buildRange(leaves, first + middle, count - middle);
+        int node = allocateNode();
+        nodes[node].bounds = bounds;
+        nodes[node].left = left;
+        nodes[node].right = right;
+        nodes[left].parent = node;
+        nodes[right].parent = node;
+        return node;
+    }
+
+    void Bvh::queryFrustum(const glm::mat4& viewProjection, std::vector<size_t>& items) const {
+        if (root == BVH_NULL_NODE) {
+            return;
+        }
+
+        //the six planes of the matrix (Gribb & Hartmann)
+        glm::vec4 rows[4];
+        for (int r = 0; r < 4; r++) {
+            rows[r] = glm::vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
+        }
+        glm::vec4 planes[6];
+        for (int axis = 0; axis < 3; axis++) {
+            planes[2 * axis] = rows[3] + rows[axis];
+            planes[2 * axis + 1] = rows[3] - rows[axis];
+        }
+
+        //a subtree inside a plane skips that plane, one inside all of them is taken whole
+        std::vector<std::pair<int, unsigned int> > stack;
+        stack.push_back(std::make_pair(root, 0x3fu));
+        while (!stack.empty()) {
+            int index = stack.back().first;
+            unsigned int planeMask = stack.back().second;
+            stack.pop_back();
+            const Node& node = nodes[index];
+
+            bool outside = false;
+            if (planeMask != 0) {
+                glm::vec3 center = node.bounds.center();
+                glm::vec3 extents = node.bounds.extents();
+                for (int p = 0; p < 6; p++) {
+                    if ((planeMask & (1u << p)) == 0) {
+                        continue;
+                    }
+                    glm::vec3 normal = glm::vec3(planes[p]);
+                    float distance = glm::dot(normal, center) + planes[p].w;
+                    float radius = glm::dot(glm::abs(normal), extents);
+                    if (distance + radius < 0.0f) {
+                        outside = true;
+                        break;
+                    }
+                    if (distance - radius >= 0.0f) {
+                        planeMask &= ~(1u << p);
+                    }
+                }
+            }
+            if (outside) {
+                continue;
+            }
+
+            if (node.left == BVH_NULL_NODE) {
+                items.push_back(node.item);
+            }
+            else {
+                stack.push_back(std::make_pair(node.left, planeMask));
+                stack.push_back(std::make_pair(node.right, planeMask));
+            }
+        }
+    }
+
+    void Bvh::queryBox(const AABB& box, std::vector<size_t>& items) const {
+        if (root == BVH_NULL_NODE) {
+            return;
+        }
+        std::vector<int> stack;
+        stack.push_back(root);
+        while (!stack.empty()) {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            if (!overlaps(node.bounds, box)) {
+                continue;
+            }
+            if (node.left == BVH_NULL_NODE) {
+                items.push_back(node.item);
+            }
+            else {
+                stack.push_back(node.left);
+                stack.push_back(node.right);
+            }
+        }
+    }
+
+    bool Bvh::raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance,
+        const std::function<bool(size_t item, float& distance)>& hitTest, size_t& hitItem, float& hitDistance) const {
+        if (root == BVH_NULL_NODE) {
+            return false;
+        }
+
+        glm::vec3 inverseDirection = 1.0f / direction;
+        float nearest = maxDistance;
+        bool found = false;
+
+        //nearer child on top of the stack, boxes entered beyond the nearest hit are skipped
+        std::vector<std::pair<int, float> > stack;
+        float entry;
+        if (rayEntersBox(nodes[root].bounds, origin, inverseDirection, nearest, entry)) {
+            stack.push_back(std::make_pair(root, entry));
+        }
+        while (!stack.empty()) {
+            int index = stack.back().first;
+            float nodeEntry = stack.back().second;
+            stack.pop_back();
+            if (nodeEntry > nearest) {
+                continue;
+            }
+
+            const Node& node = nodes[index];
+            if (node.left == BVH_NULL_NODE) {
+                float distance;
+                if (hitTest(node.item, distance) && distance <= nearest) {
+                    nearest = distance;
+                    hitItem = node.item;
+                    found = true;
+                }
+                continue;
+            }
+
+            float leftEntry;
+            float rightEntry;
+            bool hitsLeft = rayEntersBox(nodes[node.left].bounds, origin, inverseDirection, nearest, leftEntry);
+            bool hitsRight = rayEntersBox(nodes[node.right].bounds, origin, inverseDirection, nearest, rightEntry);
+            if (hitsLeft && hitsRight) {
+                if (leftEntry < rightEntry) {
+                    stack.push_back(std::make_pair(node.right, rightEntry));
+                    stack.push_back(std::make_pair(node.left, leftEntry));
+                }
+                else {
+                    stack.push_back(std::make_pair(node.left, leftEntry));
+                    stack.push_back(std::make_pair(node.right, rightEntry));
+                }
+            }
+            else if (hitsLeft) {
+                stack.push_back(std::make_pair(node.left, leftEntry));
+            }
+            else if (hitsRight) {
+                stack.push_back(std::make_pair(node.right, rightEntry));
+            }
+        }
+
+        if (found) {
+            hitDistance = nearest;
+        }
+        return found;
+    }
+
+    AABB Bvh::getBounds() const {
+        return root == BVH_NULL_NODE ? AABB() : nodes[root].bounds;
+    }
+
+    size_t Bvh::getLeafCount() const {
+        return leafCount;
+    }
+
+    int Bvh::heightOf(int node) const {
+        if (nodes[node].left == BVH_NULL_NODE) {
+            return 0;
+        }
+        return 1 + std::max(heightOf(nodes[node].left), heightOf(nodes[node].right));
+    }
+
+    int Bvh::getHeight() const {
+        return root == BVH_NULL_NODE ? 0 : heightOf(root);
+    }
+
+    float Bvh::getCost() const {
+        if (root == BVH_NULL_NODE) {
+            return 0.0f;
+        }
+        float internalArea = 0.0f;
+        for (size_t i = 0; i < nodes.size(); i++) {
+            if (nodes[i].used && nodes[i].left != BVH_NULL_NODE) {
+                internalArea += surfaceArea(nodes[i].bounds);
+            }
+        }
+        return internalArea / surfaceArea(nodes[root].bounds);
+    }
+
+}
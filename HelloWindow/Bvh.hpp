@@ -0,0 +1,80 @@
+#ifndef Bvh_hpp
+#define Bvh_hpp
+
+#include "BoundingBox.hpp"
+
+#include <glm/glm.hpp>
+#include <functional>
+#include <vector>
+
+namespace gps {
+
+    const int BVH_NULL_NODE = -1;
+    //moved leaves are stored grown by this much, small moves then need no tree update
+    const float BVH_LEAF_MARGIN = 0.05f;
+    //split candidates per axis of the SAH build
+    const int BVH_SAH_BINS = 16;
+
+    //Bounding volume hierarchy with one item per leaf. The static items are built top down
+    //with the binned surface area heuristic, dynamic ones are inserted next to the sibling that
+    //grows the tree the least and refitted or reinserted when they move.
+    class Bvh
+    {
+    public:
+        //returns the leaf of the item, valid until it is removed
+        int insert(const AABB& bounds, size_t item);
+        void remove(int leaf);
+        //refits the ancestors when the item stays close to its old place and reinserts it otherwise,
+        //returns false when the stored bounds still contain the new ones
+        bool update(int leaf, const AABB& bounds);
+        //rebuilds the tree over all the leaves with the SAH, the leaves keep their indices
+        void build();
+        //replaces the tree by one built with the SAH over the boxes, item i has bounds[i]
+        void build(const std::vector<AABB>& bounds);
+        void clear();
+
+        //items whose bounds are inside or cross the frustum of the matrix
+        void queryFrustum(const glm::mat4& viewProjection, std::vector<size_t>& items) const;
+        void queryBox(const AABB& box, std::vector<size_t>& items) const;
+        //nearest item along the ray. hitTest refines a box hit: it returns false for a miss or sets the
+        //item's distance, which is only called for items whose box is nearer than the best hit so far
+        bool raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance,
+            const std::function<bool(size_t item, float& distance)>& hitTest, size_t& hitItem, float& hitDistance) const;
+
+        //bounds of all the items, empty for an empty tree
+        AABB getBounds() const;
+        size_t getLeafCount() const;
+        //the longest path from the root to a leaf
+        int getHeight() const;
+        //SAH cost of the tree: area of the internal nodes relative to the root
+        float getCost() const;
+
+    private:
+        struct Node {
+            AABB bounds;
+            int parent;
+            //BVH_NULL_NODE for leaves
+            int left;
+            int right;
+            size_t item;
+            bool used;
+        };
+
+        std::vector<Node> nodes;
+        std::vector<int> freeNodes;
+        int root = BVH_NULL_NODE;
+        size_t leafCount = 0;
+
+        int allocateNode();
+        void freeNode(int node);
+        void insertLeaf(int leaf);
+        void removeLeaf(int leaf);
+        void refitAncestors(int node);
+        //builds the subtree over leaves [first, first + count), returns its root
+        int buildRange(std::vector<int>& leaves, size_t first, size_t count);
+        int heightOf(int node) const;
+    };
+
+}
+
+#endif /* Bvh_hpp */
@@ -0,0 +1,197 @@
+#include "BvhBenchmark.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+namespace gps {
+
+    typedef std::chrono::high_resolution_clock Clock;
+
+    static double millisecondsSince(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    //the same tests the tree makes, applied to every box
+    static bool boxInFrustum(const AABB& box, const glm::vec4 planes[6]) {
+        glm::vec3 center = box.center();
+        glm::vec3 extents = box.extents();
+        for (int p = 0; p < 6; p++) {
+            glm::vec3 normal = glm::vec3(planes[p]);
+            if (glm::dot(normal, center) + planes[p].w + glm::dot(glm::abs(normal), extents) < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool rayEntry(const AABB& box, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance, float& entry) {
+        glm::vec3 t1 = (box.min - origin) * inverseDirection;
+        glm::vec3 t2 = (box.max - origin) * inverseDirection;
+        glm::vec3 tNear = glm::min(t1, t2);
+        glm::vec3 tFar = glm::max(t1, t2);
+        entry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        return entry <= std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+    }
+
+    void runBvhBenchmark(const std::vector<AABB>& sceneBounds, const glm::mat4& viewProjection) {
+        AABB sceneBox;
+        for (size_t i = 0; i < sceneBounds.size(); i++) {
+            sceneBox.expand(sceneBounds[i]);
+        }
+        if (sceneBox.isEmpty()) {
+            return;
+        }
+        glm::vec3 sceneSize = sceneBox.max - sceneBox.min;
+
+        std::mt19937 generator(7);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+        for (size_t t = 0; t < sizeof(BVH_BENCHMARK_TILINGS) / sizeof(BVH_BENCHMARK_TILINGS[0]); t++) {
+            int tiling = BVH_BENCHMARK_TILINGS[t];
+            std::vector<AABB> boxes;
+            for (int x = 0; x < tiling; x++) {
+                for (int z = 0; z < tiling; z++) {
+                    glm::vec3 offset = glm::vec3((x - tiling / 2) * sceneSize.x, 0.0f, (z - tiling / 2) * sceneSize.z);
+                    for (size_t i = 0; i < sceneBounds.size(); i++) {
+                        AABB box = sceneBounds[i];
+                        box.min += offset;
+                        box.max += offset;
+                        boxes.push_back(box);
+                    }
+                }
+            }
+
+            //one insertion at a time, then the SAH rebuild over the same leaves
+            Bvh bvh;
+            std::vector<int> leaves;
+            Clock::time_point start = Clock::now();
+            for (size_t i = 0; i < boxes.size(); i++) {
+                leaves.push_back(bvh.insert(boxes[i], i));
+            }
+            double insertMilliseconds = millisecondsSince(start);
+            float insertCost = bvh.getCost();
+            int insertHeight = bvh.getHeight();
+
+            start = Clock::now();
+            bvh.build();
+            double buildMilliseconds = millisecondsSince(start);
+
+            printf("bvh benchmark, %zu boxes: SAH build %.3f ms (cost %.1f, height %d), insertion %.3f ms (cost %.1f, height %d)\n",
+                boxes.size(), buildMilliseconds, bvh.getCost(), bvh.getHeight(), insertMilliseconds, insertCost, insertHeight);
+
+            //a share of the boxes drifts a little every round: mostly refits, some reinsertions
+            size_t dynamicCount = std::max((size_t)1, (size_t)(boxes.size() * BVH_BENCHMARK_DYNAMIC_SHARE));
+            const int refitRounds = 100;
+            size_t treeUpdates = 0;
+            start = Clock::now();
+            for (int round = 0; round < refitRounds; round++) {
+                for (size_t i = 0; i < dynamicCount; i++) {
+                    glm::vec3 step = glm::vec3(unit(generator) - 0.5f, 0.0f, unit(generator) - 0.5f) * 0.1f;
+                    boxes[i].min += step;
+                    boxes[i].max += step;
+                    if (bvh.update(leaves[i], boxes[i])) {
+                        treeUpdates++;
+                    }
+                }
+            }
+            double refitMilliseconds = millisecondsSince(start) / refitRounds;
+            printf("    %zu moving boxes: %.3f ms per round, %zu of %zu moves changed the tree, cost %.1f after\n",
+                dynamicCount, refitMilliseconds, treeUpdates, dynamicCount * refitRounds, bvh.getCost());
+
+            //frusta all around the scene
+            std::vector<glm::mat4> frusta;
+            for (int q = 0; q < BVH_BENCHMARK_FRUSTUM_QUERIES; q++) {
+                frusta.push_back(viewProjection * glm::rotate(glm::mat4(1.0f), unit(generator) * glm::radians(360.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+            }
+            std::vector<size_t> items;
+            size_t treeResults = 0;
+            start = Clock::now();
+            for (size_t q = 0; q < frusta.size(); q++) {
+                items.clear();
+                bvh.queryFrustum(frusta[q], items);
+                treeResults += items.size();
+            }
+            double treeFrustumMilliseconds = millisecondsSince(start);
+
+            size_t loopResults = 0;
+            start = Clock::now();
+            for (size_t q = 0; q < frusta.size(); q++) {
+                glm::vec4 rows[4];
+                for (int r = 0; r < 4; r++) {
+                    rows[r] = glm::vec4(frusta[q][0][r], frusta[q][1][r], frusta[q][2][r], frusta[q][3][r]);
+                }
+                glm::vec4 planes[6];
+                for (int axis = 0; axis < 3; axis++) {
+                    planes[2 * axis] = rows[3] + rows[axis];
+                    planes[2 * axis + 1] = rows[3] - rows[axis];
+                }
+                for (size_t i = 0; i < boxes.size(); i++) {
+                    if (boxInFrustum(boxes[i], planes)) {
+                        loopResults++;
+                    }
+                }
+            }
+            double loopFrustumMilliseconds = millisecondsSince(start);
+            printf("    frustum: %.0f queries/s, loop %.0f queries/s (%.1f boxes per query, loop %.1f)\n",
+                frusta.size() * 1000.0 / treeFrustumMilliseconds, frusta.size() * 1000.0 / loopFrustumMilliseconds,
+                (double)treeResults / frusta.size(), (double)loopResults / frusta.size());
+
+            //horizontal rays at eye height from inside the tiled scene
+            AABB tiledBox;
+            for (size_t i = 0; i < boxes.size(); i++) {
+                tiledBox.expand(boxes[i]);
+            }
+            std::vector<glm::vec3> origins;
+            std::vector<glm::vec3> directions;
+            for (int r = 0; r < BVH_BENCHMARK_RAYS; r++) {
+                origins.push_back(glm::vec3(glm::mix(tiledBox.min.x, tiledBox.max.x, unit(generator)), 0.3f,
+                    glm::mix(tiledBox.min.z, tiledBox.max.z, unit(generator))));
+                float angle = unit(generator) * glm::radians(360.0f);
+                directions.push_back(glm::normalize(glm::vec3(glm::cos(angle), unit(generator) * 0.2f - 0.1f, glm::sin(angle))));
+            }
+            float maxDistance = glm::length(tiledBox.max - tiledBox.min);
+
+            size_t treeHits = 0;
+            start = Clock::now();
+            for (size_t r = 0; r < origins.size(); r++) {
+                glm::vec3 inverseDirection = 1.0f / directions[r];
+                size_t item;
+                float distance;
+                bool hit = bvh.raycast(origins[r], directions[r], maxDistance,
+                    [&](size_t candidate, float& entry) {
+                        return rayEntry(boxes[candidate], origins[r], inverseDirection, maxDistance, entry);
+                    }, item, distance);
+                if (hit) {
+                    treeHits++;
+                }
+            }
+            double treeRayMilliseconds = millisecondsSince(start);
+
+            size_t loopHits = 0;
+            start = Clock::now();
+            for (size_t r = 0; r < origins.size(); r++) {
+                glm::vec3 inverseDirection = 1.0f / directions[r];
+                float nearest = maxDistance;
+                bool hit = false;
+                for (size_t i = 0; i < boxes.size(); i++) {
+                    float entry;
+                    if (rayEntry(boxes[i], origins[r], inverseDirection, nearest, entry)) {
+                        nearest = entry;
+                        hit = true;
+                    }
+                }
+                if (hit) {
+                    loopHits++;
+                }
+            }
+            double loopRayMilliseconds = millisecondsSince(start);
+            printf("    rays: %.3f M rays/s, loop %.3f M rays/s (%zu hits, loop %zu)\n",
+                origins.size() / (treeRayMilliseconds * 1000.0), origins.size() / (loopRayMilliseconds * 1000.0), treeHits, loopHits);
+        }
+    }
+
+}
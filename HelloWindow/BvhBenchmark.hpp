@@ -0,0 +1,25 @@
+#ifndef BvhBenchmark_hpp
+#define BvhBenchmark_hpp
+
+#include "Bvh.hpp"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace gps {
+
+    //the scene is tiled n x n for each run, so the scaling past its own size shows
+    const int BVH_BENCHMARK_TILINGS[] = { 1, 4, 16 };
+    const int BVH_BENCHMARK_FRUSTUM_QUERIES = 1000;
+    const int BVH_BENCHMARK_RAYS = 100000;
+    //part of the boxes moved per refit round, as the target and the arrows are
+    const float BVH_BENCHMARK_DYNAMIC_SHARE = 0.1f;
+
+    //Times the BVH over the scene's boxes against testing every box in a loop: SAH build,
+    //incremental insertion, refit of the moving boxes, frustum queries and nearest hit rays.
+    //The frusta are the given one turned around the y axis
+    void runBvhBenchmark(const std::vector<AABB>& sceneBounds, const glm::mat4& viewProjection);
+
+}
+
+#endif /* BvhBenchmark_hpp */
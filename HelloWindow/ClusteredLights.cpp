@@ -0,0 +1,222 @@
+#include "ClusteredLights.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace gps {
+
+    //depth at which a slice of the exponential split starts
+    static float sliceDepth(int slice) {
+        return CLUSTER_NEAR * std::pow(CLUSTER_FAR / CLUSTER_NEAR, (float)slice / CLUSTER_GRID_Z);
+    }
+
+    static bool sphereTouchesBox(const glm::vec3& center, float radius, const AABB& box) {
+        glm::vec3 closest = glm::clamp(center, box.min, box.max);
+        glm::vec3 offset = center - closest;
+        return glm::dot(offset, offset) <= radius * radius;
+    }
+
+    void ClusteredLights::init(ThreadPool* pool) {
+        this->pool = pool;
+        glGenBuffers(1, &lightBuffer);
+        glGenBuffers(1, &gridBuffer);
+        glGenBuffers(1, &indexBuffer);
+        sliceIndices.resize(CLUSTER_GRID_Z);
+        sliceCandidates.resize(CLUSTER_GRID_Z);
+        clusterRanges.resize(CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z);
+    }
+
+    size_t ClusteredLights::addLight(const Light& light) {
+        lights.push_back(light);
+        lightEnabled.push_back(true);
+        return lights.size() - 1;
+    }
+
+    Light& ClusteredLights::getLight(size_t light) {
+        return lights[light];
+    }
+
+    void ClusteredLights::setLightEnabled(size_t light, bool enabled) {
+        lightEnabled[light] = enabled;
+    }
+
+    void ClusteredLights::setFrameAllocator(FrameAllocator* allocator) {
+        frameAllocator = allocator;
+    }
+
+    //the corners of each screen tile at the near and far depth of each slice
+    void ClusteredLights::buildClusterBounds(const glm::mat4& projection) {
+        glm::mat4 inverseProjection = glm::inverse(projection);
+        clusterBounds.assign(CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z, AABB());
+        for (int z = 0; z < CLUSTER_GRID_Z; z++) {
+            float depths[2] = { sliceDepth(z), sliceDepth(z + 1) };
+            for (int y = 0; y < CLUSTER_GRID_Y; y++) {
+                for (int x = 0; x < CLUSTER_GRID_X; x++) {
+                    AABB& bounds = clusterBounds[(z * CLUSTER_GRID_Y + y) * CLUSTER_GRID_X + x];
+                    for (int corner = 0; corner < 4; corner++) {
+                        float ndcX = 2.0f * (x + (corner & 1)) / CLUSTER_GRID_X - 1.0f;
+                        float ndcY = 2.0f * (y + (corner >> 1)) / CLUSTER_GRID_Y - 1.0f;
+                        glm::vec4 nearPoint = inverseProjection * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+                        glm::vec3 direction = glm::vec3(nearPoint) / nearPoint.w;
+                        for (int d = 0; d < 2; d++) {
+                            bounds.expand(direction * (depths[d] / -direction.z));
+                        }
+                    }
+                }
+            }
+        }
+        boundsProjection = projection;
+    }
+
+    void ClusteredLights::update(const glm::mat4& view, const glm::mat4& projection, int viewportWidth, int viewportHeight) {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+        if (projection != boundsProjection) {
+            buildClusterBounds(projection);
+        }
+        gridWidth = viewportWidth;
+        gridHeight = viewportHeight;
+
+        //the lights in view, moved to view space
+        glm::vec4 rows[4];
+        for (int r = 0; r < 4; r++) {
+            rows[r] = glm::vec4(projection[0][r], projection[1][r], projection[2][r], projection[3][r]);
+        }
+        glm::vec4 planes[6];
+        for (int axis = 0; axis < 3; axis++) {
+            planes[2 * axis] = rows[3] + rows[axis];
+            planes[2 * axis + 1] = rows[3] - rows[axis];
+        }
+        viewLights.clear();
+        for (size_t i = 0; i < lights.size(); i++) {
+            if (!lightEnabled[i]) {
+                continue;
+            }
+            const Light& light = lights[i];
+            glm::vec3 position = glm::vec3(view * glm::vec4(light.position, 1.0f));
+            bool inView = true;
+            for (int p = 0; p < 6 && inView; p++) {
+                inView = glm::dot(glm::vec3(planes[p]), position) + planes[p].w >= -light.range * glm::length(glm::vec3(planes[p]));
+            }
+            if (!inView) {
+                continue;
+            }
+            ClusterLightData data;
+            data.positionRange = glm::vec4(position, light.range);
+            data.colorIsSpot = glm::vec4(light.color, light.isSpot ? 1.0f : 0.0f);
+            data.directionOuterCutOff = glm::vec4(glm::normalize(glm::mat3(view) * light.direction), light.outerCutOff);
+            data.falloff = glm::vec4(light.linear, light.quadratic, light.cutOff, light.isBaked ? 1.0f : 0.0f);
+            data.shadow = glm::vec4(light.castsShadow ? 1.0f : 0.0f, 0.0f, 0.0f, 0.0f);
+            viewLights.push_back(data);
+        }
+
+        //one depth slice per job: the lights reaching its depth range, then each of its clusters
+        pool->parallelFor(CLUSTER_GRID_Z, [&](size_t z) {
+            float sliceNear = sliceDepth((int)z);
+            float sliceFar = sliceDepth((int)z + 1);
+            std::vector<GLuint>& candidates = sliceCandidates[z];
+            std::vector<GLuint>& indices = sliceIndices[z];
+            candidates.clear();
+            indices.clear();
+            for (size_t i = 0; i < viewLights.size(); i++) {
+                float depth = -viewLights[i].positionRange.z;
+                float range = viewLights[i].positionRange.w;
+                if (depth + range >= sliceNear && depth - range <= sliceFar) {
+                    candidates.push_back((GLuint)i);
+                }
+            }
+            for (int cluster = (int)z * CLUSTER_GRID_X * CLUSTER_GRID_Y; cluster < ((int)z + 1) * CLUSTER_GRID_X * CLUSTER_GRID_Y; cluster++) {
+                size_t first = indices.size();
+                for (size_t c = 0; c < candidates.size(); c++) {
+                    const glm::vec4& light = viewLights[candidates[c]].positionRange;
+                    if (sphereTouchesBox(glm::vec3(light), light.w, clusterBounds[cluster])) {
+                        indices.push_back(candidates[c]);
+                    }
+                }
+                clusterRanges[cluster] = glm::uvec2((GLuint)first, (GLuint)(indices.size() - first));
+            }
+        });
+
+        //the slices one after the other, their offsets made global
+        clusterIndices.clear();
+        maxClusterLights = 0;
+        for (int z = 0; z < CLUSTER_GRID_Z; z++) {
+            GLuint base = (GLuint)clusterIndices.size();
+            for (int cluster = z * CLUSTER_GRID_X * CLUSTER_GRID_Y; cluster < (z + 1) * CLUSTER_GRID_X * CLUSTER_GRID_Y; cluster++) {
+                clusterRanges[cluster].x += base;
+                maxClusterLights = std::max(maxClusterLights, (size_t)clusterRanges[cluster].y);
+            }
+            clusterIndices.insert(clusterIndices.end(), sliceIndices[z].begin(), sliceIndices[z].end());
+        }
+        lightsInView = viewLights.size();
+        listEntries = clusterIndices.size();
+        //an empty buffer cannot be bound
+        if (viewLights.empty()) {
+            viewLights.push_back(ClusterLightData());
+        }
+        if (clusterIndices.empty()) {
+            clusterIndices.push_back(0);
+        }
+
+        lightRange = upload(lightBuffer, viewLights.data(), viewLights.size() * sizeof(ClusterLightData));
+        gridRange = upload(gridBuffer, clusterRanges.data(), clusterRanges.size() * sizeof(glm::uvec2));
+        indexRange = upload(indexBuffer, clusterIndices.data(), clusterIndices.size() * sizeof(GLuint));
+
+        listMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    void ClusteredLights::bind(gps::Shader shader) {
+        shader.useShaderProgram();
+        bindRange(CLUSTER_LIGHT_BINDING, lightBuffer, lightRange);
+        bindRange(CLUSTER_GRID_BINDING, gridBuffer, gridRange);
+        bindRange(CLUSTER_INDEX_BINDING, indexBuffer, indexRange);
+
+        //slice = log(depth) * scale + bias, the inverse of sliceDepth
+        float scale = CLUSTER_GRID_Z / std::log(CLUSTER_FAR / CLUSTER_NEAR);
+        float bias = -scale * std::log(CLUSTER_NEAR);
+        glUniform3i(glGetUniformLocation(shader.shaderProgram, "clusterGrid"), CLUSTER_GRID_X, CLUSTER_GRID_Y, CLUSTER_GRID_Z);
+        glUniform2f(glGetUniformLocation(shader.shaderProgram, "clusterTileSize"),
+            (float)gridWidth / CLUSTER_GRID_X, (float)gridHeight / CLUSTER_GRID_Y);
+        glUniform2f(glGetUniformLocation(shader.shaderProgram, "clusterDepthScaleBias"), scale, bias);
+    }
+
+    FrameAllocation ClusteredLights::upload(GLuint buffer, const void* data, GLsizeiptr size) {
+        FrameAllocation range = { NULL, 0, size };
+        if (frameAllocator != NULL) {
+            range = frameAllocator->allocate(size, frameAllocator->getStorageAlignment());
+        }
+        if (range.data != NULL) {
+            memcpy(range.data, data, size);
+            return range;
+        }
+        //rewritten every frame, the old storage is orphaned
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_STREAM_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        return range;
+    }
+
+    void ClusteredLights::bindRange(GLuint binding, GLuint buffer, const FrameAllocation& range) {
+        if (range.data != NULL) {
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, frameAllocator->getBuffer(), range.offset, range.size);
+        }
+        else {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
+        }
+    }
+
+    void ClusteredLights::printStats() {
+        if (++framesSinceReport < CLUSTER_REPORT_FRAMES) {
+            return;
+        }
+        framesSinceReport = 0;
+        printf("clustered lights: %zu of %zu lights in view, %zu list entries over %zu clusters (at most %zu in one), listed in %.2f ms on %zu threads\n",
+            lightsInView, lights.size(), listEntries, clusterRanges.size(), maxClusterLights, listMilliseconds, pool->getThreadCount());
+    }
+
+}
@@ -0,0 +1,128 @@
+#ifndef ClusteredLights_hpp
+#define ClusteredLights_hpp
+
+#include <GL/glew.h>
+
+#include "Shader.hpp"
+#include "BoundingBox.hpp"
+#include "ThreadPool.hpp"
+#include "FrameAllocator.hpp"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace gps {
+
+    //screen tiles and depth slices the view frustum is split into
+    const int CLUSTER_GRID_X = 16;
+    const int CLUSTER_GRID_Y = 9;
+    const int CLUSTER_GRID_Z = 24;
+    //depth range sliced exponentially, nearer fragments use the first slice and farther ones the last
+    const float CLUSTER_NEAR = 0.1f;
+    const float CLUSTER_FAR = 50.0f;
+    //shader storage bindings, after the ones of the indirect draws
+    const GLuint CLUSTER_LIGHT_BINDING = 3;
+    const GLuint CLUSTER_GRID_BINDING = 4;
+    const GLuint CLUSTER_INDEX_BINDING = 5;
+    //frames between two printed reports
+    const int CLUSTER_REPORT_FRAMES = 120;
+
+    //point light, or a spot light when isSpot is set
+    struct Light {
+        glm::vec3 position;
+        glm::vec3 color;
+        //distance at which the light has faded out, the cluster lists stop there
+        float range;
+        //of the 1 / (1 + linear * d + quadratic * d * d) falloff
+        float linear;
+        float quadratic;
+        bool isSpot;
+        glm::vec3 direction;
+        //cosines of the inner and outer cone angles
+        float cutOff;
+        float outerCutOff;
+        //lit into the lightmap, basic.frag skips it on the lightmapped meshes
+        bool isBaked;
+        //shadowed by the PointShadowMap bound to the scene shaders, only one light has it
+        bool castsShadow;
+    };
+
+    //std430 layout of the light buffer read by basic.frag, in view space
+    struct ClusterLightData {
+        //xyz position, w range
+        glm::vec4 positionRange;
+        //rgb color, w 1 for a spot light
+        glm::vec4 colorIsSpot;
+        glm::vec4 directionOuterCutOff;
+        //x linear, y quadratic, z cutOff, w 1 when baked
+        glm::vec4 falloff;
+        //x 1 when the light casts shadows
+        glm::vec4 shadow;
+    };
+
+    //Clustered forward lighting: every frame the view frustum is split into a grid of clusters,
+    //the lights touching each cluster are listed on worker threads, one depth slice per job,
+    //and basic.frag shades a fragment with the lights of its cluster only.
+    class ClusteredLights
+    {
+    public:
+        //creates the buffers, the pool is shared with the owner
+        void init(ThreadPool* pool);
+        //returns the light index
+        size_t addLight(const Light& light);
+        Light& getLight(size_t light);
+        void setLightEnabled(size_t light, bool enabled);
+        //the lists are then written into the frame's ring region instead of reallocating the buffers
+        void setFrameAllocator(FrameAllocator* allocator);
+
+        //culls the lights to the view, lists them per cluster and uploads the buffers
+        void update(const glm::mat4& view, const glm::mat4& projection, int viewportWidth, int viewportHeight);
+        //binds the buffers and sets the grid uniforms of the shader
+        void bind(gps::Shader shader);
+
+        //prints the last frame's counts every CLUSTER_REPORT_FRAMES calls
+        void printStats();
+
+    private:
+        ThreadPool* pool = nullptr;
+        std::vector<Light> lights;
+        std::vector<bool> lightEnabled;
+
+        //view space bounds of every cluster, rebuilt when the projection or the viewport changes
+        std::vector<AABB> clusterBounds;
+        glm::mat4 boundsProjection = glm::mat4(0.0f);
+        int gridWidth = 0;
+        int gridHeight = 0;
+
+        std::vector<ClusterLightData> viewLights;
+        //per cluster: first index and count in clusterIndices
+        std::vector<glm::uvec2> clusterRanges;
+        std::vector<GLuint> clusterIndices;
+        //lists of each depth slice, filled by its job and joined afterwards
+        std::vector<std::vector<GLuint> > sliceIndices;
+        std::vector<std::vector<GLuint> > sliceCandidates;
+
+        GLuint lightBuffer = 0;
+        GLuint gridBuffer = 0;
+        GLuint indexBuffer = 0;
+        FrameAllocator* frameAllocator = NULL;
+        //this frame's ranges of the ring, data is NULL when the buffers above hold the lists
+        FrameAllocation lightRange = {};
+        FrameAllocation gridRange = {};
+        FrameAllocation indexRange = {};
+
+        size_t lightsInView = 0;
+        size_t listEntries = 0;
+        size_t maxClusterLights = 0;
+        double listMilliseconds = 0.0;
+        int framesSinceReport = 0;
+
+        void buildClusterBounds(const glm::mat4& projection);
+        //copies the list into the ring, or into the buffer when the ring has no room
+        FrameAllocation upload(GLuint buffer, const void* data, GLsizeiptr size);
+        void bindRange(GLuint binding, GLuint buffer, const FrameAllocation& range);
+    };
+
+}
+
+#endif /* ClusteredLights_hpp */
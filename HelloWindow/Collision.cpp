@@ -12,6 +12,30 @@ bool Collision::checkIfPointInsideRectangle(glm::vec2 A, glm::vec2 B, glm::vec2
         return false;
     }
 }
+bool Collision::checkIfRayHitsTriangle(glm::vec3 origin, glm::vec3 direction, glm::vec3 A, glm::vec3 B, glm::vec3 C, float& distance) {
+    //Moller-Trumbore: solve origin + t * direction = A + u * AB + v * AC
+    glm::vec3 AB = B - A;
+    glm::vec3 AC = C - A;
+    glm::vec3 p = glm::cross(direction, AC);
+    float determinant = glm::dot(AB, p);
+    if (determinant > -1e-8f && determinant < 1e-8f) {
+        return false;
+    }
+    float inverseDeterminant = 1.0f / determinant;
+    glm::vec3 AO = origin - A;
+    float u = glm::dot(AO, p) * inverseDeterminant;
+    if (u < 0.0f || u > 1.0f) {
+        return false;
+    }
+    glm::vec3 q = glm::cross(AO, AB);
+    float v = glm::dot(direction, q) * inverseDeterminant;
+    if (v < 0.0f || u + v > 1.0f) {
+        return false;
+    }
+    distance = glm::dot(AC, q) * inverseDeterminant;
+    return distance >= 0.0f;
+}
+
 Collision::Collision()
 {
 }
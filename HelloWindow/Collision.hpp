@@ -9,6 +9,8 @@ public:
 	Collision();
 	~Collision();
 	bool checkIfPointInsideRectangle(glm::vec2 A, glm::vec2 B, glm::vec2 D, glm::vec2 M);
+	//distance along the ray to the triangle ABC, both sides count
+	bool checkIfRayHitsTriangle(glm::vec3 origin, glm::vec3 direction, glm::vec3 A, glm::vec3 B, glm::vec3 C, float& distance);
 
 private:
 
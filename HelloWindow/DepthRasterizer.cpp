@@ -0,0 +1,322 @@
+#include "DepthRasterizer.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <emmintrin.h>
+
+namespace gps {
+
+    DepthRasterizer::DepthRasterizer() {
+        tilesX = (OCCLUSION_BUFFER_WIDTH + OCCLUSION_TILE_WIDTH - 1) / OCCLUSION_TILE_WIDTH;
+        tilesY = (OCCLUSION_BUFFER_HEIGHT + OCCLUSION_TILE_HEIGHT - 1) / OCCLUSION_TILE_HEIGHT;
+        viewProjection = glm::mat4(1.0f);
+
+        //mip chain down to a single texel, every level starts cleared to the far plane
+        int width = OCCLUSION_BUFFER_WIDTH;
+        int height = OCCLUSION_BUFFER_HEIGHT;
+        while (true) {
+            hiZ.push_back(std::vector<float>((size_t)width * height, 1.0f));
+            hiZWidth.push_back(width);
+            hiZHeight.push_back(height);
+            if (width == 1 && height == 1) {
+                break;
+            }
+            width = (width + 1) / 2;
+            height = (height + 1) / 2;
+        }
+    }
+
+    void DepthRasterizer::setThreadPool(ThreadPool* pool) {
+        this->pool = pool;
+    }
+
+    void DepthRasterizer::runJobs(size_t count, const std::function<void(size_t)>& job) {
+        if (pool != nullptr) {
+            pool->parallelFor(count, job);
+        }
+        else {
+            for (size_t i = 0; i < count; i++) {
+                job(i);
+            }
+        }
+    }
+
+    void DepthRasterizer::render(const std::vector<glm::vec3>& triangles, const glm::mat4& viewProjection) {
+        this->viewProjection = viewProjection;
+
+        //transform, clip and bin in parallel over batches of triangles
+        size_t triangleCount = triangles.size() / 3;
+        activeBatches = (triangleCount + OCCLUSION_SETUP_BATCH - 1) / OCCLUSION_SETUP_BATCH;
+        if (batches.size() < activeBatches) {
+            batches.resize(activeBatches);
+        }
+        runJobs(activeBatches, [this, &triangles](size_t b) { setupBatch(triangles, b); });
+
+        rasterizedTriangles = 0;
+        for (size_t b = 0; b < activeBatches; b++) {
+            rasterizedTriangles += batches[b].triangles.size();
+        }
+
+        //then every tile walks the bins in submission order
+        runJobs((size_t)(tilesX * tilesY), [this](size_t tile) { rasterizeTile((int)tile); });
+
+        buildHiZ();
+    }
+
+    void DepthRasterizer::setupBatch(const std::vector<glm::vec3>& triangles, size_t batchIndex) {
+        SetupBatch& batch = batches[batchIndex];
+        batch.triangles.clear();
+        batch.tileBins.resize((size_t)(tilesX * tilesY));
+        for (size_t t = 0; t < batch.tileBins.size(); t++) {
+            batch.tileBins[t].clear();
+        }
+
+        size_t first = batchIndex * OCCLUSION_SETUP_BATCH;
+        size_t last = std::min(first + OCCLUSION_SETUP_BATCH, triangles.size() / 3);
+        for (size_t t = first; t < last; t++) {
+            glm::vec4 clip[3];
+            for (int v = 0; v < 3; v++) {
+                clip[v] = viewProjection * glm::vec4(triangles[t * 3 + v], 1.0f);
+            }
+
+            //outside one side of the frustum
+            bool outside = false;
+            for (int axis = 0; axis < 3 && !outside; axis++) {
+                outside = (clip[0][axis] > clip[0].w && clip[1][axis] > clip[1].w && clip[2][axis] > clip[2].w)
+                    || (clip[0][axis] < -clip[0].w && clip[1][axis] < -clip[1].w && clip[2][axis] < -clip[2].w);
+            }
+            if (outside) {
+                continue;
+            }
+
+            //the near plane (z = -w) is the only one clipped against, the others are handled by the pixel bounds
+            float distance[3];
+            int insideCount = 0;
+            for (int v = 0; v < 3; v++) {
+                distance[v] = clip[v].z + clip[v].w;
+                insideCount += distance[v] >= 0.0f ? 1 : 0;
+            }
+            if (insideCount == 3) {
+                addTriangle(batch, clip);
+                continue;
+            }
+
+            glm::vec4 polygon[4];
+            int polygonSize = 0;
+            for (int v = 0; v < 3; v++) {
+                int next = (v + 1) % 3;
+                if (distance[v] >= 0.0f) {
+                    polygon[polygonSize++] = clip[v];
+                }
+                if ((distance[v] >= 0.0f) != (distance[next] >= 0.0f)) {
+                    float s = distance[v] / (distance[v] - distance[next]);
+                    polygon[polygonSize++] = clip[v] + s * (clip[next] - clip[v]);
+                }
+            }
+            for (int v = 1; v + 1 < polygonSize; v++) {
+                glm::vec4 fan[3] = { polygon[0], polygon[v], polygon[v + 1] };
+                addTriangle(batch, fan);
+            }
+        }
+    }
+
+    void DepthRasterizer::addTriangle(SetupBatch& batch, const glm::vec4 clip[3]) {
+        float x[3];
+        float y[3];
+        float z[3];
+        for (int v = 0; v < 3; v++) {
+            float invW = 1.0f / clip[v].w;
+            x[v] = (clip[v].x * invW * 0.5f + 0.5f) * OCCLUSION_BUFFER_WIDTH;
+            y[v] = (clip[v].y * invW * 0.5f + 0.5f) * OCCLUSION_BUFFER_HEIGHT;
+            z[v] = clip[v].z * invW * 0.5f + 0.5f;
+        }
+
+        //occluders are drawn two sided, clockwise triangles are flipped
+        float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        if (std::fabs(area) < 1e-6f) {
+            return;
+        }
+        if (area < 0.0f) {
+            std::swap(x[1], x[2]);
+            std::swap(y[1], y[2]);
+            std::swap(z[1], z[2]);
+            area = -area;
+        }
+
+        ScreenTriangle triangle;
+        triangle.minX = std::max(0, (int)std::floor(std::min(x[0], std::min(x[1], x[2]))));
+        triangle.minY = std::max(0, (int)std::floor(std::min(y[0], std::min(y[1], y[2]))));
+        triangle.maxX = std::min(OCCLUSION_BUFFER_WIDTH - 1, (int)std::ceil(std::max(x[0], std::max(x[1], x[2]))));
+        triangle.maxY = std::min(OCCLUSION_BUFFER_HEIGHT - 1, (int)std::ceil(std::max(y[0], std::max(y[1], y[2]))));
+        if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY) {
+            return;
+        }
+
+        //edge i is opposite vertex i, its value at a point is the barycentric weight of vertex i times the area
+        for (int e = 0; e < 3; e++) {
+            int a = (e + 1) % 3;
+            int b = (e + 2) % 3;
+            triangle.edgeA[e] = y[a] - y[b];
+            triangle.edgeB[e] = x[b] - x[a];
+            triangle.edgeC[e] = x[a] * y[b] - y[a] * x[b];
+        }
+        float invArea = 1.0f / area;
+        triangle.depthA = (triangle.edgeA[0] * z[0] + triangle.edgeA[1] * z[1] + triangle.edgeA[2] * z[2]) * invArea;
+        triangle.depthB = (triangle.edgeB[0] * z[0] + triangle.edgeB[1] * z[1] + triangle.edgeB[2] * z[2]) * invArea;
+        triangle.depthC = (triangle.edgeC[0] * z[0] + triangle.edgeC[1] * z[1] + triangle.edgeC[2] * z[2]) * invArea;
+
+        unsigned int index = (unsigned int)batch.triangles.size();
+        batch.triangles.push_back(triangle);
+        for (int ty = triangle.minY / OCCLUSION_TILE_HEIGHT; ty <= triangle.maxY / OCCLUSION_TILE_HEIGHT; ty++) {
+            for (int tx = triangle.minX / OCCLUSION_TILE_WIDTH; tx <= triangle.maxX / OCCLUSION_TILE_WIDTH; tx++) {
+                batch.tileBins[ty * tilesX + tx].push_back(index);
+            }
+        }
+    }
+
+    void DepthRasterizer::rasterizeTile(int tile) {
+        std::vector<float>& depth = hiZ[0];
+        int tileX0 = (tile % tilesX) * OCCLUSION_TILE_WIDTH;
+        int tileY0 = (tile / tilesX) * OCCLUSION_TILE_HEIGHT;
+        int tileX1 = std::min(tileX0 + OCCLUSION_TILE_WIDTH, OCCLUSION_BUFFER_WIDTH) - 1;
+        int tileY1 = std::min(tileY0 + OCCLUSION_TILE_HEIGHT, OCCLUSION_BUFFER_HEIGHT) - 1;
+
+        for (int y = tileY0; y <= tileY1; y++) {
+            std::fill(depth.begin() + y * OCCLUSION_BUFFER_WIDTH + tileX0, depth.begin() + y * OCCLUSION_BUFFER_WIDTH + tileX1 + 1, 1.0f);
+        }
+
+        const __m128 pixelOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        const __m128 zero = _mm_setzero_ps();
+
+        for (size_t b = 0; b < activeBatches; b++) {
+            const SetupBatch& batch = batches[b];
+            const std::vector<unsigned int>& bin = batch.tileBins[tile];
+            for (size_t i = 0; i < bin.size(); i++) {
+                const ScreenTriangle& triangle = batch.triangles[bin[i]];
+                //4 pixel aligned columns, the tiles and the buffer width are multiples of 4
+                int x0 = std::max(triangle.minX, tileX0) & ~3;
+                int x1 = std::min(triangle.maxX, tileX1);
+                int y0 = std::max(triangle.minY, tileY0);
+                int y1 = std::min(triangle.maxY, tileY1);
+
+                __m128 edgeA0 = _mm_set1_ps(triangle.edgeA[0]);
+                __m128 edgeA1 = _mm_set1_ps(triangle.edgeA[1]);
+                __m128 edgeA2 = _mm_set1_ps(triangle.edgeA[2]);
+                __m128 depthA = _mm_set1_ps(triangle.depthA);
+
+                for (int y = y0; y <= y1; y++) {
+                    float centerY = (float)y + 0.5f;
+                    __m128 row0 = _mm_set1_ps(triangle.edgeB[0] * centerY + triangle.edgeC[0]);
+                    __m128 row1 = _mm_set1_ps(triangle.edgeB[1] * centerY + triangle.edgeC[1]);
+                    __m128 row2 = _mm_set1_ps(triangle.edgeB[2] * centerY + triangle.edgeC[2]);
+                    __m128 rowDepth = _mm_set1_ps(triangle.depthB * centerY + triangle.depthC);
+                    float* row = &depth[(size_t)y * OCCLUSION_BUFFER_WIDTH];
+
+                    for (int x = x0; x <= x1; x += 4) {
+                        __m128 centerX = _mm_add_ps(_mm_set1_ps((float)x), pixelOffsets);
+                        __m128 inside = _mm_and_ps(
+                            _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA0, centerX), row0), zero),
+                            _mm_and_ps(
+                                _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA1, centerX), row1), zero),
+                                _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA2, centerX), row2), zero)));
+                        if (_mm_movemask_ps(inside) == 0) {
+                            continue;
+                        }
+                        __m128 fragmentDepth = _mm_add_ps(_mm_mul_ps(depthA, centerX), rowDepth);
+                        __m128 stored = _mm_loadu_ps(row + x);
+                        __m128 nearer = _mm_min_ps(stored, fragmentDepth);
+                        _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, stored)));
+                    }
+                }
+            }
+        }
+    }
+
+    //every texel keeps the farthest depth of the ones it covers, so a box nearer than it is nearer than all of them
+    void DepthRasterizer::buildHiZ() {
+        for (size_t level = 1; level < hiZ.size(); level++) {
+            const std::vector<float>& source = hiZ[level - 1];
+            int sourceWidth = hiZWidth[level - 1];
+            int sourceHeight = hiZHeight[level - 1];
+            std::vector<float>& target = hiZ[level];
+            for (int y = 0; y < hiZHeight[level]; y++) {
+                int y0 = y * 2;
+                int y1 = std::min(y0 + 1, sourceHeight - 1);
+                for (int x = 0; x < hiZWidth[level]; x++) {
+                    int x0 = x * 2;
+                    int x1 = std::min(x0 + 1, sourceWidth - 1);
+                    target[y * hiZWidth[level] + x] = std::max(
+                        std::max(source[y0 * sourceWidth + x0], source[y0 * sourceWidth + x1]),
+                        std::max(source[y1 * sourceWidth + x0], source[y1 * sourceWidth + x1]));
+                }
+            }
+        }
+    }
+
+    bool DepthRasterizer::isVisible(const AABB& bounds) const {
+        if (bounds.isEmpty()) {
+            return true;
+        }
+
+        float minX = FLT_MAX;
+        float minY = FLT_MAX;
+        float maxX = -FLT_MAX;
+        float maxY = -FLT_MAX;
+        float minDepth = FLT_MAX;
+        for (int corner = 0; corner < 8; corner++) {
+            glm::vec3 position = glm::vec3(
+                corner & 1 ? bounds.max.x : bounds.min.x,
+                corner & 2 ? bounds.max.y : bounds.min.y,
+                corner & 4 ? bounds.max.z : bounds.min.z);
+            glm::vec4 clip = viewProjection * glm::vec4(position, 1.0f);
+            //the box reaches the near plane, nothing can be in front of it
+            if (clip.w <= 0.0f || clip.z < -clip.w) {
+                return true;
+            }
+            float invW = 1.0f / clip.w;
+            float x = (clip.x * invW * 0.5f + 0.5f) * OCCLUSION_BUFFER_WIDTH;
+            float y = (clip.y * invW * 0.5f + 0.5f) * OCCLUSION_BUFFER_HEIGHT;
+            minX = std::min(minX, x);
+            maxX = std::max(maxX, x);
+            minY = std::min(minY, y);
+            maxY = std::max(maxY, y);
+            minDepth = std::min(minDepth, clip.z * invW * 0.5f + 0.5f);
+        }
+
+        //off screen boxes are left to frustum culling
+        if (maxX < 0.0f || maxY < 0.0f || minX >= OCCLUSION_BUFFER_WIDTH || minY >= OCCLUSION_BUFFER_HEIGHT) {
+            return true;
+        }
+        int x0 = std::max(0, (int)minX);
+        int y0 = std::max(0, (int)minY);
+        int x1 = std::min(OCCLUSION_BUFFER_WIDTH - 1, (int)maxX);
+        int y1 = std::min(OCCLUSION_BUFFER_HEIGHT - 1, (int)maxY);
+
+        //the level where the box covers at most 4 x 4 texels
+        size_t level = 0;
+        while (level + 1 < hiZ.size() && ((x1 >> level) - (x0 >> level) > 3 || (y1 >> level) - (y0 >> level) > 3)) {
+            level++;
+        }
+
+        const std::vector<float>& depth = hiZ[level];
+        int width = hiZWidth[level];
+        for (int y = y0 >> level; y <= (y1 >> level); y++) {
+            for (int x = x0 >> level; x <= (x1 >> level); x++) {
+                if (minDepth <= depth[y * width + x]) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    size_t DepthRasterizer::getRasterizedTriangles() {
+        return rasterizedTriangles;
+    }
+
+    const std::vector<float>& DepthRasterizer::getDepth() {
+        return hiZ[0];
+    }
+
+}
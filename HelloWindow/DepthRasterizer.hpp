@@ -0,0 +1,88 @@
+#ifndef DepthRasterizer_hpp
+#define DepthRasterizer_hpp
+
+#include "BoundingBox.hpp"
+#include "ThreadPool.hpp"
+
+#include <glm/glm.hpp>
+#include <functional>
+#include <vector>
+
+namespace gps {
+
+    //low resolution depth buffer for occlusion culling, the aspect follows the window
+    const int OCCLUSION_BUFFER_WIDTH = 320;
+    const int OCCLUSION_BUFFER_HEIGHT = 192;
+    //tiles are rasterized in parallel, the width must be a multiple of 4 (one SSE register of pixels)
+    const int OCCLUSION_TILE_WIDTH = 64;
+    const int OCCLUSION_TILE_HEIGHT = 32;
+    //triangles set up and binned per job
+    const size_t OCCLUSION_SETUP_BATCH = 256;
+
+    //Renders occluder triangles into a CPU depth buffer with SSE and a thread per tile,
+    //then tests bounding boxes against a max-depth (hierarchical) mip chain of it.
+    //Depth is the OpenGL window depth: 0 near, 1 far.
+    class DepthRasterizer
+    {
+    public:
+        DepthRasterizer();
+
+        //the pool is shared with the owner, without one everything runs on the calling thread
+        void setThreadPool(ThreadPool* pool);
+
+        //world space triangles, three vertices each, replace the previous frame
+        void render(const std::vector<glm::vec3>& triangles, const glm::mat4& viewProjection);
+        //false only when the whole box is behind the rendered depth
+        bool isVisible(const AABB& bounds) const;
+
+        //triangles that reached the screen in the last render (after near plane clipping)
+        size_t getRasterizedTriangles();
+        //level 0 of the depth buffer, row 0 at the bottom
+        const std::vector<float>& getDepth();
+
+    private:
+        struct ScreenTriangle {
+            //edge functions A * x + B * y + C, positive inside
+            float edgeA[3];
+            float edgeB[3];
+            float edgeC[3];
+            //depth plane
+            float depthA;
+            float depthB;
+            float depthC;
+            //pixel bounds, inclusive
+            int minX;
+            int minY;
+            int maxX;
+            int maxY;
+        };
+
+        //triangles set up by one job and the tiles they touch
+        struct SetupBatch {
+            std::vector<ScreenTriangle> triangles;
+            std::vector<std::vector<unsigned int> > tileBins;
+        };
+
+        ThreadPool* pool = nullptr;
+        int tilesX;
+        int tilesY;
+        glm::mat4 viewProjection;
+
+        std::vector<SetupBatch> batches;
+        size_t activeBatches = 0;
+        //max depth mip chain, level 0 is the depth buffer itself
+        std::vector<std::vector<float> > hiZ;
+        std::vector<int> hiZWidth;
+        std::vector<int> hiZHeight;
+        size_t rasterizedTriangles = 0;
+
+        void runJobs(size_t count, const std::function<void(size_t)>& job);
+        void setupBatch(const std::vector<glm::vec3>& triangles, size_t batchIndex);
+        void addTriangle(SetupBatch& batch, const glm::vec4 clip[3]);
+        void rasterizeTile(int tile);
+        void buildHiZ();
+    };
+
+}
+
+#endif /* DepthRasterizer_hpp */
@@ -0,0 +1,20 @@
+#ifndef DrawFilter_hpp
+#define DrawFilter_hpp
+
+namespace gps {
+
+    //which part of the static scenery a pass draws, alpha tested foliage is split off
+    //so it can go through a depth pre-pass
+    enum DrawFilter {
+        DRAW_ALL,
+        DRAW_OPAQUE,
+        DRAW_ALPHA_TESTED
+    };
+
+    inline bool passesFilter(DrawFilter filter, bool isTransparent) {
+        return filter == DRAW_ALL || (filter == DRAW_ALPHA_TESTED) == isTransparent;
+    }
+
+}
+
+#endif /* DrawFilter_hpp */
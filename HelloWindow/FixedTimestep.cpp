@@ -0,0 +1,50 @@
+#include "FixedTimestep.hpp"
+
+#include <cstdio>
+
+namespace gps {
+
+    void FixedTimestep::init(double tickRate, double now) {
+        tickSeconds = 1.0 / tickRate;
+        lastTime = now;
+        accumulator = 0.0;
+    }
+
+    int FixedTimestep::advance(double now) {
+        double frameSeconds = now - lastTime;
+        lastTime = now;
+        accumulator += frameSeconds;
+        secondsSinceReport += frameSeconds;
+
+        int ticks = (int)(accumulator / tickSeconds);
+        accumulator -= ticks * tickSeconds;
+        //the ticks over the limit are not run, the simulation falls behind the clock instead of spiraling
+        if (ticks > FIXED_TIMESTEP_MAX_TICKS) {
+            droppedSeconds += (ticks - FIXED_TIMESTEP_MAX_TICKS) * tickSeconds;
+            ticks = FIXED_TIMESTEP_MAX_TICKS;
+        }
+        ticksSinceReport += ticks;
+        return ticks;
+    }
+
+    float FixedTimestep::getTickSeconds() {
+        return (float)tickSeconds;
+    }
+
+    float FixedTimestep::getAlpha() {
+        return (float)(accumulator / tickSeconds);
+    }
+
+    void FixedTimestep::printStats() {
+        if (++framesSinceReport < FIXED_TIMESTEP_REPORT_FRAMES) {
+            return;
+        }
+        printf("simulation: %.1f ticks/s for %.1f frames/s, %.2f s dropped after long frames\n",
+            ticksSinceReport / secondsSinceReport, framesSinceReport / secondsSinceReport, droppedSeconds);
+        framesSinceReport = 0;
+        ticksSinceReport = 0;
+        secondsSinceReport = 0.0;
+        droppedSeconds = 0.0;
+    }
+
+}
@@ -0,0 +1,46 @@
+#ifndef FixedTimestep_hpp
+#define FixedTimestep_hpp
+
+namespace gps {
+
+    //ticks a second of the simulation unless --tick-rate asks for another rate
+    const double FIXED_TIMESTEP_DEFAULT_RATE = 60.0;
+    //ticks run for one frame at most, a longer stall (a breakpoint, a dragged window) drops the rest
+    const int FIXED_TIMESTEP_MAX_TICKS = 8;
+    //frames between two printed reports
+    const int FIXED_TIMESTEP_REPORT_FRAMES = 120;
+
+    //Clock of a simulation advanced in ticks of a fixed length, however long the frames take. The time of
+    //every frame is added to an accumulator and taken out again one tick at a time, what is left is less
+    //than a tick and gives the fraction the rendering interpolates the last two ticks by.
+    class FixedTimestep
+    {
+    public:
+        //starts the clock at now, in seconds
+        void init(double tickRate, double now);
+
+        //adds the time passed since the previous call and returns the ticks to run for it
+        int advance(double now);
+
+        //length of a tick in seconds
+        float getTickSeconds();
+        //part of the next tick already elapsed, in [0, 1): 0 draws the previous tick's state, 1 the last one's
+        float getAlpha();
+
+        //prints the rate the ticks ran at every FIXED_TIMESTEP_REPORT_FRAMES calls
+        void printStats();
+
+    private:
+        double tickSeconds = 1.0 / FIXED_TIMESTEP_DEFAULT_RATE;
+        double lastTime = 0.0;
+        double accumulator = 0.0;
+
+        int framesSinceReport = 0;
+        int ticksSinceReport = 0;
+        double secondsSinceReport = 0.0;
+        double droppedSeconds = 0.0;
+    };
+
+}
+
+#endif /* FixedTimestep_hpp */
@@ -0,0 +1,114 @@
+#include "FrameAllocator.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace gps {
+
+    bool FrameAllocator::init() {
+        if (!GLEW_VERSION_4_4 && !GLEW_ARB_buffer_storage) {
+            printf("frame allocator: buffer storage not supported, the per-frame data goes through uniforms\n");
+            return false;
+        }
+
+        GLint alignment;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        uniformAlignment = std::max(alignment, 1);
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        storageAlignment = std::max(alignment, 1);
+
+        //written through the mapping and read by the GPU as it is, no flushes
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        GLsizeiptr size = FRAME_ALLOCATOR_REGION_SIZE * FRAME_ALLOCATOR_FRAMES;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, flags);
+        mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        if (mapped == NULL) {
+            printf("frame allocator: the ring could not be mapped\n");
+            glDeleteBuffers(1, &buffer);
+            buffer = 0;
+            return false;
+        }
+
+        //the first beginFrame moves to region 0
+        region = FRAME_ALLOCATOR_FRAMES - 1;
+        return true;
+    }
+
+    bool FrameAllocator::isReady() {
+        return mapped != NULL;
+    }
+
+    void FrameAllocator::beginFrame() {
+        if (mapped == NULL) {
+            return;
+        }
+        region = (region + 1) % FRAME_ALLOCATOR_FRAMES;
+        used = 0;
+        GLsync fence = fences[region];
+        if (fence == 0) {
+            return;
+        }
+        //a stall when the GPU is still more than two frames behind
+        GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            stalls++;
+            while (status == GL_TIMEOUT_EXPIRED) {
+                status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            }
+        }
+        glDeleteSync(fence);
+        fences[region] = 0;
+    }
+
+    void FrameAllocator::endFrame() {
+        if (mapped == NULL) {
+            return;
+        }
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        peakUsed = std::max(peakUsed, used);
+    }
+
+    FrameAllocation FrameAllocator::allocate(GLsizeiptr size, GLintptr alignment) {
+        FrameAllocation allocation = { NULL, 0, size };
+        if (mapped == NULL) {
+            return allocation;
+        }
+        GLintptr start = (used + alignment - 1) & ~(alignment - 1);
+        if (start + size > FRAME_ALLOCATOR_REGION_SIZE) {
+            failedAllocations++;
+            return allocation;
+        }
+        used = start + size;
+        allocation.offset = region * FRAME_ALLOCATOR_REGION_SIZE + start;
+        allocation.data = mapped + allocation.offset;
+        return allocation;
+    }
+
+    GLintptr FrameAllocator::getUniformAlignment() {
+        return uniformAlignment;
+    }
+
+    GLintptr FrameAllocator::getStorageAlignment() {
+        return storageAlignment;
+    }
+
+    GLuint FrameAllocator::getBuffer() {
+        return buffer;
+    }
+
+    void FrameAllocator::printStats() {
+        if (mapped == NULL || ++framesSinceReport < FRAME_ALLOCATOR_REPORT_FRAMES) {
+            return;
+        }
+        framesSinceReport = 0;
+        printf("frame allocator: at most %.1f of %.1f KB a frame, %d stalls on a fence, %d allocations that did not fit\n",
+            peakUsed / 1024.0, FRAME_ALLOCATOR_REGION_SIZE / 1024.0, stalls, failedAllocations);
+        peakUsed = 0;
+        stalls = 0;
+        failedAllocations = 0;
+    }
+
+}
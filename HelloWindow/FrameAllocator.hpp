@@ -0,0 +1,79 @@
+#ifndef FrameAllocator_hpp
+#define FrameAllocator_hpp
+
+#include <GL/glew.h>
+
+#include <cstring>
+
+namespace gps {
+
+    //frames the ring is split into: the CPU writes one while the GPU may still read the two before
+    const int FRAME_ALLOCATOR_FRAMES = 3;
+    //bytes of each frame's region, the cluster lists and the per-draw constants of a frame fit many times over
+    const GLsizeiptr FRAME_ALLOCATOR_REGION_SIZE = 4 * 1024 * 1024;
+    //frames between two printed reports
+    const int FRAME_ALLOCATOR_REPORT_FRAMES = 120;
+
+    //block of a frame's region: where to write it and the range of the buffer to bind it by
+    struct FrameAllocation {
+        //NULL when the region had no room left
+        void* data;
+        GLintptr offset;
+        GLsizeiptr size;
+    };
+
+    //Linear allocator for the data that only lives for a frame, the per-draw constants and the dynamic
+    //buffers, in a ring mapped once for writing and kept mapped. Each frame takes the next of
+    //FRAME_ALLOCATOR_FRAMES regions and bumps an offset through it, the data is bound by its offset into
+    //the one buffer. A fence marks the end of the frame's commands, the region is only handed out again
+    //once the GPU passed it, which with three regions it normally already has.
+    class FrameAllocator
+    {
+    public:
+        //creates and maps the ring, false without buffer storage (OpenGL 4.4 or ARB_buffer_storage)
+        bool init();
+        bool isReady();
+
+        //waits for the GPU to be done with the next region and starts allocating from its beginning
+        void beginFrame();
+        //fences the frame's commands, its region is read until the fence is passed
+        void endFrame();
+
+        //size bytes at an offset that is a multiple of alignment, a power of two
+        FrameAllocation allocate(GLsizeiptr size, GLintptr alignment);
+        //a copy of the value, aligned for binding as a uniform block
+        template <typename T>
+        FrameAllocation upload(const T& value) {
+            FrameAllocation allocation = allocate(sizeof(T), uniformAlignment);
+            if (allocation.data != NULL) {
+                memcpy(allocation.data, &value, sizeof(T));
+            }
+            return allocation;
+        }
+
+        //the offsets a uniform block and a shader storage block may be bound at are multiples of these
+        GLintptr getUniformAlignment();
+        GLintptr getStorageAlignment();
+        GLuint getBuffer();
+
+        //prints the last frames' use every FRAME_ALLOCATOR_REPORT_FRAMES calls
+        void printStats();
+
+    private:
+        GLuint buffer = 0;
+        unsigned char* mapped = NULL;
+        GLsync fences[FRAME_ALLOCATOR_FRAMES] = {};
+        int region = 0;
+        GLintptr used = 0;
+        GLintptr uniformAlignment = 256;
+        GLintptr storageAlignment = 256;
+
+        int framesSinceReport = 0;
+        GLintptr peakUsed = 0;
+        int stalls = 0;
+        int failedAllocations = 0;
+    };
+
+}
+
+#endif /* FrameAllocator_hpp */
@@ -0,0 +1,70 @@
+#include "GBuffer.hpp"
+
+namespace gps {
+
+    bool GBuffer::init(RenderGraph& graph, int width, int height) {
+        glGenVertexArrays(1, &emptyVAO);
+        //the attachments in the order addGeometryPass writes them
+        std::vector<RenderTargetDesc> targets;
+        RenderTargetDesc albedoDesc = { width, height, GBUFFER_ALBEDO_FORMAT };
+        RenderTargetDesc normalDesc = { width, height, GBUFFER_NORMAL_FORMAT };
+        RenderTargetDesc specularDesc = { width, height, GBUFFER_SPECULAR_FORMAT };
+        RenderTargetDesc depthDesc = { width, height, GBUFFER_DEPTH_FORMAT };
+        targets.push_back(albedoDesc);
+        targets.push_back(normalDesc);
+        targets.push_back(specularDesc);
+        targets.push_back(depthDesc);
+        return graph.checkTargets(targets);
+    }
+
+    void GBuffer::addGeometryPass(RenderGraph& graph, int width, int height, const std::function<void()>& drawScene) {
+        RenderTargetDesc albedoDesc = { width, height, GBUFFER_ALBEDO_FORMAT };
+        RenderTargetDesc normalDesc = { width, height, GBUFFER_NORMAL_FORMAT };
+        RenderTargetDesc specularDesc = { width, height, GBUFFER_SPECULAR_FORMAT };
+        RenderTargetDesc depthDesc = { width, height, GBUFFER_DEPTH_FORMAT };
+        albedo = graph.createTexture("G-buffer albedo", albedoDesc);
+        normal = graph.createTexture("G-buffer normal", normalDesc);
+        specular = graph.createTexture("G-buffer specular", specularDesc);
+        depth = graph.createTexture("G-buffer depth", depthDesc);
+
+        //the colors are written to the attachments in this order, basic.frag's outputs 0 to 2
+        RenderGraphPass pass = graph.addPass("geometry", GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, [drawScene]() {
+            //the alpha of the targets is data, not coverage
+            glDisable(GL_BLEND);
+            drawScene();
+            glEnable(GL_BLEND);
+        });
+        graph.write(pass, albedo);
+        graph.write(pass, normal);
+        graph.write(pass, specular);
+        graph.write(pass, depth);
+    }
+
+    void GBuffer::readTargets(RenderGraph& graph, RenderGraphPass pass) {
+        graph.read(pass, albedo);
+        graph.read(pass, normal);
+        graph.read(pass, specular);
+        graph.read(pass, depth);
+    }
+
+    void GBuffer::drawLightingPass(RenderGraph& graph, gps::Shader shader) {
+        shader.useShaderProgram();
+        glActiveTexture(GL_TEXTURE0 + GBUFFER_ALBEDO_UNIT);
+        glBindTexture(GL_TEXTURE_2D, graph.getTexture(albedo));
+        glActiveTexture(GL_TEXTURE0 + GBUFFER_NORMAL_UNIT);
+        glBindTexture(GL_TEXTURE_2D, graph.getTexture(normal));
+        glActiveTexture(GL_TEXTURE0 + GBUFFER_SPECULAR_UNIT);
+        glBindTexture(GL_TEXTURE_2D, graph.getTexture(specular));
+        glActiveTexture(GL_TEXTURE0 + GBUFFER_DEPTH_UNIT);
+        glBindTexture(GL_TEXTURE_2D, graph.getTexture(depth));
+        glActiveTexture(GL_TEXTURE0);
+
+        //every pixel is written once, the stored depth replaces the cleared one
+        glDepthFunc(GL_ALWAYS);
+        glBindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        glDepthFunc(GL_LESS);
+    }
+
+}
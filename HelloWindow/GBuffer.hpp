@@ -0,0 +1,55 @@
+#ifndef GBuffer_hpp
+#define GBuffer_hpp
+
+#include <GL/glew.h>
+
+#include "Shader.hpp"
+#include "RenderGraph.hpp"
+
+#include <functional>
+
+namespace gps {
+
+    //texture units the lighting pass reads the G-buffer from, after the texture arrays of the indirect draws
+    const GLint GBUFFER_ALBEDO_UNIT = 7;
+    const GLint GBUFFER_NORMAL_UNIT = 8;
+    const GLint GBUFFER_SPECULAR_UNIT = 9;
+    const GLint GBUFFER_DEPTH_UNIT = 10;
+
+    //the colors are stored sRGB encoded like the textures they come from, the normals need the range of a float
+    const GLenum GBUFFER_ALBEDO_FORMAT = GL_SRGB8_ALPHA8;
+    const GLenum GBUFFER_NORMAL_FORMAT = GL_RGBA16F;
+    const GLenum GBUFFER_SPECULAR_FORMAT = GL_SRGB8_ALPHA8;
+    const GLenum GBUFFER_DEPTH_FORMAT = GL_DEPTH_COMPONENT24;
+
+    //Render targets of the deferred path: basic.frag writes the albedo, the view space normal and the
+    //specular color of the nearest surface, the lighting pass then shades every pixel once from them.
+    //The targets are transients of the frame's render graph, which sizes them to the window.
+    class GBuffer
+    {
+    public:
+        //creates the vertex array of the lighting pass and checks the graph can render to targets
+        //of this size, false when their framebuffer is incomplete
+        bool init(RenderGraph& graph, int width, int height);
+
+        //declares the targets and the geometry pass that clears them and writes them with drawScene
+        void addGeometryPass(RenderGraph& graph, int width, int height, const std::function<void()>& drawScene);
+        //the pass reads the targets, the one drawing the lighting
+        void readTargets(RenderGraph& graph, RenderGraphPass pass);
+
+        //binds the targets and draws one triangle over the screen. The lighting shader also
+        //writes the stored depth, the forward draws after it are tested against the scene
+        void drawLightingPass(RenderGraph& graph, gps::Shader shader);
+
+    private:
+        RenderGraphResource albedo = -1;
+        RenderGraphResource normal = -1;
+        RenderGraphResource specular = -1;
+        RenderGraphResource depth = -1;
+        //the fullscreen triangle is made from gl_VertexID, core profile still needs a bound VAO
+        GLuint emptyVAO = 0;
+    };
+
+}
+
+#endif /* GBuffer_hpp */
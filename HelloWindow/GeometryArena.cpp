@@ -0,0 +1,364 @@
+#include "GeometryArena.hpp"
+#include "Mesh.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace gps {
+
+    //index ranges start on 4 bytes so both 16 and 32 bit indices stay aligned
+    const size_t INDEX_ALIGNMENT = 4;
+
+    void RangeAllocator::reset(size_t capacity) {
+        this->capacity = capacity;
+        this->used = 0;
+        freeBlocks.clear();
+        if (capacity > 0) {
+            freeBlocks[0] = capacity;
+        }
+    }
+
+    bool RangeAllocator::allocate(size_t size, size_t alignment, size_t& offset) {
+        if (size == 0) {
+            offset = 0;
+            return true;
+        }
+
+        for (std::map<size_t, size_t>::iterator it = freeBlocks.begin(); it != freeBlocks.end(); it++) {
+            size_t blockStart = it->first;
+            size_t blockEnd = it->first + it->second;
+            size_t alignedStart = (blockStart + alignment - 1) / alignment * alignment;
+
+            if (alignedStart + size <= blockEnd) {
+                freeBlocks.erase(it);
+                //the alignment padding and the tail stay free
+                if (alignedStart > blockStart) {
+                    freeBlocks[blockStart] = alignedStart - blockStart;
+                }
+                if (alignedStart + size < blockEnd) {
+                    freeBlocks[alignedStart + size] = blockEnd - (alignedStart + size);
+                }
+                used += size;
+                offset = alignedStart;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void RangeAllocator::free(size_t offset, size_t size) {
+        if (size == 0) {
+            return;
+        }
+        used -= size;
+
+        //merge with the following block
+        std::map<size_t, size_t>::iterator next = freeBlocks.lower_bound(offset);
+        if (next != freeBlocks.end() && offset + size == next->first) {
+            size += next->second;
+            next = freeBlocks.erase(next);
+        }
+
+        //merge with the preceding block
+        if (next != freeBlocks.begin()) {
+            std::map<size_t, size_t>::iterator previous = next;
+            previous--;
+            if (previous->first + previous->second == offset) {
+                previous->second += size;
+                return;
+            }
+        }
+
+        freeBlocks[offset] = size;
+    }
+
+    void RangeAllocator::grow(size_t newCapacity) {
+        if (newCapacity <= capacity) {
+            return;
+        }
+        size_t oldCapacity = capacity;
+        capacity = newCapacity;
+        //free() lowers the used counter, the new space was never counted
+        used += newCapacity - oldCapacity;
+        free(oldCapacity, newCapacity - oldCapacity);
+    }
+
+    size_t RangeAllocator::getCapacity() {
+        return capacity;
+    }
+
+    size_t RangeAllocator::getUsed() {
+        return used;
+    }
+
+    size_t RangeAllocator::getFreeBlockCount() {
+        return freeBlocks.size();
+    }
+
+    size_t RangeAllocator::getLargestFreeBlock() {
+        size_t largest = 0;
+        for (std::map<size_t, size_t>::iterator it = freeBlocks.begin(); it != freeBlocks.end(); it++) {
+            largest = std::max(largest, it->second);
+        }
+        return largest;
+    }
+
+    GeometryArena::GeometryArena(GLsizei vertexStride, void (*setupAttributes)(), size_t initialVertexCapacity, size_t initialIndexBytes) {
+        this->vertexStride = vertexStride;
+        this->setupAttributes = setupAttributes;
+        this->initialVertexCapacity = initialVertexCapacity;
+        this->initialIndexBytes = initialIndexBytes;
+    }
+
+    //the GL objects are created on first use, the arena may be constructed before the context
+    void GeometryArena::init() {
+        glGenVertexArrays(1, &VAO);
+        VBO = resizeBuffer(0, 0, initialVertexCapacity * vertexStride);
+        EBO = resizeBuffer(0, 0, initialIndexBytes);
+        vertexRanges.reset(initialVertexCapacity);
+        indexRanges.reset(initialIndexBytes);
+        attachBuffers();
+    }
+
+    GLuint GeometryArena::resizeBuffer(GLuint buffer, size_t oldBytes, size_t newBytes) {
+        //copy targets are used so the element binding of whatever VAO is bound stays untouched
+        GLuint newBuffer;
+        glGenBuffers(1, &newBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, newBytes, NULL, GL_STATIC_DRAW);
+
+        if (buffer != 0) {
+            glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldBytes);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glDeleteBuffers(1, &buffer);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return newBuffer;
+    }
+
+    void GeometryArena::attachBuffers() {
+        generation++;
+        attachToVertexArray(VAO);
+    }
+
+    void GeometryArena::attachToVertexArray(GLuint vertexArray) {
+        if (VAO == 0) {
+            init();
+        }
+        glBindVertexArray(vertexArray);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        setupAttributes();
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBindVertexArray(0);
+    }
+
+    GeometryHandle GeometryArena::allocate(const void* vertexData, size_t vertexCount, const void* indexData, size_t indexBytes) {
+        if (VAO == 0) {
+            init();
+        }
+
+        GeometryAllocation allocation;
+        allocation.vertexCount = vertexCount;
+        allocation.indexBytes = indexBytes;
+
+        //grow by doubling when the free list has no room
+        while (!vertexRanges.allocate(vertexCount, 1, allocation.vertexOffset)) {
+            size_t capacity = vertexRanges.getCapacity();
+            size_t newCapacity = std::max(capacity * 2, capacity + vertexCount);
+            VBO = resizeBuffer(VBO, capacity * vertexStride, newCapacity * vertexStride);
+            vertexRanges.grow(newCapacity);
+            attachBuffers();
+        }
+        while (!indexRanges.allocate(indexBytes, INDEX_ALIGNMENT, allocation.indexOffset)) {
+            size_t capacity = indexRanges.getCapacity();
+            size_t newCapacity = std::max(capacity * 2, capacity + indexBytes + INDEX_ALIGNMENT);
+            EBO = resizeBuffer(EBO, capacity, newCapacity);
+            indexRanges.grow(newCapacity);
+            attachBuffers();
+        }
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.vertexOffset * vertexStride, vertexCount * vertexStride, vertexData);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.indexOffset, indexBytes, indexData);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        GeometryHandle handle;
+        if (!freeHandles.empty()) {
+            handle = freeHandles.back();
+            freeHandles.pop_back();
+            allocations[handle] = allocation;
+            allocationLive[handle] = true;
+        }
+        else {
+            handle = (GeometryHandle)allocations.size();
+            allocations.push_back(allocation);
+            allocationLive.push_back(true);
+        }
+        return handle;
+    }
+
+    void GeometryArena::free(GeometryHandle handle) {
+        if (handle >= allocations.size() || !allocationLive[handle]) {
+            return;
+        }
+        vertexRanges.free(allocations[handle].vertexOffset, allocations[handle].vertexCount);
+        indexRanges.free(allocations[handle].indexOffset, allocations[handle].indexBytes);
+        allocationLive[handle] = false;
+        freeHandles.push_back(handle);
+
+        if (isFragmented()) {
+            defragment();
+        }
+    }
+
+    bool GeometryArena::isFragmented() {
+        ArenaStats stats = getStats();
+        bool vertices = stats.vertexFreeBlocks >= GEOMETRY_ARENA_DEFRAGMENT_BLOCKS && stats.vertexFragmentation > GEOMETRY_ARENA_DEFRAGMENT_THRESHOLD;
+        bool indices = stats.indexFreeBlocks >= GEOMETRY_ARENA_DEFRAGMENT_BLOCKS && stats.indexFragmentation > GEOMETRY_ARENA_DEFRAGMENT_THRESHOLD;
+        return vertices || indices;
+    }
+
+    const GeometryAllocation& GeometryArena::getAllocation(GeometryHandle handle) {
+        return allocations[handle];
+    }
+
+    void GeometryArena::defragment() {
+        if (VAO == 0) {
+            return;
+        }
+
+        std::vector<GeometryHandle> live;
+        for (GeometryHandle handle = 0; handle < allocations.size(); handle++) {
+            if (allocationLive[handle]) {
+                live.push_back(handle);
+            }
+        }
+
+        //vertices: copy every live range, in offset order, into a fresh buffer of the same size
+        std::sort(live.begin(), live.end(), [this](GeometryHandle a, GeometryHandle b) {
+            return allocations[a].vertexOffset < allocations[b].vertexOffset;
+        });
+        GLuint packedVBO;
+        glGenBuffers(1, &packedVBO);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, packedVBO);
+        glBufferData(GL_COPY_WRITE_BUFFER, vertexRanges.getCapacity() * vertexStride, NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_READ_BUFFER, VBO);
+        size_t packedVertices = 0;
+        for (size_t i = 0; i < live.size(); i++) {
+            GeometryAllocation& allocation = allocations[live[i]];
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                allocation.vertexOffset * vertexStride, packedVertices * vertexStride, allocation.vertexCount * vertexStride);
+            allocation.vertexOffset = packedVertices;
+            packedVertices += allocation.vertexCount;
+        }
+
+        //indices: same, keeping the alignment
+        std::sort(live.begin(), live.end(), [this](GeometryHandle a, GeometryHandle b) {
+            return allocations[a].indexOffset < allocations[b].indexOffset;
+        });
+        GLuint packedEBO;
+        glGenBuffers(1, &packedEBO);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, packedEBO);
+        glBufferData(GL_COPY_WRITE_BUFFER, indexRanges.getCapacity(), NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_READ_BUFFER, EBO);
+        size_t packedIndexBytes = 0;
+        for (size_t i = 0; i < live.size(); i++) {
+            GeometryAllocation& allocation = allocations[live[i]];
+            packedIndexBytes = (packedIndexBytes + INDEX_ALIGNMENT - 1) / INDEX_ALIGNMENT * INDEX_ALIGNMENT;
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                allocation.indexOffset, packedIndexBytes, allocation.indexBytes);
+            allocation.indexOffset = packedIndexBytes;
+            packedIndexBytes += allocation.indexBytes;
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+        VBO = packedVBO;
+        EBO = packedEBO;
+
+        //the packed data becomes a single used block at the start (index alignment padding included)
+        size_t offset;
+        vertexRanges.reset(vertexRanges.getCapacity());
+        vertexRanges.allocate(packedVertices, 1, offset);
+        indexRanges.reset(indexRanges.getCapacity());
+        indexRanges.allocate(packedIndexBytes, 1, offset);
+
+        attachBuffers();
+    }
+
+    void GeometryArena::bind() {
+        glBindVertexArray(VAO);
+    }
+
+    GLuint GeometryArena::getVAO() {
+        return VAO;
+    }
+
+    GLuint GeometryArena::getVBO() {
+        return VBO;
+    }
+
+    GLuint GeometryArena::getEBO() {
+        return EBO;
+    }
+
+    unsigned int GeometryArena::getGeneration() {
+        return generation;
+    }
+
+    ArenaStats GeometryArena::getStats() {
+        ArenaStats stats;
+        stats.allocationCount = allocations.size() - freeHandles.size();
+        stats.vertexCapacity = vertexRanges.getCapacity();
+        stats.vertexUsed = vertexRanges.getUsed();
+        stats.indexCapacityBytes = indexRanges.getCapacity();
+        stats.indexUsedBytes = indexRanges.getUsed();
+        stats.vertexFreeBlocks = vertexRanges.getFreeBlockCount();
+        stats.indexFreeBlocks = indexRanges.getFreeBlockCount();
+
+        size_t vertexFree = stats.vertexCapacity - stats.vertexUsed;
+        size_t indexFree = stats.indexCapacityBytes - stats.indexUsedBytes;
+        stats.vertexFragmentation = vertexFree > 0 ? 1.0f - (float)vertexRanges.getLargestFreeBlock() / (float)vertexFree : 0.0f;
+        stats.indexFragmentation = indexFree > 0 ? 1.0f - (float)indexRanges.getLargestFreeBlock() / (float)indexFree : 0.0f;
+        return stats;
+    }
+
+    void GeometryArena::printStats(const char* name) {
+        ArenaStats stats = getStats();
+        printf("%s: %zu allocations, vertices %zu / %zu (%.1f%%, %zu free blocks, %.1f%% fragmented), "
+            "indices %zu / %zu KB (%.1f%%, %zu free blocks, %.1f%% fragmented)\n",
+            name, stats.allocationCount,
+            stats.vertexUsed, stats.vertexCapacity,
+            stats.vertexCapacity > 0 ? 100.0f * stats.vertexUsed / stats.vertexCapacity : 0.0f,
+            stats.vertexFreeBlocks, 100.0f * stats.vertexFragmentation,
+            stats.indexUsedBytes / 1024, stats.indexCapacityBytes / 1024,
+            stats.indexCapacityBytes > 0 ? 100.0f * stats.indexUsedBytes / stats.indexCapacityBytes : 0.0f,
+            stats.indexFreeBlocks, 100.0f * stats.indexFragmentation);
+    }
+
+    static void setupVertexAttributes() {
+        // Vertex Positions
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
+        // Vertex Normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
+        // Vertex Texture Coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+        // Lightmap Coords, location 3 is the draw id of the indirect draws
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, LightmapCoords));
+    }
+
+    GeometryArena& sharedGeometryArena() {
+        //8 MB of vertices and 4 MB of indices to start with, grows by doubling
+        static GeometryArena arena(sizeof(Vertex), setupVertexAttributes, 262144, 4 * 1024 * 1024);
+        return arena;
+    }
+
+}
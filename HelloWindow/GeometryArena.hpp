@@ -0,0 +1,124 @@
+#ifndef GeometryArena_hpp
+#define GeometryArena_hpp
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <map>
+#include <vector>
+
+namespace gps {
+
+    //first-fit suballocator over [0, capacity) keeping a coalesced free list
+    class RangeAllocator
+    {
+    public:
+        void reset(size_t capacity);
+        //returns false when no free block is large enough
+        bool allocate(size_t size, size_t alignment, size_t& offset);
+        void free(size_t offset, size_t size);
+        //extends the range, the new space becomes free
+        void grow(size_t newCapacity);
+
+        size_t getCapacity();
+        size_t getUsed();
+        size_t getFreeBlockCount();
+        size_t getLargestFreeBlock();
+
+    private:
+        size_t capacity = 0;
+        size_t used = 0;
+        //offset -> size
+        std::map<size_t, size_t> freeBlocks;
+    };
+
+    //free() packs the arena once this much of its free space is outside the largest free block
+    const float GEOMETRY_ARENA_DEFRAGMENT_THRESHOLD = 0.5f;
+    //and the free space is split into at least this many blocks, a couple of holes are not worth a copy
+    const size_t GEOMETRY_ARENA_DEFRAGMENT_BLOCKS = 8;
+
+    typedef unsigned int GeometryHandle;
+    const GeometryHandle INVALID_GEOMETRY = 0xFFFFFFFFu;
+
+    struct GeometryAllocation {
+        //in vertices, used as the base vertex of the draws
+        size_t vertexOffset;
+        size_t vertexCount;
+        //in bytes, used as the index pointer of the draws
+        size_t indexOffset;
+        size_t indexBytes;
+    };
+
+    struct ArenaStats {
+        size_t allocationCount;
+        size_t vertexCapacity;
+        size_t vertexUsed;
+        size_t indexCapacityBytes;
+        size_t indexUsedBytes;
+        size_t vertexFreeBlocks;
+        size_t indexFreeBlocks;
+        //1 - largest free block / total free space, 0 means the free space is contiguous
+        float vertexFragmentation;
+        float indexFragmentation;
+    };
+
+    //large shared vertex and index buffers for one vertex format, with a single VAO.
+    //Meshes get ranges of it and draw with glDrawElementsBaseVertex.
+    class GeometryArena
+    {
+    public:
+        //setupAttributes describes the vertex format on the bound VAO and VBO
+        GeometryArena(GLsizei vertexStride, void (*setupAttributes)(), size_t initialVertexCapacity, size_t initialIndexBytes);
+
+        GeometryHandle allocate(const void* vertexData, size_t vertexCount, const void* indexData, size_t indexBytes);
+        //defragments when the freed range leaves the free space too scattered
+        void free(GeometryHandle handle);
+        const GeometryAllocation& getAllocation(GeometryHandle handle);
+
+        //packs all live allocations to the start of the buffers, handles stay valid
+        void defragment();
+
+        void bind();
+        //sets up the arena buffers and vertex format on another VAO (e.g. one with extra instanced streams)
+        void attachToVertexArray(GLuint vertexArray);
+        GLuint getVAO();
+        GLuint getVBO();
+        GLuint getEBO();
+        //changes whenever the buffers are replaced (growth, defragmentation)
+        unsigned int getGeneration();
+
+        ArenaStats getStats();
+        void printStats(const char* name);
+
+    private:
+        GLsizei vertexStride;
+        void (*setupAttributes)();
+
+        GLuint VAO = 0;
+        GLuint VBO = 0;
+        GLuint EBO = 0;
+        unsigned int generation = 0;
+
+        RangeAllocator vertexRanges;
+        RangeAllocator indexRanges;
+
+        std::vector<GeometryAllocation> allocations;
+        std::vector<bool> allocationLive;
+        std::vector<GeometryHandle> freeHandles;
+
+        size_t initialVertexCapacity;
+        size_t initialIndexBytes;
+
+        void init();
+        //replaces a buffer by a bigger one, copying the old content
+        GLuint resizeBuffer(GLuint buffer, size_t oldBytes, size_t newBytes);
+        void attachBuffers();
+        bool isFragmented();
+    };
+
+    //the arena holding all Mesh geometry (Vertex format)
+    GeometryArena& sharedGeometryArena();
+
+}
+
+#endif /* GeometryArena_hpp */
@@ -0,0 +1,200 @@
+#include "Impostor.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cstddef>
+#include <iostream>
+
+namespace gps {
+
+    glm::vec3 impostorViewDirection(int azimuthView, int elevationView) {
+        float azimuth = glm::radians(360.0f) * azimuthView / IMPOSTOR_AZIMUTH_VIEWS;
+        float elevation = glm::radians(IMPOSTOR_MAX_ELEVATION) * elevationView / (IMPOSTOR_ELEVATION_VIEWS - 1);
+        return glm::vec3(glm::cos(elevation) * glm::sin(azimuth), glm::sin(elevation), glm::cos(elevation) * glm::cos(azimuth));
+    }
+
+    static GLuint createAtlas(GLenum internalFormat) {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexStorage2D(GL_TEXTURE_2D, IMPOSTOR_MIP_LEVELS, internalFormat,
+            IMPOSTOR_AZIMUTH_VIEWS * IMPOSTOR_TILE_SIZE, IMPOSTOR_ELEVATION_VIEWS * IMPOSTOR_TILE_SIZE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        return texture;
+    }
+
+    bool Impostor::bake(const std::vector<ImpostorSource>& sources, gps::Shader bakeShader) {
+        AABB bounds;
+        for (size_t s = 0; s < sources.size(); s++) {
+            bounds.expand(sources[s].model->GetBounds().transformed(sources[s].modelMatrix));
+        }
+        if (bounds.isEmpty()) {
+            return false;
+        }
+        center = bounds.center();
+        radius = glm::length(bounds.extents());
+
+        colorAtlas = createAtlas(GL_SRGB8_ALPHA8);
+        normalDepthAtlas = createAtlas(GL_RGBA8);
+
+        GLuint depthBuffer;
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24,
+            IMPOSTOR_AZIMUTH_VIEWS * IMPOSTOR_TILE_SIZE, IMPOSTOR_ELEVATION_VIEWS * IMPOSTOR_TILE_SIZE);
+
+        GLuint bakeFBO;
+        glGenFramebuffers(1, &bakeFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, bakeFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorAtlas, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalDepthAtlas, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, drawBuffers);
+
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        if (complete) {
+            GLint viewport[4];
+            GLfloat clearColor[4];
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+            GLboolean blend = glIsEnabled(GL_BLEND);
+            GLboolean cullFace = glIsEnabled(GL_CULL_FACE);
+
+            //empty texels stay transparent black, the leaves are seen from both sides
+            glDisable(GL_BLEND);
+            glDisable(GL_CULL_FACE);
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            //orthographic views framing the bounding sphere, the depth range covers it exactly
+            bakeShader.useShaderProgram();
+            glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, radius, 3.0f * radius);
+            glUniformMatrix4fv(glGetUniformLocation(bakeShader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+
+            for (int e = 0; e < IMPOSTOR_ELEVATION_VIEWS; e++) {
+                for (int a = 0; a < IMPOSTOR_AZIMUTH_VIEWS; a++) {
+                    glm::vec3 direction = impostorViewDirection(a, e);
+                    glm::mat4 view = glm::lookAt(center + direction * 2.0f * radius, center, glm::vec3(0.0f, 1.0f, 0.0f));
+                    glUniformMatrix4fv(glGetUniformLocation(bakeShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+                    glViewport(a * IMPOSTOR_TILE_SIZE, e * IMPOSTOR_TILE_SIZE, IMPOSTOR_TILE_SIZE, IMPOSTOR_TILE_SIZE);
+
+                    for (size_t s = 0; s < sources.size(); s++) {
+                        glm::mat3 normalMatrix = glm::mat3(glm::inverseTranspose(sources[s].modelMatrix));
+                        glUniformMatrix4fv(glGetUniformLocation(bakeShader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(sources[s].modelMatrix));
+                        glUniformMatrix3fv(glGetUniformLocation(bakeShader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+                        glUniform1i(glGetUniformLocation(bakeShader.shaderProgram, "isTransparent"), sources[s].isTransparent);
+                        sources[s].model->RenderModel(bakeShader);
+                    }
+                }
+            }
+
+            glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+            glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+            if (blend) {
+                glEnable(GL_BLEND);
+            }
+            if (cullFace) {
+                glEnable(GL_CULL_FACE);
+            }
+        }
+        else {
+            std::cout << "Impostor bake framebuffer is not complete" << std::endl;
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &bakeFBO);
+        glDeleteRenderbuffers(1, &depthBuffer);
+
+        glBindTexture(GL_TEXTURE_2D, colorAtlas);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, normalDepthAtlas);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        initQuad();
+        return complete;
+    }
+
+    void Impostor::initQuad() {
+        //corners of the camera facing quad, drawn as a triangle strip
+        const GLfloat corners[] = {
+            -1.0f, -1.0f,
+            1.0f, -1.0f,
+            -1.0f, 1.0f,
+            1.0f, 1.0f
+        };
+
+        glGenVertexArrays(1, &quadVAO);
+        glGenBuffers(1, &quadVBO);
+        glGenBuffers(1, &instanceVBO);
+
+        glBindVertexArray(quadVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), (GLvoid*)0);
+
+        //position and scale, then yaw, advanced once per instance
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(ImpostorInstance), (GLvoid*)0);
+        glVertexAttribDivisor(1, 1);
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(ImpostorInstance), (GLvoid*)offsetof(ImpostorInstance, yaw));
+        glVertexAttribDivisor(2, 1);
+        glBindVertexArray(0);
+    }
+
+    void Impostor::setInstances(const std::vector<ImpostorInstance>& instances) {
+        instanceCount = instances.size();
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(ImpostorInstance), instances.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void Impostor::Draw(gps::Shader shader) {
+        if (instanceCount == 0) {
+            return;
+        }
+
+        shader.useShaderProgram();
+        glUniform3fv(glGetUniformLocation(shader.shaderProgram, "impostorCenter"), 1, glm::value_ptr(center));
+        glUniform1f(glGetUniformLocation(shader.shaderProgram, "impostorRadius"), radius);
+        glUniform2i(glGetUniformLocation(shader.shaderProgram, "atlasViews"), IMPOSTOR_AZIMUTH_VIEWS, IMPOSTOR_ELEVATION_VIEWS);
+        glUniform1f(glGetUniformLocation(shader.shaderProgram, "maxElevation"), glm::radians(IMPOSTOR_MAX_ELEVATION));
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, colorAtlas);
+        glUniform1i(glGetUniformLocation(shader.shaderProgram, "colorAtlas"), 0);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, normalDepthAtlas);
+        glUniform1i(glGetUniformLocation(shader.shaderProgram, "normalDepthAtlas"), 1);
+
+        glBindVertexArray(quadVAO);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)instanceCount);
+        glBindVertexArray(0);
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    size_t Impostor::getInstanceCount() {
+        return instanceCount;
+    }
+
+    glm::vec3 Impostor::getCenter() {
+        return center;
+    }
+
+    float Impostor::getRadius() {
+        return radius;
+    }
+
+}
@@ -0,0 +1,72 @@
+#ifndef Impostor_hpp
+#define Impostor_hpp
+
+#include "Model3D.hpp"
+#include "BoundingBox.hpp"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace gps {
+
+    //baked views: a ring of azimuths at each elevation, one atlas tile per view
+    const int IMPOSTOR_AZIMUTH_VIEWS = 16;
+    const int IMPOSTOR_ELEVATION_VIEWS = 4;
+    //elevation of the highest view ring, views from above are clamped to it
+    const float IMPOSTOR_MAX_ELEVATION = 75.0f;
+    const int IMPOSTOR_TILE_SIZE = 256;
+    //few enough that the mips of a tile do not bleed into its neighbours
+    const int IMPOSTOR_MIP_LEVELS = 5;
+
+    //a model drawn into the impostor, with the transform and transparency it has in the scene
+    struct ImpostorSource {
+        Model3D* model;
+        glm::mat4 modelMatrix;
+        bool isTransparent;
+    };
+
+    //one planted copy, matches the instanced attributes of impostor.vert
+    struct ImpostorInstance {
+        glm::vec3 position;
+        float scale;
+        //rotation around the y axis, in radians
+        float yaw;
+    };
+
+    //Models baked from many directions into a color and a normal + depth atlas and drawn as
+    //one camera facing quad per instance, blending the nearest baked views.
+    class Impostor
+    {
+    public:
+        //renders the sources into the atlases, call once the models are loaded
+        bool bake(const std::vector<ImpostorSource>& sources, gps::Shader bakeShader);
+        void setInstances(const std::vector<ImpostorInstance>& instances);
+
+        //the shader must have view, projection, cameraPosition and the lighting uniforms set
+        void Draw(gps::Shader shader);
+
+        size_t getInstanceCount();
+        //bounding sphere of the baked models, before the instance scale
+        glm::vec3 getCenter();
+        float getRadius();
+
+    private:
+        GLuint colorAtlas = 0;
+        GLuint normalDepthAtlas = 0;
+        GLuint quadVAO = 0;
+        GLuint quadVBO = 0;
+        GLuint instanceVBO = 0;
+        size_t instanceCount = 0;
+
+        glm::vec3 center = glm::vec3(0.0f);
+        float radius = 0.0f;
+
+        void initQuad();
+    };
+
+    //direction from the model towards the camera of a baked view, shared with impostor.vert
+    glm::vec3 impostorViewDirection(int azimuthView, int elevationView);
+
+}
+
+#endif /* Impostor_hpp */
@@ -0,0 +1,301 @@
+#include "IndirectRenderer.hpp"
+
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <utility>
+
+namespace gps {
+
+    void IndirectRenderer::add(Model3D& model, const glm::mat4& modelMatrix, bool isTransparent, bool castsShadow) {
+        //model matrix followed by its inverse transpose, see basic.vert
+        unsigned int matrixIndex = (unsigned int)(matrices.size() / 2);
+        matrices.push_back(modelMatrix);
+        matrices.push_back(glm::inverseTranspose(modelMatrix));
+
+        const std::vector<Mesh*>& meshes = model.GetMeshes();
+        for (size_t i = 0; i < meshes.size(); i++) {
+            DrawPacket packet = { meshes[i], matrixIndex, isTransparent, castsShadow };
+            packets.push_back(packet);
+        }
+    }
+
+    int IndirectRenderer::findOrAddLayer(const Texture& texture, int& arrayIndex) {
+        int width, height, channels;
+        if (!stbi_info(texture.path.c_str(), &width, &height, &channels)) {
+            arrayIndex = -1;
+            return -1;
+        }
+
+        for (size_t a = 0; a < textureArrays.size(); a++) {
+            TextureArray& textureArray = textureArrays[a];
+            if (textureArray.width == width && textureArray.height == height && textureArray.isSRGB == texture.isSRGB) {
+                arrayIndex = (int)a;
+                for (size_t l = 0; l < textureArray.layers.size(); l++) {
+                    if (textureArray.layers[l] == texture.path) {
+                        return (int)l;
+                    }
+                }
+                textureArray.layers.push_back(texture.path);
+                return (int)textureArray.layers.size() - 1;
+            }
+        }
+
+        TextureArray textureArray;
+        textureArray.width = width;
+        textureArray.height = height;
+        textureArray.isSRGB = texture.isSRGB;
+        textureArray.layers.push_back(texture.path);
+        textureArray.id = 0;
+        textureArrays.push_back(textureArray);
+        arrayIndex = (int)textureArrays.size() - 1;
+        return 0;
+    }
+
+    void IndirectRenderer::uploadTextureArrays() {
+        for (size_t a = 0; a < textureArrays.size(); a++) {
+            TextureArray& textureArray = textureArrays[a];
+            GLsizei levels = 1 + (GLsizei)std::floor(std::log2((float)std::max(textureArray.width, textureArray.height)));
+
+            glGenTextures(1, &textureArray.id);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray.id);
+            glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, textureArray.isSRGB ? GL_SRGB8_ALPHA8 : GL_RGBA8,
+                textureArray.width, textureArray.height, (GLsizei)textureArray.layers.size());
+
+            for (size_t l = 0; l < textureArray.layers.size(); l++) {
+                int width, height, channels;
+                unsigned char* data = stbi_load(textureArray.layers[l].c_str(), &width, &height, &channels, 4);
+                if (!data) {
+                    std::cout << "Image not loaded at " << textureArray.layers[l] << std::endl;
+                    continue;
+                }
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)l, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, data);
+                stbi_image_free(data);
+            }
+
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    void IndirectRenderer::build() {
+        //materials: one entry per distinct (diffuse, specular) layer pair
+        std::map<std::pair<std::pair<int, int>, std::pair<int, int> >, GLuint> materialIndex;
+        for (size_t p = 0; p < packets.size(); p++) {
+            std::vector<Texture> textures = packets[p].mesh->getEffectiveTextures();
+            int diffuseArray = -1, diffuseLayer = -1;
+            int specularArray = -1, specularLayer = -1;
+            for (size_t t = 0; t < textures.size(); t++) {
+                if (textures[t].type == "diffuseTexture") {
+                    diffuseLayer = findOrAddLayer(textures[t], diffuseArray);
+                }
+                else if (textures[t].type == "specularTexture") {
+                    specularLayer = findOrAddLayer(textures[t], specularArray);
+                }
+            }
+
+            std::pair<std::pair<int, int>, std::pair<int, int> > key(
+                std::make_pair(diffuseArray, diffuseLayer), std::make_pair(specularArray, specularLayer));
+            std::map<std::pair<std::pair<int, int>, std::pair<int, int> >, GLuint>::iterator found = materialIndex.find(key);
+            if (found == materialIndex.end()) {
+                IndirectMaterial material = { diffuseLayer, specularLayer, 0, 0 };
+                found = materialIndex.insert(std::make_pair(key, (GLuint)materials.size())).first;
+                materials.push_back(material);
+            }
+            packetMaterial.push_back(found->second);
+            packetDiffuseArray.push_back(diffuseArray);
+            packetSpecularArray.push_back(specularArray);
+        }
+        uploadTextureArrays();
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &drawIdBuffer);
+        glGenBuffers(1, &commandBuffer);
+        glGenBuffers(1, &drawDataBuffer);
+        glGenBuffers(1, &matrixBuffer);
+        glGenBuffers(1, &materialBuffer);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, matrixBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, matrices.size() * sizeof(glm::mat4), matrices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, materialBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, materials.size() * sizeof(IndirectMaterial), materials.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        buildCommands();
+    }
+
+    void IndirectRenderer::appendCommands(bool shadowCastersOnly, std::vector<DrawElementsIndirectCommand>& commands,
+        std::vector<IndirectDrawData>& drawData, std::vector<CommandGroup>& groups) {
+        GeometryArena& arena = sharedGeometryArena();
+
+        //sort the packets so each (transparency, index type, texture arrays) combination is contiguous
+        std::vector<size_t> order;
+        for (size_t p = 0; p < packets.size(); p++) {
+            if (!shadowCastersOnly || packets[p].castsShadow) {
+                order.push_back(p);
+            }
+        }
+        std::stable_sort(order.begin(), order.end(), [this, shadowCastersOnly](size_t a, size_t b) {
+            if (packets[a].isTransparent != packets[b].isTransparent) {
+                return packets[b].isTransparent;
+            }
+            GLenum typeA = packets[a].mesh->getIndexType();
+            GLenum typeB = packets[b].mesh->getIndexType();
+            if (typeA != typeB) {
+                return typeA < typeB;
+            }
+            if (packetDiffuseArray[a] != packetDiffuseArray[b]) {
+                return packetDiffuseArray[a] < packetDiffuseArray[b];
+            }
+            //the depth pass only samples the diffuse alpha
+            return !shadowCastersOnly && packetSpecularArray[a] < packetSpecularArray[b];
+        });
+
+        for (size_t o = 0; o < order.size(); o++) {
+            const DrawPacket& packet = packets[order[o]];
+            GLenum indexType = packet.mesh->getIndexType();
+            int diffuseArray = packetDiffuseArray[order[o]];
+            int specularArray = shadowCastersOnly ? -1 : packetSpecularArray[order[o]];
+
+            if (groups.empty() || groups.back().isTransparent != packet.isTransparent || groups.back().indexType != indexType
+                || groups.back().diffuseArray != diffuseArray || groups.back().specularArray != specularArray) {
+                CommandGroup group = { packet.isTransparent, indexType, diffuseArray, specularArray, commands.size(), 0 };
+                groups.push_back(group);
+            }
+
+            size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+            const GeometryAllocation& allocation = arena.getAllocation(packet.mesh->getGeometry());
+            const std::vector<IndexRange>& ranges = packet.mesh->getIndexRanges();
+            const MeshLod& lod = packet.mesh->getLod(packet.mesh->getCurrentLod());
+            for (size_t r = lod.firstRange; r < lod.firstRange + lod.rangeCount; r++) {
+                //the draw index reaches the shader through baseInstance and the instanced draw id stream
+                DrawElementsIndirectCommand command;
+                command.count = (GLuint)ranges[r].count;
+                command.instanceCount = !shadowCastersOnly && packet.mesh->isOccluded() ? 0 : 1;
+                command.firstIndex = (GLuint)((allocation.indexOffset + ranges[r].byteOffset) / indexSize);
+                command.baseVertex = (GLint)allocation.vertexOffset + ranges[r].baseVertex;
+                command.baseInstance = (GLuint)commands.size();
+                commands.push_back(command);
+
+                IndirectDrawData data = { packet.matrixIndex, packetMaterial[order[o]], packet.isTransparent ? 1u : 0u, 0 };
+                drawData.push_back(data);
+                groups.back().commandCount++;
+            }
+        }
+    }
+
+    //the commands hold arena offsets, the selected levels of detail and the occluded packets, so they are rebuilt
+    //whenever the arena replaces its buffers or a mesh changes level or occlusion
+    void IndirectRenderer::buildCommands() {
+        packetLods.resize(packets.size());
+        packetOccluded.resize(packets.size());
+        for (size_t p = 0; p < packets.size(); p++) {
+            packetLods[p] = packets[p].mesh->getCurrentLod();
+            packetOccluded[p] = packets[p].mesh->isOccluded();
+        }
+
+        std::vector<DrawElementsIndirectCommand> commands;
+        std::vector<IndirectDrawData> drawData;
+        mainGroups.clear();
+        shadowGroups.clear();
+        appendCommands(false, commands, drawData, mainGroups);
+        appendCommands(true, commands, drawData, shadowGroups);
+        commandCount = commands.size();
+
+        std::vector<GLuint> drawIds(commands.size());
+        for (size_t i = 0; i < drawIds.size(); i++) {
+            drawIds[i] = (GLuint)i;
+        }
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawDataBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, drawData.size() * sizeof(IndirectDrawData), drawData.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        //arena vertex format plus the per-instance draw id at location 3
+        GeometryArena& arena = sharedGeometryArena();
+        arena.attachToVertexArray(VAO);
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, drawIdBuffer);
+        glBufferData(GL_ARRAY_BUFFER, drawIds.size() * sizeof(GLuint), drawIds.data(), GL_STATIC_DRAW);
+        glEnableVertexAttribArray(3);
+        glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, sizeof(GLuint), (GLvoid*)0);
+        glVertexAttribDivisor(3, 1);
+        glBindVertexArray(0);
+
+        arenaGeneration = arena.getGeneration();
+    }
+
+    void IndirectRenderer::drawGroups(gps::Shader shader, const std::vector<CommandGroup>& groups, DrawFilter filter) {
+        bool lodsChanged = false;
+        for (size_t p = 0; p < packets.size() && !lodsChanged; p++) {
+            lodsChanged = packets[p].mesh->getCurrentLod() != packetLods[p];
+        }
+        if (lodsChanged || sharedGeometryArena().getGeneration() != arenaGeneration) {
+            buildCommands();
+        }
+
+        shader.useShaderProgram();
+        glUniform1i(glGetUniformLocation(shader.shaderProgram, "useDrawData"), true);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, drawDataBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, matrixBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, materialBuffer);
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+
+        for (size_t g = 0; g < groups.size(); g++) {
+            const CommandGroup& group = groups[g];
+            if (!passesFilter(filter, group.isTransparent)) {
+                continue;
+            }
+            glActiveTexture(GL_TEXTURE0 + DIFFUSE_ARRAY_UNIT);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, group.diffuseArray >= 0 ? textureArrays[group.diffuseArray].id : 0);
+            glActiveTexture(GL_TEXTURE0 + SPECULAR_ARRAY_UNIT);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, group.specularArray >= 0 ? textureArrays[group.specularArray].id : 0);
+
+            glMultiDrawElementsIndirect(GL_TRIANGLES, group.indexType,
+                (GLvoid*)(group.firstCommand * sizeof(DrawElementsIndirectCommand)), (GLsizei)group.commandCount, 0);
+        }
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glUniform1i(glGetUniformLocation(shader.shaderProgram, "useDrawData"), false);
+    }
+
+    void IndirectRenderer::Draw(gps::Shader shader, DrawFilter filter) {
+        //occlusion only applies to the main pass, the shadow commands always draw
+        bool occlusionChanged = false;
+        for (size_t p = 0; p < packets.size() && !occlusionChanged; p++) {
+            occlusionChanged = packets[p].mesh->isOccluded() != packetOccluded[p];
+        }
+        if (occlusionChanged) {
+            buildCommands();
+        }
+        drawGroups(shader, mainGroups, filter);
+    }
+
+    void IndirectRenderer::DrawShadowCasters(gps::Shader shader) {
+        drawGroups(shader, shadowGroups, DRAW_ALL);
+    }
+
+    void IndirectRenderer::printStats() {
+        size_t layers = 0;
+        for (size_t a = 0; a < textureArrays.size(); a++) {
+            layers += textureArrays[a].layers.size();
+        }
+        printf("indirect draws: %zu packets, %zu commands, main pass %zu calls, shadow pass %zu calls, "
+            "%zu materials in %zu texture arrays (%zu layers)\n",
+            packets.size(), commandCount, mainGroups.size(), shadowGroups.size(),
+            materials.size(), textureArrays.size(), layers);
+    }
+
+}
@@ -0,0 +1,120 @@
+#ifndef IndirectRenderer_hpp
+#define IndirectRenderer_hpp
+
+#include "Model3D.hpp"
+#include "DrawFilter.hpp"
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //texture units of the material arrays, away from the units Mesh::Draw and the shadow map use.
+    //The array samplers must be set to them at init, a sampler2D and a sampler2DArray may not share a unit
+    const GLint DIFFUSE_ARRAY_UNIT = 5;
+    const GLint SPECULAR_ARRAY_UNIT = 6;
+
+    //one Mesh drawn with a model matrix
+    struct DrawPacket {
+        Mesh* mesh;
+        unsigned int matrixIndex;
+        bool isTransparent;
+        bool castsShadow;
+    };
+
+    //layout fixed by glMultiDrawElementsIndirect
+    struct DrawElementsIndirectCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    //std430 layouts of the buffers read by basic.vert / shadow.vert
+    struct IndirectDrawData {
+        GLuint matrixIndex;
+        GLuint materialIndex;
+        GLuint isTransparent;
+        GLuint pad;
+    };
+
+    struct IndirectMaterial {
+        GLint diffuseLayer;
+        GLint specularLayer;
+        GLint pad0;
+        GLint pad1;
+    };
+
+    //Submits the static scene with glMultiDrawElementsIndirect: per-draw matrices and materials
+    //live in SSBOs, textures in arrays grouped by size, so a pass is a few API calls.
+    class IndirectRenderer
+    {
+    public:
+        void add(Model3D& model, const glm::mat4& modelMatrix, bool isTransparent, bool castsShadow);
+        //loads the texture arrays and uploads the per-draw buffers
+        void build();
+
+        //main pass, the shader must have the view matrix set
+        void Draw(gps::Shader shader, DrawFilter filter = DRAW_ALL);
+        void DrawShadowCasters(gps::Shader shader);
+        void printStats();
+
+    private:
+        struct TextureArray {
+            GLsizei width;
+            GLsizei height;
+            bool isSRGB;
+            std::vector<std::string> layers;
+            GLuint id;
+        };
+
+        //commands sharing transparency, index type and texture arrays, drawn with one call
+        struct CommandGroup {
+            bool isTransparent;
+            GLenum indexType;
+            int diffuseArray;
+            int specularArray;
+            size_t firstCommand;
+            size_t commandCount;
+        };
+
+        std::vector<DrawPacket> packets;
+        std::vector<glm::mat4> matrices;
+
+        std::vector<TextureArray> textureArrays;
+        std::vector<IndirectMaterial> materials;
+        //per packet: material index and the arrays it samples
+        std::vector<GLuint> packetMaterial;
+        std::vector<int> packetDiffuseArray;
+        std::vector<int> packetSpecularArray;
+
+        std::vector<CommandGroup> mainGroups;
+        std::vector<CommandGroup> shadowGroups;
+        size_t commandCount = 0;
+
+        GLuint VAO = 0;
+        GLuint drawIdBuffer = 0;
+        GLuint commandBuffer = 0;
+        GLuint drawDataBuffer = 0;
+        GLuint matrixBuffer = 0;
+        GLuint materialBuffer = 0;
+        //arena generation and levels of detail the commands were built for
+        unsigned int arenaGeneration = 0;
+        std::vector<size_t> packetLods;
+        //occluded packets keep their commands with no instances in the main pass
+        std::vector<bool> packetOccluded;
+
+        //returns the layer and sets the array index, -1 when the texture cannot be read
+        int findOrAddLayer(const Texture& texture, int& arrayIndex);
+        void uploadTextureArrays();
+        void buildCommands();
+        void appendCommands(bool shadowCastersOnly, std::vector<DrawElementsIndirectCommand>& commands,
+            std::vector<IndirectDrawData>& drawData, std::vector<CommandGroup>& groups);
+        void drawGroups(gps::Shader shader, const std::vector<CommandGroup>& groups, DrawFilter filter);
+    };
+
+}
+
+#endif /* IndirectRenderer_hpp */
@@ -0,0 +1,323 @@
+#include "Lightmap.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+
+namespace gps {
+
+    const unsigned int LIGHTMAP_FILE_MAGIC = 0x50414D4C; // "LMAP"
+    const unsigned int LIGHTMAP_FILE_VERSION = 2;
+
+    struct LightmapChart {
+        //0 to 2, the axis the chart is projected along
+        int axis;
+        glm::vec2 min;
+        glm::vec2 max;
+        //texel rectangle in the atlas, padding included
+        glm::ivec2 origin;
+        glm::ivec2 size;
+    };
+
+    //the two coordinates left when projecting along the axis
+    static glm::vec2 projectAlong(const glm::vec3& position, int axis) {
+        if (axis == 0) {
+            return glm::vec2(position.z, position.y);
+        }
+        if (axis == 1) {
+            return glm::vec2(position.x, position.z);
+        }
+        return glm::vec2(position.x, position.y);
+    }
+
+    static GLuint findRoot(std::vector<GLuint>& parents, GLuint vertex) {
+        while (parents[vertex] != vertex) {
+            parents[vertex] = parents[parents[vertex]];
+            vertex = parents[vertex];
+        }
+        return vertex;
+    }
+
+    //shelves from the bottom of the atlas, in the given order (tallest first)
+    static bool packCharts(std::vector<LightmapChart>& charts, const std::vector<size_t>& order, float density) {
+        int x = 0;
+        int y = 0;
+        int shelfHeight = 0;
+        for (size_t i = 0; i < order.size(); i++) {
+            LightmapChart& chart = charts[order[i]];
+            glm::vec2 extent = (chart.max - chart.min) * density;
+            chart.size = glm::ivec2(std::max(1, (int)std::ceil(extent.x)) + 2 * LIGHTMAP_PADDING,
+                std::max(1, (int)std::ceil(extent.y)) + 2 * LIGHTMAP_PADDING);
+            if (chart.size.x > LIGHTMAP_SIZE) {
+                return false;
+            }
+            if (x + chart.size.x > LIGHTMAP_SIZE) {
+                x = 0;
+                y += shelfHeight;
+                shelfHeight = 0;
+            }
+            if (y + chart.size.y > LIGHTMAP_SIZE) {
+                return false;
+            }
+            chart.origin = glm::ivec2(x, y);
+            x += chart.size.x;
+            shelfHeight = std::max(shelfHeight, chart.size.y);
+        }
+        return true;
+    }
+
+    static unsigned int hashValue(unsigned int hash, unsigned int value) {
+        //FNV-1a over the bytes of the value
+        for (int i = 0; i < 4; i++) {
+            hash = (hash ^ ((value >> (8 * i)) & 0xFF)) * 16777619u;
+        }
+        return hash;
+    }
+
+    static unsigned int hashFloats(unsigned int hash, const float* values, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            unsigned int bits;
+            memcpy(&bits, &values[i], sizeof(bits));
+            hash = hashValue(hash, bits);
+        }
+        return hash;
+    }
+
+    bool Lightmap::generateCoords(const std::vector<LightmapTarget>& targets) {
+        const GLuint unused = 0xFFFFFFFFu;
+        std::vector<LightmapChart> charts;
+        std::vector<std::vector<Vertex> > targetVertices(targets.size());
+        std::vector<std::vector<GLuint> > targetIndices(targets.size());
+        //per split vertex: its chart and its position projected along the chart's axis
+        std::vector<std::vector<size_t> > vertexCharts(targets.size());
+        std::vector<std::vector<glm::vec2> > vertexProjections(targets.size());
+        size_t sourceVertices = 0;
+
+        for (size_t t = 0; t < targets.size(); t++) {
+            Mesh& mesh = *targets[t].mesh;
+            std::vector<glm::vec3> world(mesh.vertices.size());
+            for (size_t v = 0; v < mesh.vertices.size(); v++) {
+                world[v] = glm::vec3(targets[t].modelMatrix * glm::vec4(mesh.vertices[v].Position, 1.0f));
+            }
+            sourceVertices += mesh.vertices.size();
+
+            //one copy of a vertex per side of an axis its triangles face, the levels of detail alike
+            std::vector<GLuint> copies(mesh.vertices.size() * 6, unused);
+            std::vector<int> copyAxes;
+            std::vector<Vertex>& vertices = targetVertices[t];
+            std::vector<GLuint>& indices = targetIndices[t];
+            std::vector<glm::vec2>& projections = vertexProjections[t];
+            for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+                glm::vec3 normal = glm::cross(world[mesh.indices[i + 1]] - world[mesh.indices[i]], world[mesh.indices[i + 2]] - world[mesh.indices[i]]);
+                glm::vec3 magnitude = glm::abs(normal);
+                int axis = (magnitude.x >= magnitude.y && magnitude.x >= magnitude.z) ? 0 : (magnitude.y >= magnitude.z ? 1 : 2);
+                int side = axis * 2 + (normal[axis] < 0.0f ? 1 : 0);
+                for (int corner = 0; corner < 3; corner++) {
+                    GLuint source = mesh.indices[i + corner];
+                    GLuint& copy = copies[source * 6 + side];
+                    if (copy == unused) {
+                        copy = (GLuint)vertices.size();
+                        vertices.push_back(mesh.vertices[source]);
+                        copyAxes.push_back(axis);
+                        projections.push_back(projectAlong(world[source], axis));
+                    }
+                    indices.push_back(copy);
+                }
+            }
+
+            //a chart per group of copies joined by triangles
+            std::vector<GLuint> parents(vertices.size());
+            std::iota(parents.begin(), parents.end(), 0);
+            for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+                GLuint root = findRoot(parents, indices[i]);
+                parents[findRoot(parents, indices[i + 1])] = root;
+                parents[findRoot(parents, indices[i + 2])] = root;
+            }
+            const size_t noChart = (size_t)-1;
+            std::vector<size_t> rootCharts(vertices.size(), noChart);
+            vertexCharts[t].resize(vertices.size());
+            for (size_t v = 0; v < vertices.size(); v++) {
+                GLuint root = findRoot(parents, (GLuint)v);
+                if (rootCharts[root] == noChart) {
+                    LightmapChart chart;
+                    chart.axis = copyAxes[v];
+                    chart.min = glm::vec2(FLT_MAX);
+                    chart.max = glm::vec2(-FLT_MAX);
+                    rootCharts[root] = charts.size();
+                    charts.push_back(chart);
+                }
+                LightmapChart& chart = charts[rootCharts[root]];
+                chart.min = glm::min(chart.min, projections[v]);
+                chart.max = glm::max(chart.max, projections[v]);
+                vertexCharts[t][v] = rootCharts[root];
+            }
+        }
+        if (charts.empty()) {
+            return false;
+        }
+
+        //the densest layout that fits, the shelves and the padding waste about half of the atlas
+        float chartArea = 0.0f;
+        std::vector<size_t> order(charts.size());
+        for (size_t c = 0; c < charts.size(); c++) {
+            glm::vec2 extent = charts[c].max - charts[c].min;
+            chartArea += extent.x * extent.y;
+            order[c] = c;
+        }
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return charts[a].max.y - charts[a].min.y > charts[b].max.y - charts[b].min.y;
+        });
+        float density = std::min(LIGHTMAP_MAX_TEXELS_PER_UNIT,
+            std::sqrt(0.5f * LIGHTMAP_SIZE * LIGHTMAP_SIZE / std::max(chartArea, 1e-6f)));
+        bool packed = false;
+        for (int attempt = 0; attempt < 64 && !packed; attempt++) {
+            packed = packCharts(charts, order, density);
+            if (!packed) {
+                density *= 0.9f;
+            }
+        }
+        if (!packed) {
+            printf("lightmap: %zu charts do not fit a %dx%d atlas\n", charts.size(), LIGHTMAP_SIZE, LIGHTMAP_SIZE);
+            return false;
+        }
+        texelsPerUnit = density;
+
+        size_t splitVertices = 0;
+        signature = hashValue(2166136261u, (unsigned int)charts.size());
+        for (size_t t = 0; t < targets.size(); t++) {
+            std::vector<Vertex>& vertices = targetVertices[t];
+            for (size_t v = 0; v < vertices.size(); v++) {
+                const LightmapChart& chart = charts[vertexCharts[t][v]];
+                glm::vec2 texel = glm::vec2(chart.origin + LIGHTMAP_PADDING) + (vertexProjections[t][v] - chart.min) * density;
+                vertices[v].LightmapCoords = texel / (float)LIGHTMAP_SIZE;
+            }
+            //a moved or edited mesh keeps its counts, its placement and positions change the signature
+            signature = hashValue(signature, (unsigned int)vertices.size());
+            signature = hashValue(signature, (unsigned int)targetIndices[t].size());
+            signature = hashFloats(signature, &targets[t].modelMatrix[0][0], 16);
+            for (size_t v = 0; v < vertices.size(); v++) {
+                signature = hashFloats(signature, &vertices[v].Position[0], 3);
+            }
+            splitVertices += vertices.size();
+            targets[t].mesh->setGeometry(vertices, targetIndices[t]);
+        }
+        signature = hashValue(signature, (unsigned int)(density * 1000.0f));
+
+        printf("lightmap: %zu charts from %zu meshes at %.1f texels per unit, %zu vertices after splitting (%zu before)\n",
+            charts.size(), targets.size(), density, splitVertices, sourceVertices);
+        return true;
+    }
+
+    glm::vec3 Lightmap::getSunDirection(int layer) {
+        //the path of dayNightCycle: from the horizon towards +z over the top to the horizon towards -z
+        float z = 1.0f - 2.0f * layer / (LIGHTMAP_SUN_LAYERS - 1);
+        return glm::normalize(glm::vec3(0.0f, 1.0f - std::abs(z), z));
+    }
+
+    glm::vec4* Lightmap::getLayer(int layer) {
+        if (texels.empty()) {
+            texels.assign((size_t)LIGHTMAP_SIZE * LIGHTMAP_SIZE * LIGHTMAP_LAYERS, glm::vec4(0.0f));
+        }
+        return &texels[(size_t)layer * LIGHTMAP_SIZE * LIGHTMAP_SIZE];
+    }
+
+    float Lightmap::getTexelsPerUnit() {
+        return texelsPerUnit;
+    }
+
+    bool Lightmap::load(const std::string& fileName) {
+        std::ifstream file(fileName.c_str(), std::ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+
+        unsigned int header[5];
+        file.read((char*)header, sizeof(header));
+        if (!file || header[0] != LIGHTMAP_FILE_MAGIC || header[1] != LIGHTMAP_FILE_VERSION
+            || header[2] != (unsigned int)LIGHTMAP_SIZE || header[3] != (unsigned int)LIGHTMAP_LAYERS) {
+            return false;
+        }
+        if (header[4] != signature) {
+            printf("lightmap: %s was baked for another chart layout, bake it again with --bake-lightmaps\n", fileName.c_str());
+            return false;
+        }
+
+        texels.resize((size_t)LIGHTMAP_SIZE * LIGHTMAP_SIZE * LIGHTMAP_LAYERS);
+        file.read((char*)texels.data(), texels.size() * sizeof(glm::vec4));
+        if (!file) {
+            texels.clear();
+            return false;
+        }
+        upload();
+        return true;
+    }
+
+    bool Lightmap::save(const std::string& fileName) {
+        std::ofstream file(fileName.c_str(), std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            printf("lightmap: could not write %s\n", fileName.c_str());
+            return false;
+        }
+
+        unsigned int header[5] = { LIGHTMAP_FILE_MAGIC, LIGHTMAP_FILE_VERSION, (unsigned int)LIGHTMAP_SIZE, (unsigned int)LIGHTMAP_LAYERS, signature };
+        file.write((const char*)header, sizeof(header));
+        getLayer(0);
+        file.write((const char*)texels.data(), texels.size() * sizeof(glm::vec4));
+        return (bool)file;
+    }
+
+    bool Lightmap::isLoaded() {
+        return texture != 0;
+    }
+
+    void Lightmap::upload() {
+        if (texture == 0) {
+            glGenTextures(1, &texture);
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA16F, LIGHTMAP_SIZE, LIGHTMAP_SIZE, LIGHTMAP_LAYERS, 0, GL_RGBA, GL_FLOAT, texels.data());
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    void Lightmap::bind(gps::Shader shader, const glm::vec3& lightDir) {
+        shader.useShaderProgram();
+        glActiveTexture(GL_TEXTURE0 + LIGHTMAP_UNIT);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glActiveTexture(GL_TEXTURE0);
+
+        //the two layers whose sun is nearest the light, blended by angle
+        glm::vec3 direction = glm::normalize(lightDir);
+        float angles[LIGHTMAP_SUN_LAYERS];
+        int first = 0;
+        for (int layer = 0; layer < LIGHTMAP_SUN_LAYERS; layer++) {
+            angles[layer] = std::acos(glm::clamp(glm::dot(direction, getSunDirection(layer)), -1.0f, 1.0f));
+        }
+        for (int layer = 0; layer < LIGHTMAP_SUN_LAYERS; layer++) {
+            if (angles[layer] < angles[first]) {
+                first = layer;
+            }
+        }
+        int second = first == 0 ? 1 : 0;
+        for (int layer = 0; layer < LIGHTMAP_SUN_LAYERS; layer++) {
+            if (layer != first && angles[layer] < angles[second]) {
+                second = layer;
+            }
+        }
+        float total = angles[first] + angles[second];
+        float blend = total > 0.0f ? angles[first] / total : 0.0f;
+
+        glUniform1i(glGetUniformLocation(shader.shaderProgram, "lightmap"), LIGHTMAP_UNIT);
+        glUniform2i(glGetUniformLocation(shader.shaderProgram, "lightmapSunLayers"), first, second);
+        glUniform1f(glGetUniformLocation(shader.shaderProgram, "lightmapSunBlend"), blend);
+        glUniform1i(glGetUniformLocation(shader.shaderProgram, "lightmapLampLayer"), LIGHTMAP_LAMP_LAYER);
+    }
+
+}
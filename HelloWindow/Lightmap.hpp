@@ -0,0 +1,71 @@
+#ifndef Lightmap_hpp
+#define Lightmap_hpp
+
+#include <GL/glew.h>
+
+#include "Mesh.hpp"
+#include "Shader.hpp"
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //texels per side of the atlas
+    const int LIGHTMAP_SIZE = 512;
+    //texels around every chart, filled by dilation so filtering never reads an empty texel
+    const int LIGHTMAP_PADDING = 2;
+    //texel density the charts never go above, however much room the atlas has
+    const float LIGHTMAP_MAX_TEXELS_PER_UNIT = 64.0f;
+    //texture unit of the atlas, after the G-buffer ones
+    const GLint LIGHTMAP_UNIT = 11;
+    //sun directions baked along the day/night cycle, then one layer for the cottage lamp
+    const int LIGHTMAP_SUN_LAYERS = 5;
+    const int LIGHTMAP_LAMP_LAYER = LIGHTMAP_SUN_LAYERS;
+    const int LIGHTMAP_LAYERS = LIGHTMAP_SUN_LAYERS + 1;
+
+    //a static mesh with a lightmap, placed in the world by the matrix
+    struct LightmapTarget {
+        Mesh* mesh;
+        glm::mat4 modelMatrix;
+    };
+
+    //Lightmap atlas of the static meshes. Their triangles are grouped into planar charts, one per connected
+    //part facing the same axis, which are projected along that axis and packed into the atlas. A sun layer
+    //holds the sky and bounced light in rgb and the direct sun with the static shadows in alpha, the lamp
+    //layer holds all of the lamp's light. The layers are baked offline by LightmapBaker.
+    class Lightmap
+    {
+    public:
+        //gives the vertices of the targets their lightmap coordinates, splitting the ones shared by two charts,
+        //and uploads the meshes again. False when the charts do not fit the atlas
+        bool generateCoords(const std::vector<LightmapTarget>& targets);
+
+        //direction towards the sun of a sun layer
+        glm::vec3 getSunDirection(int layer);
+        //LIGHTMAP_SIZE rows of LIGHTMAP_SIZE texels
+        glm::vec4* getLayer(int layer);
+        float getTexelsPerUnit();
+
+        //a file only loads for the chart layout it was baked with
+        bool load(const std::string& fileName);
+        bool save(const std::string& fileName);
+        bool isLoaded();
+
+        //binds the atlas and picks the two sun layers around the light direction
+        void bind(gps::Shader shader, const glm::vec3& lightDir);
+
+    private:
+        std::vector<glm::vec4> texels;
+        //hash of the chart layout
+        unsigned int signature = 0;
+        float texelsPerUnit = 0.0f;
+        GLuint texture = 0;
+
+        void upload();
+    };
+
+}
+
+#endif /* Lightmap_hpp */
@@ -0,0 +1,276 @@
+#include "LightmapBaker.hpp"
+
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+namespace gps {
+
+    typedef std::chrono::high_resolution_clock Clock;
+
+    //falloff of the clustered lights in basic.frag, faded to zero at the range
+    static float lampAttenuation(const Light& lamp, float distance) {
+        float attenuation = 1.0f / (1.0f + lamp.linear * distance + lamp.quadratic * distance * distance);
+        float fade = glm::clamp(1.0f - std::pow(distance / lamp.range, 4.0f), 0.0f, 1.0f);
+        return attenuation * fade * fade;
+    }
+
+    static glm::vec3 cosineDirection(const glm::vec3& normal, std::mt19937& generator) {
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        float angle = 2.0f * 3.14159265f * unit(generator);
+        float radius2 = unit(generator);
+        float radius = std::sqrt(radius2);
+        glm::vec3 axis = std::abs(normal.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+        glm::vec3 tangent = glm::normalize(glm::cross(axis, normal));
+        glm::vec3 bitangent = glm::cross(normal, tangent);
+        return glm::normalize(tangent * (radius * std::cos(angle)) + bitangent * (radius * std::sin(angle)) + normal * std::sqrt(1.0f - radius2));
+    }
+
+    void LightmapBaker::addTriangles(const LightmapTarget& source) {
+        Mesh& mesh = *source.mesh;
+        const MeshLod& lod = mesh.getLod(0);
+        for (size_t i = lod.indexOffset; i + 2 < lod.indexOffset + lod.indexCount; i += 3) {
+            Triangle triangle;
+            triangle.a = glm::vec3(source.modelMatrix * glm::vec4(mesh.vertices[mesh.indices[i]].Position, 1.0f));
+            triangle.b = glm::vec3(source.modelMatrix * glm::vec4(mesh.vertices[mesh.indices[i + 1]].Position, 1.0f));
+            triangle.c = glm::vec3(source.modelMatrix * glm::vec4(mesh.vertices[mesh.indices[i + 2]].Position, 1.0f));
+            glm::vec3 normal = glm::cross(triangle.b - triangle.a, triangle.c - triangle.a);
+            if (glm::dot(normal, normal) <= 0.0f) {
+                continue;
+            }
+            triangle.normal = glm::normalize(normal);
+
+            AABB bounds;
+            bounds.expand(triangle.a);
+            bounds.expand(triangle.b);
+            bounds.expand(triangle.c);
+            bvh.insert(bounds, triangles.size());
+            triangles.push_back(triangle);
+        }
+    }
+
+    //the texel centers inside each full detail triangle, in the atlas
+    void LightmapBaker::rasterizeTexels(const std::vector<LightmapTarget>& targets) {
+        samples.clear();
+        texelSamples.assign((size_t)LIGHTMAP_SIZE * LIGHTMAP_SIZE, -1);
+        for (size_t t = 0; t < targets.size(); t++) {
+            Mesh& mesh = *targets[t].mesh;
+            glm::mat4 modelMatrix = targets[t].modelMatrix;
+            //basic.frag lights the negated normals
+            glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat3(modelMatrix));
+            const MeshLod& lod = mesh.getLod(0);
+            for (size_t i = lod.indexOffset; i + 2 < lod.indexOffset + lod.indexCount; i += 3) {
+                const Vertex* corners[3] = { &mesh.vertices[mesh.indices[i]], &mesh.vertices[mesh.indices[i + 1]], &mesh.vertices[mesh.indices[i + 2]] };
+                glm::vec2 uv[3];
+                for (int c = 0; c < 3; c++) {
+                    uv[c] = corners[c]->LightmapCoords * (float)LIGHTMAP_SIZE;
+                }
+                float area = (uv[1].x - uv[0].x) * (uv[2].y - uv[0].y) - (uv[2].x - uv[0].x) * (uv[1].y - uv[0].y);
+                if (area == 0.0f) {
+                    continue;
+                }
+                int minX = std::max(0, (int)std::floor(std::min(uv[0].x, std::min(uv[1].x, uv[2].x))));
+                int minY = std::max(0, (int)std::floor(std::min(uv[0].y, std::min(uv[1].y, uv[2].y))));
+                int maxX = std::min(LIGHTMAP_SIZE - 1, (int)std::ceil(std::max(uv[0].x, std::max(uv[1].x, uv[2].x))));
+                int maxY = std::min(LIGHTMAP_SIZE - 1, (int)std::ceil(std::max(uv[0].y, std::max(uv[1].y, uv[2].y))));
+                for (int y = minY; y <= maxY; y++) {
+                    for (int x = minX; x <= maxX; x++) {
+                        glm::vec2 p = glm::vec2(x + 0.5f, y + 0.5f);
+                        //barycentric coordinates of the texel center
+                        float w0 = ((uv[1].x - p.x) * (uv[2].y - p.y) - (uv[2].x - p.x) * (uv[1].y - p.y)) / area;
+                        float w1 = ((uv[2].x - p.x) * (uv[0].y - p.y) - (uv[0].x - p.x) * (uv[2].y - p.y)) / area;
+                        float w2 = 1.0f - w0 - w1;
+                        if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) {
+                            continue;
+                        }
+                        TexelSample sample;
+                        glm::vec3 position = corners[0]->Position * w0 + corners[1]->Position * w1 + corners[2]->Position * w2;
+                        glm::vec3 normal = corners[0]->Normal * w0 + corners[1]->Normal * w1 + corners[2]->Normal * w2;
+                        sample.position = glm::vec3(modelMatrix * glm::vec4(position, 1.0f));
+                        sample.normal = glm::normalize(normalMatrix * -normal);
+                        texelSamples[(size_t)y * LIGHTMAP_SIZE + x] = (int)samples.size();
+                        samples.push_back(sample);
+                    }
+                }
+            }
+        }
+    }
+
+    bool LightmapBaker::trace(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float& distance, size_t& triangle, size_t& rays) {
+        rays++;
+        return bvh.raycast(origin, direction, maxDistance,
+            [&](size_t item, float& hitDistance) {
+                const Triangle& candidate = triangles[item];
+                return collision.checkIfRayHitsTriangle(origin, direction, candidate.a, candidate.b, candidate.c, hitDistance)
+                    && hitDistance <= maxDistance;
+            }, triangle, distance);
+    }
+
+    glm::vec3 LightmapBaker::directLight(const BakeLight& light, const glm::vec3& position, const glm::vec3& normal, size_t& rays) {
+        float distance;
+        size_t triangle;
+        glm::vec3 origin = position + normal * LIGHTMAP_BAKE_OFFSET;
+        if (light.isSun) {
+            float cosine = glm::dot(normal, light.direction);
+            if (cosine <= 0.0f || trace(origin, light.direction, LIGHTMAP_BAKE_DISTANCE, distance, triangle, rays)) {
+                return glm::vec3(0.0f);
+            }
+            return glm::vec3(cosine);
+        }
+
+        glm::vec3 toLight = light.lamp.position - position;
+        float lightDistance = glm::length(toLight);
+        if (lightDistance >= light.lamp.range || lightDistance <= 0.0f) {
+            return glm::vec3(0.0f);
+        }
+        glm::vec3 direction = toLight / lightDistance;
+        float cosine = glm::dot(normal, direction);
+        if (cosine <= 0.0f || trace(origin, direction, lightDistance, distance, triangle, rays)) {
+            return glm::vec3(0.0f);
+        }
+        return light.lamp.color * (lampAttenuation(light.lamp, lightDistance) * cosine);
+    }
+
+    glm::vec3 LightmapBaker::incomingLight(const BakeLight& light, const glm::vec3& origin, const glm::vec3& direction, int depth, std::mt19937& generator, size_t& rays) {
+        float distance;
+        size_t hit;
+        glm::vec3 sky = light.isSun ? glm::vec3(LIGHTMAP_BAKE_SKY) : glm::vec3(0.0f);
+        if (!trace(origin, direction, LIGHTMAP_BAKE_DISTANCE, distance, hit, rays)) {
+            return sky;
+        }
+
+        //both sides of a triangle reflect
+        glm::vec3 position = origin + direction * distance;
+        glm::vec3 normal = triangles[hit].normal;
+        if (glm::dot(normal, direction) > 0.0f) {
+            normal = -normal;
+        }
+        glm::vec3 radiance = directLight(light, position, normal, rays);
+        if (depth < LIGHTMAP_BAKE_BOUNCES) {
+            radiance += incomingLight(light, position + normal * LIGHTMAP_BAKE_OFFSET, cosineDirection(normal, generator), depth + 1, generator, rays);
+        }
+        else {
+            //the bounces left out, taken as open sky
+            radiance += sky;
+        }
+        return LIGHTMAP_BAKE_ALBEDO * radiance;
+    }
+
+    glm::vec4 LightmapBaker::bakeTexel(const BakeLight& light, const TexelSample& sample, std::mt19937& generator, size_t& rays) {
+        glm::vec3 direct = directLight(light, sample.position, sample.normal, rays);
+        glm::vec3 indirect = glm::vec3(0.0f);
+        glm::vec3 origin = sample.position + sample.normal * LIGHTMAP_BAKE_OFFSET;
+        for (int s = 0; s < LIGHTMAP_BAKE_SAMPLES; s++) {
+            indirect += incomingLight(light, origin, cosineDirection(sample.normal, generator), 1, generator, rays);
+        }
+        indirect /= (float)LIGHTMAP_BAKE_SAMPLES;
+
+        if (light.isSun) {
+            //the sun is white, its direct part stays apart for the dynamic shadows and the specular
+            return glm::vec4(indirect, direct.x);
+        }
+        //the ambient term basic.frag gives every clustered light, unshadowed
+        float lightDistance = glm::length(light.lamp.position - sample.position);
+        glm::vec3 ambient = lightDistance < light.lamp.range ?
+            LIGHTMAP_BAKE_SKY * light.lamp.color * lampAttenuation(light.lamp, lightDistance) : glm::vec3(0.0f);
+        return glm::vec4(direct + ambient + indirect, 0.0f);
+    }
+
+    void LightmapBaker::dilate(glm::vec4* texels) {
+        std::vector<bool> filled(texelSamples.size());
+        for (size_t i = 0; i < texelSamples.size(); i++) {
+            filled[i] = texelSamples[i] >= 0;
+        }
+        for (int pass = 0; pass < LIGHTMAP_PADDING; pass++) {
+            std::vector<bool> next = filled;
+            for (int y = 0; y < LIGHTMAP_SIZE; y++) {
+                for (int x = 0; x < LIGHTMAP_SIZE; x++) {
+                    size_t texel = (size_t)y * LIGHTMAP_SIZE + x;
+                    if (filled[texel]) {
+                        continue;
+                    }
+                    glm::vec4 sum = glm::vec4(0.0f);
+                    int count = 0;
+                    for (int dy = -1; dy <= 1; dy++) {
+                        for (int dx = -1; dx <= 1; dx++) {
+                            int nx = x + dx;
+                            int ny = y + dy;
+                            if (nx < 0 || ny < 0 || nx >= LIGHTMAP_SIZE || ny >= LIGHTMAP_SIZE || !filled[(size_t)ny * LIGHTMAP_SIZE + nx]) {
+                                continue;
+                            }
+                            sum += texels[(size_t)ny * LIGHTMAP_SIZE + nx];
+                            count++;
+                        }
+                    }
+                    if (count > 0) {
+                        texels[texel] = sum / (float)count;
+                        next[texel] = true;
+                    }
+                }
+            }
+            filled = next;
+        }
+    }
+
+    void LightmapBaker::bake(ThreadPool* pool, Lightmap& lightmap, const std::vector<LightmapTarget>& targets, const std::vector<LightmapTarget>& occluders, const Light& lamp) {
+        Clock::time_point start = Clock::now();
+        triangles.clear();
+        bvh.clear();
+        for (size_t i = 0; i < targets.size(); i++) {
+            addTriangles(targets[i]);
+        }
+        for (size_t i = 0; i < occluders.size(); i++) {
+            addTriangles(occluders[i]);
+        }
+        bvh.build();
+        rasterizeTexels(targets);
+        printf("lightmap bake: %zu triangles (BVH height %d), %zu of %d texels covered, set up in %.2f s\n",
+            triangles.size(), bvh.getHeight(), samples.size(), LIGHTMAP_SIZE * LIGHTMAP_SIZE,
+            std::chrono::duration<double>(Clock::now() - start).count());
+
+        size_t totalRays = 0;
+        double totalSeconds = 0.0;
+        for (int layer = 0; layer < LIGHTMAP_LAYERS; layer++) {
+            BakeLight light;
+            light.isSun = layer < LIGHTMAP_SUN_LAYERS;
+            light.direction = light.isSun ? lightmap.getSunDirection(layer) : glm::vec3(0.0f);
+            light.lamp = lamp;
+
+            glm::vec4* texels = lightmap.getLayer(layer);
+            std::vector<size_t> rowRays(LIGHTMAP_SIZE, 0);
+            Clock::time_point layerStart = Clock::now();
+            //one row per job, each with its own random sequence so a bake always gives the same atlas
+            pool->parallelFor(LIGHTMAP_SIZE, [&](size_t row) {
+                std::mt19937 generator((unsigned int)(layer * LIGHTMAP_SIZE + row));
+                for (int x = 0; x < LIGHTMAP_SIZE; x++) {
+                    size_t texel = row * LIGHTMAP_SIZE + x;
+                    if (texelSamples[texel] >= 0) {
+                        texels[texel] = bakeTexel(light, samples[texelSamples[texel]], generator, rowRays[row]);
+                    }
+                }
+            });
+            double seconds = std::chrono::duration<double>(Clock::now() - layerStart).count();
+            dilate(texels);
+
+            size_t rays = 0;
+            for (size_t row = 0; row < rowRays.size(); row++) {
+                rays += rowRays[row];
+            }
+            totalRays += rays;
+            totalSeconds += seconds;
+            if (light.isSun) {
+                printf("lightmap bake: sun (%.2f, %.2f, %.2f) in %.2f s, %.1f M rays, %.2f M rays/s\n",
+                    light.direction.x, light.direction.y, light.direction.z, seconds, rays / 1e6, rays / (seconds * 1e6));
+            }
+            else {
+                printf("lightmap bake: cottage lamp in %.2f s, %.1f M rays, %.2f M rays/s\n", seconds, rays / 1e6, rays / (seconds * 1e6));
+            }
+        }
+        printf("lightmap bake: %d layers in %.2f s, %.1f M rays, %.2f M rays/s on %zu threads\n",
+            LIGHTMAP_LAYERS, totalSeconds, totalRays / 1e6, totalRays / (totalSeconds * 1e6), pool->getThreadCount());
+    }
+
+}
@@ -0,0 +1,81 @@
+#ifndef LightmapBaker_hpp
+#define LightmapBaker_hpp
+
+#include "Lightmap.hpp"
+#include "ClusteredLights.hpp"
+#include "Bvh.hpp"
+#include "Collision.hpp"
+#include "ThreadPool.hpp"
+
+#include <glm/glm.hpp>
+#include <random>
+#include <vector>
+
+namespace gps {
+
+    //cosine distributed hemisphere rays per texel
+    const int LIGHTMAP_BAKE_SAMPLES = 64;
+    //bounces followed after the first hit of a hemisphere ray
+    const int LIGHTMAP_BAKE_BOUNCES = 2;
+    //the baker does not read the textures back, every surface reflects this much
+    const float LIGHTMAP_BAKE_ALBEDO = 0.5f;
+    //light of an open sky, the ambientStrength of basic.frag
+    const float LIGHTMAP_BAKE_SKY = 0.2f;
+    //rays leave a surface this far above it
+    const float LIGHTMAP_BAKE_OFFSET = 1e-3f;
+    //reach of the rays towards the sun and of the hemisphere rays
+    const float LIGHTMAP_BAKE_DISTANCE = 100.0f;
+
+    //Offline path tracer of the lightmap. Every covered texel gathers the sun of each sun layer, then the lamp,
+    //directly and over the bounces of its hemisphere rays, traced against a BVH of the scene triangles.
+    //The rows of the atlas are split over the threads of the pool.
+    class LightmapBaker
+    {
+    public:
+        //the targets must have their lightmap coordinates. They receive the light, they and the occluders
+        //cast shadows and bounce it. The pool is the application's shared one
+        void bake(ThreadPool* pool, Lightmap& lightmap, const std::vector<LightmapTarget>& targets, const std::vector<LightmapTarget>& occluders, const Light& lamp);
+
+    private:
+        struct Triangle {
+            glm::vec3 a;
+            glm::vec3 b;
+            glm::vec3 c;
+            glm::vec3 normal;
+        };
+
+        //surface point under the center of a texel
+        struct TexelSample {
+            glm::vec3 position;
+            glm::vec3 normal;
+        };
+
+        //the light of the layer being baked, the sun when isSun is set
+        struct BakeLight {
+            bool isSun;
+            glm::vec3 direction;
+            Light lamp;
+        };
+
+        std::vector<Triangle> triangles;
+        Bvh bvh;
+        Collision collision;
+        std::vector<TexelSample> samples;
+        //sample of every texel of the atlas, -1 when no triangle covers it
+        std::vector<int> texelSamples;
+
+        void addTriangles(const LightmapTarget& source);
+        void rasterizeTexels(const std::vector<LightmapTarget>& targets);
+
+        bool trace(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float& distance, size_t& triangle, size_t& rays);
+        glm::vec3 directLight(const BakeLight& light, const glm::vec3& position, const glm::vec3& normal, size_t& rays);
+        //light arriving at the origin along the direction, after depth bounces so far
+        glm::vec3 incomingLight(const BakeLight& light, const glm::vec3& origin, const glm::vec3& direction, int depth, std::mt19937& generator, size_t& rays);
+        glm::vec4 bakeTexel(const BakeLight& light, const TexelSample& sample, std::mt19937& generator, size_t& rays);
+        //spreads the covered texels into the padding around the charts
+        void dilate(glm::vec4* texels);
+    };
+
+}
+
+#endif /* LightmapBaker_hpp */
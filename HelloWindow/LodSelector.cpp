@@ -0,0 +1,71 @@
+#include "LodSelector.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    LodSelector::LodSelector(float pixelError) {
+        this->pixelError = pixelError;
+    }
+
+    void LodSelector::update(const glm::vec3& cameraPosition, float fieldOfViewY, float viewportHeight) {
+        this->cameraPosition = cameraPosition;
+        this->pixelsPerUnit = viewportHeight / (2.0f * std::tan(fieldOfViewY * 0.5f));
+        selectedTriangles = 0;
+        fullDetailTriangles = 0;
+    }
+
+    void LodSelector::setEnabled(bool enabled) {
+        this->enabled = enabled;
+    }
+
+    void LodSelector::selectLods(Model3D& model, const glm::mat4& modelMatrix) {
+        const std::vector<Mesh*>& meshes = model.GetMeshes();
+        for (size_t i = 0; i < meshes.size(); i++) {
+            selectLod(*meshes[i], modelMatrix);
+        }
+    }
+
+    size_t LodSelector::selectLod(Mesh& mesh, const glm::mat4& modelMatrix) {
+        size_t current = mesh.getCurrentLod();
+        size_t lod = 0;
+
+        if (enabled && mesh.getLodCount() > 1) {
+            //closest point of the world space bounds, zero when the camera is inside
+            AABB bounds = mesh.getBounds().transformed(modelMatrix);
+            glm::vec3 closest = glm::clamp(cameraPosition, bounds.min, bounds.max);
+            float distance = glm::length(cameraPosition - closest);
+
+            //the errors are in model space, scale them by the largest axis scale of the matrix
+            float scale = std::max(glm::length(glm::vec3(modelMatrix[0])),
+                std::max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
+
+            if (distance > 0.0f) {
+                for (size_t l = mesh.getLodCount() - 1; l > 0; l--) {
+                    float projected = mesh.getLod(l).error * scale * pixelsPerUnit / distance;
+                    //coarsening needs the error to be clearly under the threshold, refining happens right at it
+                    float threshold = l > current ? pixelError * LOD_HYSTERESIS : pixelError;
+                    if (projected <= threshold) {
+                        lod = l;
+                        break;
+                    }
+                }
+            }
+        }
+
+        mesh.setCurrentLod(lod);
+        selectedTriangles += mesh.getLod(lod).indexCount / 3;
+        fullDetailTriangles += mesh.getLod(0).indexCount / 3;
+        return lod;
+    }
+
+    size_t LodSelector::getSelectedTriangles() {
+        return selectedTriangles;
+    }
+
+    size_t LodSelector::getFullDetailTriangles() {
+        return fullDetailTriangles;
+    }
+
+}
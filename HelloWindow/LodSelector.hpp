@@ -0,0 +1,47 @@
+#ifndef LodSelector_hpp
+#define LodSelector_hpp
+
+#include "Model3D.hpp"
+
+#include <glm/glm.hpp>
+
+namespace gps {
+
+    //how far, in pixels, a level may deviate from the full detail surface
+    const float DEFAULT_LOD_PIXEL_ERROR = 1.5f;
+    //a mesh only switches to a coarser level once its error is this fraction of the threshold,
+    //so it does not flicker between two levels at the boundary distance
+    const float LOD_HYSTERESIS = 0.75f;
+
+    //picks per mesh the coarsest level whose error projects under the pixel threshold
+    class LodSelector
+    {
+    public:
+        LodSelector(float pixelError = DEFAULT_LOD_PIXEL_ERROR);
+
+        //call once per frame before selecting
+        void update(const glm::vec3& cameraPosition, float fieldOfViewY, float viewportHeight);
+        //when disabled every mesh is set to full detail
+        void setEnabled(bool enabled);
+
+        void selectLods(Model3D& model, const glm::mat4& modelMatrix);
+        size_t selectLod(Mesh& mesh, const glm::mat4& modelMatrix);
+
+        //triangles of the selected levels against the full detail ones, since the last update
+        size_t getSelectedTriangles();
+        size_t getFullDetailTriangles();
+
+    private:
+        float pixelError;
+        bool enabled = true;
+        glm::vec3 cameraPosition = glm::vec3(0.0f);
+        //pixels covered by one unit at distance one
+        float pixelsPerUnit = 1.0f;
+
+        size_t selectedTriangles = 0;
+        size_t fullDetailTriangles = 0;
+    };
+
+}
+
+#endif /* LodSelector_hpp */
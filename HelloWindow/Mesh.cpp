@@ -1,22 +1,141 @@
 #include "Mesh.hpp"
 
+#include <algorithm>
+
 	/* Mesh Constructor */
 	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures)
+		: Mesh(vertices, indices, textures, std::vector<MeshLod>(1, MeshLod{ 0, indices.size(), 0.0f, 0, 0 }))
+	{
+	}
+
+	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures, std::vector<MeshLod> lods)
 	{
 		this->vertices = vertices;
 		this->indices = indices;
 		this->textures = textures;
+		this->lods = lods;
+
+		for (size_t i = 0; i < this->vertices.size(); i++)
+		{
+			this->bounds.expand(this->vertices[i].Position);
+		}
 
 		this->setupMesh();
 	}
 
 	Buffers Mesh::getBuffers() {
-		return this->buffers;
+		gps::GeometryArena& arena = gps::sharedGeometryArena();
+		Buffers buffers = { arena.getVAO(), arena.getVBO(), arena.getEBO() };
+		return buffers;
+	}
+
+	// Returns the vertex and index ranges to the shared arena, the mesh cannot be drawn afterwards
+	void Mesh::releaseGeometry() {
+		gps::sharedGeometryArena().free(this->geometry);
+		this->geometry = gps::INVALID_GEOMETRY;
+		this->indexRanges.clear();
+	}
+
+	void Mesh::setGeometry(std::vector<Vertex> vertices, std::vector<GLuint> indices) {
+		if (this->geometry != gps::INVALID_GEOMETRY) {
+			this->releaseGeometry();
+		}
+		this->vertices = vertices;
+		this->indices = indices;
+
+		this->bounds = gps::AABB();
+		for (size_t i = 0; i < this->vertices.size(); i++)
+		{
+			this->bounds.expand(this->vertices[i].Position);
+		}
+
+		this->setupMesh();
+	}
+
+	gps::AABB Mesh::getBounds() {
+		return this->bounds;
+	}
+
+	std::vector<Texture> Mesh::getEffectiveTextures() {
+		std::vector<Texture> result;
+		for (size_t i = 0; i < this->textures.size(); i++)
+		{
+			bool replaced = false;
+			for (size_t j = 0; j < result.size(); j++)
+			{
+				if (result[j].type == this->textures[i].type) {
+					result[j] = this->textures[i];
+					replaced = true;
+				}
+			}
+			if (!replaced) {
+				result.push_back(this->textures[i]);
+			}
+		}
+		return result;
+	}
+
+	GLenum Mesh::getIndexType() {
+		return this->indexType;
+	}
+
+	const std::vector<IndexRange>& Mesh::getIndexRanges() {
+		return this->indexRanges;
+	}
+
+	gps::GeometryHandle Mesh::getGeometry() {
+		return this->geometry;
+	}
+
+	size_t Mesh::getLodCount() {
+		return this->lods.size();
+	}
+
+	const MeshLod& Mesh::getLod(size_t lod) {
+		return this->lods[lod];
+	}
+
+	size_t Mesh::getCurrentLod() {
+		return this->currentLod;
+	}
+
+	void Mesh::setCurrentLod(size_t lod) {
+		this->currentLod = std::min(lod, this->lods.size() - 1);
+	}
+
+	bool Mesh::isOccluded() {
+		return this->occluded;
+	}
+
+	void Mesh::setOccluded(bool occluded) {
+		this->occluded = occluded;
+	}
+
+	GLuint Mesh::getConditionalQuery() {
+		return this->conditionalQuery;
+	}
+
+	void Mesh::setConditionalQuery(GLuint query) {
+		this->conditionalQuery = query;
+	}
+
+	MeshStats Mesh::getStats() {
+		MeshStats stats;
+		stats.vertexCount = this->vertices.size();
+		stats.indexCount = this->lods[0].indexCount;
+		stats.indexType = this->indexType;
+		stats.indexBufferBytes = this->indices.size() * (this->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint));
+		stats.rangeCount = this->lods[0].rangeCount;
+		stats.lodCount = this->lods.size();
+		return stats;
 	}
 
 	/* Mesh drawing function - also applies associated textures */
 	void Mesh::Draw(gps::Shader shader)
 	{
+		if (this->occluded) {
+			return;
+		}
 		shader.useShaderProgram();
 
 		//set textures
@@ -28,9 +147,24 @@
 			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
 		}
 
-		glBindVertexArray(this->buffers.VAO);
-		glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+		// all meshes share the arena VAO, the ranges are selected by index offset and base vertex
+		gps::GeometryArena& arena = gps::sharedGeometryArena();
+		arena.bind();
+		// skipped on the GPU when the query found the bounds hidden, drawn when its result is not there yet
+		if (this->conditionalQuery != 0) {
+			glBeginConditionalRender(this->conditionalQuery, GL_QUERY_NO_WAIT);
+		}
+		const MeshLod& lod = this->lods[this->currentLod];
+		for (size_t i = lod.firstRange; i < lod.firstRange + lod.rangeCount && i < this->indexRanges.size(); i++)
+		{
+			const gps::GeometryAllocation& allocation = arena.getAllocation(this->geometry);
+			const IndexRange& range = this->indexRanges[i];
+			glDrawElementsBaseVertex(GL_TRIANGLES, range.count, this->indexType,
+				(GLvoid*)(allocation.indexOffset + range.byteOffset), (GLint)allocation.vertexOffset + range.baseVertex);
+		}
+		if (this->conditionalQuery != 0) {
+			glEndConditionalRender();
+		}
 
 		for (GLuint i = 0; i < this->textures.size(); i++)
 		{
@@ -40,32 +174,92 @@
 
 	}
 
-	// Initializes all the buffer objects/arrays
+	// Uploads the vertices and indices into ranges of the shared geometry arena
 	void Mesh::setupMesh() {
-		// Create buffers/arrays
-		glGenVertexArrays(1, &this->buffers.VAO);
-		glGenBuffers(1, &this->buffers.VBO);
-		glGenBuffers(1, &this->buffers.EBO);
+		std::vector<GLushort> shortIndices = this->buildShortIndices();
+		if (!shortIndices.empty()) {
+			this->indexType = GL_UNSIGNED_SHORT;
+			this->geometry = gps::sharedGeometryArena().allocate(
+				&this->vertices[0], this->vertices.size(),
+				&shortIndices[0], shortIndices.size() * sizeof(GLushort));
+		}
+		else {
+			// the ranges would be too fragmented, keep 32 bit indices
+			this->indexType = GL_UNSIGNED_INT;
+			this->indexRanges.clear();
+			for (size_t l = 0; l < this->lods.size(); l++)
+			{
+				IndexRange range = { (GLsizei)this->lods[l].indexCount, this->lods[l].indexOffset * sizeof(GLuint), 0 };
+				this->lods[l].firstRange = l;
+				this->lods[l].rangeCount = 1;
+				this->indexRanges.push_back(range);
+			}
+			this->geometry = gps::sharedGeometryArena().allocate(
+				&this->vertices[0], this->vertices.size(),
+				&this->indices[0], this->indices.size() * sizeof(GLuint));
+		}
+	}
 
-		glBindVertexArray(this->buffers.VAO);
-		// Load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.VBO);
-		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
+	// Converts the indices to 16 bit, split per level into ranges that each address at most 65536 vertices
+	std::vector<GLushort> Mesh::buildShortIndices() {
+		const GLuint maxRangeVertices = 65536;
+		// more ranges than this cost more in draw calls than the index bandwidth saves
+		const size_t maxRanges = 16;
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
+		std::vector<GLushort> shortIndices;
+		this->indexRanges.clear();
+		if (this->indices.empty()) {
+			return shortIndices;
+		}
+		shortIndices.reserve(this->indices.size());
 
-		// Set the vertex attribute pointers
-		// Vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
-		// Vertex Normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
-		// Vertex Texture Coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+		for (size_t l = 0; l < this->lods.size(); l++)
+		{
+			MeshLod& lod = this->lods[l];
+			size_t lodEnd = lod.indexOffset + lod.indexCount;
+			lod.firstRange = this->indexRanges.size();
 
-		glBindVertexArray(0);
-	}
+			size_t rangeStart = lod.indexOffset;
+			GLuint rangeMin = this->indices[rangeStart];
+			GLuint rangeMax = this->indices[rangeStart];
 
+			for (size_t t = lod.indexOffset; t + 2 < lodEnd; t += 3)
+			{
+				GLuint triangleMin = std::min(this->indices[t], std::min(this->indices[t + 1], this->indices[t + 2]));
+				GLuint triangleMax = std::max(this->indices[t], std::max(this->indices[t + 1], this->indices[t + 2]));
+				GLuint newMin = std::min(rangeMin, triangleMin);
+				GLuint newMax = std::max(rangeMax, triangleMax);
+
+				// close the current range when the triangle does not fit
+				if (t > rangeStart && newMax - newMin >= maxRangeVertices) {
+					IndexRange range = { (GLsizei)(t - rangeStart), rangeStart * sizeof(GLushort), (GLint)rangeMin };
+					this->indexRanges.push_back(range);
+					rangeStart = t;
+					newMin = triangleMin;
+					newMax = triangleMax;
+				}
+				rangeMin = newMin;
+				rangeMax = newMax;
+			}
+			IndexRange lastRange = { (GLsizei)(lodEnd - rangeStart), rangeStart * sizeof(GLushort), (GLint)rangeMin };
+			this->indexRanges.push_back(lastRange);
+
+			lod.rangeCount = this->indexRanges.size() - lod.firstRange;
+			if (lod.rangeCount > maxRanges) {
+				this->indexRanges.clear();
+				return shortIndices;
+			}
+		}
+
+		for (size_t r = 0; r < this->indexRanges.size(); r++)
+		{
+			const IndexRange& range = this->indexRanges[r];
+			size_t first = range.byteOffset / sizeof(GLushort);
+			for (size_t i = first; i < first + range.count; i++)
+			{
+				shortIndices.push_back((GLushort)(this->indices[i] - range.baseVertex));
+			}
+		}
+
+		return shortIndices;
+	}
@@ -5,6 +5,8 @@
 #include "glm/glm.hpp"
 
 #include "Shader.hpp"
+#include "GeometryArena.hpp"
+#include "BoundingBox.hpp"
 
 #include <string>
 #include <vector>
@@ -15,6 +17,8 @@
         glm::vec3 Position;
         glm::vec3 Normal;
         glm::vec2 TexCoords;
+        // position in the lightmap atlas, negative for meshes without a lightmap
+        glm::vec2 LightmapCoords;
     };
 
     struct Texture
@@ -23,6 +27,8 @@
         //ambientTexture, diffuseTexture, specularTexture
         std::string type;
         std::string path;
+        // uploaded with sRGB decoding (opaque models)
+        bool isSRGB;
     };
 
     struct Buffers {
@@ -31,25 +37,89 @@
         GLuint EBO;
     };
 
+    // part of the index buffer drawn with one call, indices are relative to baseVertex
+    struct IndexRange {
+        GLsizei count;
+        size_t byteOffset;
+        GLint baseVertex;
+    };
+
+    // one level of detail: a slice of Mesh::indices and its index ranges
+    struct MeshLod {
+        size_t indexOffset;
+        size_t indexCount;
+        // deviation from the full detail surface in model space units
+        float error;
+        size_t firstRange;
+        size_t rangeCount;
+    };
+
+    struct MeshStats {
+        size_t vertexCount;
+        // of the full detail level
+        size_t indexCount;
+        // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+        GLenum indexType;
+        size_t indexBufferBytes;
+        size_t rangeCount;
+        size_t lodCount;
+    };
+
     class Mesh
     {
     public:
         std::vector<Vertex> vertices;
+        // all levels of detail one after the other, the full detail one first
         std::vector<GLuint> indices;
         std::vector<Texture> textures;
+        // name of the source mesh, merged meshes join their sources' names with ','
+        std::string name;
 
         Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures);
+        Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures, std::vector<MeshLod> lods);
 
         Buffers getBuffers();
+        MeshStats getStats();
+        gps::AABB getBounds();
+        void releaseGeometry();
+        // Replaces the vertices and indices of the same levels of detail and uploads them again
+        void setGeometry(std::vector<Vertex> vertices, std::vector<GLuint> indices);
+
+        // Textures bound by Draw: a later texture of a type overrides an earlier one
+        std::vector<Texture> getEffectiveTextures();
+        GLenum getIndexType();
+        const std::vector<IndexRange>& getIndexRanges();
+        gps::GeometryHandle getGeometry();
+
+        size_t getLodCount();
+        const MeshLod& getLod(size_t lod);
+        // the level Draw uses, kept between frames for the hysteresis of the selection
+        size_t getCurrentLod();
+        void setCurrentLod(size_t lod);
+        // set for the main pass when the occlusion culler finds the mesh hidden, Draw then skips it
+        bool isOccluded();
+        void setOccluded(bool occluded);
+        // set for the main pass while the mesh's occlusion query is in flight, Draw then renders conditionally on it
+        GLuint getConditionalQuery();
+        void setConditionalQuery(GLuint query);
 
         void Draw(gps::Shader shader);
 
     private:
         /*  Render data  */
-        Buffers buffers;
-
-        // Initializes all the buffer objects/arrays
+        gps::GeometryHandle geometry = gps::INVALID_GEOMETRY;
+        gps::AABB bounds;
+        GLenum indexType;
+        std::vector<IndexRange> indexRanges;
+        std::vector<MeshLod> lods;
+        size_t currentLod = 0;
+        bool occluded = false;
+        GLuint conditionalQuery = 0;
+
+        // Uploads the vertices and indices into ranges of the shared geometry arena
         void setupMesh();
+        // Converts the indices to 16 bit, split per level into ranges that each address at most 65536 vertices
+        std::vector<GLushort> buildShortIndices();
 
     };
 
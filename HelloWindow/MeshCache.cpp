@@ -0,0 +1,101 @@
+#include "MeshCache.hpp"
+
+#include <fstream>
+#include <iostream>
+
+namespace gps {
+
+    const unsigned int MESH_CACHE_MAGIC = 0x4843534D; // "MSCH"
+
+    static unsigned long long hashBytes(unsigned long long hash, const void* data, size_t size) {
+        const unsigned char* bytes = (const unsigned char*)data;
+        for (size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    unsigned long long hashMeshSource(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices) {
+        unsigned long long hash = 14695981039346656037ull;
+        hash = hashBytes(hash, vertices.data(), vertices.size() * sizeof(Vertex));
+        hash = hashBytes(hash, indices.data(), indices.size() * sizeof(GLuint));
+        return hash;
+    }
+
+    std::string meshCachePath(const std::string& modelFileName) {
+        return modelFileName + ".meshcache";
+    }
+
+    bool loadMeshCache(const std::string& cacheFileName, std::vector<CachedMesh>& meshes) {
+        std::ifstream file(cacheFileName.c_str(), std::ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+
+        unsigned int header[3];
+        file.read((char*)header, sizeof(header));
+        if (!file || header[0] != MESH_CACHE_MAGIC || header[1] != MESH_CACHE_VERSION) {
+            return false;
+        }
+
+        meshes.clear();
+        meshes.resize(header[2]);
+        for (size_t i = 0; i < meshes.size(); i++) {
+            unsigned int counts[5];
+            file.read((char*)counts, sizeof(counts));
+            file.read((char*)&meshes[i].sourceHash, sizeof(meshes[i].sourceHash));
+            if (!file) {
+                meshes.clear();
+                return false;
+            }
+
+            meshes[i].sourceVertexCount = counts[0];
+            meshes[i].sourceFaceCount = counts[1];
+            meshes[i].vertices.resize(counts[2]);
+            meshes[i].indices.resize(counts[3]);
+            meshes[i].lodIndexCounts.resize(counts[4]);
+            meshes[i].lodErrors.resize(counts[4]);
+            file.read((char*)meshes[i].vertices.data(), meshes[i].vertices.size() * sizeof(Vertex));
+            file.read((char*)meshes[i].indices.data(), meshes[i].indices.size() * sizeof(GLuint));
+            file.read((char*)meshes[i].lodIndexCounts.data(), meshes[i].lodIndexCounts.size() * sizeof(unsigned int));
+            file.read((char*)meshes[i].lodErrors.data(), meshes[i].lodErrors.size() * sizeof(float));
+        }
+
+        if (!file) {
+            meshes.clear();
+            return false;
+        }
+        return true;
+    }
+
+    bool saveMeshCache(const std::string& cacheFileName, const std::vector<CachedMesh>& meshes) {
+        std::ofstream file(cacheFileName.c_str(), std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cout << "Could not write mesh cache " << cacheFileName << std::endl;
+            return false;
+        }
+
+        unsigned int header[3] = { MESH_CACHE_MAGIC, MESH_CACHE_VERSION, (unsigned int)meshes.size() };
+        file.write((const char*)header, sizeof(header));
+
+        for (size_t i = 0; i < meshes.size(); i++) {
+            unsigned int counts[5] = {
+                meshes[i].sourceVertexCount,
+                meshes[i].sourceFaceCount,
+                (unsigned int)meshes[i].vertices.size(),
+                (unsigned int)meshes[i].indices.size(),
+                (unsigned int)meshes[i].lodIndexCounts.size()
+            };
+            file.write((const char*)counts, sizeof(counts));
+            file.write((const char*)&meshes[i].sourceHash, sizeof(meshes[i].sourceHash));
+            file.write((const char*)meshes[i].vertices.data(), meshes[i].vertices.size() * sizeof(Vertex));
+            file.write((const char*)meshes[i].indices.data(), meshes[i].indices.size() * sizeof(GLuint));
+            file.write((const char*)meshes[i].lodIndexCounts.data(), meshes[i].lodIndexCounts.size() * sizeof(unsigned int));
+            file.write((const char*)meshes[i].lodErrors.data(), meshes[i].lodErrors.size() * sizeof(float));
+        }
+
+        return (bool)file;
+    }
+
+}
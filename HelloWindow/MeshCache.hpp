@@ -0,0 +1,40 @@
+#ifndef MeshCache_hpp
+#define MeshCache_hpp
+
+#include "Mesh.hpp"
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //bump whenever the optimization pipeline or the file layout changes
+    const unsigned int MESH_CACHE_VERSION = 5;
+
+    //optimized geometry of one imported mesh (or chunk of one), keyed by the order Model3D visits them
+    struct CachedMesh {
+        //counts of the imported mesh, used to detect a stale cache
+        unsigned int sourceVertexCount;
+        unsigned int sourceFaceCount;
+        //of the imported vertices and indices, an edited model with the same counts is stale too
+        unsigned long long sourceHash;
+
+        std::vector<Vertex> vertices;
+        //the levels of detail one after the other
+        std::vector<GLuint> indices;
+        std::vector<unsigned int> lodIndexCounts;
+        std::vector<float> lodErrors;
+    };
+
+    //FNV-1a of the imported geometry, before it is optimized
+    unsigned long long hashMeshSource(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices);
+
+    //the cache of a model lives next to it as "<model file>.meshcache"
+    std::string meshCachePath(const std::string& modelFileName);
+
+    bool loadMeshCache(const std::string& cacheFileName, std::vector<CachedMesh>& meshes);
+    bool saveMeshCache(const std::string& cacheFileName, const std::vector<CachedMesh>& meshes);
+
+}
+
+#endif /* MeshCache_hpp */
@@ -0,0 +1,312 @@
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    //scoring constants from Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+    const int FORSYTH_CACHE_SIZE = 32;
+    const float CACHE_DECAY_POWER = 1.5f;
+    const float LAST_TRIANGLE_SCORE = 0.75f;
+    const float VALENCE_BOOST_SCALE = 2.0f;
+    const float VALENCE_BOOST_POWER = 0.5f;
+
+    //minimum triangles in an overdraw cluster before it may be cut
+    const size_t MIN_CLUSTER_TRIANGLES = 16;
+
+    VertexCacheStats analyzeVertexCache(const std::vector<GLuint>& indices, size_t vertexCount, unsigned int cacheSize) {
+        VertexCacheStats stats = { 0.0f, 0.0f };
+        if (indices.empty() || vertexCount == 0) {
+            return stats;
+        }
+
+        //a vertex is in the FIFO cache if fewer than cacheSize misses happened since it was loaded
+        std::vector<unsigned int> loadedAt(vertexCount, 0);
+        std::vector<bool> referenced(vertexCount, false);
+        unsigned int timestamp = cacheSize + 1;
+        unsigned int misses = 0;
+        size_t uniqueVertices = 0;
+
+        for (size_t i = 0; i < indices.size(); i++) {
+            GLuint v = indices[i];
+            if (timestamp - loadedAt[v] > cacheSize) {
+                loadedAt[v] = timestamp++;
+                misses++;
+            }
+            if (!referenced[v]) {
+                referenced[v] = true;
+                uniqueVertices++;
+            }
+        }
+
+        stats.acmr = (float)misses / (float)(indices.size() / 3);
+        stats.atvr = (float)misses / (float)uniqueVertices;
+        return stats;
+    }
+
+    static float vertexScore(int cachePosition, unsigned int remainingValence) {
+        if (remainingValence == 0) {
+            //no triangles left, the vertex is useless
+            return -1.0f;
+        }
+
+        float score = 0.0f;
+        if (cachePosition >= 0) {
+            if (cachePosition < 3) {
+                //the vertices of the last triangle get a fixed score so the order inside it does not matter
+                score = LAST_TRIANGLE_SCORE;
+            }
+            else {
+                const float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+                score = 1.0f - (cachePosition - 3) * scaler;
+                score = std::pow(score, CACHE_DECAY_POWER);
+            }
+        }
+
+        //boost vertices with few triangles left so they are finished off instead of left as islands
+        score += VALENCE_BOOST_SCALE * std::pow((float)remainingValence, -VALENCE_BOOST_POWER);
+        return score;
+    }
+
+    void optimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount) {
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0) {
+            return;
+        }
+
+        //build vertex -> triangle adjacency
+        std::vector<unsigned int> valence(vertexCount, 0);
+        for (size_t i = 0; i < indices.size(); i++) {
+            valence[indices[i]]++;
+        }
+
+        std::vector<unsigned int> adjacencyOffset(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; v++) {
+            adjacencyOffset[v + 1] = adjacencyOffset[v] + valence[v];
+        }
+
+        std::vector<unsigned int> adjacency(indices.size());
+        std::vector<unsigned int> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+        for (size_t t = 0; t < triangleCount; t++) {
+            for (int k = 0; k < 3; k++) {
+                adjacency[fill[indices[t * 3 + k]]++] = (unsigned int)t;
+            }
+        }
+
+        //initial scores
+        std::vector<int> cachePosition(vertexCount, -1);
+        std::vector<float> vScore(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++) {
+            vScore[v] = vertexScore(-1, valence[v]);
+        }
+
+        std::vector<float> tScore(triangleCount);
+        std::vector<bool> triangleEmitted(triangleCount, false);
+        for (size_t t = 0; t < triangleCount; t++) {
+            tScore[t] = vScore[indices[t * 3]] + vScore[indices[t * 3 + 1]] + vScore[indices[t * 3 + 2]];
+        }
+
+        std::vector<GLuint> result;
+        result.reserve(indices.size());
+
+        std::vector<GLuint> cache;
+        std::vector<GLuint> newCache;
+        cache.reserve(FORSYTH_CACHE_SIZE + 3);
+        newCache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+        size_t scanCursor = 0;
+        long long bestTriangle = -1;
+
+        for (size_t emitted = 0; emitted < triangleCount; emitted++) {
+            if (bestTriangle < 0) {
+                //nothing useful in the cache, continue with the next triangle in input order
+                //(a full rescan here is quadratic on foliage made of thousands of disjoint quads)
+                while (triangleEmitted[scanCursor]) {
+                    scanCursor++;
+                }
+                bestTriangle = (long long)scanCursor;
+            }
+
+            size_t tri = (size_t)bestTriangle;
+            triangleEmitted[tri] = true;
+
+            //emit the triangle and remove it from the adjacency of its vertices
+            newCache.clear();
+            for (int k = 0; k < 3; k++) {
+                GLuint v = indices[tri * 3 + k];
+                result.push_back(v);
+                newCache.push_back(v);
+
+                unsigned int* begin = &adjacency[adjacencyOffset[v]];
+                unsigned int* end = begin + valence[v];
+                unsigned int* found = std::find(begin, end, (unsigned int)tri);
+                std::swap(*found, *(end - 1));
+                valence[v]--;
+            }
+
+            //move the triangle's vertices to the front of the LRU cache
+            for (size_t i = 0; i < cache.size(); i++) {
+                GLuint v = cache[i];
+                if (v != newCache[0] && v != newCache[1] && v != newCache[2]) {
+                    newCache.push_back(v);
+                }
+            }
+
+            //vertices pushed out of the cache lose their position
+            for (size_t i = FORSYTH_CACHE_SIZE; i < newCache.size(); i++) {
+                cachePosition[newCache[i]] = -1;
+                vScore[newCache[i]] = vertexScore(-1, valence[newCache[i]]);
+            }
+            if (newCache.size() > (size_t)FORSYTH_CACHE_SIZE) {
+                newCache.resize(FORSYTH_CACHE_SIZE);
+            }
+            cache.swap(newCache);
+
+            //rescore the cached vertices and their remaining triangles, picking the best for the next step
+            for (size_t i = 0; i < cache.size(); i++) {
+                cachePosition[cache[i]] = (int)i;
+                vScore[cache[i]] = vertexScore((int)i, valence[cache[i]]);
+            }
+
+            bestTriangle = -1;
+            float bestScore = -1.0f;
+            for (size_t i = 0; i < cache.size(); i++) {
+                GLuint v = cache[i];
+                for (unsigned int a = 0; a < valence[v]; a++) {
+                    unsigned int t = adjacency[adjacencyOffset[v] + a];
+                    tScore[t] = vScore[indices[t * 3]] + vScore[indices[t * 3 + 1]] + vScore[indices[t * 3 + 2]];
+                    if (tScore[t] > bestScore) {
+                        bestScore = tScore[t];
+                        bestTriangle = t;
+                    }
+                }
+            }
+        }
+
+        indices.swap(result);
+    }
+
+    struct OverdrawCluster {
+        size_t firstTriangle;
+        size_t triangleCount;
+        float sortKey;
+    };
+
+    void optimizeOverdraw(std::vector<GLuint>& indices, const std::vector<Vertex>& vertices, float threshold) {
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount <= MIN_CLUSTER_TRIANGLES) {
+            return;
+        }
+
+        float meshAcmr = analyzeVertexCache(indices, vertices.size()).acmr;
+
+        //split into clusters: every cluster starts with a cold cache and is cut once its
+        //own ACMR is within threshold of the whole mesh, so reordering clusters costs little
+        std::vector<OverdrawCluster> clusters;
+        std::vector<unsigned int> loadedAt(vertices.size(), 0);
+        unsigned int timestamp = VERTEX_CACHE_SIZE + 1;
+
+        size_t clusterStart = 0;
+        unsigned int clusterMisses = 0;
+        for (size_t t = 0; t < triangleCount; t++) {
+            for (int k = 0; k < 3; k++) {
+                GLuint v = indices[t * 3 + k];
+                if (timestamp - loadedAt[v] > VERTEX_CACHE_SIZE) {
+                    loadedAt[v] = timestamp++;
+                    clusterMisses++;
+                }
+            }
+
+            size_t clusterSize = t - clusterStart + 1;
+            float clusterAcmr = (float)clusterMisses / (float)clusterSize;
+            if ((clusterSize >= MIN_CLUSTER_TRIANGLES && clusterAcmr <= meshAcmr * threshold) || t == triangleCount - 1) {
+                OverdrawCluster cluster = { clusterStart, clusterSize, 0.0f };
+                clusters.push_back(cluster);
+                clusterStart = t + 1;
+                clusterMisses = 0;
+                //flush the simulated cache
+                timestamp += VERTEX_CACHE_SIZE + 1;
+            }
+        }
+
+        if (clusters.size() < 2) {
+            return;
+        }
+
+        //area weighted mesh centroid
+        glm::vec3 meshCentroid(0.0f);
+        float meshArea = 0.0f;
+        for (size_t t = 0; t < triangleCount; t++) {
+            const glm::vec3& a = vertices[indices[t * 3]].Position;
+            const glm::vec3& b = vertices[indices[t * 3 + 1]].Position;
+            const glm::vec3& c = vertices[indices[t * 3 + 2]].Position;
+            float area = glm::length(glm::cross(b - a, c - a)) * 0.5f;
+            meshCentroid += (a + b + c) * (area / 3.0f);
+            meshArea += area;
+        }
+        if (meshArea > 0.0f) {
+            meshCentroid /= meshArea;
+        }
+
+        //clusters facing away from the centroid occlude the rest, so draw them first
+        for (size_t i = 0; i < clusters.size(); i++) {
+            glm::vec3 centroid(0.0f);
+            glm::vec3 normal(0.0f);
+            float area = 0.0f;
+            for (size_t t = clusters[i].firstTriangle; t < clusters[i].firstTriangle + clusters[i].triangleCount; t++) {
+                const glm::vec3& a = vertices[indices[t * 3]].Position;
+                const glm::vec3& b = vertices[indices[t * 3 + 1]].Position;
+                const glm::vec3& c = vertices[indices[t * 3 + 2]].Position;
+                glm::vec3 faceNormal = glm::cross(b - a, c - a);
+                float faceArea = glm::length(faceNormal) * 0.5f;
+                centroid += (a + b + c) * (faceArea / 3.0f);
+                normal += faceNormal;
+                area += faceArea;
+            }
+            if (area > 0.0f) {
+                centroid /= area;
+            }
+            float normalLength = glm::length(normal);
+            clusters[i].sortKey = normalLength > 0.0f ? glm::dot(centroid - meshCentroid, normal / normalLength) : 0.0f;
+        }
+
+        std::stable_sort(clusters.begin(), clusters.end(), [](const OverdrawCluster& a, const OverdrawCluster& b) {
+            return a.sortKey > b.sortKey;
+        });
+
+        std::vector<GLuint> result;
+        result.reserve(indices.size());
+        for (size_t i = 0; i < clusters.size(); i++) {
+            result.insert(result.end(),
+                indices.begin() + clusters[i].firstTriangle * 3,
+                indices.begin() + (clusters[i].firstTriangle + clusters[i].triangleCount) * 3);
+        }
+        indices.swap(result);
+    }
+
+    void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices) {
+        const GLuint unused = 0xFFFFFFFFu;
+        std::vector<GLuint> remap(vertices.size(), unused);
+        std::vector<Vertex> result;
+        result.reserve(vertices.size());
+
+        for (size_t i = 0; i < indices.size(); i++) {
+            GLuint& index = indices[i];
+            if (remap[index] == unused) {
+                remap[index] = (GLuint)result.size();
+                result.push_back(vertices[index]);
+            }
+            index = remap[index];
+        }
+
+        vertices.swap(result);
+    }
+
+    void optimizeMesh(std::vector<Vertex>& vertices, std::vector<GLuint>& indices) {
+        optimizeVertexCache(indices, vertices.size());
+        optimizeOverdraw(indices, vertices);
+        optimizeVertexFetch(vertices, indices);
+    }
+
+}
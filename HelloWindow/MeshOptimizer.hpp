@@ -0,0 +1,38 @@
+#ifndef MeshOptimizer_hpp
+#define MeshOptimizer_hpp
+
+#include "Mesh.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    //simulated post-transform cache size used for the reports
+    const unsigned int VERTEX_CACHE_SIZE = 16;
+
+    struct VertexCacheStats {
+        //average cache miss ratio - transformed vertices per triangle (0.5 best, 3.0 worst)
+        float acmr;
+        //average transform to vertex ratio - transformed vertices per unique vertex (1.0 best)
+        float atvr;
+    };
+
+    //simulate a FIFO post-transform cache over the index buffer
+    VertexCacheStats analyzeVertexCache(const std::vector<GLuint>& indices, size_t vertexCount, unsigned int cacheSize = VERTEX_CACHE_SIZE);
+
+    //reorder triangles for the post-transform cache (Forsyth's linear-speed algorithm)
+    void optimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount);
+
+    //reorder clusters of the cache optimized triangles so the outward facing ones are drawn first
+    //threshold - how much the ACMR is allowed to degrade (1.05 = 5%)
+    void optimizeOverdraw(std::vector<GLuint>& indices, const std::vector<Vertex>& vertices, float threshold = 1.05f);
+
+    //reorder vertices in the order the index buffer first uses them, dropping unreferenced ones
+    void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices);
+
+    //runs the whole pipeline: vertex cache, overdraw, vertex fetch
+    void optimizeMesh(std::vector<Vertex>& vertices, std::vector<GLuint>& indices);
+
+}
+
+#endif /* MeshOptimizer_hpp */
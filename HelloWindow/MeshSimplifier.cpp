@@ -0,0 +1,675 @@
+#include "MeshSimplifier.hpp"
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    //collapse targets of the coarser levels, as a fraction of the full detail triangles
+    const float LOD_TRIANGLE_RATIOS[MAX_LOD_LEVELS - 1] = { 0.5f, 0.2f, 0.05f };
+    //a level has to remove at least this fraction of the previous one to be kept
+    const float MIN_LOD_REDUCTION = 0.1f;
+    //open borders are weighted up so outlines keep their shape
+    const double BORDER_WEIGHT = 10.0;
+    //smallest cosine between a triangle normal before and after a collapse
+    const float MIN_NORMAL_COSINE = 0.25f;
+    //finest grid tried by the clustering
+    const int MAX_CLUSTER_GRID = 1024;
+    const size_t MAX_CHUNKS_PER_AXIS = 8;
+
+    enum VertexKind { VERTEX_MANIFOLD, VERTEX_BORDER, VERTEX_LOCKED };
+
+    //symmetric error quadric: Q(p) = p.A.p + 2 b.p + c, weight is the area it was built from
+    struct Quadric {
+        double a00, a01, a02, a11, a12, a22;
+        double b0, b1, b2;
+        double c;
+        double weight;
+    };
+
+    static Quadric planeQuadric(const glm::vec3& normal, double distance, double weight) {
+        double x = normal.x, y = normal.y, z = normal.z;
+        Quadric q;
+        q.a00 = x * x * weight; q.a01 = x * y * weight; q.a02 = x * z * weight;
+        q.a11 = y * y * weight; q.a12 = y * z * weight; q.a22 = z * z * weight;
+        q.b0 = x * distance * weight; q.b1 = y * distance * weight; q.b2 = z * distance * weight;
+        q.c = distance * distance * weight;
+        q.weight = weight;
+        return q;
+    }
+
+    static void addQuadric(Quadric& q, const Quadric& other) {
+        q.a00 += other.a00; q.a01 += other.a01; q.a02 += other.a02;
+        q.a11 += other.a11; q.a12 += other.a12; q.a22 += other.a22;
+        q.b0 += other.b0; q.b1 += other.b1; q.b2 += other.b2;
+        q.c += other.c;
+        q.weight += other.weight;
+    }
+
+    //weighted RMS distance of the point to the planes of the quadric
+    static float quadricError(const Quadric& q, const glm::vec3& p) {
+        if (q.weight <= 0.0) {
+            return 0.0f;
+        }
+        double x = p.x, y = p.y, z = p.z;
+        double rx = q.a00 * x + q.a01 * y + q.a02 * z;
+        double ry = q.a01 * x + q.a11 * y + q.a12 * z;
+        double rz = q.a02 * x + q.a12 * y + q.a22 * z;
+        double error = rx * x + ry * y + rz * z + 2.0 * (q.b0 * x + q.b1 * y + q.b2 * z) + q.c;
+        return (float)std::sqrt(std::max(error, 0.0) / q.weight);
+    }
+
+    //positions scaled into the unit cube so errors are relative to the mesh extent
+    static std::vector<glm::vec3> normalizedPositions(const std::vector<Vertex>& vertices) {
+        AABB bounds;
+        for (size_t i = 0; i < vertices.size(); i++) {
+            bounds.expand(vertices[i].Position);
+        }
+        glm::vec3 size = bounds.max - bounds.min;
+        float extent = std::max(size.x, std::max(size.y, size.z));
+        float scale = extent > 0.0f ? 1.0f / extent : 0.0f;
+
+        std::vector<glm::vec3> positions(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++) {
+            positions[i] = (vertices[i].Position - bounds.min) * scale;
+        }
+        return positions;
+    }
+
+    static bool lessPosition(const glm::vec3& a, const glm::vec3& b) {
+        if (a.x != b.x) {
+            return a.x < b.x;
+        }
+        if (a.y != b.y) {
+            return a.y < b.y;
+        }
+        return a.z < b.z;
+    }
+
+    //remap[v] is the first vertex with the same position, wedges counts the vertices sharing it
+    static void buildPositionRemap(const std::vector<glm::vec3>& positions, std::vector<GLuint>& remap, std::vector<unsigned int>& wedges) {
+        std::vector<GLuint> order(positions.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            order[i] = (GLuint)i;
+        }
+        std::sort(order.begin(), order.end(), [&positions](GLuint a, GLuint b) {
+            return lessPosition(positions[a], positions[b]);
+        });
+
+        remap.assign(positions.size(), 0);
+        wedges.assign(positions.size(), 0);
+        for (size_t i = 0; i < order.size(); i++) {
+            GLuint v = order[i];
+            if (i > 0 && positions[v] == positions[order[i - 1]]) {
+                remap[v] = remap[order[i - 1]];
+            }
+            else {
+                remap[v] = v;
+            }
+            wedges[remap[v]]++;
+        }
+    }
+
+    static unsigned long long edgeKey(GLuint from, GLuint to) {
+        return ((unsigned long long)from << 32) | to;
+    }
+
+    static bool hasHalfEdge(const std::vector<unsigned long long>& halfEdges, GLuint from, GLuint to) {
+        return std::binary_search(halfEdges.begin(), halfEdges.end(), edgeKey(from, to));
+    }
+
+    //sorted half edges between positions, an edge without its reverse is an open border
+    static void buildHalfEdges(const std::vector<GLuint>& indices, const std::vector<GLuint>& remap, std::vector<unsigned long long>& halfEdges) {
+        halfEdges.clear();
+        halfEdges.reserve(indices.size());
+        for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+            for (int k = 0; k < 3; k++) {
+                halfEdges.push_back(edgeKey(remap[indices[t + k]], remap[indices[t + (k + 1) % 3]]));
+            }
+        }
+        std::sort(halfEdges.begin(), halfEdges.end());
+    }
+
+    static void classifyVertices(const std::vector<unsigned long long>& halfEdges, const std::vector<unsigned int>& wedges, std::vector<VertexKind>& kinds) {
+        std::vector<unsigned int> openEdges(wedges.size(), 0);
+        std::vector<bool> nonManifold(wedges.size(), false);
+
+        for (size_t i = 0; i < halfEdges.size(); i++) {
+            GLuint from = (GLuint)(halfEdges[i] >> 32);
+            GLuint to = (GLuint)(halfEdges[i] & 0xFFFFFFFFu);
+            if (i > 0 && halfEdges[i] == halfEdges[i - 1]) {
+                //the same directed edge twice: more than two triangles meet there
+                nonManifold[from] = true;
+                nonManifold[to] = true;
+            }
+            if (!hasHalfEdge(halfEdges, to, from)) {
+                openEdges[from]++;
+                openEdges[to]++;
+            }
+        }
+
+        kinds.assign(wedges.size(), VERTEX_LOCKED);
+        for (size_t v = 0; v < wedges.size(); v++) {
+            //UV seams keep their vertices, collapsing one side would tear the other
+            if (wedges[v] != 1 || nonManifold[v]) {
+                continue;
+            }
+            if (openEdges[v] == 0) {
+                kinds[v] = VERTEX_MANIFOLD;
+            }
+            else if (openEdges[v] == 2) {
+                kinds[v] = VERTEX_BORDER;
+            }
+        }
+    }
+
+    static std::vector<Quadric> buildQuadrics(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices,
+        const std::vector<GLuint>& remap, const std::vector<unsigned long long>& halfEdges) {
+        Quadric zero = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+        std::vector<Quadric> quadrics(positions.size(), zero);
+
+        for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+            glm::vec3 p0 = positions[indices[t]];
+            glm::vec3 normal = glm::cross(positions[indices[t + 1]] - p0, positions[indices[t + 2]] - p0);
+            float length = glm::length(normal);
+            if (length <= 0.0f) {
+                continue;
+            }
+            normal /= length;
+
+            Quadric plane = planeQuadric(normal, -glm::dot(normal, p0), length * 0.5);
+            for (int k = 0; k < 3; k++) {
+                addQuadric(quadrics[remap[indices[t + k]]], plane);
+            }
+
+            for (int k = 0; k < 3; k++) {
+                GLuint from = remap[indices[t + k]];
+                GLuint to = remap[indices[t + (k + 1) % 3]];
+                if (hasHalfEdge(halfEdges, to, from)) {
+                    continue;
+                }
+                //plane through the border edge, perpendicular to the triangle
+                glm::vec3 edge = positions[to] - positions[from];
+                float edgeLength = glm::length(edge);
+                glm::vec3 edgeNormal = glm::cross(edge, normal);
+                float edgeNormalLength = glm::length(edgeNormal);
+                if (edgeNormalLength <= 0.0f) {
+                    continue;
+                }
+                edgeNormal /= edgeNormalLength;
+                Quadric border = planeQuadric(edgeNormal, -glm::dot(edgeNormal, positions[from]), edgeLength * edgeLength * BORDER_WEIGHT);
+                addQuadric(quadrics[from], border);
+                addQuadric(quadrics[to], border);
+            }
+        }
+        return quadrics;
+    }
+
+    //true when moving vertex from onto vertex to turns one of the remaining triangles too far
+    static bool collapseFlipsTriangles(GLuint from, GLuint to, const std::vector<GLuint>& indices,
+        const std::vector<unsigned int>& adjacencyOffsets, const std::vector<unsigned int>& adjacency,
+        const std::vector<glm::vec3>& positions, const std::vector<GLuint>& remap) {
+        for (unsigned int a = adjacencyOffsets[from]; a < adjacencyOffsets[from + 1]; a++) {
+            size_t t = adjacency[a] * 3;
+            GLuint corners[3] = { indices[t], indices[t + 1], indices[t + 2] };
+            if (remap[corners[0]] == remap[to] || remap[corners[1]] == remap[to] || remap[corners[2]] == remap[to]) {
+                //the triangle degenerates and is removed
+                continue;
+            }
+
+            glm::vec3 before[3];
+            glm::vec3 after[3];
+            for (int k = 0; k < 3; k++) {
+                before[k] = positions[corners[k]];
+                after[k] = corners[k] == from ? positions[to] : before[k];
+            }
+            glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+            glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+            //rotations close to 90 degrees also count, several of them in a row would fold the surface
+            if (glm::dot(normalBefore, normalAfter) <= MIN_NORMAL_COSINE * glm::length(normalBefore) * glm::length(normalAfter)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    struct Collapse {
+        GLuint from;
+        GLuint to;
+        float error;
+        bool isBorder;
+    };
+
+    std::vector<GLuint> simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+        const std::vector<bool>& lockedVertices, size_t targetIndexCount, float targetError, float& resultError) {
+        resultError = 0.0f;
+        std::vector<GLuint> result = indices;
+        if (indices.size() <= targetIndexCount || vertices.empty()) {
+            return result;
+        }
+
+        std::vector<glm::vec3> positions = normalizedPositions(vertices);
+        std::vector<GLuint> remap;
+        std::vector<unsigned int> wedges;
+        buildPositionRemap(positions, remap, wedges);
+
+        std::vector<unsigned long long> halfEdges;
+        buildHalfEdges(result, remap, halfEdges);
+        std::vector<Quadric> quadrics = buildQuadrics(positions, result, remap, halfEdges);
+
+        std::vector<VertexKind> kinds;
+        std::vector<unsigned int> adjacencyOffsets;
+        std::vector<unsigned int> adjacency;
+        std::vector<Collapse> collapses;
+        std::vector<bool> locked;
+        std::vector<GLuint> collapseTo;
+
+        //each pass collapses the cheapest independent edges, then rebuilds the topology
+        while (result.size() > targetIndexCount) {
+            classifyVertices(halfEdges, wedges, kinds);
+            for (size_t v = 0; v < lockedVertices.size(); v++) {
+                if (lockedVertices[v]) {
+                    kinds[remap[v]] = VERTEX_LOCKED;
+                }
+            }
+
+            adjacencyOffsets.assign(vertices.size() + 1, 0);
+            for (size_t i = 0; i < result.size(); i++) {
+                adjacencyOffsets[result[i] + 1]++;
+            }
+            for (size_t v = 0; v < vertices.size(); v++) {
+                adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+            }
+            adjacency.resize(result.size());
+            std::vector<unsigned int> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+            for (size_t i = 0; i < result.size(); i++) {
+                adjacency[fill[result[i]]++] = (unsigned int)(i / 3);
+            }
+
+            collapses.clear();
+            for (size_t t = 0; t + 2 < result.size(); t += 3) {
+                for (int k = 0; k < 3; k++) {
+                    GLuint a = result[t + k];
+                    GLuint b = result[t + (k + 1) % 3];
+                    for (int direction = 0; direction < 2; direction++) {
+                        GLuint from = direction == 0 ? a : b;
+                        GLuint to = direction == 0 ? b : a;
+                        GLuint fromPosition = remap[from];
+                        GLuint toPosition = remap[to];
+                        if (fromPosition == toPosition || kinds[fromPosition] == VERTEX_LOCKED) {
+                            continue;
+                        }
+                        bool isBorder = kinds[fromPosition] == VERTEX_BORDER;
+                        if (isBorder) {
+                            //border vertices only slide along their border
+                            if (kinds[toPosition] == VERTEX_MANIFOLD
+                                || hasHalfEdge(halfEdges, fromPosition, toPosition) == hasHalfEdge(halfEdges, toPosition, fromPosition)) {
+                                continue;
+                            }
+                        }
+                        Quadric q = quadrics[fromPosition];
+                        addQuadric(q, quadrics[toPosition]);
+                        Collapse collapse = { from, to, quadricError(q, positions[to]), isBorder };
+                        collapses.push_back(collapse);
+                    }
+                }
+            }
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) {
+                return a.error < b.error;
+            });
+
+            size_t trianglesToRemove = (result.size() - targetIndexCount) / 3;
+            size_t removed = 0;
+            locked.assign(vertices.size(), false);
+            collapseTo.resize(vertices.size());
+            for (size_t v = 0; v < vertices.size(); v++) {
+                collapseTo[v] = (GLuint)v;
+            }
+
+            for (size_t c = 0; c < collapses.size() && removed < std::max(trianglesToRemove, (size_t)1); c++) {
+                const Collapse& collapse = collapses[c];
+                if (collapse.error > targetError) {
+                    break;
+                }
+                GLuint fromPosition = remap[collapse.from];
+                GLuint toPosition = remap[collapse.to];
+                if (locked[fromPosition] || locked[toPosition]) {
+                    continue;
+                }
+                if (collapseFlipsTriangles(collapse.from, collapse.to, result, adjacencyOffsets, adjacency, positions, remap)) {
+                    continue;
+                }
+
+                collapseTo[collapse.from] = collapse.to;
+                addQuadric(quadrics[toPosition], quadrics[fromPosition]);
+                resultError = std::max(resultError, collapse.error);
+                removed += collapse.isBorder ? 1 : 2;
+
+                //lock the one-ring so the collapses of a pass do not interact
+                for (unsigned int a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1]; a++) {
+                    size_t t = adjacency[a] * 3;
+                    locked[remap[result[t]]] = true;
+                    locked[remap[result[t + 1]]] = true;
+                    locked[remap[result[t + 2]]] = true;
+                }
+                locked[toPosition] = true;
+            }
+
+            if (removed == 0) {
+                break;
+            }
+
+            //drop the triangles that became degenerate
+            size_t write = 0;
+            for (size_t t = 0; t + 2 < result.size(); t += 3) {
+                GLuint a = collapseTo[result[t]];
+                GLuint b = collapseTo[result[t + 1]];
+                GLuint c = collapseTo[result[t + 2]];
+                if (remap[a] == remap[b] || remap[b] == remap[c] || remap[a] == remap[c]) {
+                    continue;
+                }
+                result[write++] = a;
+                result[write++] = b;
+                result[write++] = c;
+            }
+            result.resize(write);
+            buildHalfEdges(result, remap, halfEdges);
+        }
+
+        return result;
+    }
+
+    //cell of every vertex on a grid of gridSize^3 cells over the unit cube
+    static void clusterVertices(const std::vector<glm::vec3>& positions, int gridSize, std::vector<unsigned long long>& cells) {
+        cells.resize(positions.size());
+        for (size_t v = 0; v < positions.size(); v++) {
+            unsigned long long cell = 0;
+            for (int axis = 0; axis < 3; axis++) {
+                int coordinate = std::min((int)(positions[v][axis] * gridSize), gridSize - 1);
+                cell = cell * (unsigned long long)gridSize + (unsigned long long)std::max(coordinate, 0);
+            }
+            cells[v] = cell;
+        }
+    }
+
+    static size_t countClusteredTriangles(const std::vector<GLuint>& indices, const std::vector<unsigned long long>& cells) {
+        size_t count = 0;
+        for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+            unsigned long long a = cells[indices[t]], b = cells[indices[t + 1]], c = cells[indices[t + 2]];
+            if (a != b && b != c && a != c) {
+                count++;
+            }
+        }
+        return count;
+    }
+
+    //locked vertices get a cell of their own, past the ones of the grid, shared by the wedges of a position
+    static void lockCells(const std::vector<bool>& lockedVertices, const std::vector<GLuint>& remap, std::vector<unsigned long long>& cells) {
+        for (size_t v = 0; v < lockedVertices.size(); v++) {
+            if (lockedVertices[v]) {
+                cells[v] = (1ull << 63) | remap[v];
+            }
+        }
+    }
+
+    std::vector<GLuint> simplifyMeshSloppy(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+        const std::vector<bool>& lockedVertices, size_t targetIndexCount, float& resultError) {
+        resultError = 0.0f;
+        if (indices.size() <= targetIndexCount || vertices.empty()) {
+            return indices;
+        }
+
+        std::vector<glm::vec3> positions = normalizedPositions(vertices);
+        std::vector<unsigned long long> cells;
+        std::vector<GLuint> remap;
+        std::vector<unsigned int> wedges;
+        buildPositionRemap(positions, remap, wedges);
+
+        //finest grid that still reaches the target, the triangle count grows with the grid
+        int low = 1;
+        int high = MAX_CLUSTER_GRID;
+        while (low < high) {
+            int middle = (low + high + 1) / 2;
+            clusterVertices(positions, middle, cells);
+            lockCells(lockedVertices, remap, cells);
+            if (countClusteredTriangles(indices, cells) * 3 <= targetIndexCount) {
+                low = middle;
+            }
+            else {
+                high = middle - 1;
+            }
+        }
+        int gridSize = low;
+        clusterVertices(positions, gridSize, cells);
+        lockCells(lockedVertices, remap, cells);
+
+        //the representative of a cell is the used vertex closest to the average of its used vertices
+        std::vector<GLuint> used(indices.begin(), indices.end());
+        std::sort(used.begin(), used.end());
+        used.erase(std::unique(used.begin(), used.end()), used.end());
+        std::sort(used.begin(), used.end(), [&cells](GLuint a, GLuint b) {
+            return cells[a] < cells[b] || (cells[a] == cells[b] && a < b);
+        });
+
+        std::vector<GLuint> representative(vertices.size(), 0);
+        for (size_t begin = 0; begin < used.size();) {
+            size_t end = begin;
+            glm::vec3 average(0.0f);
+            while (end < used.size() && cells[used[end]] == cells[used[begin]]) {
+                average += positions[used[end]];
+                end++;
+            }
+            average /= (float)(end - begin);
+
+            GLuint best = used[begin];
+            float bestDistance = glm::dot(positions[best] - average, positions[best] - average);
+            for (size_t i = begin + 1; i < end; i++) {
+                float distance = glm::dot(positions[used[i]] - average, positions[used[i]] - average);
+                if (distance < bestDistance) {
+                    best = used[i];
+                    bestDistance = distance;
+                }
+            }
+            for (size_t i = begin; i < end; i++) {
+                representative[used[i]] = best;
+            }
+            begin = end;
+        }
+
+        //collapsed triangles, rotated so the smallest index is first to find the duplicates
+        std::vector<unsigned long long> seen;
+        std::vector<GLuint> result;
+        for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+            if (cells[indices[t]] == cells[indices[t + 1]] || cells[indices[t + 1]] == cells[indices[t + 2]]
+                || cells[indices[t]] == cells[indices[t + 2]]) {
+                continue;
+            }
+            GLuint corners[3] = { representative[indices[t]], representative[indices[t + 1]], representative[indices[t + 2]] };
+            int first = corners[0] < corners[1] ? (corners[0] < corners[2] ? 0 : 2) : (corners[1] < corners[2] ? 1 : 2);
+            for (int k = 0; k < 3; k++) {
+                result.push_back(corners[(first + k) % 3]);
+            }
+        }
+
+        std::vector<size_t> order(result.size() / 3);
+        for (size_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&result](size_t a, size_t b) {
+            return std::lexicographical_compare(result.begin() + a * 3, result.begin() + a * 3 + 3,
+                result.begin() + b * 3, result.begin() + b * 3 + 3);
+        });
+        std::vector<GLuint> unique;
+        unique.reserve(result.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            if (i > 0 && std::equal(result.begin() + order[i] * 3, result.begin() + order[i] * 3 + 3, result.begin() + order[i - 1] * 3)) {
+                continue;
+            }
+            unique.insert(unique.end(), result.begin() + order[i] * 3, result.begin() + order[i] * 3 + 3);
+        }
+
+        //a vertex moves at most a cell diagonal
+        resultError = std::sqrt(3.0f) / (float)gridSize;
+        return unique;
+    }
+
+    std::vector<MeshLod> buildLodChain(const std::vector<Vertex>& vertices, std::vector<GLuint>& indices,
+        const std::vector<glm::vec3>& lockedPositions) {
+        std::vector<MeshLod> lods;
+        MeshLod full = { 0, indices.size(), 0.0f, 0, 0 };
+        lods.push_back(full);
+
+        size_t fullIndexCount = indices.size();
+        if (fullIndexCount / 3 < MIN_LOD_TRIANGLES) {
+            return lods;
+        }
+
+        AABB bounds;
+        for (size_t i = 0; i < vertices.size(); i++) {
+            bounds.expand(vertices[i].Position);
+        }
+        glm::vec3 size = bounds.max - bounds.min;
+        float extent = std::max(size.x, std::max(size.y, size.z));
+        if (extent <= 0.0f) {
+            return lods;
+        }
+
+        //matched by position, the vertices were reordered since the split
+        std::vector<glm::vec3> sortedLocked = lockedPositions;
+        std::sort(sortedLocked.begin(), sortedLocked.end(), lessPosition);
+        std::vector<bool> lockedVertices(sortedLocked.empty() ? 0 : vertices.size(), false);
+        for (size_t v = 0; v < lockedVertices.size(); v++) {
+            lockedVertices[v] = std::binary_search(sortedLocked.begin(), sortedLocked.end(), vertices[v].Position, lessPosition);
+        }
+
+        std::vector<GLuint> previous = indices;
+        float error = 0.0f;
+        for (size_t level = 1; level < MAX_LOD_LEVELS; level++) {
+            size_t targetIndexCount = (size_t)(fullIndexCount / 3 * LOD_TRIANGLE_RATIOS[level - 1]) * 3;
+
+            float levelError = 0.0f;
+            std::vector<GLuint> lod = simplifyMesh(vertices, previous, lockedVertices, targetIndexCount, 1.0f, levelError);
+            //the collapse stalls on meshes made of many small open pieces
+            if (lod.size() > targetIndexCount + targetIndexCount / 2) {
+                float sloppyError = 0.0f;
+                std::vector<GLuint> sloppy = simplifyMeshSloppy(vertices, previous, lockedVertices, targetIndexCount, sloppyError);
+                if (!sloppy.empty() && sloppy.size() < lod.size()) {
+                    lod.swap(sloppy);
+                    levelError = sloppyError;
+                }
+            }
+
+            if (lod.empty() || lod.size() > previous.size() - (size_t)(previous.size() * MIN_LOD_REDUCTION)) {
+                break;
+            }
+            optimizeVertexCache(lod, vertices.size());
+
+            //every level is simplified from the previous one, so the deviations add up
+            error += levelError * extent;
+            MeshLod entry = { indices.size(), lod.size(), error, 0, 0 };
+            indices.insert(indices.end(), lod.begin(), lod.end());
+            lods.push_back(entry);
+            previous.swap(lod);
+        }
+
+        return lods;
+    }
+
+    void splitMesh(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+        std::vector<std::vector<Vertex> >& chunkVertices, std::vector<std::vector<GLuint> >& chunkIndices,
+        std::vector<std::vector<glm::vec3> >& chunkSeams) {
+        chunkVertices.clear();
+        chunkIndices.clear();
+        chunkSeams.clear();
+
+        size_t triangleCount = indices.size() / 3;
+        size_t cellsPerAxis = std::min((size_t)std::sqrt((double)triangleCount / CHUNK_TRIANGLES), MAX_CHUNKS_PER_AXIS);
+        if (cellsPerAxis < 2) {
+            chunkVertices.push_back(vertices);
+            chunkIndices.push_back(indices);
+            chunkSeams.push_back(std::vector<glm::vec3>());
+            return;
+        }
+
+        AABB bounds;
+        for (size_t i = 0; i < vertices.size(); i++) {
+            bounds.expand(vertices[i].Position);
+        }
+        glm::vec3 size = bounds.max - bounds.min;
+
+        //the grid spans the two largest axes
+        int axes[3] = { 0, 1, 2 };
+        std::sort(axes, axes + 3, [&size](int a, int b) {
+            return size[a] > size[b];
+        });
+
+        std::vector<std::vector<size_t> > cellTriangles(cellsPerAxis * cellsPerAxis);
+        for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+            glm::vec3 centroid = (vertices[indices[t]].Position + vertices[indices[t + 1]].Position + vertices[indices[t + 2]].Position) / 3.0f;
+            size_t cell = 0;
+            for (int k = 1; k >= 0; k--) {
+                int axis = axes[k];
+                float relative = size[axis] > 0.0f ? (centroid[axis] - bounds.min[axis]) / size[axis] : 0.0f;
+                size_t coordinate = (size_t)std::max(0.0f, std::min(relative * cellsPerAxis, (float)(cellsPerAxis - 1)));
+                cell = cell * cellsPerAxis + coordinate;
+            }
+            cellTriangles[cell].push_back(t);
+        }
+
+        //a position used by the triangles of two chunks lies on their seam
+        std::vector<glm::vec3> positions(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++) {
+            positions[i] = vertices[i].Position;
+        }
+        std::vector<GLuint> positionRemap;
+        std::vector<unsigned int> wedges;
+        buildPositionRemap(positions, positionRemap, wedges);
+        const size_t noChunk = (size_t)-1;
+        const size_t manyChunks = (size_t)-2;
+        std::vector<size_t> positionChunk(vertices.size(), noChunk);
+        for (size_t c = 0; c < cellTriangles.size(); c++) {
+            for (size_t i = 0; i < cellTriangles[c].size(); i++) {
+                for (int k = 0; k < 3; k++) {
+                    size_t& chunk = positionChunk[positionRemap[indices[cellTriangles[c][i] + k]]];
+                    chunk = chunk == noChunk || chunk == c ? c : manyChunks;
+                }
+            }
+        }
+
+        //compact the vertices of every chunk in order of first use
+        const GLuint unassigned = 0xFFFFFFFFu;
+        std::vector<GLuint> remap(vertices.size(), unassigned);
+        for (size_t c = 0; c < cellTriangles.size(); c++) {
+            if (cellTriangles[c].empty()) {
+                continue;
+            }
+            chunkVertices.push_back(std::vector<Vertex>());
+            chunkIndices.push_back(std::vector<GLuint>());
+            chunkSeams.push_back(std::vector<glm::vec3>());
+            std::vector<Vertex>& outVertices = chunkVertices.back();
+            std::vector<GLuint>& outIndices = chunkIndices.back();
+            std::vector<glm::vec3>& outSeam = chunkSeams.back();
+
+            for (size_t i = 0; i < cellTriangles[c].size(); i++) {
+                for (int k = 0; k < 3; k++) {
+                    GLuint v = indices[cellTriangles[c][i] + k];
+                    if (remap[v] == unassigned) {
+                        remap[v] = (GLuint)outVertices.size();
+                        outVertices.push_back(vertices[v]);
+                        if (positionChunk[positionRemap[v]] == manyChunks) {
+                            outSeam.push_back(vertices[v].Position);
+                        }
+                    }
+                    outIndices.push_back(remap[v]);
+                }
+            }
+            for (size_t i = 0; i < cellTriangles[c].size(); i++) {
+                for (int k = 0; k < 3; k++) {
+                    remap[indices[cellTriangles[c][i] + k]] = unassigned;
+                }
+            }
+        }
+    }
+
+}
@@ -0,0 +1,41 @@
+#ifndef MeshSimplifier_hpp
+#define MeshSimplifier_hpp
+
+#include "Mesh.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    //levels including the full detail one
+    const size_t MAX_LOD_LEVELS = 4;
+    //meshes smaller than this are always drawn at full detail
+    const size_t MIN_LOD_TRIANGLES = 64;
+    //large meshes are split so their parts can change detail independently
+    const size_t CHUNK_TRIANGLES = 8192;
+
+    //quadric error edge collapse (Garland & Heckbert) over the existing vertices, returns the new indices.
+    //UV seams, non-manifold vertices and the vertices flagged in lockedVertices (may be empty) are locked,
+    //open borders only collapse along themselves. targetError and resultError are relative to the mesh extent
+    std::vector<GLuint> simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+        const std::vector<bool>& lockedVertices, size_t targetIndexCount, float targetError, float& resultError);
+
+    //vertex clustering on a grid, for meshes the collapse cannot reduce (foliage cards, many small pieces).
+    //The vertices flagged in lockedVertices keep their own cell
+    std::vector<GLuint> simplifyMeshSloppy(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+        const std::vector<bool>& lockedVertices, size_t targetIndexCount, float& resultError);
+
+    //appends up to MAX_LOD_LEVELS - 1 coarser levels to indices, returns the levels starting with the full detail one.
+    //The vertices at one of lockedPositions are never collapsed. The errors are in model space units
+    std::vector<MeshLod> buildLodChain(const std::vector<Vertex>& vertices, std::vector<GLuint>& indices,
+        const std::vector<glm::vec3>& lockedPositions);
+
+    //splits a mesh on a grid over its two largest axes into parts of about CHUNK_TRIANGLES triangles.
+    //chunkSeams gets the positions each chunk shares with another, they have to stay for the chunks to meet
+    void splitMesh(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+        std::vector<std::vector<Vertex> >& chunkVertices, std::vector<std::vector<GLuint> >& chunkIndices,
+        std::vector<std::vector<glm::vec3> >& chunkSeams);
+
+}
+
+#endif /* MeshSimplifier_hpp */
@@ -13,6 +13,21 @@
 		}
 	}
 
+	const std::vector<Mesh*>& Model3D::GetMeshes()
+	{
+		return meshList;
+	}
+
+	gps::AABB Model3D::GetBounds()
+	{
+		gps::AABB bounds;
+		for (size_t i = 0; i < meshList.size(); i++)
+		{
+			bounds.expand(meshList[i]->getBounds());
+		}
+		return bounds;
+	}
+
 	void Model3D::LoadModel(const std::string& fileName, const std::string path, bool transparentModel)
 	{
 		Assimp::Importer importer;
@@ -27,8 +42,21 @@
 		directory = path.substr(0, path.find_last_of("/"));
 
 		isTransparentModel = transparentModel;
+
+		modelFileName = fileName;
+		if (!gps::loadMeshCache(gps::meshCachePath(fileName), meshCache)) {
+			meshCache.clear();
+		}
+		nextCachedMesh = 0;
+		meshCacheDirty = false;
 		
 		LoadNode(scene->mRootNode, scene);
+
+		if (meshCacheDirty || nextCachedMesh != meshCache.size()) {
+			meshCache.resize(nextCachedMesh);
+			gps::saveMeshCache(gps::meshCachePath(fileName), meshCache);
+		}
+		meshCache.clear();
 		
 		
 		//LoadMaterials(scene);
@@ -66,6 +94,8 @@
 				new_vertex.TexCoords = glm::vec2(0.0f, 0.0f);
 			}
 			new_vertex.Normal = glm::vec3(-mesh->mNormals[i].x, -mesh->mNormals[i].y, -mesh->mNormals[i].z );
+			// given by the lightmap atlas to the meshes that get one
+			new_vertex.LightmapCoords = glm::vec2(-1.0f, -1.0f);
 
 			vertices.push_back(new_vertex);
 		}
@@ -97,11 +127,85 @@
 
 		}
 
-		Mesh* newMesh = new Mesh(vertices, indices, loadedTextures);
-		meshList.push_back(newMesh);
+		// large meshes are split so distant parts can drop detail on their own
+		std::vector<std::vector<Vertex> > chunkVertices;
+		std::vector<std::vector<GLuint> > chunkIndices;
+		std::vector<std::vector<glm::vec3> > chunkSeams;
+		gps::splitMesh(vertices, indices, chunkVertices, chunkIndices, chunkSeams);
+
+		for (size_t c = 0; c < chunkVertices.size(); c++)
+		{
+			LoadChunk(chunkVertices[c], chunkIndices[c], chunkSeams[c], mesh->mName.C_Str());
+		}
 		
 	}
 
+	// optimizes a mesh (or a chunk of one) and builds its levels of detail, or reuses the cached result
+	void Model3D::LoadChunk(std::vector<Vertex>& vertices, std::vector<GLuint>& indices, const std::vector<glm::vec3>& seam, const char* meshName)
+	{
+		unsigned int sourceVertexCount = (unsigned int)vertices.size();
+		unsigned int sourceFaceCount = (unsigned int)(indices.size() / 3);
+		unsigned long long sourceHash = gps::hashMeshSource(vertices, indices);
+		gps::VertexCacheStats before = gps::analyzeVertexCache(indices, vertices.size());
+
+		std::vector<MeshLod> lods;
+		size_t cacheIndex = nextCachedMesh++;
+		if (cacheIndex < meshCache.size()
+			&& meshCache[cacheIndex].sourceVertexCount == sourceVertexCount
+			&& meshCache[cacheIndex].sourceFaceCount == sourceFaceCount
+			&& meshCache[cacheIndex].sourceHash == sourceHash) {
+			vertices = meshCache[cacheIndex].vertices;
+			indices = meshCache[cacheIndex].indices;
+			size_t indexOffset = 0;
+			for (size_t l = 0; l < meshCache[cacheIndex].lodIndexCounts.size(); l++)
+			{
+				MeshLod lod = { indexOffset, meshCache[cacheIndex].lodIndexCounts[l], meshCache[cacheIndex].lodErrors[l], 0, 0 };
+				lods.push_back(lod);
+				indexOffset += lod.indexCount;
+			}
+		}
+		else {
+			gps::optimizeMesh(vertices, indices);
+			// the seam stays as it is so the neighbouring chunks meet at any level
+			lods = gps::buildLodChain(vertices, indices, seam);
+
+			gps::CachedMesh cached;
+			cached.sourceVertexCount = sourceVertexCount;
+			cached.sourceFaceCount = sourceFaceCount;
+			cached.sourceHash = sourceHash;
+			cached.vertices = vertices;
+			cached.indices = indices;
+			for (size_t l = 0; l < lods.size(); l++)
+			{
+				cached.lodIndexCounts.push_back((unsigned int)lods[l].indexCount);
+				cached.lodErrors.push_back(lods[l].error);
+			}
+			if (cacheIndex < meshCache.size()) {
+				meshCache[cacheIndex] = cached;
+			}
+			else {
+				meshCache.push_back(cached);
+			}
+			meshCacheDirty = true;
+		}
+
+		Mesh* newMesh = new Mesh(vertices, indices, loadedTextures, lods);
+		newMesh->name = meshName;
+		meshList.push_back(newMesh);
+
+		std::vector<GLuint> fullDetail(indices.begin(), indices.begin() + lods[0].indexCount);
+		gps::VertexCacheStats after = gps::analyzeVertexCache(fullDetail, vertices.size());
+		MeshStats stats = newMesh->getStats();
+		printf("%s [%s]: %zu tris, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, %d-bit indices (%zu ranges, %zu KB)\n",
+			modelFileName.c_str(), meshName, stats.indexCount / 3,
+			before.acmr, after.acmr, before.atvr, after.atvr,
+			stats.indexType == GL_UNSIGNED_SHORT ? 16 : 32, stats.rangeCount, stats.indexBufferBytes / 1024);
+		for (size_t l = 1; l < lods.size(); l++)
+		{
+			printf("    LOD%zu: %zu tris, error %.4f\n", l, lods[l].indexCount / 3, lods[l].error);
+		}
+	}
+
 
 	// load list of textures
 	std::vector<Texture> Model3D::loadTextures(aiMaterial* mat, aiTextureType type, std::string textureName) {
@@ -133,6 +237,7 @@
 				newTexture.id = ReadTextureFromFile((directory + "/" + filename).c_str());
 				newTexture.type = textureName;
 				newTexture.path = directory + "/" + filename;
+				newTexture.isSRGB = !isTransparentModel;
 				textures.push_back(newTexture);
 			}
 		}
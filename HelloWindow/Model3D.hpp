@@ -8,6 +8,9 @@
 #include <assimp\postprocess.h>      
 
 #include "Mesh.hpp"
+#include "MeshCache.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshSimplifier.hpp"
 #include "stb_image.h"
 
 	class Model3D
@@ -17,6 +20,10 @@
 
 		void LoadModel(const std::string& fileName, const std::string path, bool isTransparentModel);
 		void RenderModel(gps::Shader shaderProgram);
+
+		const std::vector<Mesh*>& GetMeshes();
+		// bounds of all meshes in model space
+		gps::AABB GetBounds();
 		
 		~Model3D();
 
@@ -24,6 +31,7 @@
 
 		void LoadNode(aiNode* node, const aiScene* scene);
 		void LoadMesh(aiMesh* mesh, const aiScene* scene);
+		void LoadChunk(std::vector<Vertex>& vertices, std::vector<GLuint>& indices, const std::vector<glm::vec3>& seam, const char* meshName);
 
 		// Reads the pixel data from an image file and loads it into the video memory
 		GLuint ReadTextureFromFile(const char* file_name);
@@ -35,6 +43,12 @@
 
 		std::string directory;
 		bool isTransparentModel = false;
+
+		// optimized geometry from "<model>.meshcache", rebuilt when missing or stale
+		std::string modelFileName;
+		std::vector<gps::CachedMesh> meshCache;
+		size_t nextCachedMesh = 0;
+		bool meshCacheDirty = false;
 	};
 
 
@@ -0,0 +1,269 @@
+#include "OcclusionCuller.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+namespace gps {
+
+    void OcclusionCuller::init(ThreadPool* pool) {
+        this->pool = pool;
+        rasterizer.setThreadPool(pool);
+        printf("occlusion culling: %dx%d depth buffer, %zu threads\n",
+            OCCLUSION_BUFFER_WIDTH, OCCLUSION_BUFFER_HEIGHT, pool->getThreadCount());
+    }
+
+    //two triangles over the corners in order
+    static void addQuad(std::vector<glm::vec3>& triangles, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const glm::vec3& d) {
+        triangles.push_back(a);
+        triangles.push_back(b);
+        triangles.push_back(c);
+        triangles.push_back(a);
+        triangles.push_back(c);
+        triangles.push_back(d);
+    }
+
+    size_t OcclusionCuller::addOccluder(Occluder& occluder, const char* kind) {
+        if (occluder.triangles.size() / 3 > OCCLUDER_MESH_TRIANGLES) {
+            printf("occluder %zu: %zu triangles over the budget of %zu, the rest is dropped\n",
+                occluders.size(), occluder.triangles.size() / 3, OCCLUDER_MESH_TRIANGLES);
+            occluder.triangles.resize(OCCLUDER_MESH_TRIANGLES * 3);
+        }
+        printf("occluder %zu: %s, %zu triangles\n", occluders.size(), kind, occluder.triangles.size() / 3);
+        occluders.push_back(occluder);
+        return occluders.size() - 1;
+    }
+
+    size_t OcclusionCuller::addHeightfieldOccluder(Model3D& model, const glm::mat4& modelMatrix) {
+        //two triangles per cell
+        const int cells = (int)std::sqrt((double)(OCCLUDER_MESH_TRIANGLES / 2));
+        const std::vector<Mesh*>& meshes = model.GetMeshes();
+        AABB bounds = model.GetBounds();
+        glm::vec2 cellSize = glm::vec2(bounds.max.x - bounds.min.x, bounds.max.z - bounds.min.z) / (float)cells;
+
+        //a triangle is nowhere lower than its lowest vertex, every cell it overlaps is lowered to that.
+        //Cells no triangle reaches stay empty and get no quad
+        std::vector<float> lowest(cells * cells, FLT_MAX);
+        for (size_t m = 0; m < meshes.size(); m++) {
+            Mesh* mesh = meshes[m];
+            const MeshLod& level = mesh->getLod(0);
+            for (size_t i = level.indexOffset; i + 2 < level.indexOffset + level.indexCount; i += 3) {
+                AABB triangle;
+                for (int v = 0; v < 3; v++) {
+                    triangle.expand(mesh->vertices[mesh->indices[i + v]].Position);
+                }
+                int x0 = glm::clamp((int)std::floor((triangle.min.x - bounds.min.x) / cellSize.x), 0, cells - 1);
+                int x1 = glm::clamp((int)std::floor((triangle.max.x - bounds.min.x) / cellSize.x), 0, cells - 1);
+                int z0 = glm::clamp((int)std::floor((triangle.min.z - bounds.min.z) / cellSize.y), 0, cells - 1);
+                int z1 = glm::clamp((int)std::floor((triangle.max.z - bounds.min.z) / cellSize.y), 0, cells - 1);
+                for (int z = z0; z <= z1; z++) {
+                    for (int x = x0; x <= x1; x++) {
+                        lowest[z * cells + x] = std::min(lowest[z * cells + x], triangle.min.y);
+                    }
+                }
+            }
+        }
+
+        //a corner takes the lowest of the cells around it, so the quads meet and none rises above its cell
+        std::vector<float> corners((cells + 1) * (cells + 1), FLT_MAX);
+        for (int z = 0; z < cells; z++) {
+            for (int x = 0; x < cells; x++) {
+                float height = lowest[z * cells + x];
+                for (int corner = 0; corner < 4; corner++) {
+                    float& cornerHeight = corners[(z + corner / 2) * (cells + 1) + x + corner % 2];
+                    cornerHeight = std::min(cornerHeight, height);
+                }
+            }
+        }
+
+        Occluder occluder;
+        occluder.modelMatrix = modelMatrix;
+        for (int z = 0; z < cells; z++) {
+            for (int x = 0; x < cells; x++) {
+                if (lowest[z * cells + x] == FLT_MAX) {
+                    continue;
+                }
+                float x0 = bounds.min.x + x * cellSize.x;
+                float z0 = bounds.min.z + z * cellSize.y;
+                addQuad(occluder.triangles,
+                    glm::vec3(x0, corners[z * (cells + 1) + x], z0),
+                    glm::vec3(x0 + cellSize.x, corners[z * (cells + 1) + x + 1], z0),
+                    glm::vec3(x0 + cellSize.x, corners[(z + 1) * (cells + 1) + x + 1], z0 + cellSize.y),
+                    glm::vec3(x0, corners[(z + 1) * (cells + 1) + x], z0 + cellSize.y));
+            }
+        }
+        return addOccluder(occluder, "heightfield");
+    }
+
+    size_t OcclusionCuller::addWallOccluder(const std::vector<glm::vec2>& footprint, float floorY, float ceilingY,
+        const std::vector<OccluderOpening>& openings, const glm::mat4& modelMatrix) {
+        glm::vec2 center = glm::vec2(0.0f);
+        for (size_t i = 0; i < footprint.size(); i++) {
+            center += footprint[i] / (float)footprint.size();
+        }
+        float bottom = floorY + OCCLUDER_WALL_INSET;
+        float top = ceilingY - OCCLUDER_WALL_INSET;
+
+        Occluder occluder;
+        occluder.modelMatrix = modelMatrix;
+        for (size_t i = 0; i < footprint.size(); i++) {
+            glm::vec2 start = footprint[i];
+            glm::vec2 end = footprint[(i + 1) % footprint.size()];
+            float length = glm::length(end - start);
+            glm::vec2 along = (end - start) / length;
+            glm::vec2 inward = glm::vec2(-along.y, along.x);
+            if (glm::dot(center - start, inward) < 0.0f) {
+                inward = -inward;
+            }
+            //also shortened at both ends, the corners stay inside the neighbouring walls
+            glm::vec2 origin = start + inward * OCCLUDER_WALL_INSET;
+
+            //the openings in this wall as [from, to] along it, grown by the inset
+            std::vector<OccluderOpening> spans;
+            for (size_t o = 0; o < openings.size(); o++) {
+                const OccluderOpening& opening = openings[o];
+                float startOffset = std::fabs(glm::dot(opening.start - start, inward));
+                float endOffset = std::fabs(glm::dot(opening.end - start, inward));
+                if (startOffset > 4.0f * OCCLUDER_WALL_INSET || endOffset > 4.0f * OCCLUDER_WALL_INSET) {
+                    continue;
+                }
+                float from = glm::dot(opening.start - start, along);
+                float to = glm::dot(opening.end - start, along);
+                OccluderOpening span = opening;
+                span.start = glm::vec2(std::min(from, to) - OCCLUDER_WALL_INSET, 0.0f);
+                span.end = glm::vec2(std::max(from, to) + OCCLUDER_WALL_INSET, 0.0f);
+                span.bottom = opening.bottom - OCCLUDER_WALL_INSET;
+                span.top = opening.top + OCCLUDER_WALL_INSET;
+                spans.push_back(span);
+            }
+            std::sort(spans.begin(), spans.end(), [](const OccluderOpening& a, const OccluderOpening& b) {
+                return a.start.x < b.start.x;
+            });
+
+            //full height pieces between the openings, the parts below and above each opening
+            float cursor = OCCLUDER_WALL_INSET;
+            float wallEnd = length - OCCLUDER_WALL_INSET;
+            std::vector<glm::vec4> pieces;
+            for (size_t s = 0; s < spans.size(); s++) {
+                float from = std::max(spans[s].start.x, cursor);
+                float to = std::min(spans[s].end.x, wallEnd);
+                if (from > cursor) {
+                    pieces.push_back(glm::vec4(cursor, from, bottom, top));
+                }
+                if (to > from && spans[s].bottom > bottom) {
+                    pieces.push_back(glm::vec4(from, to, bottom, std::min(spans[s].bottom, top)));
+                }
+                if (to > from && spans[s].top < top) {
+                    pieces.push_back(glm::vec4(from, to, std::max(spans[s].top, bottom), top));
+                }
+                cursor = std::max(cursor, to);
+            }
+            if (wallEnd > cursor) {
+                pieces.push_back(glm::vec4(cursor, wallEnd, bottom, top));
+            }
+
+            for (size_t p = 0; p < pieces.size(); p++) {
+                glm::vec2 from = origin + along * pieces[p].x;
+                glm::vec2 to = origin + along * pieces[p].y;
+                addQuad(occluder.triangles,
+                    glm::vec3(from.x, pieces[p].z, from.y), glm::vec3(to.x, pieces[p].z, to.y),
+                    glm::vec3(to.x, pieces[p].w, to.y), glm::vec3(from.x, pieces[p].w, from.y));
+            }
+        }
+        return addOccluder(occluder, "walls");
+    }
+
+    size_t OcclusionCuller::addBoxOccluder(const AABB& box, const glm::mat4& modelMatrix) {
+        glm::vec3 corners[8];
+        for (int i = 0; i < 8; i++) {
+            corners[i] = glm::vec3(i & 1 ? box.max.x : box.min.x, i & 2 ? box.max.y : box.min.y, i & 4 ? box.max.z : box.min.z);
+        }
+        Occluder occluder;
+        occluder.modelMatrix = modelMatrix;
+        addQuad(occluder.triangles, corners[0], corners[1], corners[3], corners[2]);
+        addQuad(occluder.triangles, corners[4], corners[5], corners[7], corners[6]);
+        addQuad(occluder.triangles, corners[0], corners[1], corners[5], corners[4]);
+        addQuad(occluder.triangles, corners[2], corners[3], corners[7], corners[6]);
+        addQuad(occluder.triangles, corners[0], corners[2], corners[6], corners[4]);
+        addQuad(occluder.triangles, corners[1], corners[3], corners[7], corners[5]);
+        return addOccluder(occluder, "box");
+    }
+
+    void OcclusionCuller::setOccluderMatrix(size_t occluder, const glm::mat4& modelMatrix) {
+        occluders[occluder].modelMatrix = modelMatrix;
+    }
+
+    void OcclusionCuller::setEnabled(bool enabled) {
+        this->enabled = enabled;
+    }
+
+    void OcclusionCuller::update(const glm::mat4& viewProjection) {
+        testedObjects = 0;
+        occludedObjects = 0;
+        if (!enabled) {
+            return;
+        }
+
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+        worldTriangles.clear();
+        for (size_t o = 0; o < occluders.size(); o++) {
+            const Occluder& occluder = occluders[o];
+            for (size_t v = 0; v < occluder.triangles.size(); v++) {
+                worldTriangles.push_back(glm::vec3(occluder.modelMatrix * glm::vec4(occluder.triangles[v], 1.0f)));
+            }
+        }
+        rasterizer.render(worldTriangles, viewProjection);
+
+        rasterMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    void OcclusionCuller::cullModel(Model3D& model, const glm::mat4& modelMatrix) {
+        const std::vector<Mesh*>& meshes = model.GetMeshes();
+        for (size_t i = 0; i < meshes.size(); i++) {
+            cullMesh(*meshes[i], modelMatrix);
+        }
+    }
+
+    bool OcclusionCuller::cullMesh(Mesh& mesh, const glm::mat4& modelMatrix) {
+        //already culled outside the view
+        if (!enabled || mesh.isOccluded()) {
+            return false;
+        }
+        testedObjects++;
+        if (rasterizer.isVisible(mesh.getBounds().transformed(modelMatrix))) {
+            return false;
+        }
+        occludedObjects++;
+        mesh.setOccluded(true);
+        occludedMeshes.push_back(&mesh);
+        return true;
+    }
+
+    void OcclusionCuller::restore() {
+        for (size_t i = 0; i < occludedMeshes.size(); i++) {
+            occludedMeshes[i]->setOccluded(false);
+        }
+        occludedMeshes.clear();
+    }
+
+    size_t OcclusionCuller::getTestedObjects() {
+        return testedObjects;
+    }
+
+    size_t OcclusionCuller::getOccludedObjects() {
+        return occludedObjects;
+    }
+
+    void OcclusionCuller::printStats() {
+        if (!enabled || ++framesSinceReport < OCCLUSION_REPORT_FRAMES) {
+            return;
+        }
+        framesSinceReport = 0;
+        printf("occlusion culling: %zu of %zu objects occluded, %zu occluder triangles rasterized in %.2f ms\n",
+            occludedObjects, testedObjects, rasterizer.getRasterizedTriangles(), rasterMilliseconds);
+    }
+
+}
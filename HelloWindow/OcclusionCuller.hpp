@@ -0,0 +1,91 @@
+#ifndef OcclusionCuller_hpp
+#define OcclusionCuller_hpp
+
+#include "Model3D.hpp"
+#include "DepthRasterizer.hpp"
+#include "ThreadPool.hpp"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace gps {
+
+    //most triangles one occluder may have, the heightfield grid is sized to it
+    const size_t OCCLUDER_MESH_TRIANGLES = 512;
+    //the walls are moved this far into the wall thickness and the openings grown by it, in model units
+    const float OCCLUDER_WALL_INSET = 0.025f;
+    //frames between two printed reports
+    const int OCCLUSION_REPORT_FRAMES = 120;
+
+    //a door or window left open in a wall occluder, in model space
+    struct OccluderOpening {
+        //ends on the footprint, x and z
+        glm::vec2 start;
+        glm::vec2 end;
+        float bottom;
+        float top;
+    };
+
+    //Renders a few simplified occluders on the CPU every frame and marks the meshes
+    //whose bounds are hidden behind them, Mesh::Draw then skips them. The occluders stay
+    //inside the surfaces they stand for, they can only hide less than the real geometry
+    class OcclusionCuller
+    {
+    public:
+        //the rasterizer runs on the pool, which is shared with the owner
+        void init(ThreadPool* pool);
+
+        //a grid over the model's xz bounds at the lowest height of the triangles over each cell, for terrain
+        //seen from above. Returns the occluder index
+        size_t addHeightfieldOccluder(Model3D& model, const glm::mat4& modelMatrix);
+        //walls along the closed xz footprint from floorY to ceilingY, set inside the footprint by
+        //OCCLUDER_WALL_INSET and without the openings
+        size_t addWallOccluder(const std::vector<glm::vec2>& footprint, float floorY, float ceilingY,
+            const std::vector<OccluderOpening>& openings, const glm::mat4& modelMatrix);
+        //the faces of a box that lies inside the solid part of a model
+        size_t addBoxOccluder(const AABB& box, const glm::mat4& modelMatrix);
+        //for occluders that move
+        void setOccluderMatrix(size_t occluder, const glm::mat4& modelMatrix);
+        //when disabled nothing is rendered and every test passes
+        void setEnabled(bool enabled);
+
+        //renders the occluders, once per frame before culling
+        void update(const glm::mat4& viewProjection);
+        //marks the hidden meshes as occluded until restore()
+        void cullModel(Model3D& model, const glm::mat4& modelMatrix);
+        bool cullMesh(Mesh& mesh, const glm::mat4& modelMatrix);
+        //clears the marks, the shadow pass needs the hidden meshes
+        void restore();
+
+        //objects tested and occluded since the last update
+        size_t getTestedObjects();
+        size_t getOccludedObjects();
+        //prints the last frame's counts every OCCLUSION_REPORT_FRAMES calls
+        void printStats();
+
+    private:
+        struct Occluder {
+            //model space, three vertices per triangle
+            std::vector<glm::vec3> triangles;
+            glm::mat4 modelMatrix;
+        };
+
+        //keeps the first OCCLUDER_MESH_TRIANGLES triangles
+        size_t addOccluder(Occluder& occluder, const char* kind);
+
+        bool enabled = true;
+        ThreadPool* pool = nullptr;
+        DepthRasterizer rasterizer;
+        std::vector<Occluder> occluders;
+        std::vector<glm::vec3> worldTriangles;
+        std::vector<Mesh*> occludedMeshes;
+
+        size_t testedObjects = 0;
+        size_t occludedObjects = 0;
+        double rasterMilliseconds = 0.0;
+        int framesSinceReport = 0;
+    };
+
+}
+
+#endif /* OcclusionCuller_hpp */
@@ -0,0 +1,176 @@
+#include "OcclusionQueries.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cstdio>
+
+namespace gps {
+
+    void OcclusionQueries::init(const std::string& name) {
+        this->name = name;
+
+        //unit cube, stretched over each box by boundingBox.vert
+        const GLfloat corners[] = {
+            0.0f, 0.0f, 0.0f,  1.0f, 0.0f, 0.0f,  1.0f, 1.0f, 0.0f,  0.0f, 1.0f, 0.0f,
+            0.0f, 0.0f, 1.0f,  1.0f, 0.0f, 1.0f,  1.0f, 1.0f, 1.0f,  0.0f, 1.0f, 1.0f
+        };
+        const GLubyte indices[] = {
+            0, 2, 1,  0, 3, 2,
+            4, 5, 6,  4, 6, 7,
+            0, 1, 5,  0, 5, 4,
+            3, 6, 2,  3, 7, 6,
+            0, 4, 7,  0, 7, 3,
+            1, 2, 6,  1, 6, 5
+        };
+
+        glGenVertexArrays(1, &boxVAO);
+        glGenBuffers(1, &boxVBO);
+        glGenBuffers(1, &boxEBO);
+        glBindVertexArray(boxVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, boxVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, boxEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
+        glBindVertexArray(0);
+    }
+
+    void OcclusionQueries::add(Mesh& mesh, const glm::mat4& modelMatrix) {
+        Object object;
+        object.mesh = &mesh;
+        object.bounds = mesh.getBounds().transformed(modelMatrix);
+        glGenQueries(OCCLUSION_QUERY_LATENCY, object.queries);
+        for (int i = 0; i < OCCLUSION_QUERY_LATENCY; i++) {
+            object.queryFrames[i] = 0;
+        }
+        object.firstPending = 0;
+        object.pendingCount = 0;
+        object.visible = true;
+        object.resultFrame = 0;
+        object.containsCamera = false;
+        objects.push_back(object);
+    }
+
+    void OcclusionQueries::setEnabled(bool enabled) {
+        this->enabled = enabled;
+    }
+
+    void OcclusionQueries::setConditionalRender(bool enabled) {
+        conditionalRender = enabled;
+    }
+
+    void OcclusionQueries::beginFrame(const glm::vec3& cameraPosition) {
+        frame++;
+        skippedObjects = 0;
+        conditionalObjects = 0;
+        issuedQueries = 0;
+        pendingQueries = 0;
+        if (!enabled) {
+            return;
+        }
+
+        for (size_t i = 0; i < objects.size(); i++) {
+            Object& object = objects[i];
+
+            //results arrive in issue order, stop at the first one the GPU has not finished
+            while (object.pendingCount > 0) {
+                GLuint query = object.queries[object.firstPending];
+                GLuint available = GL_FALSE;
+                glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+                if (available == GL_FALSE) {
+                    break;
+                }
+                GLuint anySamplesPassed = GL_FALSE;
+                glGetQueryObjectuiv(query, GL_QUERY_RESULT, &anySamplesPassed);
+                object.visible = anySamplesPassed != GL_FALSE;
+                object.resultFrame = object.queryFrames[object.firstPending];
+                object.firstPending = (object.firstPending + 1) % OCCLUSION_QUERY_LATENCY;
+                object.pendingCount--;
+            }
+            pendingQueries += object.pendingCount;
+
+            AABB grown = object.bounds;
+            grown.min -= glm::vec3(OCCLUSION_QUERY_MARGIN);
+            grown.max += glm::vec3(OCCLUSION_QUERY_MARGIN);
+            object.containsCamera = glm::all(glm::greaterThanEqual(cameraPosition, grown.min)) &&
+                glm::all(glm::lessThanEqual(cameraPosition, grown.max));
+            if (object.containsCamera) {
+                continue;
+            }
+
+            //only last frame's box says anything about this frame's view, older ones are ignored
+            if (object.pendingCount > 0) {
+                int newest = (object.firstPending + object.pendingCount - 1) % OCCLUSION_QUERY_LATENCY;
+                if (conditionalRender && object.queryFrames[newest] + 1 == frame) {
+                    //the GPU reads the result when it reaches the draw, and draws anyway if it is not there yet
+                    object.mesh->setConditionalQuery(object.queries[newest]);
+                    markedMeshes.push_back(object.mesh);
+                    conditionalObjects++;
+                }
+            }
+            else if (!object.visible && object.resultFrame + 1 == frame) {
+                object.mesh->setOccluded(true);
+                markedMeshes.push_back(object.mesh);
+                skippedObjects++;
+            }
+        }
+    }
+
+    void OcclusionQueries::issueQueries(gps::Shader boxShader, const glm::mat4& viewProjection) {
+        if (!enabled) {
+            return;
+        }
+
+        boxShader.useShaderProgram();
+        glUniformMatrix4fv(glGetUniformLocation(boxShader.shaderProgram, "viewProjection"), 1, GL_FALSE, glm::value_ptr(viewProjection));
+        GLint boxMinLoc = glGetUniformLocation(boxShader.shaderProgram, "boxMin");
+        GLint boxMaxLoc = glGetUniformLocation(boxShader.shaderProgram, "boxMax");
+
+        //both sides of the boxes are tested, nothing is written
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        glDisable(GL_CULL_FACE);
+        glBindVertexArray(boxVAO);
+
+        for (size_t i = 0; i < objects.size(); i++) {
+            Object& object = objects[i];
+            //a GPU this far behind gets no more work until it catches up
+            if (object.containsCamera || object.pendingCount == OCCLUSION_QUERY_LATENCY) {
+                continue;
+            }
+            int slot = (object.firstPending + object.pendingCount) % OCCLUSION_QUERY_LATENCY;
+            glUniform3fv(boxMinLoc, 1, glm::value_ptr(object.bounds.min));
+            glUniform3fv(boxMaxLoc, 1, glm::value_ptr(object.bounds.max));
+            glBeginQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE, object.queries[slot]);
+            glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, (GLvoid*)0);
+            glEndQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE);
+            object.queryFrames[slot] = frame;
+            object.pendingCount++;
+            issuedQueries++;
+        }
+
+        glBindVertexArray(0);
+        glEnable(GL_CULL_FACE);
+        glDepthMask(GL_TRUE);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    }
+
+    void OcclusionQueries::restore() {
+        for (size_t i = 0; i < markedMeshes.size(); i++) {
+            markedMeshes[i]->setOccluded(false);
+            markedMeshes[i]->setConditionalQuery(0);
+        }
+        markedMeshes.clear();
+    }
+
+    void OcclusionQueries::printStats() {
+        if (!enabled || ++framesSinceReport < OCCLUSION_QUERY_REPORT_FRAMES) {
+            return;
+        }
+        framesSinceReport = 0;
+        printf("%s queries: %zu objects, %zu skipped, %zu conditional, %zu issued, %zu still in flight\n",
+            name.c_str(), objects.size(), skippedObjects, conditionalObjects, issuedQueries, pendingQueries);
+    }
+
+}
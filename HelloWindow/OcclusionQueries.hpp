@@ -0,0 +1,83 @@
+#ifndef OcclusionQueries_hpp
+#define OcclusionQueries_hpp
+
+#include "Mesh.hpp"
+#include "BoundingBox.hpp"
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //queries an object can have in flight before it stops issuing new ones
+    const int OCCLUSION_QUERY_LATENCY = 3;
+    //a camera this close to a box may see none of its faces, the mesh is then drawn without a test
+    const float OCCLUSION_QUERY_MARGIN = 0.05f;
+    //frames between two printed reports
+    const int OCCLUSION_QUERY_REPORT_FRAMES = 120;
+
+    //Hardware occlusion queries on the bounding boxes of a few large, often hidden meshes.
+    //The boxes are drawn against the depth of one frame and their results steer the next:
+    //a mesh whose box was hidden is skipped once the result is read back, a mesh whose
+    //result is still in flight is drawn under glBeginConditionalRender. Nothing waits on the GPU.
+    class OcclusionQueries
+    {
+    public:
+        //creates the box geometry, the name tags the reports
+        void init(const std::string& name);
+        //the mesh is tested with its bounds under the model matrix
+        void add(Mesh& mesh, const glm::mat4& modelMatrix);
+        //when disabled no query is issued and every mesh is drawn
+        void setEnabled(bool enabled);
+        //off while a depth pre-pass runs: a result arriving between the pre-pass and the GL_EQUAL lit pass
+        //would leave holes, so meshes whose result is in flight are then drawn unconditionally
+        void setConditionalRender(bool enabled);
+
+        //reads back the finished queries and marks the meshes for the main pass, once per frame
+        void beginFrame(const glm::vec3& cameraPosition);
+        //draws the boxes with color and depth writes off, call once the main pass has drawn the occluders
+        void issueQueries(gps::Shader boxShader, const glm::mat4& viewProjection);
+        //clears the marks, the shadow pass needs every mesh
+        void restore();
+
+        //prints the last frame's counts every OCCLUSION_QUERY_REPORT_FRAMES calls
+        void printStats();
+
+    private:
+        struct Object {
+            Mesh* mesh;
+            //world space
+            AABB bounds;
+            //ring of queries, the in flight ones oldest first from firstPending
+            GLuint queries[OCCLUSION_QUERY_LATENCY];
+            unsigned int queryFrames[OCCLUSION_QUERY_LATENCY];
+            int firstPending;
+            int pendingCount;
+            //last result read back and the frame its query was issued in
+            bool visible;
+            unsigned int resultFrame;
+            bool containsCamera;
+        };
+
+        std::string name;
+        bool enabled = true;
+        bool conditionalRender = true;
+        std::vector<Object> objects;
+        std::vector<Mesh*> markedMeshes;
+        unsigned int frame = 0;
+
+        GLuint boxVAO = 0;
+        GLuint boxVBO = 0;
+        GLuint boxEBO = 0;
+
+        size_t skippedObjects = 0;
+        size_t conditionalObjects = 0;
+        size_t issuedQueries = 0;
+        size_t pendingQueries = 0;
+        int framesSinceReport = 0;
+    };
+
+}
+
+#endif /* OcclusionQueries_hpp */
@@ -0,0 +1,111 @@
+#include "OverdrawMeter.hpp"
+
+#include <cstdio>
+
+namespace gps {
+
+    void OverdrawMeter::init(const std::string& name) {
+        this->name = name;
+        countsInvocations = GLEW_ARB_pipeline_statistics_query != 0;
+        if (!countsInvocations) {
+            printf("overdraw %s: ARB_pipeline_statistics_query is not supported, only samples are counted\n", name.c_str());
+        }
+
+        //the default framebuffer is multisampled, a fully covered pixel passes this many samples per layer
+        glGetIntegerv(GL_SAMPLES, &samplesPerPixel);
+        if (samplesPerPixel < 1) {
+            samplesPerPixel = 1;
+        }
+
+        for (int i = 0; i < OVERDRAW_QUERY_FRAMES; i++) {
+            glGenQueries(1, &slots[i].samplesQuery);
+            slots[i].invocationsQuery = 0;
+            if (countsInvocations) {
+                glGenQueries(1, &slots[i].invocationsQuery);
+            }
+            slots[i].pixels = 0.0;
+            slots[i].pending = false;
+        }
+        initialized = true;
+    }
+
+    void OverdrawMeter::begin(const std::string& mode, GLsizei width, GLsizei height) {
+        if (!initialized) {
+            return;
+        }
+        if (mode != this->mode) {
+            //the queries still in flight belong to the previous mode
+            this->mode = mode;
+            for (int i = 0; i < OVERDRAW_QUERY_FRAMES; i++) {
+                slots[i].pending = false;
+            }
+            reset();
+        }
+
+        QuerySlot& slot = slots[currentSlot];
+        if (slot.pending) {
+            collect(slot);
+        }
+        slot.pixels = (double)width * (double)height;
+        glBeginQuery(GL_SAMPLES_PASSED, slot.samplesQuery);
+        if (countsInvocations) {
+            glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB, slot.invocationsQuery);
+        }
+    }
+
+    void OverdrawMeter::end() {
+        if (!initialized) {
+            return;
+        }
+        glEndQuery(GL_SAMPLES_PASSED);
+        if (countsInvocations) {
+            glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+        }
+        slots[currentSlot].pending = true;
+        currentSlot = (currentSlot + 1) % OVERDRAW_QUERY_FRAMES;
+    }
+
+    void OverdrawMeter::collect(QuerySlot& slot) {
+        slot.pending = false;
+
+        //a result that is still not ready is dropped rather than waited for
+        GLuint available = 0;
+        glGetQueryObjectuiv(slot.samplesQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available && countsInvocations) {
+            glGetQueryObjectuiv(slot.invocationsQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        }
+        if (!available) {
+            return;
+        }
+
+        GLuint64 result = 0;
+        glGetQueryObjectui64v(slot.samplesQuery, GL_QUERY_RESULT, &result);
+        samples += (double)result;
+        if (countsInvocations) {
+            glGetQueryObjectui64v(slot.invocationsQuery, GL_QUERY_RESULT, &result);
+            invocations += (double)result;
+        }
+        pixels += slot.pixels;
+        measuredFrames++;
+
+        if (measuredFrames >= OVERDRAW_REPORT_FRAMES) {
+            if (countsInvocations) {
+                printf("overdraw %s [%s]: %.2f shaded fragments per pixel, %.2f depth-passing layers per sample (%d frames)\n",
+                    name.c_str(), mode.c_str(), invocations / pixels, samples / (pixels * samplesPerPixel), measuredFrames);
+            }
+            else {
+                printf("overdraw %s [%s]: %.2f depth-passing layers per sample (%d frames)\n",
+                    name.c_str(), mode.c_str(), samples / (pixels * samplesPerPixel), measuredFrames);
+            }
+            reset();
+        }
+    }
+
+    void OverdrawMeter::reset() {
+        measuredFrames = 0;
+        samples = 0.0;
+        invocations = 0.0;
+        pixels = 0.0;
+    }
+
+}
@@ -0,0 +1,55 @@
+#ifndef OverdrawMeter_hpp
+#define OverdrawMeter_hpp
+
+#include <GL/glew.h>
+
+#include <string>
+
+namespace gps {
+
+    //frames of queries in flight, results are read this many frames late so the CPU never waits on the GPU
+    const int OVERDRAW_QUERY_FRAMES = 3;
+    //frames averaged in one printed report
+    const int OVERDRAW_REPORT_FRAMES = 120;
+
+    //counts the depth-passing samples and the fragment shader invocations of a part of the frame
+    //and periodically prints them per pixel of the viewport
+    class OverdrawMeter
+    {
+    public:
+        void init(const std::string& name);
+
+        //the mode tags the report (e.g. which foliage path is on), changing it restarts the average
+        void begin(const std::string& mode, GLsizei width, GLsizei height);
+        void end();
+
+    private:
+        struct QuerySlot {
+            GLuint samplesQuery;
+            GLuint invocationsQuery;
+            double pixels;
+            bool pending;
+        };
+
+        std::string name;
+        std::string mode;
+        //fragment shader invocations need ARB_pipeline_statistics_query
+        bool countsInvocations = false;
+        GLint samplesPerPixel = 1;
+        bool initialized = false;
+
+        QuerySlot slots[OVERDRAW_QUERY_FRAMES];
+        int currentSlot = 0;
+
+        int measuredFrames = 0;
+        double samples = 0.0;
+        double invocations = 0.0;
+        double pixels = 0.0;
+
+        void collect(QuerySlot& slot);
+        void reset();
+    };
+
+}
+
+#endif /* OverdrawMeter_hpp */
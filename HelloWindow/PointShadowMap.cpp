@@ -0,0 +1,118 @@
+#include "PointShadowMap.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cstdio>
+
+namespace gps {
+
+    bool PointShadowMap::init(const glm::vec3& position, float range) {
+        this->position = position;
+        this->range = range;
+
+        glGenTextures(1, &cubemap);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+        for (int face = 0; face < 6; face++) {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_DEPTH_COMPONENT24, POINT_SHADOW_SIZE, POINT_SHADOW_SIZE,
+                0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        }
+        //read through a shadow sampler, the compare of the 4 nearest texels is filtered
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+        //all six faces are attached, gl_Layer picks the face
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cubemap, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        if (status != GL_FRAMEBUFFER_COMPLETE) {
+            printf("point shadow map: framebuffer incomplete (0x%x) at %dx%d\n", status, POINT_SHADOW_SIZE, POINT_SHADOW_SIZE);
+            return false;
+        }
+        dirty = true;
+        return true;
+    }
+
+    void PointShadowMap::invalidate(const AABB& bounds) {
+        if (bounds.isEmpty()) {
+            return;
+        }
+        glm::vec3 closest = glm::clamp(position, bounds.min, bounds.max);
+        glm::vec3 offset = position - closest;
+        if (glm::dot(offset, offset) <= range * range) {
+            dirty = true;
+        }
+    }
+
+    bool PointShadowMap::needsUpdate() {
+        return dirty;
+    }
+
+    AABB PointShadowMap::getBounds() {
+        AABB bounds;
+        bounds.min = position - glm::vec3(range);
+        bounds.max = position + glm::vec3(range);
+        return bounds;
+    }
+
+    void PointShadowMap::beginShadowPass(gps::Shader shader) {
+        //looking down each axis in the order of the cubemap faces, with the up vectors of its convention
+        const glm::vec3 directions[6] = {
+            glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+            glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+            glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+        };
+        const glm::vec3 ups[6] = {
+            glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+            glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+            glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)
+        };
+        glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, POINT_SHADOW_NEAR, range);
+        glm::mat4 faceMatrices[6];
+        for (int face = 0; face < 6; face++) {
+            faceMatrices[face] = projection * glm::lookAt(position, position + directions[face], ups[face]);
+        }
+
+        shader.useShaderProgram();
+        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "faceMatrices"), 6, GL_FALSE, glm::value_ptr(faceMatrices[0]));
+        glUniform3fv(glGetUniformLocation(shader.shaderProgram, "lightPosition"), 1, glm::value_ptr(position));
+        glUniform1f(glGetUniformLocation(shader.shaderProgram, "lightRange"), range);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, POINT_SHADOW_SIZE, POINT_SHADOW_SIZE);
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    void PointShadowMap::endShadowPass() {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        dirty = false;
+        if (++updates % POINT_SHADOW_REPORT_UPDATES == 1) {
+            printf("point shadow map: drawn %d times\n", updates);
+        }
+    }
+
+    void PointShadowMap::bind(gps::Shader shader) {
+        shader.useShaderProgram();
+        glActiveTexture(GL_TEXTURE0 + POINT_SHADOW_UNIT);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+        glActiveTexture(GL_TEXTURE0);
+        glUniform3fv(glGetUniformLocation(shader.shaderProgram, "pointShadowPosition"), 1, glm::value_ptr(position));
+        glUniform1f(glGetUniformLocation(shader.shaderProgram, "pointShadowRange"), range);
+    }
+
+    GLuint PointShadowMap::getTexture() {
+        return cubemap;
+    }
+
+}
@@ -0,0 +1,60 @@
+#ifndef PointShadowMap_hpp
+#define PointShadowMap_hpp
+
+#include <GL/glew.h>
+
+#include "Shader.hpp"
+#include "BoundingBox.hpp"
+
+#include <glm/glm.hpp>
+
+namespace gps {
+
+    //texels per side of a face of the cubemap
+    const int POINT_SHADOW_SIZE = 512;
+    //texture unit of the cubemap, after the lightmap
+    const GLint POINT_SHADOW_UNIT = 12;
+    //near plane of the face projections
+    const float POINT_SHADOW_NEAR = 0.05f;
+    //updates between two printed reports
+    const int POINT_SHADOW_REPORT_UPDATES = 30;
+
+    //Shadow cubemap of a point light that does not move. It holds the distance to the light over its range
+    //and is drawn in a single layered pass: the geometry shader sends every triangle to the faces whose
+    //frustum it touches. The map is kept between frames and only drawn again once a caster moved within
+    //the light's range.
+    class PointShadowMap
+    {
+    public:
+        //creates the cubemap, false when the framebuffer is incomplete
+        bool init(const glm::vec3& position, float range);
+
+        //the map is drawn again on the next update when the box reaches into the light's range
+        void invalidate(const AABB& bounds);
+        bool needsUpdate();
+        //box around the light's range, for gathering the casters
+        AABB getBounds();
+
+        //binds the layered target and sets the face matrices and the light of the shader, the casters
+        //are then drawn with it
+        void beginShadowPass(gps::Shader shader);
+        //back to the default framebuffer, the map is up to date
+        void endShadowPass();
+
+        //binds the cubemap and sets the light of the shader
+        void bind(gps::Shader shader);
+
+        GLuint getTexture();
+
+    private:
+        glm::vec3 position = glm::vec3(0.0f);
+        float range = 1.0f;
+        GLuint framebuffer = 0;
+        GLuint cubemap = 0;
+        bool dirty = true;
+        int updates = 0;
+    };
+
+}
+
+#endif /* PointShadowMap_hpp */
@@ -0,0 +1,338 @@
+#include "PortalCuller.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace gps {
+
+    bool ConvexVolume::contains(const glm::vec3& point) const {
+        for (size_t i = 0; i < planes.size(); i++) {
+            if (glm::dot(glm::vec3(planes[i]), point) + planes[i].w < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //conservative: only rejects boxes fully behind one plane
+    bool ConvexVolume::intersects(const AABB& bounds) const {
+        if (bounds.isEmpty()) {
+            return false;
+        }
+        for (size_t i = 0; i < planes.size(); i++) {
+            //the box corner farthest along the plane normal
+            glm::vec3 farthest = glm::vec3(
+                planes[i].x >= 0.0f ? bounds.max.x : bounds.min.x,
+                planes[i].y >= 0.0f ? bounds.max.y : bounds.min.y,
+                planes[i].z >= 0.0f ? bounds.max.z : bounds.min.z);
+            if (glm::dot(glm::vec3(planes[i]), farthest) + planes[i].w < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //plane through a point, facing towards inside
+    static glm::vec4 planeFacing(const glm::vec3& normal, const glm::vec3& point, const glm::vec3& inside) {
+        glm::vec4 plane = glm::vec4(normal, -glm::dot(normal, point));
+        if (glm::dot(normal, inside) + plane.w < 0.0f) {
+            plane = -plane;
+        }
+        return plane;
+    }
+
+    //the six planes of a view projection matrix (Gribb & Hartmann)
+    static ConvexVolume frustumOf(const glm::mat4& viewProjection) {
+        glm::vec4 rows[4];
+        for (int r = 0; r < 4; r++) {
+            rows[r] = glm::vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
+        }
+        ConvexVolume frustum;
+        for (int axis = 0; axis < 3; axis++) {
+            frustum.planes.push_back(rows[3] + rows[axis]);
+            frustum.planes.push_back(rows[3] - rows[axis]);
+        }
+        for (size_t i = 0; i < frustum.planes.size(); i++) {
+            frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+        }
+        return frustum;
+    }
+
+    //Sutherland-Hodgman against every plane of the volume
+    static std::vector<glm::vec3> clipPolygon(const std::vector<glm::vec3>& polygon, const ConvexVolume& volume) {
+        std::vector<glm::vec3> result = polygon;
+        for (size_t p = 0; p < volume.planes.size() && result.size() >= 3; p++) {
+            const glm::vec4& plane = volume.planes[p];
+            std::vector<glm::vec3> clipped;
+            for (size_t i = 0; i < result.size(); i++) {
+                const glm::vec3& a = result[i];
+                const glm::vec3& b = result[(i + 1) % result.size()];
+                float distanceA = glm::dot(glm::vec3(plane), a) + plane.w;
+                float distanceB = glm::dot(glm::vec3(plane), b) + plane.w;
+                if (distanceA >= 0.0f) {
+                    clipped.push_back(a);
+                }
+                if ((distanceA >= 0.0f) != (distanceB >= 0.0f)) {
+                    clipped.push_back(a + (b - a) * (distanceA / (distanceA - distanceB)));
+                }
+            }
+            result = clipped;
+        }
+        return result;
+    }
+
+    int PortalCuller::addCell(const std::string& name) {
+        Cell cell;
+        cell.name = name;
+        cell.isBounded = false;
+        cells.push_back(cell);
+        unboundedCell = (int)cells.size() - 1;
+        return unboundedCell;
+    }
+
+    int PortalCuller::addCell(const std::string& name, const std::vector<glm::vec2>& footprint, float minY, float maxY) {
+        Cell cell;
+        cell.name = name;
+        cell.isBounded = true;
+
+        glm::vec2 center = glm::vec2(0.0f);
+        for (size_t i = 0; i < footprint.size(); i++) {
+            center += footprint[i] / (float)footprint.size();
+        }
+        glm::vec3 inside = glm::vec3(center.x, (minY + maxY) * 0.5f, center.y);
+        for (size_t i = 0; i < footprint.size(); i++) {
+            glm::vec2 a = footprint[i];
+            glm::vec2 b = footprint[(i + 1) % footprint.size()];
+            glm::vec3 normal = glm::normalize(glm::vec3(a.y - b.y, 0.0f, b.x - a.x));
+            cell.volume.planes.push_back(planeFacing(normal, glm::vec3(a.x, minY, a.y), inside));
+        }
+        cell.volume.planes.push_back(glm::vec4(0.0f, 1.0f, 0.0f, -minY));
+        cell.volume.planes.push_back(glm::vec4(0.0f, -1.0f, 0.0f, maxY));
+
+        cells.push_back(cell);
+        return (int)cells.size() - 1;
+    }
+
+    void PortalCuller::addPortal(int cellA, int cellB, const std::vector<glm::vec3>& corners) {
+        Portal portal;
+        portal.corners = corners;
+        glm::vec3 normal = glm::normalize(glm::cross(corners[1] - corners[0], corners[2] - corners[0]));
+        portal.plane = glm::vec4(normal, -glm::dot(normal, corners[0]));
+        portal.cells[0] = cellA;
+        portal.cells[1] = cellB;
+        portals.push_back(portal);
+        cells[cellA].portals.push_back(portals.size() - 1);
+        cells[cellB].portals.push_back(portals.size() - 1);
+    }
+
+    void PortalCuller::addMeshRule(const std::string& pattern, int cell) {
+        MeshRule rule = { pattern, cell };
+        meshRules.push_back(rule);
+    }
+
+    void PortalCuller::setEnabled(bool enabled) {
+        this->enabled = enabled;
+    }
+
+    int PortalCuller::findCell(const glm::vec3& point) {
+        for (size_t c = 0; c < cells.size(); c++) {
+            if (cells[c].isBounded && cells[c].volume.contains(point)) {
+                return (int)c;
+            }
+        }
+        return unboundedCell;
+    }
+
+    void PortalCuller::update(const glm::mat4& viewProjection, const glm::vec3& cameraPosition) {
+        this->viewProjection = viewProjection;
+        this->cameraPosition = cameraPosition;
+        cellFrusta.assign(cells.size(), std::vector<ConvexVolume>());
+        cellScreenBounds.assign(cells.size(), glm::vec4(1.0f, 1.0f, -1.0f, -1.0f));
+        cellNarrowed.assign(cells.size(), true);
+        portalsPassed = 0;
+        testedObjects = 0;
+        culledObjects = 0;
+
+        cameraCell = findCell(cameraPosition);
+        if (cameraCell < 0) {
+            return;
+        }
+        traverse(cameraCell, frustumOf(viewProjection), -1, 0, glm::vec4(-1.0f, -1.0f, 1.0f, 1.0f), false);
+    }
+
+    void PortalCuller::traverse(int cell, const ConvexVolume& frustum, int fromPortal, int depth, const glm::vec4& screenBounds, bool narrowed) {
+        cellFrusta[cell].push_back(frustum);
+        glm::vec4& bounds = cellScreenBounds[cell];
+        bounds = glm::vec4(glm::min(glm::vec2(bounds), glm::vec2(screenBounds)), glm::max(glm::vec2(bounds.z, bounds.w), glm::vec2(screenBounds.z, screenBounds.w)));
+        cellNarrowed[cell] = cellNarrowed[cell] && narrowed;
+        if (depth >= MAX_PORTAL_DEPTH) {
+            return;
+        }
+
+        for (size_t i = 0; i < cells[cell].portals.size(); i++) {
+            int p = (int)cells[cell].portals[i];
+            if (p == fromPortal) {
+                continue;
+            }
+            const Portal& portal = portals[p];
+            int nextCell = portal.cells[0] == cell ? portal.cells[1] : portal.cells[0];
+
+            //standing in the opening, the next cell is seen with the same frustum
+            float cameraDistance = glm::dot(glm::vec3(portal.plane), cameraPosition) + portal.plane.w;
+            if (std::abs(cameraDistance) < PORTAL_PASS_DISTANCE) {
+                portalsPassed++;
+                traverse(nextCell, frustum, p, depth + 1, screenBounds, narrowed);
+                continue;
+            }
+
+            std::vector<glm::vec3> visible = clipPolygon(portal.corners, frustum);
+            if (visible.size() < 3) {
+                continue;
+            }
+            portalsPassed++;
+
+            //the frustum narrowed to the visible part of the portal: planes through the eye and each
+            //edge, plus the portal plane itself so nothing on the near side is seen through it
+            glm::vec3 center = glm::vec3(0.0f);
+            for (size_t v = 0; v < visible.size(); v++) {
+                center += visible[v] / (float)visible.size();
+            }
+            ConvexVolume narrowedFrustum = frustum;
+            for (size_t v = 0; v < visible.size(); v++) {
+                glm::vec3 edgeNormal = glm::cross(visible[v] - cameraPosition, visible[(v + 1) % visible.size()] - cameraPosition);
+                float length = glm::length(edgeNormal);
+                if (length < 1e-8f) {
+                    continue;
+                }
+                narrowedFrustum.planes.push_back(planeFacing(edgeNormal / length, cameraPosition, center));
+            }
+            glm::vec3 beyond = center + (center - cameraPosition);
+            narrowedFrustum.planes.push_back(planeFacing(glm::vec3(portal.plane), center, beyond));
+
+            //screen bounds of the visible part, kept inside the bounds of the portals before it
+            glm::vec4 portalBounds = glm::vec4(1.0f, 1.0f, -1.0f, -1.0f);
+            for (size_t v = 0; v < visible.size(); v++) {
+                glm::vec4 clip = viewProjection * glm::vec4(visible[v], 1.0f);
+                glm::vec2 ndc = glm::vec2(clip) / std::max(clip.w, 1e-6f);
+                portalBounds = glm::vec4(glm::min(glm::vec2(portalBounds), ndc), glm::max(glm::vec2(portalBounds.z, portalBounds.w), ndc));
+            }
+            portalBounds = glm::vec4(glm::max(glm::vec2(portalBounds), glm::vec2(screenBounds)),
+                glm::min(glm::vec2(portalBounds.z, portalBounds.w), glm::vec2(screenBounds.z, screenBounds.w)));
+
+            traverse(nextCell, narrowedFrustum, p, depth + 1, portalBounds, true);
+        }
+    }
+
+    int PortalCuller::getCameraCell() {
+        return cameraCell;
+    }
+
+    bool PortalCuller::isCellVisible(int cell) {
+        return !enabled || !cellFrusta[cell].empty();
+    }
+
+    bool PortalCuller::getCellScissor(int cell, int viewportWidth, int viewportHeight, GLint rect[4]) {
+        if (!enabled || !cellNarrowed[cell] || cellFrusta[cell].empty()) {
+            return false;
+        }
+        glm::vec4 bounds = glm::clamp(cellScreenBounds[cell], glm::vec4(-1.0f), glm::vec4(1.0f));
+        rect[0] = (GLint)std::floor((bounds.x * 0.5f + 0.5f) * viewportWidth);
+        rect[1] = (GLint)std::floor((bounds.y * 0.5f + 0.5f) * viewportHeight);
+        rect[2] = std::max(0, (GLint)std::ceil((bounds.z * 0.5f + 0.5f) * viewportWidth) - rect[0]);
+        rect[3] = std::max(0, (GLint)std::ceil((bounds.w * 0.5f + 0.5f) * viewportHeight) - rect[1]);
+        return true;
+    }
+
+    unsigned int PortalCuller::getMeshCells(const std::string& meshName) {
+        //merged meshes list their sources separated by ','
+        unsigned int result = 0;
+        size_t start = 0;
+        while (start <= meshName.size()) {
+            size_t end = meshName.find(',', start);
+            if (end == std::string::npos) {
+                end = meshName.size();
+            }
+            std::string part = meshName.substr(start, end - start);
+            unsigned int partCells = 0;
+            for (size_t r = 0; r < meshRules.size(); r++) {
+                if (part.find(meshRules[r].pattern) != std::string::npos) {
+                    partCells |= 1u << meshRules[r].cell;
+                }
+            }
+            if (partCells == 0 && unboundedCell >= 0) {
+                partCells = 1u << unboundedCell;
+            }
+            result |= partCells;
+            start = end + 1;
+        }
+        return result;
+    }
+
+    bool PortalCuller::isVisible(const AABB& bounds, unsigned int cells) {
+        if (!enabled) {
+            return true;
+        }
+        for (size_t c = 0; c < cellFrusta.size(); c++) {
+            if (!(cells & (1u << c))) {
+                continue;
+            }
+            for (size_t f = 0; f < cellFrusta[c].size(); f++) {
+                if (cellFrusta[c][f].intersects(bounds)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void PortalCuller::cullModel(Model3D& model, const glm::mat4& modelMatrix) {
+        const std::vector<Mesh*>& meshes = model.GetMeshes();
+        for (size_t i = 0; i < meshes.size(); i++) {
+            cullMesh(*meshes[i], modelMatrix, getMeshCells(meshes[i]->name));
+        }
+    }
+
+    void PortalCuller::cullModel(Model3D& model, const glm::mat4& modelMatrix, unsigned int cells) {
+        const std::vector<Mesh*>& meshes = model.GetMeshes();
+        for (size_t i = 0; i < meshes.size(); i++) {
+            cullMesh(*meshes[i], modelMatrix, cells);
+        }
+    }
+
+    bool PortalCuller::cullMesh(Mesh& mesh, const glm::mat4& modelMatrix, unsigned int cells) {
+        if (!enabled) {
+            return false;
+        }
+        testedObjects++;
+        if (isVisible(mesh.getBounds().transformed(modelMatrix), cells)) {
+            return false;
+        }
+        culledObjects++;
+        mesh.setOccluded(true);
+        occludedMeshes.push_back(&mesh);
+        return true;
+    }
+
+    void PortalCuller::restore() {
+        for (size_t i = 0; i < occludedMeshes.size(); i++) {
+            occludedMeshes[i]->setOccluded(false);
+        }
+        occludedMeshes.clear();
+    }
+
+    void PortalCuller::printStats() {
+        if (!enabled || ++framesSinceReport < PORTAL_REPORT_FRAMES) {
+            return;
+        }
+        framesSinceReport = 0;
+        size_t visibleCells = 0;
+        for (size_t c = 0; c < cellFrusta.size(); c++) {
+            visibleCells += cellFrusta[c].empty() ? 0 : 1;
+        }
+        printf("portal culling: camera in %s, %zu of %zu cells visible through %zu portals, %zu of %zu objects culled\n",
+            cameraCell >= 0 ? cells[cameraCell].name.c_str() : "no cell", visibleCells, cells.size(), portalsPassed,
+            culledObjects, testedObjects);
+    }
+
+}
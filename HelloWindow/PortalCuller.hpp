@@ -0,0 +1,110 @@
+#ifndef PortalCuller_hpp
+#define PortalCuller_hpp
+
+#include "Model3D.hpp"
+#include "BoundingBox.hpp"
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //cells seen through this many portals in a row are not followed further
+    const int MAX_PORTAL_DEPTH = 4;
+    //a camera this close to a portal plane looks through it with the unclipped frustum,
+    //the planes through a portal edge degenerate when the eye is on it
+    const float PORTAL_PASS_DISTANCE = 0.05f;
+    //frames between two printed reports
+    const int PORTAL_REPORT_FRAMES = 120;
+
+    //convex region of world space bounded by planes, dot(plane.xyz, p) + plane.w >= 0 inside
+    struct ConvexVolume {
+        std::vector<glm::vec4> planes;
+
+        bool contains(const glm::vec3& point) const;
+        bool intersects(const AABB& bounds) const;
+    };
+
+    //Cells of space connected by portal polygons. Each frame the view frustum is clipped through
+    //the portals of the camera's cell, a cell is visible through the frusta that reach it.
+    class PortalCuller
+    {
+    public:
+        //the unbounded cell, holds every point outside the bounded ones
+        int addCell(const std::string& name);
+        //a prism over a convex world space footprint (x, z)
+        int addCell(const std::string& name, const std::vector<glm::vec2>& footprint, float minY, float maxY);
+        //convex polygon in world space
+        void addPortal(int cellA, int cellB, const std::vector<glm::vec3>& corners);
+        //meshes whose name contains the pattern belong to the cell, several rules may match.
+        //Meshes matching no rule belong to the unbounded cell
+        void addMeshRule(const std::string& pattern, int cell);
+        //when disabled every cell is visible with the plain view frustum
+        void setEnabled(bool enabled);
+
+        //walks the portals from the camera's cell, once per frame before culling
+        void update(const glm::mat4& viewProjection, const glm::vec3& cameraPosition);
+
+        int getCameraCell();
+        bool isCellVisible(int cell);
+        //screen rectangle (x, y, width, height) the cell is seen through, false when it is not narrowed by portals
+        bool getCellScissor(int cell, int viewportWidth, int viewportHeight, GLint rect[4]);
+        //bit i set for cell i
+        unsigned int getMeshCells(const std::string& meshName);
+        bool isVisible(const AABB& bounds, unsigned int cells);
+
+        //marks the meshes in no visible part of their cells as occluded until restore()
+        void cullModel(Model3D& model, const glm::mat4& modelMatrix);
+        void cullModel(Model3D& model, const glm::mat4& modelMatrix, unsigned int cells);
+        bool cullMesh(Mesh& mesh, const glm::mat4& modelMatrix, unsigned int cells);
+        void restore();
+
+        void printStats();
+
+    private:
+        struct Cell {
+            std::string name;
+            bool isBounded;
+            ConvexVolume volume;
+            std::vector<size_t> portals;
+        };
+
+        struct Portal {
+            std::vector<glm::vec3> corners;
+            glm::vec4 plane;
+            int cells[2];
+        };
+
+        struct MeshRule {
+            std::string pattern;
+            int cell;
+        };
+
+        std::vector<Cell> cells;
+        std::vector<Portal> portals;
+        std::vector<MeshRule> meshRules;
+        int unboundedCell = -1;
+        bool enabled = true;
+
+        glm::mat4 viewProjection;
+        glm::vec3 cameraPosition;
+        int cameraCell = -1;
+        //per cell: the frusta it is seen through and the screen bounds of the portals they pass, in NDC
+        std::vector<std::vector<ConvexVolume> > cellFrusta;
+        std::vector<glm::vec4> cellScreenBounds;
+        std::vector<bool> cellNarrowed;
+        size_t portalsPassed = 0;
+
+        std::vector<Mesh*> occludedMeshes;
+        size_t testedObjects = 0;
+        size_t culledObjects = 0;
+        int framesSinceReport = 0;
+
+        int findCell(const glm::vec3& point);
+        void traverse(int cell, const ConvexVolume& frustum, int fromPortal, int depth, const glm::vec4& screenBounds, bool narrowed);
+    };
+
+}
+
+#endif /* PortalCuller_hpp */
@@ -0,0 +1,189 @@
+#include "ProceduralSky.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    static const float PI = 3.14159265f;
+    //scale of the sky luminance, in kcd/m^2, before it is tone mapped
+    static const float SKY_EXPOSURE = 0.05f;
+    //angular radius of the sun and the moon discs, larger than the real ones to cover a few texels
+    static const float DISC_RADIUS = 0.03f;
+    //night sky, display colors at the horizon and the zenith, and of the moon
+    static const glm::vec3 NIGHT_HORIZON = glm::vec3(0.06f, 0.07f, 0.12f);
+    static const glm::vec3 NIGHT_ZENITH = glm::vec3(0.01f, 0.015f, 0.04f);
+    static const glm::vec3 MOON_COLOR = glm::vec3(0.8f, 0.8f, 0.75f);
+
+    //Perez et al. distribution of a sky value over the zenith angle theta and the angle gamma from the sun
+    static float perezDistribution(const float* c, float cosTheta, float gamma, float cosGamma) {
+        return (1.0f + c[0] * std::exp(c[1] / cosTheta)) * (1.0f + c[2] * std::exp(c[3] * gamma) + c[4] * cosGamma * cosGamma);
+    }
+
+    static float cubic(float t, float a, float b, float c, float d) {
+        return ((a * t + b) * t + c) * t + d;
+    }
+
+    void ProceduralSky::init(ThreadPool* pool, const glm::vec3& lightDir, float night) {
+        this->pool = pool;
+        for (int face = 0; face < 6; face++) {
+            faces[face].assign(PROCEDURAL_SKY_SIZE * PROCEDURAL_SKY_SIZE * 3, 0);
+        }
+
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+        for (int face = 0; face < 6; face++) {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGB8, PROCEDURAL_SKY_SIZE, PROCEDURAL_SKY_SIZE, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+        }
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+        nextTile = 0;
+        advance(lightDir, night, PROCEDURAL_SKY_TILES);
+    }
+
+    void ProceduralSky::update(const glm::vec3& lightDir, float night) {
+        advance(lightDir, night, PROCEDURAL_SKY_TILES_PER_FRAME);
+    }
+
+    GLuint ProceduralSky::getTexture() {
+        return texture;
+    }
+
+    SphericalHarmonics ProceduralSky::getAmbient() {
+        return ambient;
+    }
+
+    //the Perez coefficients and zenith values fitted by Preetham et al. for the turbidity and the sun
+    void ProceduralSky::beginSweep(const glm::vec3& lightDir, float night) {
+        this->night = night;
+        sunDirection = glm::normalize(lightDir);
+
+        //the model only holds for a sun above the horizon
+        float thetaS = std::acos(glm::clamp(sunDirection.y, 0.02f, 1.0f));
+        float T = PROCEDURAL_SKY_TURBIDITY;
+
+        const float coefficients[3][5] = {
+            { 0.1787f * T - 1.4630f, -0.3554f * T + 0.4275f, -0.0227f * T + 5.3251f, 0.1206f * T - 2.5771f, -0.0670f * T + 0.3703f },
+            { -0.0193f * T - 0.2592f, -0.0665f * T + 0.0008f, -0.0004f * T + 0.2125f, -0.0641f * T - 0.8989f, -0.0033f * T + 0.0452f },
+            { -0.0167f * T - 0.2608f, -0.0950f * T + 0.0092f, -0.0079f * T + 0.2102f, -0.0441f * T - 1.6537f, -0.0109f * T + 0.0529f }
+        };
+
+        float chi = (4.0f / 9.0f - T / 120.0f) * (PI - 2.0f * thetaS);
+        float zenith[3];
+        zenith[0] = (4.0453f * T - 4.9710f) * std::tan(chi) - 0.2155f * T + 2.4192f;
+        zenith[1] = T * T * cubic(thetaS, 0.00166f, -0.00375f, 0.00209f, 0.0f)
+            + T * cubic(thetaS, -0.02903f, 0.06377f, -0.03202f, 0.00394f)
+            + cubic(thetaS, 0.11693f, -0.21196f, 0.06052f, 0.25886f);
+        zenith[2] = T * T * cubic(thetaS, 0.00275f, -0.00610f, 0.00317f, 0.0f)
+            + T * cubic(thetaS, -0.04214f, 0.08970f, -0.04153f, 0.00516f)
+            + cubic(thetaS, 0.15346f, -0.26756f, 0.06670f, 0.26688f);
+
+        for (int channel = 0; channel < 3; channel++) {
+            std::copy(coefficients[channel], coefficients[channel] + 5, perez[channel].coefficients);
+            perez[channel].zenithScale = zenith[channel] / perezDistribution(coefficients[channel], 1.0f, thetaS, std::cos(thetaS));
+        }
+    }
+
+    void ProceduralSky::advance(const glm::vec3& lightDir, float night, int tiles) {
+        if (nextTile == 0) {
+            beginSweep(lightDir, night);
+        }
+        int first = nextTile;
+        int count = std::min(tiles, PROCEDURAL_SKY_TILES - first);
+        pool->parallelFor(count, [&](size_t i) {
+            evaluateTile(first + (int)i);
+        });
+
+        glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, PROCEDURAL_SKY_SIZE);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        const int tilesPerRow = PROCEDURAL_SKY_SIZE / PROCEDURAL_SKY_TILE;
+        for (int tile = first; tile < first + count; tile++) {
+            int face = tile / PROCEDURAL_SKY_TILES_PER_FACE;
+            int x = (tile % PROCEDURAL_SKY_TILES_PER_FACE) % tilesPerRow * PROCEDURAL_SKY_TILE;
+            int y = (tile % PROCEDURAL_SKY_TILES_PER_FACE) / tilesPerRow * PROCEDURAL_SKY_TILE;
+            glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, x, y, PROCEDURAL_SKY_TILE, PROCEDURAL_SKY_TILE,
+                GL_RGB, GL_UNSIGNED_BYTE, &faces[face][(y * PROCEDURAL_SKY_SIZE + x) * 3]);
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+        nextTile = first + count;
+        if (nextTile == PROCEDURAL_SKY_TILES) {
+            SphericalHarmonics projections[6];
+            pool->parallelFor(6, [&](size_t face) {
+                projections[face] = projectCubemapFace(faces[face].data(), PROCEDURAL_SKY_SIZE, PROCEDURAL_SKY_SIZE, (int)face);
+            });
+            ambient = SphericalHarmonics();
+            for (int face = 0; face < 6; face++) {
+                ambient.add(projections[face]);
+            }
+            nextTile = 0;
+        }
+    }
+
+    void ProceduralSky::evaluateTile(int tile) {
+        const int tilesPerRow = PROCEDURAL_SKY_SIZE / PROCEDURAL_SKY_TILE;
+        int face = tile / PROCEDURAL_SKY_TILES_PER_FACE;
+        int tileX = (tile % PROCEDURAL_SKY_TILES_PER_FACE) % tilesPerRow * PROCEDURAL_SKY_TILE;
+        int tileY = (tile % PROCEDURAL_SKY_TILES_PER_FACE) / tilesPerRow * PROCEDURAL_SKY_TILE;
+        for (int y = tileY; y < tileY + PROCEDURAL_SKY_TILE; y++) {
+            float t = 2.0f * (y + 0.5f) / PROCEDURAL_SKY_SIZE - 1.0f;
+            for (int x = tileX; x < tileX + PROCEDURAL_SKY_TILE; x++) {
+                float s = 2.0f * (x + 0.5f) / PROCEDURAL_SKY_SIZE - 1.0f;
+                glm::vec3 color = evaluate(glm::normalize(cubemapFaceDirection(face, s, t)));
+                unsigned char* texel = &faces[face][(y * PROCEDURAL_SKY_SIZE + x) * 3];
+                for (int channel = 0; channel < 3; channel++) {
+                    texel[channel] = (unsigned char)(glm::clamp(color[channel], 0.0f, 1.0f) * 255.0f + 0.5f);
+                }
+            }
+        }
+    }
+
+    glm::vec3 ProceduralSky::evaluate(const glm::vec3& direction) {
+        //below the horizon the sky keeps its horizon color, darkened towards the ground
+        float cosTheta = std::max(direction.y, 0.01f);
+        float cosGamma = glm::clamp(glm::dot(direction, sunDirection), -1.0f, 1.0f);
+        float gamma = std::acos(cosGamma);
+        float ground = 1.0f - 0.6f * glm::smoothstep(0.0f, -0.2f, direction.y);
+
+        glm::vec3 day(0.0f);
+        if (night < 1.0f) {
+            //luminance Y and chromaticity x, y, then XYZ to linear sRGB
+            float Y = perez[0].zenithScale * perezDistribution(perez[0].coefficients, cosTheta, gamma, cosGamma);
+            float x = perez[1].zenithScale * perezDistribution(perez[1].coefficients, cosTheta, gamma, cosGamma);
+            float y = perez[2].zenithScale * perezDistribution(perez[2].coefficients, cosTheta, gamma, cosGamma);
+            glm::vec3 XYZ = glm::vec3(x / y * Y, Y, (1.0f - x - y) / y * Y);
+            glm::vec3 linear = glm::vec3(
+                3.2406f * XYZ.x - 1.5372f * XYZ.y - 0.4986f * XYZ.z,
+                -0.9689f * XYZ.x + 1.8758f * XYZ.y + 0.0415f * XYZ.z,
+                0.0557f * XYZ.x - 0.2040f * XYZ.y + 1.0570f * XYZ.z);
+            linear = glm::max(linear, glm::vec3(0.0f)) * ground;
+            if (gamma < DISC_RADIUS && direction.y > 0.0f) {
+                linear += glm::vec3(100.0f);
+            }
+            //exponential tone mapping, then the sRGB curve the skybox images were stored with
+            for (int channel = 0; channel < 3; channel++) {
+                day[channel] = std::pow(1.0f - std::exp(-linear[channel] * SKY_EXPOSURE), 1.0f / 2.2f);
+            }
+        }
+
+        glm::vec3 dark(0.0f);
+        if (night > 0.0f) {
+            dark = glm::mix(NIGHT_HORIZON, NIGHT_ZENITH, std::sqrt(std::max(direction.y, 0.0f))) * ground;
+            float glow = std::exp(-gamma * 12.0f) * 0.15f;
+            dark += glow * MOON_COLOR;
+            if (gamma < DISC_RADIUS && direction.y > 0.0f) {
+                dark = MOON_COLOR;
+            }
+        }
+        return glm::mix(day, dark, night);
+    }
+
+}
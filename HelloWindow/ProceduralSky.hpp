@@ -0,0 +1,70 @@
+#ifndef ProceduralSky_hpp
+#define ProceduralSky_hpp
+
+#include <GL/glew.h>
+
+#include "SphericalHarmonics.hpp"
+#include "ThreadPool.hpp"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace gps {
+
+    //texels per side of a face of the sky cubemap
+    const int PROCEDURAL_SKY_SIZE = 64;
+    //faces are evaluated in square tiles of this many texels per side
+    const int PROCEDURAL_SKY_TILE = 16;
+    const int PROCEDURAL_SKY_TILES_PER_FACE = (PROCEDURAL_SKY_SIZE / PROCEDURAL_SKY_TILE) * (PROCEDURAL_SKY_SIZE / PROCEDURAL_SKY_TILE);
+    const int PROCEDURAL_SKY_TILES = 6 * PROCEDURAL_SKY_TILES_PER_FACE;
+    //tiles evaluated and uploaded a frame, a sweep over the whole cubemap takes 6 frames
+    const int PROCEDURAL_SKY_TILES_PER_FRAME = 16;
+    //haze of the daylight sky, 2 is a very clear one
+    const float PROCEDURAL_SKY_TURBIDITY = 2.5f;
+
+    //Daylight sky of the Preetham model, faded into a night sky lit by a moon, evaluated on the CPU into a
+    //small cubemap. The tiles of a sweep over the cubemap all see the light direction of its first frame and
+    //are spread over several frames, each frame's share split over the cores. The ambient light is projected
+    //from every finished sweep.
+    class ProceduralSky
+    {
+    public:
+        //evaluates and uploads the whole cubemap, the pool is shared with the owner
+        void init(ThreadPool* pool, const glm::vec3& lightDir, float night);
+        //evaluates and uploads the next PROCEDURAL_SKY_TILES_PER_FRAME tiles. night 0 is the daylight sky,
+        //with the sun towards lightDir, 1 the night sky, with the moon there
+        void update(const glm::vec3& lightDir, float night);
+
+        GLuint getTexture();
+        SphericalHarmonics getAmbient();
+
+    private:
+        //coefficients A to E of the Perez distribution of one of Y, x and y, and its zenith value
+        //over the distribution at the zenith
+        struct PerezChannel {
+            float coefficients[5];
+            float zenithScale;
+        };
+
+        ThreadPool* pool = nullptr;
+        GLuint texture = 0;
+        //RGB texels of the faces, in the GL_TEXTURE_CUBE_MAP_POSITIVE_X + face order
+        std::vector<unsigned char> faces[6];
+        SphericalHarmonics ambient;
+        int nextTile = 0;
+
+        //sky of the current sweep
+        glm::vec3 sunDirection = glm::vec3(0.0f, 1.0f, 0.0f);
+        float night = 0.0f;
+        PerezChannel perez[3];
+
+        void beginSweep(const glm::vec3& lightDir, float night);
+        void advance(const glm::vec3& lightDir, float night, int tiles);
+        void evaluateTile(int tile);
+        //display color of the sky in a direction
+        glm::vec3 evaluate(const glm::vec3& direction);
+    };
+
+}
+
+#endif /* ProceduralSky_hpp */
@@ -0,0 +1,386 @@
+#include "RenderGraph.hpp"
+
+#include <cstdio>
+
+namespace gps {
+
+    static bool isDepthFormat(GLenum internalFormat) {
+        return internalFormat == GL_DEPTH_COMPONENT16 || internalFormat == GL_DEPTH_COMPONENT24 ||
+            internalFormat == GL_DEPTH_COMPONENT32F || internalFormat == GL_DEPTH24_STENCIL8 ||
+            internalFormat == GL_DEPTH32F_STENCIL8;
+    }
+
+    static bool sameDesc(const RenderTargetDesc& a, const RenderTargetDesc& b) {
+        return a.width == b.width && a.height == b.height && a.internalFormat == b.internalFormat;
+    }
+
+    static bool contains(const std::vector<RenderGraphResource>& list, RenderGraphResource resource) {
+        for (size_t i = 0; i < list.size(); i++) {
+            if (list[i] == resource) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void RenderGraph::reset() {
+        resources.clear();
+        passes.clear();
+    }
+
+    RenderGraphResource RenderGraph::createTexture(const char* name, const RenderTargetDesc& desc) {
+        Resource resource = { name, desc, true, 0, -1, false, -1, -1 };
+        resources.push_back(resource);
+        return (RenderGraphResource)resources.size() - 1;
+    }
+
+    RenderGraphResource RenderGraph::importTexture(const char* name, GLuint texture) {
+        RenderTargetDesc desc = { 0, 0, GL_NONE };
+        Resource resource = { name, desc, false, texture, -1, false, -1, -1 };
+        resources.push_back(resource);
+        return (RenderGraphResource)resources.size() - 1;
+    }
+
+    RenderGraphResource RenderGraph::importTarget(const char* name, GLuint framebuffer, int width, int height) {
+        RenderTargetDesc desc = { width, height, GL_NONE };
+        Resource resource = { name, desc, false, 0, (GLint)framebuffer, false, -1, -1 };
+        resources.push_back(resource);
+        return (RenderGraphResource)resources.size() - 1;
+    }
+
+    RenderGraphPass RenderGraph::addPass(const char* name, GLbitfield clearMask, const std::function<void()>& execute) {
+        Pass pass;
+        pass.name = name;
+        pass.clearMask = clearMask;
+        pass.execute = execute;
+        passes.push_back(pass);
+        return (RenderGraphPass)passes.size() - 1;
+    }
+
+    void RenderGraph::read(RenderGraphPass pass, RenderGraphResource resource) {
+        passes[pass].reads.push_back(resource);
+    }
+
+    void RenderGraph::write(RenderGraphPass pass, RenderGraphResource resource) {
+        passes[pass].writes.push_back(resource);
+    }
+
+    void RenderGraph::markOutput(RenderGraphResource resource) {
+        resources[resource].output = true;
+    }
+
+    //the writers of a resource keep the order they were added in. A pass that only reads it sees all of
+    //their writes, one that also writes it those added before it
+    bool RenderGraph::dependsOn(int b, int a) const {
+        if (a == b) {
+            return false;
+        }
+        const std::vector<RenderGraphResource>& writes = passes[a].writes;
+        for (size_t i = 0; i < writes.size(); i++) {
+            bool bWrites = contains(passes[b].writes, writes[i]);
+            if ((bWrites && a < b) || (!bWrites && contains(passes[b].reads, writes[i]))) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool RenderGraph::cullAndOrder() {
+        int count = (int)passes.size();
+
+        //the passes writing an output, then everything they depend on
+        needed.assign(count, false);
+        order.clear();
+        for (int p = 0; p < count; p++) {
+            for (size_t i = 0; i < passes[p].writes.size(); i++) {
+                if (resources[passes[p].writes[i]].output) {
+                    needed[p] = true;
+                }
+            }
+            if (needed[p]) {
+                order.push_back(p);
+            }
+        }
+        for (size_t next = 0; next < order.size(); next++) {
+            for (int a = 0; a < count; a++) {
+                if (!needed[a] && dependsOn(order[next], a)) {
+                    needed[a] = true;
+                    order.push_back(a);
+                }
+            }
+        }
+
+        //Kahn's sort, the earliest added of the ready passes first
+        pendingDependencies.assign(count, 0);
+        for (int b = 0; b < count; b++) {
+            for (int a = 0; needed[b] && a < count; a++) {
+                if (needed[a] && dependsOn(b, a)) {
+                    pendingDependencies[b]++;
+                }
+            }
+        }
+        size_t neededCount = order.size();
+        order.clear();
+        while (order.size() < neededCount) {
+            int ready = -1;
+            for (int p = 0; p < count && ready < 0; p++) {
+                if (needed[p] && pendingDependencies[p] == 0) {
+                    ready = p;
+                }
+            }
+            if (ready < 0) {
+                return false;
+            }
+            order.push_back(ready);
+            pendingDependencies[ready] = -1;
+            for (int b = 0; b < count; b++) {
+                if (needed[b] && pendingDependencies[b] > 0 && dependsOn(b, ready)) {
+                    pendingDependencies[b]--;
+                }
+            }
+        }
+        return true;
+    }
+
+    void RenderGraph::execute() {
+        frame++;
+        if (!cullAndOrder()) {
+            //a cycle, the needed passes run as they were added
+            printf("render graph: the passes depend on each other in a cycle, running them in the order added\n");
+            order.clear();
+            for (int p = 0; p < (int)passes.size(); p++) {
+                if (needed[p]) {
+                    order.push_back(p);
+                }
+            }
+        }
+
+        //lifetimes of the transients over the execution steps
+        for (int step = 0; step < (int)order.size(); step++) {
+            const Pass& pass = passes[order[step]];
+            for (int list = 0; list < 2; list++) {
+                const std::vector<RenderGraphResource>& used = list == 0 ? pass.reads : pass.writes;
+                for (size_t i = 0; i < used.size(); i++) {
+                    Resource& resource = resources[used[i]];
+                    if (resource.firstUse < 0) {
+                        resource.firstUse = step;
+                    }
+                    resource.lastUse = step;
+                }
+            }
+        }
+
+        transientTextures = 0;
+        skippedPasses = 0;
+        for (int step = 0; step < (int)order.size(); step++) {
+            for (size_t r = 0; r < resources.size(); r++) {
+                if (resources[r].transient && resources[r].firstUse == step) {
+                    resources[r].texture = acquireTexture(resources[r].desc);
+                    transientTextures++;
+                }
+            }
+
+            const Pass& pass = passes[order[step]];
+            if (bindTargets(pass)) {
+                pass.execute();
+            }
+            else {
+                skippedPasses++;
+            }
+
+            //the texture goes back to the pool for the transients that start later
+            for (size_t r = 0; r < resources.size(); r++) {
+                if (resources[r].transient && resources[r].lastUse == step) {
+                    releaseTexture(resources[r].texture);
+                }
+            }
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        evictUnusedTextures();
+        declaredPasses = passes.size();
+        executedPasses = order.size();
+        pooledTextures = pool.size();
+    }
+
+    bool RenderGraph::targetsComplete() {
+        return skippedPasses == 0;
+    }
+
+    bool RenderGraph::checkTargets(const std::vector<RenderTargetDesc>& targets) {
+        attachments.clear();
+        GLuint depthAttachment = 0;
+        for (size_t i = 0; i < targets.size(); i++) {
+            GLuint texture = acquireTexture(targets[i]);
+            if (isDepthFormat(targets[i].internalFormat)) {
+                depthAttachment = texture;
+            }
+            else {
+                attachments.push_back(texture);
+            }
+        }
+        attachments.push_back(depthAttachment);
+
+        GLuint framebuffer;
+        bool complete = getFramebuffer(attachments, framebuffer);
+        for (size_t i = 0; i < attachments.size(); i++) {
+            releaseTexture(attachments[i]);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return complete;
+    }
+
+    GLuint RenderGraph::getTexture(RenderGraphResource resource) {
+        return resources[resource].texture;
+    }
+
+    GLuint RenderGraph::acquireTexture(const RenderTargetDesc& desc) {
+        for (size_t i = 0; i < pool.size(); i++) {
+            if (!pool[i].inUse && sameDesc(pool[i].desc, desc)) {
+                pool[i].inUse = true;
+                pool[i].lastUsedFrame = frame;
+                return pool[i].texture;
+            }
+        }
+
+        PooledTexture pooled = { desc, 0, true, frame };
+        glGenTextures(1, &pooled.texture);
+        glBindTexture(GL_TEXTURE_2D, pooled.texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, desc.internalFormat, desc.width, desc.height);
+        //read texel by texel, nothing is filtered
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        pool.push_back(pooled);
+        return pooled.texture;
+    }
+
+    void RenderGraph::releaseTexture(GLuint texture) {
+        for (size_t i = 0; i < pool.size(); i++) {
+            if (pool[i].texture == texture) {
+                pool[i].inUse = false;
+            }
+        }
+    }
+
+    void RenderGraph::evictUnusedTextures() {
+        for (size_t i = 0; i < pool.size();) {
+            if (frame - pool[i].lastUsedFrame < RENDER_GRAPH_POOL_FRAMES) {
+                i++;
+                continue;
+            }
+            //the framebuffers it is attached to go with it
+            GLuint texture = pool[i].texture;
+            for (std::map<std::vector<GLuint>, GLuint>::iterator it = framebuffers.begin(); it != framebuffers.end();) {
+                bool attached = false;
+                for (size_t a = 0; a < it->first.size(); a++) {
+                    attached = attached || it->first[a] == texture;
+                }
+                if (attached) {
+                    glDeleteFramebuffers(1, &it->second);
+                    it = framebuffers.erase(it);
+                }
+                else {
+                    ++it;
+                }
+            }
+            glDeleteTextures(1, &texture);
+            pool[i] = pool.back();
+            pool.pop_back();
+        }
+    }
+
+    bool RenderGraph::bindTargets(const Pass& pass) {
+        //an imported framebuffer, or the transients written, colors first and the depth last
+        attachments.clear();
+        GLuint depthAttachment = 0;
+        const Resource* sized = NULL;
+        GLint importedFramebuffer = -1;
+        for (size_t i = 0; i < pass.writes.size(); i++) {
+            const Resource& resource = resources[pass.writes[i]];
+            if (resource.transient) {
+                if (isDepthFormat(resource.desc.internalFormat)) {
+                    depthAttachment = resource.texture;
+                }
+                else {
+                    attachments.push_back(resource.texture);
+                }
+                sized = &resource;
+            }
+            else if (resource.framebuffer >= 0) {
+                importedFramebuffer = resource.framebuffer;
+                sized = &resource;
+            }
+        }
+        if (sized == NULL) {
+            return true;
+        }
+
+        if (importedFramebuffer >= 0) {
+            glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)importedFramebuffer);
+        }
+        else {
+            attachments.push_back(depthAttachment);
+            GLuint framebuffer;
+            if (!getFramebuffer(attachments, framebuffer)) {
+                return false;
+            }
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        }
+        glViewport(0, 0, sized->desc.width, sized->desc.height);
+        if (pass.clearMask != 0) {
+            glClear(pass.clearMask);
+        }
+        return true;
+    }
+
+    //the last texture is the depth attachment, 0 for none
+    bool RenderGraph::getFramebuffer(const std::vector<GLuint>& textures, GLuint& framebuffer) {
+        std::map<std::vector<GLuint>, GLuint>::iterator found = framebuffers.find(textures);
+        if (found != framebuffers.end()) {
+            framebuffer = found->second;
+            return true;
+        }
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        GLenum drawBuffers[8];
+        GLsizei colorCount = 0;
+        for (size_t i = 0; i + 1 < textures.size() && colorCount < 8; i++) {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + colorCount, GL_TEXTURE_2D, textures[i], 0);
+            drawBuffers[colorCount] = GL_COLOR_ATTACHMENT0 + colorCount;
+            colorCount++;
+        }
+        if (textures.back() != 0) {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, textures.back(), 0);
+        }
+        if (colorCount > 0) {
+            glDrawBuffers(colorCount, drawBuffers);
+        }
+        else {
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+        }
+        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        if (status != GL_FRAMEBUFFER_COMPLETE) {
+            printf("render graph: framebuffer of %d targets incomplete (0x%x)\n", (int)textures.size(), status);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glDeleteFramebuffers(1, &framebuffer);
+            return false;
+        }
+        framebuffers[textures] = framebuffer;
+        return true;
+    }
+
+    void RenderGraph::printStats() {
+        if (++framesSinceReport < RENDER_GRAPH_REPORT_FRAMES) {
+            return;
+        }
+        framesSinceReport = 0;
+        printf("render graph: %zu of %zu passes run, %zu transient textures in %zu pooled\n",
+            executedPasses, declaredPasses, transientTextures, pooledTextures);
+    }
+
+}
@@ -0,0 +1,132 @@
+#ifndef RenderGraph_hpp
+#define RenderGraph_hpp
+
+#include <GL/glew.h>
+
+#include <functional>
+#include <map>
+#include <vector>
+
+namespace gps {
+
+    //frames between two printed reports
+    const int RENDER_GRAPH_REPORT_FRAMES = 120;
+    //a pooled texture no frame asked for in this many frames is deleted, a resized window frees its old targets
+    const int RENDER_GRAPH_POOL_FRAMES = 2;
+
+    typedef int RenderGraphResource;
+    typedef int RenderGraphPass;
+
+    //size and format of a texture the graph allocates
+    struct RenderTargetDesc {
+        int width;
+        int height;
+        GLenum internalFormat;
+    };
+
+    //Passes of a frame and the textures they read and write, declared again every frame. Before running
+    //them the graph drops the passes nothing reads from, orders the rest so every pass comes after the
+    //writers of what it reads, and gives the transient textures storage from a pool: a transient lives
+    //from its first pass to its last and then hands its texture to the next transient of the same size and
+    //format. The pooled textures and their framebuffers are kept between frames.
+    //
+    //A pass writing transients or an imported target gets them bound, the viewport set and cleared with its
+    //clear mask. One writing only imported textures binds its own framebuffer, as the shadow maps do.
+    class RenderGraph
+    {
+    public:
+        //forgets the passes and resources of the previous frame, the pool stays
+        void reset();
+
+        //a texture that only lives within the frame
+        RenderGraphResource createTexture(const char* name, const RenderTargetDesc& desc);
+        //a texture owned elsewhere, for passes that bind their own framebuffer
+        RenderGraphResource importTexture(const char* name, GLuint texture);
+        //a framebuffer owned elsewhere, 0 for the window
+        RenderGraphResource importTarget(const char* name, GLuint framebuffer, int width, int height);
+
+        RenderGraphPass addPass(const char* name, GLbitfield clearMask, const std::function<void()>& execute);
+        void read(RenderGraphPass pass, RenderGraphResource resource);
+        void write(RenderGraphPass pass, RenderGraphResource resource);
+        //the passes leading to an output are kept
+        void markOutput(RenderGraphResource resource);
+
+        //culls, orders and allocates, then runs the passes. A pass whose targets make an incomplete
+        //framebuffer is skipped
+        void execute();
+        //false when the last execute skipped a pass for an incomplete framebuffer
+        bool targetsComplete();
+        //builds the framebuffer of transients with these descs, colors first and the depth last, ahead of
+        //the first frame. False when it is incomplete
+        bool checkTargets(const std::vector<RenderTargetDesc>& targets);
+
+        //texture of a resource, transients have one only while their passes run
+        GLuint getTexture(RenderGraphResource resource);
+
+        //prints the last frame's counts every RENDER_GRAPH_REPORT_FRAMES calls
+        void printStats();
+
+    private:
+        struct Resource {
+            const char* name;
+            RenderTargetDesc desc;
+            bool transient;
+            GLuint texture;
+            //-1 for an imported texture
+            GLint framebuffer;
+            bool output;
+            //execution steps of its first and last pass
+            int firstUse;
+            int lastUse;
+        };
+
+        struct Pass {
+            const char* name;
+            GLbitfield clearMask;
+            std::function<void()> execute;
+            std::vector<RenderGraphResource> reads;
+            std::vector<RenderGraphResource> writes;
+        };
+
+        struct PooledTexture {
+            RenderTargetDesc desc;
+            GLuint texture;
+            bool inUse;
+            int lastUsedFrame;
+        };
+
+        std::vector<Resource> resources;
+        std::vector<Pass> passes;
+        std::vector<PooledTexture> pool;
+        //framebuffers of the transient attachments, keyed by their textures in attachment order
+        std::map<std::vector<GLuint>, GLuint> framebuffers;
+        int frame = 0;
+
+        //scratch of the compile, kept to reuse its storage
+        std::vector<int> order;
+        std::vector<bool> needed;
+        std::vector<int> pendingDependencies;
+        std::vector<GLuint> attachments;
+
+        int framesSinceReport = 0;
+        size_t declaredPasses = 0;
+        size_t executedPasses = 0;
+        size_t transientTextures = 0;
+        size_t pooledTextures = 0;
+        size_t skippedPasses = 0;
+
+        //true when pass a has to run before pass b
+        bool dependsOn(int b, int a) const;
+        bool cullAndOrder();
+        GLuint acquireTexture(const RenderTargetDesc& desc);
+        void releaseTexture(GLuint texture);
+        void evictUnusedTextures();
+        //false when the targets make an incomplete framebuffer
+        bool bindTargets(const Pass& pass);
+        //incomplete framebuffers are deleted and not kept, false for them
+        bool getFramebuffer(const std::vector<GLuint>& textures, GLuint& framebuffer);
+    };
+
+}
+
+#endif /* RenderGraph_hpp */
@@ -19,7 +19,35 @@ namespace gps {
 
         //convert stream into GLchar array
         shaderString = shaderStringStream.str();
-        return shaderString;
+        return expandIncludes(shaderString, fileName);
+    }
+
+    std::string Shader::expandIncludes(std::string source, std::string fileName)
+    {
+        //included files are looked up next to the including one
+        size_t slash = fileName.find_last_of("/\\");
+        std::string directory = slash == std::string::npos ? "" : fileName.substr(0, slash + 1);
+
+        std::stringstream input(source);
+        std::stringstream output;
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(input, line))
+        {
+            lineNumber++;
+            size_t open = line.find('"');
+            size_t close = line.rfind('"');
+            if (line.compare(0, 8, "#include") != 0 || open == std::string::npos || close <= open)
+            {
+                output << line << "\n";
+                continue;
+            }
+            //the compile log counts the included lines as source 1, the rest keeps its own numbers
+            output << "#line 1 1\n";
+            output << readShaderFile(directory + line.substr(open + 1, close - open - 1)) << "\n";
+            output << "#line " << lineNumber + 1 << " 0\n";
+        }
+        return output.str();
     }
 
     void Shader::shaderCompileLog(GLuint shaderId)
@@ -82,6 +110,37 @@ namespace gps {
         shaderLinkLog(this->shaderProgram);
     }
 
+    GLuint Shader::compileShader(GLenum type, std::string fileName)
+    {
+        std::string source = readShaderFile(fileName);
+        const GLchar* sourceString = source.c_str();
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &sourceString, NULL);
+        glCompileShader(shader);
+        //check compilation status
+        shaderCompileLog(shader);
+        return shader;
+    }
+
+    void Shader::loadShader(std::string vertexShaderFileName, std::string geometryShaderFileName, std::string fragmentShaderFileName)
+    {
+        GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexShaderFileName);
+        GLuint geometryShader = compileShader(GL_GEOMETRY_SHADER, geometryShaderFileName);
+        GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentShaderFileName);
+
+        //attach and link the shader programs
+        this->shaderProgram = glCreateProgram();
+        glAttachShader(this->shaderProgram, vertexShader);
+        glAttachShader(this->shaderProgram, geometryShader);
+        glAttachShader(this->shaderProgram, fragmentShader);
+        glLinkProgram(this->shaderProgram);
+        glDeleteShader(vertexShader);
+        glDeleteShader(geometryShader);
+        glDeleteShader(fragmentShader);
+        //check linking info
+        shaderLinkLog(this->shaderProgram);
+    }
+
     void Shader::useShaderProgram()
     {
         glUseProgram(this->shaderProgram);
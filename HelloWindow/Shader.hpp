@@ -16,10 +16,15 @@ class Shader
 public:
     GLuint shaderProgram;
     void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
+    //with a geometry stage between the two
+    void loadShader(std::string vertexShaderFileName, std::string geometryShaderFileName, std::string fragmentShaderFileName);
     void useShaderProgram();
 
 private:
     std::string readShaderFile(std::string fileName);
+    //replaces each #include "file" line with the file, a path relative to the including shader
+    std::string expandIncludes(std::string source, std::string fileName);
+    GLuint compileShader(GLenum type, std::string fileName);
     void shaderCompileLog(GLuint shaderId);
     void shaderLinkLog(GLuint shaderProgramId);
 };
@@ -0,0 +1,156 @@
+#include "ShadowAtlas.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace gps {
+
+    static const float PI = 3.14159265f;
+
+    bool ShadowAtlas::init() {
+        glGenTextures(1, &depthTexture);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        //read through a shadow sampler, the compare of the 4 nearest texels is filtered
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        if (status != GL_FRAMEBUFFER_COMPLETE) {
+            printf("shadow atlas: framebuffer incomplete (0x%x) at %dx%d\n", status, SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE);
+            return false;
+        }
+
+        //room for the atlas split entirely into tiles of each level, the lists never grow afterwards
+        for (int level = 0; level < SHADOW_ATLAS_LEVELS; level++) {
+            int tilesPerSide = SHADOW_ATLAS_SIZE / (SHADOW_ATLAS_MAX_TILE >> level);
+            freeTiles[level].reserve(tilesPerSide * tilesPerSide);
+        }
+        beginFrame();
+        return true;
+    }
+
+    void ShadowAtlas::beginFrame() {
+        for (int level = 0; level < SHADOW_ATLAS_LEVELS; level++) {
+            freeTiles[level].clear();
+        }
+        for (int y = 0; y < SHADOW_ATLAS_SIZE; y += SHADOW_ATLAS_MAX_TILE) {
+            for (int x = 0; x < SHADOW_ATLAS_SIZE; x += SHADOW_ATLAS_MAX_TILE) {
+                freeTiles[0].push_back(glm::ivec2(x, y));
+            }
+        }
+    }
+
+    bool ShadowAtlas::allocate(float screenCoverage, ShadowAtlasTile& tile) {
+        //the side of the tile follows the side of the light on the screen
+        float wanted = SHADOW_ATLAS_MAX_TILE * std::sqrt(glm::clamp(screenCoverage, 0.0f, 1.0f));
+        int target = 0;
+        while (target + 1 < SHADOW_ATLAS_LEVELS && (SHADOW_ATLAS_MAX_TILE >> (target + 1)) >= wanted) {
+            target++;
+        }
+
+        //the smallest free tile at least as large, split down to the wanted size
+        int level = target;
+        while (level >= 0 && freeTiles[level].empty()) {
+            level--;
+        }
+        if (level < 0) {
+            //a full atlas still has room for smaller tiles
+            level = target + 1;
+            while (level < SHADOW_ATLAS_LEVELS && freeTiles[level].empty()) {
+                level++;
+            }
+            if (level == SHADOW_ATLAS_LEVELS) {
+                return false;
+            }
+            target = level;
+        }
+
+        glm::ivec2 corner = freeTiles[level].back();
+        freeTiles[level].pop_back();
+        for (; level < target; level++) {
+            int half = (SHADOW_ATLAS_MAX_TILE >> level) / 2;
+            freeTiles[level + 1].push_back(corner + glm::ivec2(half, 0));
+            freeTiles[level + 1].push_back(corner + glm::ivec2(0, half));
+            freeTiles[level + 1].push_back(corner + glm::ivec2(half, half));
+        }
+        tile.x = corner.x;
+        tile.y = corner.y;
+        tile.size = SHADOW_ATLAS_MAX_TILE >> target;
+        return true;
+    }
+
+    void ShadowAtlas::beginShadowPass() {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glEnable(GL_SCISSOR_TEST);
+        //pushes the depths back along the slope of the surface, the shaders then compare without a bias
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(2.0f, 4.0f);
+    }
+
+    void ShadowAtlas::beginTile(const ShadowAtlasTile& tile) {
+        glViewport(tile.x, tile.y, tile.size, tile.size);
+        glScissor(tile.x, tile.y, tile.size, tile.size);
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    void ShadowAtlas::endShadowPass() {
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glDisable(GL_SCISSOR_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    glm::mat4 ShadowAtlas::getTileMatrix(const ShadowAtlasTile& tile, const glm::mat4& lightViewProjection) {
+        //clip space [-1, 1] to the tile, depth to [0, 1]
+        float scale = (float)tile.size / SHADOW_ATLAS_SIZE;
+        glm::vec3 offset = glm::vec3((tile.x + 0.5f * tile.size) / SHADOW_ATLAS_SIZE, (tile.y + 0.5f * tile.size) / SHADOW_ATLAS_SIZE, 0.5f);
+        glm::mat4 toTile = glm::translate(glm::mat4(1.0f), offset);
+        toTile = glm::scale(toTile, glm::vec3(0.5f * scale, 0.5f * scale, 0.5f));
+        return toTile * lightViewProjection;
+    }
+
+    glm::vec4 ShadowAtlas::getTileRect(const ShadowAtlasTile& tile) {
+        float halfTexel = 0.5f / SHADOW_ATLAS_SIZE;
+        return glm::vec4(
+            (float)tile.x / SHADOW_ATLAS_SIZE + halfTexel,
+            (float)tile.y / SHADOW_ATLAS_SIZE + halfTexel,
+            (float)(tile.x + tile.size) / SHADOW_ATLAS_SIZE - halfTexel,
+            (float)(tile.y + tile.size) / SHADOW_ATLAS_SIZE - halfTexel);
+    }
+
+    GLuint ShadowAtlas::getTexture() {
+        return depthTexture;
+    }
+
+    float sphereScreenCoverage(const glm::vec3& center, float radius, const glm::mat4& view, const glm::mat4& projection) {
+        glm::vec3 centerEye = glm::vec3(view * glm::vec4(center, 1.0f));
+        float distance2 = glm::dot(centerEye, centerEye);
+        if (distance2 <= radius * radius) {
+            return 1.0f;
+        }
+        if (centerEye.z - radius >= 0.0f) {
+            return 0.0f;
+        }
+        //tangent of the half angle the sphere spans, scaled to clip space, the screen edges are not clipped
+        float tangent = radius / std::sqrt(distance2 - radius * radius);
+        float radiusX = tangent * projection[0][0];
+        float radiusY = tangent * projection[1][1];
+        return std::min(PI * radiusX * radiusY / 4.0f, 1.0f);
+    }
+
+}
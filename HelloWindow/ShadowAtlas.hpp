@@ -0,0 +1,69 @@
+#ifndef ShadowAtlas_hpp
+#define ShadowAtlas_hpp
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace gps {
+
+    //texels per side of the atlas
+    const int SHADOW_ATLAS_SIZE = 4096;
+    //largest and smallest tiles, a light covering the whole screen gets the largest
+    const int SHADOW_ATLAS_MAX_TILE = 2048;
+    const int SHADOW_ATLAS_MIN_TILE = 256;
+    //tile sizes from the largest down to the smallest, each half the one before
+    const int SHADOW_ATLAS_LEVELS = 4;
+    //texture unit of the atlas, after the point shadow cubemap
+    const GLint SHADOW_ATLAS_UNIT = 13;
+
+    //square region of the atlas given to one light for a frame
+    struct ShadowAtlasTile {
+        int x;
+        int y;
+        int size;
+    };
+
+    //Depth texture shared by the shadows of the spotlights, each drawn into its own tile. The tiles are
+    //handed out again every frame, sized by how much of the screen the light covers, by splitting the free
+    //tiles of a quadtree: the texture, its framebuffer and the free lists are made once and reused, so more
+    //lights only take more tiles, down to the smallest size once the atlas fills up.
+    class ShadowAtlas
+    {
+    public:
+        //creates the atlas, false when the framebuffer is incomplete
+        bool init();
+
+        //frees every tile, the lights allocate theirs again, largest first for the tightest packing
+        void beginFrame();
+        //a tile for a light covering this fraction of the screen, false when the atlas is full
+        bool allocate(float screenCoverage, ShadowAtlasTile& tile);
+
+        //binds the atlas, the tiles are then drawn one after the other
+        void beginShadowPass();
+        //restricts the drawing to the tile and clears its depth
+        void beginTile(const ShadowAtlasTile& tile);
+        //back to the default framebuffer
+        void endShadowPass();
+
+        //from world space to the tile's texture coordinates and depth, for the light's view projection
+        glm::mat4 getTileMatrix(const ShadowAtlasTile& tile, const glm::mat4& lightViewProjection);
+        //the tile's texture coordinates, shrunk by half a texel so filtering stays inside: min in xy, max in zw
+        glm::vec4 getTileRect(const ShadowAtlasTile& tile);
+
+        GLuint getTexture();
+
+    private:
+        GLuint framebuffer = 0;
+        GLuint depthTexture = 0;
+        //corners of the free tiles of each level
+        std::vector<glm::ivec2> freeTiles[SHADOW_ATLAS_LEVELS];
+    };
+
+    //fraction of the screen covered by a sphere, 1 when the camera is inside it
+    float sphereScreenCoverage(const glm::vec3& center, float radius, const glm::mat4& view, const glm::mat4& projection);
+
+}
+
+#endif /* ShadowAtlas_hpp */
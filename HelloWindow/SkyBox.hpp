@@ -11,6 +11,7 @@
 
 #include <stdio.h>
 #include "Shader.hpp"
+#include <string>
 #include <vector>
 #include "stb_image.h"
 #include "glm/glm.hpp"
@@ -21,14 +22,14 @@ namespace gps {
     {
     public:
         SkyBox();
-        void Load(std::vector<const GLchar*> cubeMapFaces);
+        //draws a cubemap filled elsewhere, such as the procedural sky
+        void Load(GLuint cubemap);
         void Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix);
         GLuint GetTextureId();
     private:
         GLuint skyboxVAO;
         GLuint skyboxVBO;
         GLuint cubemapTexture;
-        GLuint LoadSkyBoxTextures(std::vector<const GLchar*> cubeMapFaces);
         void InitSkyBox();
     };
 }
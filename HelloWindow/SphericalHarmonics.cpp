@@ -0,0 +1,171 @@
+#include "SphericalHarmonics.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <emmintrin.h>
+
+namespace gps {
+
+    static const float PI = 3.14159265f;
+
+    //the direction through the center of a face, then the ones its s and t coordinates grow along,
+    //as laid out by the GL cubemap convention with the first row of an image at t = -1
+    static const glm::vec3 faceCenters[6] = {
+        glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+        glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+    };
+    static const glm::vec3 faceS[6] = {
+        glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+        glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f),
+        glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f)
+    };
+    static const glm::vec3 faceT[6] = {
+        glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+        glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)
+    };
+
+    //constants of the 9 basis functions, which are these times 1, y, z, x, xy, yz, 3z^2 - 1, xz and x^2 - y^2
+    static const float basisConstants[SH_COEFFICIENTS] = {
+        0.282095f,
+        0.488603f, 0.488603f, 0.488603f,
+        1.092548f, 1.092548f, 0.315392f, 1.092548f, 0.546274f
+    };
+    //convolution of each band with the cosine lobe of a diffuse surface
+    static const float bandWeights[SH_COEFFICIENTS] = {
+        PI,
+        2.0f * PI / 3.0f, 2.0f * PI / 3.0f, 2.0f * PI / 3.0f,
+        PI / 4.0f, PI / 4.0f, PI / 4.0f, PI / 4.0f, PI / 4.0f
+    };
+
+    SphericalHarmonics::SphericalHarmonics() {
+        for (int i = 0; i < SH_COEFFICIENTS; i++) {
+            coefficients[i] = glm::vec3(0.0f);
+        }
+    }
+
+    void SphericalHarmonics::add(const SphericalHarmonics& other) {
+        for (int i = 0; i < SH_COEFFICIENTS; i++) {
+            coefficients[i] += other.coefficients[i];
+        }
+    }
+
+    SphericalHarmonics SphericalHarmonics::mix(const SphericalHarmonics& other, float t) const {
+        SphericalHarmonics result;
+        for (int i = 0; i < SH_COEFFICIENTS; i++) {
+            result.coefficients[i] = glm::mix(coefficients[i], other.coefficients[i], t);
+        }
+        return result;
+    }
+
+    void SphericalHarmonics::upload(gps::Shader shader) const {
+        glm::vec3 ambient[SH_COEFFICIENTS];
+        for (int i = 0; i < SH_COEFFICIENTS; i++) {
+            ambient[i] = coefficients[i] * (basisConstants[i] * bandWeights[i] / PI);
+        }
+        shader.useShaderProgram();
+        glUniform3fv(glGetUniformLocation(shader.shaderProgram, "shAmbient"), SH_COEFFICIENTS, glm::value_ptr(ambient[0]));
+    }
+
+    glm::vec3 cubemapFaceDirection(int face, float s, float t) {
+        return faceCenters[face] + s * faceS[face] + t * faceT[face];
+    }
+
+    SphericalHarmonics projectCubemapFace(const unsigned char* pixels, int width, int height, int face) {
+        const glm::vec3 center = faceCenters[face];
+        const glm::vec3 s = faceS[face];
+        const glm::vec3 t = faceT[face];
+
+        //a face spans [-1, 1] both ways
+        const __m128 texelArea = _mm_set1_ps(4.0f / ((float)width * height));
+        const __m128 texelSize = _mm_set1_ps(2.0f / width);
+        const __m128 laneCenters = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        const __m128 toUnit = _mm_set1_ps(1.0f / 255.0f);
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 three = _mm_set1_ps(3.0f);
+        const __m128 rowEnd = _mm_set1_ps((float)width);
+        const __m128 stepX = _mm_set1_ps(s.x);
+        const __m128 stepY = _mm_set1_ps(s.y);
+        const __m128 stepZ = _mm_set1_ps(s.z);
+
+        //the rows are summed in single precision, four texels at a time, and the face in double
+        double sums[SH_COEFFICIENTS][3] = {};
+        for (int y = 0; y < height; y++) {
+            float tc = 2.0f * (y + 0.5f) / height - 1.0f;
+            __m128 rowX = _mm_set1_ps(center.x + tc * t.x);
+            __m128 rowY = _mm_set1_ps(center.y + tc * t.y);
+            __m128 rowZ = _mm_set1_ps(center.z + tc * t.z);
+            const unsigned char* row = pixels + (size_t)y * width * 3;
+
+            __m128 accumulators[SH_COEFFICIENTS][3];
+            for (int i = 0; i < SH_COEFFICIENTS; i++) {
+                for (int channel = 0; channel < 3; channel++) {
+                    accumulators[i][channel] = _mm_setzero_ps();
+                }
+            }
+
+            for (int x = 0; x < width; x += 4) {
+                __m128 texelX = _mm_add_ps(_mm_set1_ps((float)x), laneCenters);
+                __m128 sc = _mm_sub_ps(_mm_mul_ps(texelX, texelSize), one);
+                __m128 dirX = _mm_add_ps(rowX, _mm_mul_ps(sc, stepX));
+                __m128 dirY = _mm_add_ps(rowY, _mm_mul_ps(sc, stepY));
+                __m128 dirZ = _mm_add_ps(rowZ, _mm_mul_ps(sc, stepZ));
+
+                //1 + s^2 + t^2, the squared length of the direction
+                __m128 length2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dirX, dirX), _mm_mul_ps(dirY, dirY)), _mm_mul_ps(dirZ, dirZ));
+                __m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(length2));
+                dirX = _mm_mul_ps(dirX, invLength);
+                dirY = _mm_mul_ps(dirY, invLength);
+                dirZ = _mm_mul_ps(dirZ, invLength);
+
+                //solid angle of the texel, its area over (1 + s^2 + t^2)^(3/2). The lanes past the row get none
+                __m128 weight = _mm_mul_ps(texelArea, _mm_mul_ps(invLength, _mm_mul_ps(invLength, invLength)));
+                weight = _mm_and_ps(weight, _mm_cmplt_ps(texelX, rowEnd));
+                weight = _mm_mul_ps(weight, toUnit);
+
+                int x0 = x * 3;
+                int x1 = std::min(x + 1, width - 1) * 3;
+                int x2 = std::min(x + 2, width - 1) * 3;
+                int x3 = std::min(x + 3, width - 1) * 3;
+                __m128 color[3];
+                for (int channel = 0; channel < 3; channel++) {
+                    color[channel] = _mm_mul_ps(weight, _mm_setr_ps(row[x0 + channel], row[x1 + channel], row[x2 + channel], row[x3 + channel]));
+                }
+
+                __m128 basis[SH_COEFFICIENTS] = {
+                    one,
+                    dirY,
+                    dirZ,
+                    dirX,
+                    _mm_mul_ps(dirX, dirY),
+                    _mm_mul_ps(dirY, dirZ),
+                    _mm_sub_ps(_mm_mul_ps(three, _mm_mul_ps(dirZ, dirZ)), one),
+                    _mm_mul_ps(dirX, dirZ),
+                    _mm_sub_ps(_mm_mul_ps(dirX, dirX), _mm_mul_ps(dirY, dirY))
+                };
+                for (int i = 0; i < SH_COEFFICIENTS; i++) {
+                    for (int channel = 0; channel < 3; channel++) {
+                        accumulators[i][channel] = _mm_add_ps(accumulators[i][channel], _mm_mul_ps(basis[i], color[channel]));
+                    }
+                }
+            }
+
+            for (int i = 0; i < SH_COEFFICIENTS; i++) {
+                for (int channel = 0; channel < 3; channel++) {
+                    float lanes[4];
+                    _mm_storeu_ps(lanes, accumulators[i][channel]);
+                    sums[i][channel] += (double)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+                }
+            }
+        }
+
+        SphericalHarmonics result;
+        for (int i = 0; i < SH_COEFFICIENTS; i++) {
+            result.coefficients[i] = glm::vec3((float)sums[i][0], (float)sums[i][1], (float)sums[i][2]) * basisConstants[i];
+        }
+        return result;
+    }
+
+}
@@ -0,0 +1,41 @@
+#ifndef SphericalHarmonics_hpp
+#define SphericalHarmonics_hpp
+
+#include <GL/glew.h>
+
+#include "Shader.hpp"
+
+#include <glm/glm.hpp>
+
+namespace gps {
+
+    //order 2 spherical harmonics, enough for the diffuse light of an environment
+    const int SH_COEFFICIENTS = 9;
+
+    //Radiance of an environment projected onto the first 9 real spherical harmonics, an rgb weight for each.
+    //The scene shaders turn it into the ambient light of a surface from its world normal.
+    struct SphericalHarmonics
+    {
+        glm::vec3 coefficients[SH_COEFFICIENTS];
+
+        SphericalHarmonics();
+
+        void add(const SphericalHarmonics& other);
+        //t 0 gives this one, 1 the other
+        SphericalHarmonics mix(const SphericalHarmonics& other, float t) const;
+
+        //sets the shAmbient uniform to the irradiance over pi, the cosine lobe and the basis constants folded in
+        void upload(gps::Shader shader) const;
+    };
+
+    //unnormalized direction through the point (s, t) of a cubemap face, both in [-1, 1] with t = -1
+    //along the first row of its image, face counted from GL_TEXTURE_CUBE_MAP_POSITIVE_X
+    glm::vec3 cubemapFaceDirection(int face, float s, float t);
+
+    //projection of one RGB face of a cubemap, face counted from GL_TEXTURE_CUBE_MAP_POSITIVE_X.
+    //The projections of the six faces add up to the one of the cubemap
+    SphericalHarmonics projectCubemapFace(const unsigned char* pixels, int width, int height, int face);
+
+}
+
+#endif /* SphericalHarmonics_hpp */
@@ -0,0 +1,168 @@
+#include "StaticBatcher.hpp"
+
+#include <glm/gtc/matrix_inverse.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <utility>
+
+namespace gps {
+
+    void StaticBatcher::add(Model3D& model, const glm::mat4& modelMatrix, bool isTransparent) {
+        Source source = { &model, modelMatrix, isTransparent };
+        sources.push_back(source);
+    }
+
+    void StaticBatcher::build() {
+        //a source mesh whose vertices were appended to a batch from baseVertex on
+        struct BatchPart {
+            Mesh* mesh;
+            GLuint baseVertex;
+            bool flipWinding;
+            //largest axis scale of the model matrix, brings the level errors to world space
+            float scale;
+        };
+        struct BatchData {
+            std::vector<Vertex> vertices;
+            std::vector<BatchPart> parts;
+            std::vector<Texture> textures;
+            bool isTransparent;
+            size_t sourceMeshCount;
+            std::string name;
+        };
+
+        //material key: transparency + (sampler, texture id) pairs, and the cell of the mesh's center
+        typedef std::pair<std::pair<bool, std::pair<int, int> >, std::vector<std::pair<std::string, GLuint> > > MaterialKey;
+        std::map<MaterialKey, size_t> batchOfMaterial;
+        std::vector<BatchData> data;
+
+        for (size_t s = 0; s < sources.size(); s++) {
+            const glm::mat4& modelMatrix = sources[s].modelMatrix;
+            glm::mat3 normalTransform = glm::inverseTranspose(glm::mat3(modelMatrix));
+            //mirroring transforms flip the winding
+            bool flipWinding = glm::determinant(glm::mat3(modelMatrix)) < 0.0f;
+            float scale = std::max(glm::length(glm::vec3(modelMatrix[0])),
+                std::max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
+
+            const std::vector<Mesh*>& meshes = sources[s].model->GetMeshes();
+            for (size_t m = 0; m < meshes.size(); m++) {
+                Mesh* mesh = meshes[m];
+                std::vector<Texture> textures = mesh->getEffectiveTextures();
+
+                glm::vec3 center = mesh->getBounds().transformed(modelMatrix).center();
+                MaterialKey key;
+                key.first.first = sources[s].isTransparent;
+                key.first.second = std::make_pair((int)std::floor(center.x / STATIC_BATCH_CELL_SIZE), (int)std::floor(center.z / STATIC_BATCH_CELL_SIZE));
+                for (size_t t = 0; t < textures.size(); t++) {
+                    key.second.push_back(std::make_pair(textures[t].type, textures[t].id));
+                }
+                std::sort(key.second.begin(), key.second.end());
+
+                std::map<MaterialKey, size_t>::iterator found = batchOfMaterial.find(key);
+                if (found == batchOfMaterial.end()) {
+                    BatchData batch;
+                    batch.textures = textures;
+                    batch.isTransparent = sources[s].isTransparent;
+                    batch.sourceMeshCount = 0;
+                    found = batchOfMaterial.insert(std::make_pair(key, data.size())).first;
+                    data.push_back(batch);
+                }
+
+                BatchData& batch = data[found->second];
+                GLuint baseVertex = (GLuint)batch.vertices.size();
+                for (size_t v = 0; v < mesh->vertices.size(); v++) {
+                    Vertex vertex = mesh->vertices[v];
+                    vertex.Position = glm::vec3(modelMatrix * glm::vec4(vertex.Position, 1.0f));
+                    vertex.Normal = glm::normalize(normalTransform * vertex.Normal);
+                    batch.vertices.push_back(vertex);
+                }
+                BatchPart part = { mesh, baseVertex, flipWinding, scale };
+                batch.parts.push_back(part);
+                batch.sourceMeshCount++;
+                batch.name += (batch.name.empty() ? "" : ",") + mesh->name;
+            }
+        }
+
+        batches.clear();
+        for (size_t b = 0; b < data.size(); b++) {
+            const std::vector<BatchPart>& parts = data[b].parts;
+            size_t levelCount = 1;
+            for (size_t p = 0; p < parts.size(); p++) {
+                levelCount = std::max(levelCount, parts[p].mesh->getLodCount());
+            }
+
+            //the levels one after the other like in a loaded mesh, a level is as far off as its worst part
+            std::vector<GLuint> indices;
+            std::vector<MeshLod> lods;
+            for (size_t l = 0; l < levelCount; l++) {
+                MeshLod lod = { indices.size(), 0, 0.0f, 0, 0 };
+                for (size_t p = 0; p < parts.size(); p++) {
+                    const BatchPart& part = parts[p];
+                    const MeshLod& level = part.mesh->getLod(std::min(l, part.mesh->getLodCount() - 1));
+                    for (size_t i = level.indexOffset; i + 2 < level.indexOffset + level.indexCount; i += 3) {
+                        indices.push_back(part.baseVertex + part.mesh->indices[i]);
+                        indices.push_back(part.baseVertex + part.mesh->indices[i + (part.flipWinding ? 2 : 1)]);
+                        indices.push_back(part.baseVertex + part.mesh->indices[i + (part.flipWinding ? 1 : 2)]);
+                    }
+                    lod.error = std::max(lod.error, level.error * part.scale);
+                }
+                lod.indexCount = indices.size() - lod.indexOffset;
+                lods.push_back(lod);
+            }
+
+            StaticBatch batch;
+            batch.mesh = new Mesh(data[b].vertices, indices, data[b].textures, lods);
+            batch.mesh->name = data[b].name;
+            batch.bounds = batch.mesh->getBounds();
+            batch.isTransparent = data[b].isTransparent;
+            batch.sourceMeshCount = data[b].sourceMeshCount;
+            batches.push_back(batch);
+        }
+    }
+
+    void StaticBatcher::selectLods(LodSelector& selector) {
+        for (size_t i = 0; i < batches.size(); i++) {
+            selector.selectLod(*batches[i].mesh, glm::mat4(1.0f));
+        }
+    }
+
+    void StaticBatcher::Draw(gps::Shader shader, const glm::mat4& viewMatrix, DrawFilter filter) {
+        shader.useShaderProgram();
+
+        //the vertices are already in world space
+        glm::mat4 identity = glm::mat4(1.0f);
+        glm::mat3 normalMatrix = glm::mat3(glm::inverseTranspose(viewMatrix));
+        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(identity));
+        glUniformMatrix3fv(glGetUniformLocation(shader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
+
+        GLint isTransparentLoc = glGetUniformLocation(shader.shaderProgram, "isTransparent");
+        for (size_t i = 0; i < batches.size(); i++) {
+            if (!passesFilter(filter, batches[i].isTransparent)) {
+                continue;
+            }
+            glUniform1i(isTransparentLoc, batches[i].isTransparent);
+            batches[i].mesh->Draw(shader);
+        }
+        glUniform1i(isTransparentLoc, false);
+    }
+
+    const std::vector<StaticBatch>& StaticBatcher::getBatches() {
+        return batches;
+    }
+
+    void StaticBatcher::printStats() {
+        size_t sourceMeshes = 0;
+        size_t triangles = 0;
+        size_t levels = 0;
+        for (size_t i = 0; i < batches.size(); i++) {
+            sourceMeshes += batches[i].sourceMeshCount;
+            triangles += batches[i].mesh->getLod(0).indexCount / 3;
+            levels = std::max(levels, batches[i].mesh->getLodCount());
+        }
+        printf("static batches: %zu draws instead of %zu (%zu full detail triangles, up to %zu levels)\n",
+            batches.size(), sourceMeshes, triangles, levels);
+    }
+
+}
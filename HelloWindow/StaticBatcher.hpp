@@ -0,0 +1,55 @@
+#ifndef StaticBatcher_hpp
+#define StaticBatcher_hpp
+
+#include "Model3D.hpp"
+#include "BoundingBox.hpp"
+#include "DrawFilter.hpp"
+#include "LodSelector.hpp"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace gps {
+
+    //side of the square cells of the ground plane a batch is limited to, so culling can drop a part of the scene
+    const float STATIC_BATCH_CELL_SIZE = 8.0f;
+
+    //meshes of static models sharing a material and a cell, merged into one pre-transformed mesh.
+    //Level l of the batch joins level l of every source mesh, or its coarsest one when it has fewer
+    struct StaticBatch {
+        Mesh* mesh;
+        //world space, for culling
+        AABB bounds;
+        bool isTransparent;
+        size_t sourceMeshCount;
+    };
+
+    class StaticBatcher
+    {
+    public:
+        //register a model that never moves, with the model matrix it is drawn with
+        void add(Model3D& model, const glm::mat4& modelMatrix, bool isTransparent);
+        //merge all registered meshes, one batch per material in each cell with all their levels of detail
+        void build();
+        //picks the level each batch draws, its errors are already in world space
+        void selectLods(LodSelector& selector);
+
+        //draws the batches passing the filter with an identity model matrix
+        void Draw(gps::Shader shader, const glm::mat4& viewMatrix, DrawFilter filter = DRAW_ALL);
+        const std::vector<StaticBatch>& getBatches();
+        void printStats();
+
+    private:
+        struct Source {
+            Model3D* model;
+            glm::mat4 modelMatrix;
+            bool isTransparent;
+        };
+
+        std::vector<Source> sources;
+        std::vector<StaticBatch> batches;
+    };
+
+}
+
+#endif /* StaticBatcher_hpp */
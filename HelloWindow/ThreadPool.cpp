@@ -0,0 +1,87 @@
+#include "ThreadPool.hpp"
+
+namespace gps {
+
+    ThreadPool::ThreadPool(size_t workerCount) : nextIndex(0) {
+        if (workerCount == 0) {
+            unsigned int hardwareThreads = std::thread::hardware_concurrency();
+            workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+        }
+        for (size_t i = 0; i < workerCount; i++) {
+            workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+    }
+
+    void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& job) {
+        if (count == 0) {
+            return;
+        }
+        if (workers.empty() || count == 1) {
+            for (size_t i = 0; i < count; i++) {
+                job(i);
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            this->job = &job;
+            jobCount = count;
+            nextIndex = 0;
+            busyWorkers = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+
+        runJobs();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this] { return busyWorkers == 0; });
+        this->job = nullptr;
+    }
+
+    size_t ThreadPool::getThreadCount() {
+        return workers.size() + 1;
+    }
+
+    void ThreadPool::workerLoop() {
+        unsigned int seenGeneration = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this, seenGeneration] { return stopping || generation != seenGeneration; });
+                if (stopping) {
+                    return;
+                }
+                seenGeneration = generation;
+            }
+
+            runJobs();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            busyWorkers--;
+            if (busyWorkers == 0) {
+                finished.notify_one();
+            }
+        }
+    }
+
+    void ThreadPool::runJobs() {
+        size_t index;
+        while ((index = nextIndex++) < jobCount) {
+            (*job)(index);
+        }
+    }
+
+}
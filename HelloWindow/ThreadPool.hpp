@@ -0,0 +1,46 @@
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+    //persistent worker threads for splitting CPU work (rasterization, baking) over the cores
+    class ThreadPool
+    {
+    public:
+        //threads beside the calling one, 0 uses one per hardware thread minus the caller
+        ThreadPool(size_t workerCount = 0);
+        ~ThreadPool();
+
+        //runs job(i) for every i in [0, count) on the workers and the calling thread, returns when all are done
+        void parallelFor(size_t count, const std::function<void(size_t)>& job);
+        //workers plus the calling thread
+        size_t getThreadCount();
+
+    private:
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable finished;
+
+        const std::function<void(size_t)>* job = nullptr;
+        size_t jobCount = 0;
+        std::atomic<size_t> nextIndex;
+        //bumped for every parallelFor so each worker joins it exactly once
+        unsigned int generation = 0;
+        size_t busyWorkers = 0;
+        bool stopping = false;
+
+        void workerLoop();
+        void runJobs();
+    };
+
+}
+
+#endif /* ThreadPool_hpp */
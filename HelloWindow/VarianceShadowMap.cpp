@@ -0,0 +1,87 @@
+#include "VarianceShadowMap.hpp"
+
+#include <cstdio>
+
+namespace gps {
+
+    bool VarianceShadowMap::init() {
+        glGenFramebuffers(2, framebuffers);
+        glGenTextures(2, moments);
+        glGenRenderbuffers(1, &depthBuffer);
+        glGenVertexArrays(1, &emptyVAO);
+
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, VSM_SIZE, VSM_SIZE);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        GLenum status = GL_FRAMEBUFFER_COMPLETE;
+        for (int i = 0; i < 2; i++) {
+            glBindTexture(GL_TEXTURE_2D, moments[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, VSM_SIZE, VSM_SIZE, 0, GL_RG, GL_FLOAT, NULL);
+            //unlike a depth map the moments are filtered, outside the map is lit
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+            glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, moments[i], 0);
+            //only the casters need a depth test, the blur passes draw over everything
+            if (i == 0) {
+                glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+            }
+            glDrawBuffer(GL_COLOR_ATTACHMENT0);
+            GLenum targetStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+            if (targetStatus != GL_FRAMEBUFFER_COMPLETE) {
+                status = targetStatus;
+            }
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        if (status != GL_FRAMEBUFFER_COMPLETE) {
+            printf("variance shadow map: framebuffer incomplete (0x%x) at %dx%d\n", status, VSM_SIZE, VSM_SIZE);
+            return false;
+        }
+        return true;
+    }
+
+    void VarianceShadowMap::beginShadowPass() {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[0]);
+        glViewport(0, 0, VSM_SIZE, VSM_SIZE);
+        glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        //the moments are data, not colors to blend
+        glDisable(GL_BLEND);
+    }
+
+    void VarianceShadowMap::endShadowPass(gps::Shader blurShader) {
+        glDisable(GL_DEPTH_TEST);
+        drawBlurPass(blurShader, 1, 1.0f / VSM_SIZE, 0.0f);
+        drawBlurPass(blurShader, 0, 0.0f, 1.0f / VSM_SIZE);
+        glEnable(GL_DEPTH_TEST);
+        glEnable(GL_BLEND);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void VarianceShadowMap::drawBlurPass(gps::Shader blurShader, int target, float stepX, float stepY) {
+        blurShader.useShaderProgram();
+        glUniform1i(glGetUniformLocation(blurShader.shaderProgram, "moments"), 0);
+        glUniform2f(glGetUniformLocation(blurShader.shaderProgram, "blurStep"), stepX, stepY);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[target]);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, moments[1 - target]);
+        glBindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    GLuint VarianceShadowMap::getTexture() {
+        return moments[0];
+    }
+
+}
@@ -0,0 +1,43 @@
+#ifndef VarianceShadowMap_hpp
+#define VarianceShadowMap_hpp
+
+#include <GL/glew.h>
+
+#include "Shader.hpp"
+
+namespace gps {
+
+    //texels per side of the moments, a small fraction of the hard shadow map
+    const int VSM_SIZE = 2048;
+
+    //Variance shadow map of the sun. The casters write their depth and squared depth, which are blurred
+    //by a separable Gaussian and read back filtered: basic.frag bounds the lit fraction of a receiver
+    //from the two moments with Chebyshev's inequality, giving soft shadow edges.
+    class VarianceShadowMap
+    {
+    public:
+        //creates the targets, false when the framebuffer is incomplete
+        bool init();
+
+        //binds the moments target and clears it to the far plane
+        void beginShadowPass();
+        //blurs the moments along x then y and goes back to the default framebuffer
+        void endShadowPass(gps::Shader blurShader);
+
+        //the blurred moments, depth in r and squared depth in g
+        GLuint getTexture();
+
+    private:
+        //the moments are blurred from the first target into the second and back
+        GLuint framebuffers[2] = { 0, 0 };
+        GLuint moments[2] = { 0, 0 };
+        GLuint depthBuffer = 0;
+        //the fullscreen triangle is made from gl_VertexID, core profile still needs a bound VAO
+        GLuint emptyVAO = 0;
+
+        void drawBlurPass(gps::Shader blurShader, int target, float stepX, float stepY);
+    };
+
+}
+
+#endif /* VarianceShadowMap_hpp */
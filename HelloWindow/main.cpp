@@ -14,14 +14,54 @@
 #include "Mesh.hpp"
 #include "Collision.hpp"
 #include "SkyBox.hpp"
-
+#include "StaticBatcher.hpp"
+#include "IndirectRenderer.hpp"
+#include "LodSelector.hpp"
+#include "Impostor.hpp"
+#include "OverdrawMeter.hpp"
+#include "OcclusionCuller.hpp"
+#include "PortalCuller.hpp"
+#include "OcclusionQueries.hpp"
+#include "Bvh.hpp"
+#include "BvhBenchmark.hpp"
+#include "ClusteredLights.hpp"
+#include "GBuffer.hpp"
+#include "Lightmap.hpp"
+#include "LightmapBaker.hpp"
+#include "SphericalHarmonics.hpp"
+#include "ProceduralSky.hpp"
+#include "VarianceShadowMap.hpp"
+#include "PointShadowMap.hpp"
+#include "ShadowAtlas.hpp"
+#include "RenderGraph.hpp"
+#include "FrameAllocator.hpp"
+#include "FixedTimestep.hpp"
+#include "ThreadPool.hpp"
+
+#include <cfloat>
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
 
 const float toRadians = 3.14159265f / 180.0f;
 const float fromRadians = 180.0f / 3.14159265f;
 
 const unsigned int SHADOW_WIDTH = 10480;
 const unsigned int SHADOW_HEIGHT = 10480;
+// the sun's shadow is fitted to the receivers seen up to this far from the camera
+const float SHADOW_DISTANCE = 25.0f;
+// the fitted width is rounded up to whole steps, so its texels keep their size between frames
+const float SHADOW_FIT_STEP = 1.0f;
+// depth bias of the hard sun shadow in world units, the fitted depth range changes every frame
+const float SHADOW_BIAS = 0.08f;
+const int SHADOW_REPORT_FRAMES = 120;
+int shadowFramesSinceReport = 0;
+// SHADOW_BIAS in the depth range of this frame's light volume
+float sunShadowBias = 0.005f;
 
 // window
 gps::Window myWindow;
@@ -30,6 +70,8 @@ gps::Window myWindow;
 glm::mat4 model;
 glm::mat4 view;
 glm::mat4 projection;
+// the sky's own, projection stays the one of the scene
+glm::mat4 skyboxProjection;
 glm::mat3 normalMatrix;
 
 glm::mat4 initial_view;
@@ -38,6 +80,14 @@ glm::vec3 front_direction;
 // light parameters
 glm::vec3 lightDir;
 glm::vec3 lightColor;
+// the rest of the state sent to the main shader, the other passes read it here instead of from the program
+glm::vec3 spotLightPosition;
+glm::vec3 spotLightDirection;
+float spotCutOff;
+float spotOuterCutOff;
+bool showSpotLight = false;
+bool showFog = false;
+bool nightModeEnabled = false;
 
 // shader uniform locations
 GLint modelLoc;
@@ -80,11 +130,127 @@ Model3D tree_bark2;
 Model3D tree_leaves2;
 Model3D clover;
 
+// static scenery merged per material and cell, with one merged level of detail per source level
+gps::StaticBatcher staticScenery;
+bool useStaticBatching = true;
+
+// static scenery submitted with multi-draw indirect
+gps::IndirectRenderer indirectScenery;
+bool useIndirectDraws = false;
+
+// distance based level of detail
+gps::LodSelector lodSelector;
+bool useLod = true;
+
+// baked tree planted around the range as camera facing quads
+gps::Impostor treeImpostor;
+bool showImpostorForest = true;
+// planted on the terrain, away from the range in the middle of it
+const int IMPOSTOR_FOREST_TREES = 600;
+const float IMPOSTOR_FOREST_INNER_RADIUS = 12.0f;
+// kept this far inside the terrain's edges so the quads do not hang over them
+const float IMPOSTOR_FOREST_EDGE_MARGIN = 0.5f;
+
+// foliage resolved by a depth pre-pass with alpha to coverage on the window's 4x MSAA
+bool useAlphaToCoverage = false;
+// depth pre-pass of all the static geometry, basic.frag then lights each visible pixel once
+bool useDepthPrepass = false;
+
+// shaded fragments and samples of the static scenery, printed periodically
+gps::OverdrawMeter prepassOverdraw;
+gps::OverdrawMeter sceneryOverdraw;
+
+// worker threads shared by the occlusion rasterizer, the light clusters and the sky
+std::unique_ptr<gps::ThreadPool> workerPool;
+
+// scenery hidden behind the cottage, the terrain and the target is skipped in the main pass
+gps::OcclusionCuller occlusionCuller;
+bool useOcclusionCulling = true;
+size_t targetOccluder;
+
+// cottage interior and the outside seen through the door and windows
+gps::PortalCuller portalCuller;
+bool usePortalCulling = true;
+int outsideCell;
+int cottageCell;
+
+// GPU occlusion queries on the cottage interior, the bow in the cottage and the foliage.
+// The batched path draws other meshes than the individual and indirect ones, each has its set
+gps::OcclusionQueries sceneryQueries;
+gps::OcclusionQueries batchQueries;
+gps::OcclusionQueries bowQueries;
+bool useOcclusionQueries = true;
+
+// every mesh instance of the scene in a bounding volume hierarchy, for view and shadow
+// frustum culling and the flying arrow's ray queries
+enum SceneInstancePath { DRAWN_BY_ALL_PATHS, DRAWN_BY_MODELS, DRAWN_BY_BATCHES };
+struct SceneInstance {
+    Mesh* mesh;
+    Model3D* model;
+    glm::mat4 modelMatrix;
+    SceneInstancePath path;
+    bool castsShadow;
+    bool isTransparent;
+    int leaf;
+};
+std::vector<SceneInstance> sceneInstances;
+gps::Bvh sceneBvh;
+// triangles of LOD0 in model space per mesh, built on the first ray that reaches the mesh
+std::map<Mesh*, gps::Bvh> meshTriangleTrees;
+bool useFrustumCulling = true;
+std::vector<Mesh*> frustumCulledMeshes;
+
+// cottage lamp and lanterns around the range, lit at night per cluster of the view frustum
+gps::ClusteredLights clusteredLights;
+bool showLanterns = true;
+const int LANTERN_COUNT = 256;
+// annulus around the shooting spot the lanterns are planted in
+const float LANTERN_INNER_RADIUS = 1.0f;
+const float LANTERN_OUTER_RADIUS = 9.0f;
+size_t firstLantern;
+size_t cottageLamp;
+
+// shadow cubemap of the cottage lamp, kept between frames
+gps::PointShadowMap lampShadowMap;
+gps::Shader pointShadowShader;
+
+// shadows of the spotlights, drawn every frame into tiles of one atlas
+gps::ShadowAtlas spotShadowAtlas;
+bool useSpotShadows = false;
+// depth range of the flashlight's shadow, its light is faint past it
+const float SPOT_SHADOW_NEAR = 0.1f;
+const float SPOT_SHADOW_RANGE = 20.0f;
+// the flashlight's tile of this frame and the view projection it is drawn with
+gps::ShadowAtlasTile spotShadowTile;
+glm::mat4 spotShadowViewProjection;
+
+// baked sun and lamp light of the terrain and the cottage, made with --bake-lightmaps
+gps::Lightmap rangeLightmap;
+const char* LIGHTMAP_FILE = "models/scene/range.lightmap";
+bool useLightmaps = true;
+
+// deferred path, chosen with --deferred at startup: the scenery is written to a G-buffer and lit once per pixel
+bool useDeferredShading = false;
+gps::GBuffer gBuffer;
+
+// the passes of a frame, declared again every frame, and the pool its transient targets come from
+gps::RenderGraph frameGraph;
+
+// data that only lives for a frame, the per-object constants and the cluster light lists, written into a
+// mapped ring instead of being pushed through glUniform* and reallocated buffers
+gps::FrameAllocator frameAllocator;
+bool useFrameAllocator = false;
+
 GLfloat angle;
 
 // shaders
 gps::Shader myBasicShader;
 gps::Shader depthMapShader;
+gps::Shader impostorShader;
+gps::Shader impostorBakeShader;
+gps::Shader depthPrepassShader;
+gps::Shader boundingBoxShader;
+gps::Shader deferredShader;
 
 //mouse
 bool firstMouse = true;
@@ -99,6 +265,11 @@ Texture plainTexture;
 //for shadows
 GLuint shadowMapFBO;
 GLuint depthMapTexture;
+
+//soft shadows from a blurred variance shadow map in place of the hard one, chosen with --variance-shadows
+bool useVarianceShadows = false;
+gps::VarianceShadowMap varianceShadowMap;
+gps::Shader vsmBlurShader;
 bool showDepthMap;
 bool showShadows = false;
 
@@ -108,6 +279,8 @@ float sun_position_z = 1.0f;
 bool inc_y = true;
 bool dayCycleCompleted = false;
 bool changeDayNightMode = false;
+// sun position of the tick before the last, the frames draw the sun between the two
+glm::vec3 previousSunDirection = glm::vec3(0.0f, 0.0f, 1.0f);
 
 //make arrow fly
 bool shotArrow = false;
@@ -120,10 +293,22 @@ float acceleration;
 float horiz_velocity = 0.3f;
 float vert_velocity = 0.1f;
 bool goingUp = true;
+// pitch of the flying arrow, and where the arrow was the tick before the last
+float arrowRotation = 0.0f;
+float previousArrowRotation = 0.0f;
+glm::vec3 previousArrowPosition;
 
 float deltaTime = 0.0f;	// Time between current frame and last frame
 float lastFrame = 0.0f; // Time of last frame
 
+// the sun, the arrow, the target and the camera's collisions advance in fixed ticks of this clock, set with
+// --tick-rate, and the frames draw their state between the last two ticks
+gps::FixedTimestep simulationClock;
+double simulationTickRate = gps::FIXED_TIMESTEP_DEFAULT_RATE;
+// the sun and the arrow used to step a fixed amount per frame, tuned at this frame rate
+const float TUNED_FRAME_RATE = 60.0f;
+const float SUN_SPEED = 0.002f * TUNED_FRAME_RATE;
+
 //target state
 int target_state = 0;
 
@@ -140,12 +325,12 @@ bool bowAquired = false;
 bool enableNightMode = false;
 bool enableDayNightCycle = false;
 
-std::vector<const GLchar*> faces;
-std::vector<const GLchar*> darkFaces;
-
 gps::SkyBox mySkyBox;
 gps::Shader skyboxShader;
 
+//sky of the day/night cycle, also the source of the ambient light
+gps::ProceduralSky proceduralSky;
+
 
 GLenum glCheckError_(const char *file, int line)
 {
@@ -245,8 +430,8 @@ void mouseCallback(GLFWwindow* window, double xpos, double ypos) {
     normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
     normalMatrixLoc = glGetUniformLocation(myBasicShader.shaderProgram, "normalMatrix");
 
-    glm::vec3 newSpotDir = myCamera.getFrontDirection();
-    glUniform3fv(lightSpotDirLoc, 1, glm::value_ptr(newSpotDir));
+    spotLightDirection = myCamera.getFrontDirection();
+    glUniform3fv(lightSpotDirLoc, 1, glm::value_ptr(spotLightDirection));
 }
 
 void processInputs() {
@@ -262,8 +447,8 @@ void processInputs() {
         normalMatrixLoc = glGetUniformLocation(myBasicShader.shaderProgram, "normalMatrix");
 
         //send new spot light position
-        glm::vec3 newSpotPosition = myCamera.getPosition();
-        glUniform3fv(lightSpotPosLoc, 1, glm::value_ptr(newSpotPosition));
+        spotLightPosition = myCamera.getPosition();
+        glUniform3fv(lightSpotPosLoc, 1, glm::value_ptr(spotLightPosition));
     }
 
     if (pressedKeys[GLFW_KEY_S]) {
@@ -277,8 +462,8 @@ void processInputs() {
         normalMatrixLoc = glGetUniformLocation(myBasicShader.shaderProgram, "normalMatrix");
 
         //send new spot light position
-        glm::vec3 newSpotPosition = myCamera.getPosition();
-        glUniform3fv(lightSpotPosLoc, 1, glm::value_ptr(newSpotPosition));
+        spotLightPosition = myCamera.getPosition();
+        glUniform3fv(lightSpotPosLoc, 1, glm::value_ptr(spotLightPosition));
     }
 
     if (pressedKeys[GLFW_KEY_A]) {
@@ -291,8 +476,8 @@ void processInputs() {
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
 
         //send new spot light position
-        glm::vec3 newSpotPosition = myCamera.getPosition();
-        glUniform3fv(lightSpotPosLoc, 1, glm::value_ptr(newSpotPosition));
+        spotLightPosition = myCamera.getPosition();
+        glUniform3fv(lightSpotPosLoc, 1, glm::value_ptr(spotLightPosition));
     }
 
     if (pressedKeys[GLFW_KEY_D]) {
@@ -305,8 +490,8 @@ void processInputs() {
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
 
         //send new spot light position
-        glm::vec3 newSpotPosition = myCamera.getPosition();
-        glUniform3fv(lightSpotPosLoc, 1, glm::value_ptr(newSpotPosition));
+        spotLightPosition = myCamera.getPosition();
+        glUniform3fv(lightSpotPosLoc, 1, glm::value_ptr(spotLightPosition));
     }
 
     if (mouseClicked) {
@@ -330,13 +515,15 @@ void processInputs() {
     }
 
     if (pressedKeys[GLFW_KEY_KP_MULTIPLY]) {
+        showSpotLight = true;
         myBasicShader.useShaderProgram();
-        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "showSpotLight"), true);
+        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "showSpotLight"), showSpotLight);
     }
 
     if (pressedKeys[GLFW_KEY_KP_DIVIDE]) {
+        showSpotLight = false;
         myBasicShader.useShaderProgram();
-        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "showSpotLight"), false);
+        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "showSpotLight"), showSpotLight);
     }
     
 
@@ -355,49 +542,149 @@ void processInputs() {
         showShadows = false;
     }
 
+    if (pressedKeys[GLFW_KEY_B]) {
+        useStaticBatching = true;
+    }
+
+    if (pressedKeys[GLFW_KEY_V]) {
+        useStaticBatching = false;
+    }
+
+    if (pressedKeys[GLFW_KEY_I]) {
+        useIndirectDraws = true;
+    }
+
+    if (pressedKeys[GLFW_KEY_U]) {
+        useIndirectDraws = false;
+    }
+
+    if (pressedKeys[GLFW_KEY_J]) {
+        useLod = true;
+    }
+
+    if (pressedKeys[GLFW_KEY_H]) {
+        useLod = false;
+    }
+
+    if (pressedKeys[GLFW_KEY_T]) {
+        showImpostorForest = true;
+    }
+
+    if (pressedKeys[GLFW_KEY_Y]) {
+        showImpostorForest = false;
+    }
+
+    if (pressedKeys[GLFW_KEY_F]) {
+        useAlphaToCoverage = true;
+    }
+
+    if (pressedKeys[GLFW_KEY_G]) {
+        useAlphaToCoverage = false;
+    }
+
+    if (pressedKeys[GLFW_KEY_E]) {
+        useDepthPrepass = true;
+    }
+
+    if (pressedKeys[GLFW_KEY_R]) {
+        useDepthPrepass = false;
+    }
+
+    if (pressedKeys[GLFW_KEY_C]) {
+        useOcclusionCulling = true;
+    }
+
+    if (pressedKeys[GLFW_KEY_X]) {
+        useOcclusionCulling = false;
+    }
+
+    if (pressedKeys[GLFW_KEY_1]) {
+        usePortalCulling = true;
+    }
+
+    if (pressedKeys[GLFW_KEY_2]) {
+        usePortalCulling = false;
+    }
+
+    if (pressedKeys[GLFW_KEY_3]) {
+        useOcclusionQueries = true;
+    }
+
+    if (pressedKeys[GLFW_KEY_4]) {
+        useOcclusionQueries = false;
+    }
+
+    if (pressedKeys[GLFW_KEY_5]) {
+        useFrustumCulling = true;
+    }
+
+    if (pressedKeys[GLFW_KEY_6]) {
+        useFrustumCulling = false;
+    }
+
+    if (pressedKeys[GLFW_KEY_7]) {
+        showLanterns = true;
+    }
+
+    if (pressedKeys[GLFW_KEY_8]) {
+        showLanterns = false;
+    }
+
+    if (pressedKeys[GLFW_KEY_9]) {
+        useLightmaps = true;
+    }
+
+    if (pressedKeys[GLFW_KEY_0]) {
+        useLightmaps = false;
+    }
+
     if (pressedKeys[GLFW_KEY_K]) {
+        showFog = true;
         myBasicShader.useShaderProgram();
-        glUniform1i(showFogLoc, true);
+        glUniform1i(showFogLoc, showFog);
     }
 
     if (pressedKeys[GLFW_KEY_L]) {
+        showFog = false;
         myBasicShader.useShaderProgram();
-        glUniform1i(showFogLoc, false);
+        glUniform1i(showFogLoc, showFog);
     }
 
     if (pressedKeys[GLFW_KEY_N]) {
         enableNightMode = true;
         myBasicShader.useShaderProgram();
-        glm::vec3 lightColor = glm::vec3(0.05f, 0.05f, 0.05f); //dark light
+        lightColor = glm::vec3(0.05f, 0.05f, 0.05f); //dark light
         glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
-        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "nightModeEnabled"), true);
-        mySkyBox.Load(darkFaces);
+        nightModeEnabled = true;
+        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "nightModeEnabled"), nightModeEnabled);
     }
 
     if (pressedKeys[GLFW_KEY_M]) {
         enableNightMode = false;
         myBasicShader.useShaderProgram();
-        glm::vec3 lightColor = glm::vec3(1.0f, 1.0f, 1.0f); //white light
+        lightColor = glm::vec3(1.0f, 1.0f, 1.0f); //white light
         glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
-        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "nightModeEnabled"), false);
-        mySkyBox.Load(faces);
+        nightModeEnabled = false;
+        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "nightModeEnabled"), nightModeEnabled);
     }
 
     if (pressedKeys[GLFW_KEY_KP_1]) {
         enableDayNightCycle = true;
         sun_position_y = 0.0f;
         sun_position_z = 1.0f;
+        previousSunDirection = glm::vec3(0.0f, sun_position_y, sun_position_z);
     }
     if (pressedKeys[GLFW_KEY_KP_2]) {
         enableDayNightCycle = false;
         lightDir = glm::vec3(0.0f, 1.0f, 1.0f);
         glUniform3fv(lightDirLoc, 1, glm::value_ptr(lightDir));
-        glm::vec3 lightColor = glm::vec3(1.0f, 1.0f, 1.0f); //white light
+        lightColor = glm::vec3(1.0f, 1.0f, 1.0f); //white light
         glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
-        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "nightModeEnabled"), false);
+        nightModeEnabled = false;
+        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "nightModeEnabled"), nightModeEnabled);
         dayCycleCompleted = false;
         changeDayNightMode = false;
-        mySkyBox.Load(faces);
+        enableNightMode = false;
     }
 
     // line view
@@ -464,8 +751,416 @@ void initModels() {
     cottage = Model3D();
     cottage.LoadModel("models/cottage/cottage2.obj", "models/cottage/", false);
 
+    gps::sharedGeometryArena().printStats("geometry arena");
+}
+
+glm::mat4 terrainModelMatrix() {
+    glm::mat4 terrainModel = glm::mat4(1.0f);
+    terrainModel = glm::translate(terrainModel, glm::vec3(0.0f, 0.0f, 0.0f));
+    terrainModel = glm::scale(terrainModel, glm::vec3(2.0f, 2.0f, 2.0f));
+    return terrainModel;
+}
+
+glm::mat4 forestModelMatrix() {
+    // trees and grass
+    return glm::scale(glm::mat4(1.0f), glm::vec3(2.0f, 2.0f, 2.0f));
+}
+
+glm::mat4 cloverModelMatrix() {
+    return glm::scale(glm::mat4(1.0f), glm::vec3(2.0f, 1.0f, 2.0f));
+}
+
+glm::mat4 cottageModelMatrix() {
+    glm::mat4 cottageModel = glm::mat4(1.0f);
+    cottageModel = glm::translate(cottageModel, glm::vec3(-3.0f, 0.0f, 3.0f));
+    cottageModel = glm::rotate(cottageModel, 180 * toRadians, glm::vec3(0.0f, 1.0f, 0.0f));
+    cottageModel = glm::scale(cottageModel, glm::vec3(0.7f, 0.7f, 0.7f));
+    return cottageModel;
+}
+
+glm::mat4 targetModelMatrix() {
+    glm::mat4 targetModel = glm::mat4(1.0f);
+    targetModel = glm::translate(targetModel, glm::vec3(target_state * 0.5f, 0.2f, 5.0f));
+    targetModel = glm::scale(targetModel, glm::vec3(0.3f, 0.3f, 0.3f));
+    return targetModel;
+}
+
+glm::mat4 bowInCottageModelMatrix() {
+    glm::mat4 bowModel = glm::mat4(1.0f);
+    bowModel = glm::rotate(bowModel, 90 * toRadians, glm::vec3(1.0f, 0.0f, 0.0f));
+    bowModel = glm::translate(bowModel, glm::vec3(-2.6f, 3.9f, -0.27f));
+    bowModel = glm::scale(bowModel, glm::vec3(1.0f, 1.0f, 1.0f));
+    return bowModel;
+}
+
+// the static meshes lit from the lightmap
+std::vector<gps::LightmapTarget> lightmapTargets() {
+    std::vector<gps::LightmapTarget> targets;
+    const std::vector<Mesh*>& terrainMeshes = terrain.GetMeshes();
+    for (size_t i = 0; i < terrainMeshes.size(); i++) {
+        gps::LightmapTarget target = { terrainMeshes[i], terrainModelMatrix() };
+        targets.push_back(target);
+    }
+    const std::vector<Mesh*>& cottageMeshes = cottage.GetMeshes();
+    for (size_t i = 0; i < cottageMeshes.size(); i++) {
+        gps::LightmapTarget target = { cottageMeshes[i], cottageModelMatrix() };
+        targets.push_back(target);
+    }
+    return targets;
+}
+
+// before the batches copy the vertices: the lightmap coordinates split some of them
+void initLightmaps() {
+    if (!rangeLightmap.generateCoords(lightmapTargets())) {
+        return;
+    }
+    if (!rangeLightmap.load(LIGHTMAP_FILE)) {
+        printf("lightmap: %s is not baked, the terrain and the cottage are lit per fragment\n", LIGHTMAP_FILE);
+    }
+}
+
+// the tree trunks shade the range too, the alpha tested foliage is left to the shadow map
+void bakeLightmaps() {
+    if (rangeLightmap.getTexelsPerUnit() <= 0.0f) {
+        return;
+    }
+    std::vector<gps::LightmapTarget> occluders;
+    const std::vector<Mesh*>& barkMeshes = tree_bark1.GetMeshes();
+    for (size_t i = 0; i < barkMeshes.size(); i++) {
+        gps::LightmapTarget occluder = { barkMeshes[i], forestModelMatrix() };
+        occluders.push_back(occluder);
+    }
+    gps::LightmapBaker baker;
+    baker.bake(workerPool.get(), rangeLightmap, lightmapTargets(), occluders, clusteredLights.getLight(cottageLamp));
+    if (rangeLightmap.save(LIGHTMAP_FILE)) {
+        printf("lightmap: saved %s\n", LIGHTMAP_FILE);
+    }
+}
+
+void initStaticBatches() {
+    // everything that never moves, drawn in a handful of draws
+    staticScenery.add(terrain, terrainModelMatrix(), false);
+    staticScenery.add(clover, cloverModelMatrix(), false);
+    staticScenery.add(tree_bark1, forestModelMatrix(), false);
+    staticScenery.add(tree_leaves1, forestModelMatrix(), true);
+    staticScenery.add(grass, forestModelMatrix(), true);
+    staticScenery.add(cottage, cottageModelMatrix(), false);
+    staticScenery.build();
+    staticScenery.printStats();
+}
+
+void initIndirectDraws() {
+    // same scenery, one multi-draw per index type and texture size
+    indirectScenery.add(terrain, terrainModelMatrix(), false, false);
+    indirectScenery.add(clover, cloverModelMatrix(), false, false);
+    indirectScenery.add(tree_bark1, forestModelMatrix(), false, true);
+    indirectScenery.add(tree_leaves1, forestModelMatrix(), true, true);
+    indirectScenery.add(grass, forestModelMatrix(), true, false);
+    indirectScenery.add(cottage, cottageModelMatrix(), false, true);
+    indirectScenery.build();
+    indirectScenery.printStats();
+}
+
+
+// cottage2.obj model space: the outer wall footprint, its height and the openings in Wall_Ouside
+const float cottageFootprint[4][2] = {
+    { -1.0294f, -0.5119f }, { 0.0567f, -1.3674f }, { -1.1450f, -2.8931f }, { -2.2312f, -2.0375f } };
+const float cottageFloorY = 0.0119f;
+const float cottageCeilingY = 1.0982f;
+// x0, z0, x1, z1, bottom, top
+const float cottageOpenings[4][6] = {
+    { -2.1996f, -1.9975f, -1.9681f, -1.7035f, 0.0119f, 0.8974f },  // door
+    { -0.5386f, -0.8985f, -0.2416f, -1.1325f, 0.4707f, 0.8974f },  // windows
+    { -0.3905f, -1.9352f, -0.6291f, -2.2381f, 0.4707f, 0.8974f },
+    { -1.4766f, -1.0796f, -1.7152f, -1.3825f, 0.4707f, 0.8974f } };
+
+void initOcclusionCulling() {
+    // simplified stand-ins that stay inside the real surfaces: the terrain under its lowest points,
+    // the cottage walls inside their thickness and a box inside the target disk, which moves with every hit
+    occlusionCuller.init(workerPool.get());
+    occlusionCuller.addHeightfieldOccluder(terrain, terrainModelMatrix());
+
+    std::vector<glm::vec2> footprint;
+    for (int i = 0; i < 4; i++) {
+        footprint.push_back(glm::vec2(cottageFootprint[i][0], cottageFootprint[i][1]));
+    }
+    std::vector<gps::OccluderOpening> openings;
+    for (int i = 0; i < 4; i++) {
+        gps::OccluderOpening opening;
+        opening.start = glm::vec2(cottageOpenings[i][0], cottageOpenings[i][1]);
+        opening.end = glm::vec2(cottageOpenings[i][2], cottageOpenings[i][3]);
+        opening.bottom = cottageOpenings[i][4];
+        opening.top = cottageOpenings[i][5];
+        openings.push_back(opening);
+    }
+    occlusionCuller.addWallOccluder(footprint, cottageFloorY, cottageCeilingY, openings, cottageModelMatrix());
+
+    // the disk faces z, the box keeps to the square inside its circle and to the middle of its thickness
+    gps::AABB targetBounds = target.GetBounds();
+    glm::vec3 targetCenter = (targetBounds.min + targetBounds.max) * 0.5f;
+    glm::vec3 targetExtent = targetBounds.max - targetBounds.min;
+    float halfSide = 0.5f * std::min(targetExtent.x, targetExtent.y) * 0.7f;
+    gps::AABB targetBox;
+    targetBox.min = targetCenter - glm::vec3(halfSide, halfSide, 0.25f * targetExtent.z);
+    targetBox.max = targetCenter + glm::vec3(halfSide, halfSide, 0.25f * targetExtent.z);
+    targetOccluder = occlusionCuller.addBoxOccluder(targetBox, targetModelMatrix());
+}
+
+void initPortals() {
+    glm::mat4 cottageModel = cottageModelMatrix();
+    std::vector<glm::vec2> worldFootprint;
+    for (int i = 0; i < 4; i++) {
+        glm::vec3 corner = glm::vec3(cottageModel * glm::vec4(cottageFootprint[i][0], 0.0f, cottageFootprint[i][1], 1.0f));
+        worldFootprint.push_back(glm::vec2(corner.x, corner.z));
+    }
+    float worldFloorY = (cottageModel * glm::vec4(0.0f, cottageFloorY, 0.0f, 1.0f)).y;
+    float worldCeilingY = (cottageModel * glm::vec4(0.0f, cottageCeilingY, 0.0f, 1.0f)).y;
+
+    outsideCell = portalCuller.addCell("outside");
+    cottageCell = portalCuller.addCell("cottage", worldFootprint, worldFloorY, worldCeilingY);
+    for (int i = 0; i < 4; i++) {
+        const float* opening = cottageOpenings[i];
+        std::vector<glm::vec3> corners;
+        corners.push_back(glm::vec3(cottageModel * glm::vec4(opening[0], opening[4], opening[1], 1.0f)));
+        corners.push_back(glm::vec3(cottageModel * glm::vec4(opening[2], opening[4], opening[3], 1.0f)));
+        corners.push_back(glm::vec3(cottageModel * glm::vec4(opening[2], opening[5], opening[3], 1.0f)));
+        corners.push_back(glm::vec3(cottageModel * glm::vec4(opening[0], opening[5], opening[1], 1.0f)));
+        portalCuller.addPortal(outsideCell, cottageCell, corners);
+    }
+
+    // the inner walls are only seen from inside, window frames, beams and the floor slab from both sides
+    portalCuller.addMeshRule("Wall_Inside", cottageCell);
+    portalCuller.addMeshRule("Cube.004", cottageCell);
+    portalCuller.addMeshRule("Cube.004", outsideCell);
+    portalCuller.addMeshRule("Wood", cottageCell);
+    portalCuller.addMeshRule("Wood", outsideCell);
+    portalCuller.addMeshRule("Concrete", cottageCell);
+    portalCuller.addMeshRule("Concrete", outsideCell);
+}
+
+// cottage meshes only seen from inside or through the openings, the outer walls and the roof hide them
+bool isCottageInterior(const std::string& meshName) {
+    return meshName.find("Wall_Inside") != std::string::npos || meshName.find("Cube.004") != std::string::npos ||
+        meshName.find("Wood") != std::string::npos || meshName.find("Concrete") != std::string::npos;
+}
+
+void initOcclusionQueries() {
+    sceneryQueries.init("scenery");
+    batchQueries.init("batch");
+    bowQueries.init("bow");
+
+    const std::vector<Mesh*>& cottageMeshes = cottage.GetMeshes();
+    for (size_t i = 0; i < cottageMeshes.size(); i++) {
+        if (isCottageInterior(cottageMeshes[i]->name)) {
+            sceneryQueries.add(*cottageMeshes[i], cottageModelMatrix());
+        }
+    }
+    // the foliage is loaded in chunks, each chunk is a cluster with its own query
+    const std::vector<Mesh*>& leavesMeshes = tree_leaves1.GetMeshes();
+    for (size_t i = 0; i < leavesMeshes.size(); i++) {
+        sceneryQueries.add(*leavesMeshes[i], forestModelMatrix());
+    }
+    const std::vector<Mesh*>& grassMeshes = grass.GetMeshes();
+    for (size_t i = 0; i < grassMeshes.size(); i++) {
+        sceneryQueries.add(*grassMeshes[i], forestModelMatrix());
+    }
+
+    // batches merge a whole material, only the interior and foliage ones are worth a query
+    const std::vector<gps::StaticBatch>& batches = staticScenery.getBatches();
+    for (size_t i = 0; i < batches.size(); i++) {
+        if (batches[i].isTransparent || isCottageInterior(batches[i].mesh->name)) {
+            batchQueries.add(*batches[i].mesh, glm::mat4(1.0f));
+        }
+    }
+
+    const std::vector<Mesh*>& bowMeshes = bow.GetMeshes();
+    for (size_t i = 0; i < bowMeshes.size(); i++) {
+        bowQueries.add(*bowMeshes[i], bowInCottageModelMatrix());
+    }
+}
+
+void addSceneInstances(Model3D& model, const glm::mat4& modelMatrix, SceneInstancePath path, bool castsShadow, bool isTransparent) {
+    const std::vector<Mesh*>& meshes = model.GetMeshes();
+    for (size_t i = 0; i < meshes.size(); i++) {
+        SceneInstance instance = { meshes[i], &model, modelMatrix, path, castsShadow, isTransparent, gps::BVH_NULL_NODE };
+        instance.leaf = sceneBvh.insert(meshes[i]->getBounds().transformed(modelMatrix), sceneInstances.size());
+        sceneInstances.push_back(instance);
+    }
+}
+
+void initSceneBvh() {
+    // the shadow casters are the models the shadow pass draws
+    addSceneInstances(terrain, terrainModelMatrix(), DRAWN_BY_MODELS, true, false);
+    addSceneInstances(clover, cloverModelMatrix(), DRAWN_BY_MODELS, false, false);
+    addSceneInstances(tree_bark1, forestModelMatrix(), DRAWN_BY_MODELS, true, false);
+    addSceneInstances(tree_leaves1, forestModelMatrix(), DRAWN_BY_MODELS, true, true);
+    addSceneInstances(grass, forestModelMatrix(), DRAWN_BY_MODELS, false, true);
+    addSceneInstances(cottage, cottageModelMatrix(), DRAWN_BY_MODELS, true, false);
+    addSceneInstances(bow, bowInCottageModelMatrix(), DRAWN_BY_ALL_PATHS, false, false);
+    const std::vector<gps::StaticBatch>& batches = staticScenery.getBatches();
+    for (size_t i = 0; i < batches.size(); i++) {
+        SceneInstance instance = { batches[i].mesh, NULL, glm::mat4(1.0f), DRAWN_BY_BATCHES, false, batches[i].isTransparent, gps::BVH_NULL_NODE };
+        instance.leaf = sceneBvh.insert(batches[i].bounds, sceneInstances.size());
+        sceneInstances.push_back(instance);
+    }
+
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    sceneBvh.build();
+    double buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    // the moving models are inserted after the build and follow their matrices every frame
+    addSceneInstances(target, targetModelMatrix(), DRAWN_BY_ALL_PATHS, true, false);
+    addSceneInstances(arrow, glm::mat4(1.0f), DRAWN_BY_ALL_PATHS, false, false);
+    printf("scene bvh: %zu instances, SAH build %.2f ms, height %d, cost %.1f\n",
+        sceneBvh.getLeafCount(), buildMilliseconds, sceneBvh.getHeight(), sceneBvh.getCost());
+}
+
+void moveSceneInstances(Model3D& model, const glm::mat4& modelMatrix) {
+    for (size_t i = 0; i < sceneInstances.size(); i++) {
+        if (sceneInstances[i].model == &model) {
+            // a caster moving near the lamp, from where it was or to where it goes, redraws the lamp's shadow
+            if (sceneInstances[i].castsShadow && sceneInstances[i].modelMatrix != modelMatrix) {
+                lampShadowMap.invalidate(sceneInstances[i].mesh->getBounds().transformed(sceneInstances[i].modelMatrix));
+                lampShadowMap.invalidate(sceneInstances[i].mesh->getBounds().transformed(modelMatrix));
+            }
+            sceneInstances[i].modelMatrix = modelMatrix;
+            sceneBvh.update(sceneInstances[i].leaf, sceneInstances[i].mesh->getBounds().transformed(modelMatrix));
+        }
+    }
+}
+
+// the bow in the cottage and the flying arrow share their meshes with the ones held in front of the camera
+bool isSceneInstanceDrawn(const SceneInstance& instance) {
+    if (instance.model == &bow) {
+        return !bowAquired;
+    }
+    if (instance.model == &arrow) {
+        return shotArrow && !getInitialPosition;
+    }
+    return true;
+}
+
+// marks the instances the pass draws that are outside the frustum of the matrix
+void cullSceneInstances(const glm::mat4& viewProjection, bool shadowPass) {
+    if (!useFrustumCulling) {
+        return;
+    }
+    std::vector<size_t> visible;
+    sceneBvh.queryFrustum(viewProjection, visible);
+    std::vector<bool> inFrustum(sceneInstances.size(), false);
+    for (size_t i = 0; i < visible.size(); i++) {
+        inFrustum[visible[i]] = true;
+    }
+
+    // the shadow pass draws the models, the main pass the batches or the models
+    bool batched = !useIndirectDraws && useStaticBatching;
+    for (size_t i = 0; i < sceneInstances.size(); i++) {
+        const SceneInstance& instance = sceneInstances[i];
+        bool drawnByPass = shadowPass ? instance.castsShadow :
+            instance.path == DRAWN_BY_ALL_PATHS || (instance.path == DRAWN_BY_BATCHES) == batched;
+        if (inFrustum[i] || !drawnByPass || !isSceneInstanceDrawn(instance)) {
+            continue;
+        }
+        instance.mesh->setOccluded(true);
+        frustumCulledMeshes.push_back(instance.mesh);
+    }
+}
+
+// how many of the sun's casters the fitted volume dropped, every SHADOW_REPORT_FRAMES shadow passes
+void reportShadowCasters() {
+    if (!useFrustumCulling || ++shadowFramesSinceReport < SHADOW_REPORT_FRAMES) {
+        return;
+    }
+    shadowFramesSinceReport = 0;
+    size_t casters = 0;
+    for (size_t i = 0; i < sceneInstances.size(); i++) {
+        if (sceneInstances[i].castsShadow && isSceneInstanceDrawn(sceneInstances[i])) {
+            casters++;
+        }
+    }
+    printf("sun shadow: %zu of %zu casters outside the fitted light volume\n", frustumCulledMeshes.size(), casters);
+}
+
+void restoreSceneInstances() {
+    for (size_t i = 0; i < frustumCulledMeshes.size(); i++) {
+        frustumCulledMeshes[i]->setOccluded(false);
+    }
+    frustumCulledMeshes.clear();
+}
+
+// the triangle tree of the mesh, item i is the triangle starting at index lod.indexOffset + 3 * i
+const gps::Bvh& meshTriangleTree(Mesh& mesh) {
+    std::map<Mesh*, gps::Bvh>::iterator found = meshTriangleTrees.find(&mesh);
+    if (found != meshTriangleTrees.end()) {
+        return found->second;
+    }
+    const MeshLod& lod = mesh.getLod(0);
+    std::vector<gps::AABB> triangles;
+    triangles.reserve(lod.indexCount / 3);
+    for (size_t i = lod.indexOffset; i + 2 < lod.indexOffset + lod.indexCount; i += 3) {
+        gps::AABB triangle;
+        triangle.expand(mesh.vertices[mesh.indices[i]].Position);
+        triangle.expand(mesh.vertices[mesh.indices[i + 1]].Position);
+        triangle.expand(mesh.vertices[mesh.indices[i + 2]].Position);
+        triangles.push_back(triangle);
+    }
+    gps::Bvh& tree = meshTriangleTrees[&mesh];
+    tree.build(triangles);
+    return tree;
+}
+
+// nearest triangle of the mesh along the ray, the distance is in world units for a unit direction
+bool raycastMesh(Mesh& mesh, const glm::mat4& modelMatrix, const glm::vec3& origin, const glm::vec3& direction, float& distance) {
+    glm::mat4 inverseModel = glm::inverse(modelMatrix);
+    glm::vec3 localOrigin = glm::vec3(inverseModel * glm::vec4(origin, 1.0f));
+    glm::vec3 localDirection = glm::vec3(inverseModel * glm::vec4(direction, 0.0f));
+
+    // the model matrix keeps the ray parameter, the local distances compare with the world ones
+    const MeshLod& lod = mesh.getLod(0);
+    size_t hitTriangle;
+    return meshTriangleTree(mesh).raycast(localOrigin, localDirection, FLT_MAX,
+        [&](size_t triangle, float& triangleDistance) {
+            size_t i = lod.indexOffset + 3 * triangle;
+            return myCollisionDetection.checkIfRayHitsTriangle(localOrigin, localDirection, mesh.vertices[mesh.indices[i]].Position,
+                mesh.vertices[mesh.indices[i + 1]].Position, mesh.vertices[mesh.indices[i + 2]].Position, triangleDistance);
+        }, hitTriangle, distance);
+}
+
+// true when the segment crosses an opaque surface of the static scenery, with the distance to the first one
+bool raycastScenery(const glm::vec3& from, const glm::vec3& to, float& hitDistance) {
+    float length = glm::length(to - from);
+    if (length <= 0.0f) {
+        return false;
+    }
+    glm::vec3 direction = (to - from) / length;
+    size_t hitInstance;
+    return sceneBvh.raycast(from, direction, length,
+        [&](size_t i, float& distance) {
+            const SceneInstance& instance = sceneInstances[i];
+            // the target keeps its own hit test
+            if (instance.path == DRAWN_BY_BATCHES || instance.isTransparent || instance.model == &target ||
+                instance.model == &arrow || !isSceneInstanceDrawn(instance)) {
+                return false;
+            }
+            return raycastMesh(*instance.mesh, instance.modelMatrix, from, direction, distance);
+        }, hitInstance, hitDistance);
 }
 
+// height of the terrain under x, z, false off the terrain
+bool terrainHeight(float x, float z, float& height) {
+    const float rayHeight = 100.0f;
+    glm::vec3 from = glm::vec3(x, rayHeight, z);
+    glm::vec3 direction = glm::vec3(0.0f, -1.0f, 0.0f);
+    size_t hitInstance;
+    float hitDistance;
+    bool hit = sceneBvh.raycast(from, direction, 2.0f * rayHeight,
+        [&](size_t i, float& distance) {
+            const SceneInstance& instance = sceneInstances[i];
+            return instance.model == &terrain && raycastMesh(*instance.mesh, instance.modelMatrix, from, direction, distance);
+        }, hitInstance, hitDistance);
+    height = rayHeight - hitDistance;
+    return hit;
+}
 
 void initShaders() {
 	myBasicShader.loadShader(
@@ -473,22 +1168,92 @@ void initShaders() {
         "shaders/basic.frag");
 
     depthMapShader.loadShader("shaders/shadow.vert", "shaders/shadow.frag");
+    //the blur passes draw the same fullscreen triangle as the deferred lighting
+    vsmBlurShader.loadShader("shaders/deferred.vert", "shaders/vsmBlur.frag");
+    pointShadowShader.loadShader("shaders/pointShadow.vert", "shaders/pointShadow.geom", "shaders/pointShadow.frag");
+    impostorShader.loadShader("shaders/impostor.vert", "shaders/impostor.frag");
+    impostorBakeShader.loadShader("shaders/impostorBake.vert", "shaders/impostorBake.frag");
+    depthPrepassShader.loadShader("shaders/depth.vert", "shaders/depth.frag");
+    boundingBoxShader.loadShader("shaders/boundingBox.vert", "shaders/boundingBox.frag");
+    deferredShader.loadShader("shaders/deferred.vert", "shaders/deferred.frag");
+}
+
+void initOverdrawMeters() {
+    prepassOverdraw.init("depth pre-pass");
+    sceneryOverdraw.init("scenery");
+}
+
+void initImpostors() {
+    // bake the tree as it stands in the scene
+    std::vector<gps::ImpostorSource> sources;
+    gps::ImpostorSource bark = { &tree_bark1, forestModelMatrix(), false };
+    gps::ImpostorSource leaves = { &tree_leaves1, forestModelMatrix(), true };
+    sources.push_back(bark);
+    sources.push_back(leaves);
+    if (!treeImpostor.bake(sources, impostorBakeShader)) {
+        showImpostorForest = false;
+        return;
+    }
+
+    // plant a forest on the terrain around the range, same seed every run
+    gps::AABB terrainBounds;
+    const std::vector<Mesh*>& terrainMeshes = terrain.GetMeshes();
+    for (size_t i = 0; i < terrainMeshes.size(); i++) {
+        terrainBounds.expand(terrainMeshes[i]->getBounds().transformed(terrainModelMatrix()));
+    }
+    glm::vec2 footprintMin = glm::vec2(terrainBounds.min.x + IMPOSTOR_FOREST_EDGE_MARGIN, terrainBounds.min.z + IMPOSTOR_FOREST_EDGE_MARGIN);
+    glm::vec2 footprintMax = glm::vec2(terrainBounds.max.x - IMPOSTOR_FOREST_EDGE_MARGIN, terrainBounds.max.z - IMPOSTOR_FOREST_EDGE_MARGIN);
+
+    std::mt19937 generator(7);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<gps::ImpostorInstance> instances;
+    for (int i = 0; i < IMPOSTOR_FOREST_TREES; i++) {
+        // uniform over the footprint, outside the range, standing on the ground
+        glm::vec2 position;
+        float groundHeight;
+        do {
+            position.x = glm::mix(footprintMin.x, footprintMax.x, unit(generator));
+            position.y = glm::mix(footprintMin.y, footprintMax.y, unit(generator));
+        } while (glm::length(position) < IMPOSTOR_FOREST_INNER_RADIUS || !terrainHeight(position.x, position.y, groundHeight));
+
+        gps::ImpostorInstance instance;
+        instance.position = glm::vec3(position.x, groundHeight, position.y);
+        instance.scale = 0.8f + 0.4f * unit(generator);
+        instance.yaw = unit(generator) * glm::radians(360.0f);
+        instances.push_back(instance);
+    }
+    treeImpostor.setInstances(instances);
+    printf("impostor forest: %zu trees, one quad each (bounding radius %.2f)\n",
+        treeImpostor.getInstanceCount(), treeImpostor.getRadius());
+}
+
+// how far the sky is into the night, crossfaded around the day/night swaps and half way at the swap itself
+float skyNightWeight() {
+    float night = enableNightMode ? 1.0f : 0.0f;
+    if (enableDayNightCycle) {
+        float progress = (1.0f - sun_position_z) * 0.5f;
+        float nearSwap = 0.5f * (1.0f - glm::smoothstep(0.0f, 0.2f, progress)) + 0.5f * glm::smoothstep(0.8f, 1.0f, progress);
+        night = dayCycleCompleted ? 1.0f - nearSwap : nearSwap;
+    }
+    return night;
 }
 
 void initSkyBoxShader()
 {
-    mySkyBox.Load(faces);
+    proceduralSky.init(workerPool.get(), lightDir, skyNightWeight());
+    mySkyBox.Load(proceduralSky.getTexture());
+    printf("procedural sky: %d texel faces, %d tiles a frame\n", gps::PROCEDURAL_SKY_SIZE, gps::PROCEDURAL_SKY_TILES_PER_FRAME);
     skyboxShader.loadShader("shaders/skyboxShader.vert", "shaders/skyboxShader.frag");
     skyboxShader.useShaderProgram();
     view = myCamera.getViewMatrix();
     glUniformMatrix4fv(glGetUniformLocation(skyboxShader.shaderProgram, "view"), 1, GL_FALSE,
         glm::value_ptr(view));
 
-    projection = glm::perspective(glm::radians(45.0f), 
+    skyboxProjection = glm::perspective(glm::radians(45.0f), 
         (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height, 
         0.1f, 1000.0f);
     glUniformMatrix4fv(glGetUniformLocation(skyboxShader.shaderProgram, "projection"), 1, GL_FALSE,
-        glm::value_ptr(projection));
+        glm::value_ptr(skyboxProjection));
 }
 
 void initUniforms() {
@@ -540,22 +1305,51 @@ void initUniforms() {
     //spot light
     //set the spot light position
     lightSpotPosLoc = glGetUniformLocation(myBasicShader.shaderProgram, "spotLightPos");
-    glm::vec3 newSpotPosition = myCamera.getPosition();
-    glUniform3fv(lightSpotPosLoc, 1, glm::value_ptr(newSpotPosition));
+    spotLightPosition = myCamera.getPosition();
+    glUniform3fv(lightSpotPosLoc, 1, glm::value_ptr(spotLightPosition));
     //set the spot light direction
     lightSpotDirLoc = glGetUniformLocation(myBasicShader.shaderProgram, "spotLightDir");
-    glm::vec3 newSpotDir = myCamera.getFrontDirection();
-    glUniform3fv(lightSpotDirLoc, 1, glm::value_ptr(newSpotDir));
+    spotLightDirection = myCamera.getFrontDirection();
+    glUniform3fv(lightSpotDirLoc, 1, glm::value_ptr(spotLightDirection));
     glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "showSpotLight"), false);
     //send cutoffs
-    glUniform1f(glGetUniformLocation(myBasicShader.shaderProgram, "cutOff"), glm::cos(glm::radians(12.5f)));
-    glUniform1f(glGetUniformLocation(myBasicShader.shaderProgram, "outerCutOff"), glm::cos(glm::radians(15.0f)));
+    spotCutOff = glm::cos(glm::radians(12.5f));
+    spotOuterCutOff = glm::cos(glm::radians(15.0f));
+    glUniform1f(glGetUniformLocation(myBasicShader.shaderProgram, "cutOff"), spotCutOff);
+    glUniform1f(glGetUniformLocation(myBasicShader.shaderProgram, "outerCutOff"), spotOuterCutOff);
+
+    //texture arrays of the indirect draws
+    glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "diffuseTextureArray"), gps::DIFFUSE_ARRAY_UNIT);
+    glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "specularTextureArray"), gps::SPECULAR_ARRAY_UNIT);
+    glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "lightmap"), gps::LIGHTMAP_UNIT);
+    depthMapShader.useShaderProgram();
+    glUniform1i(glGetUniformLocation(depthMapShader.shaderProgram, "diffuseTextureArray"), gps::DIFFUSE_ARRAY_UNIT);
+    depthPrepassShader.useShaderProgram();
+    glUniform1i(glGetUniformLocation(depthPrepassShader.shaderProgram, "diffuseTextureArray"), gps::DIFFUSE_ARRAY_UNIT);
 
 
 
 }
 
 void initFBO() {
+    if (useVarianceShadows) {
+        if (varianceShadowMap.init()) {
+            printf("variance shadow map: %dx%d RG32F moments, separable blur\n", gps::VSM_SIZE, gps::VSM_SIZE);
+        }
+        else {
+            printf("variance shadow map: falling back to the hard shadow map\n");
+            useVarianceShadows = false;
+        }
+    }
+    myBasicShader.useShaderProgram();
+    glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "useVarianceShadows"), useVarianceShadows);
+    deferredShader.useShaderProgram();
+    glUniform1i(glGetUniformLocation(deferredShader.shaderProgram, "useVarianceShadows"), useVarianceShadows);
+    myBasicShader.useShaderProgram();
+    if (useVarianceShadows) {
+        return;
+    }
+
     //TODO - Create the FBO, the depth texture and attach the depth texture to the FBO
     // 
     //generate FBO ID
@@ -581,36 +1375,133 @@ void initFBO() {
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-void initFaces()
-{
+// the sun's ortho volume, fitted every frame around the receivers the camera sees up to SHADOW_DISTANCE
+// and stretched towards the light to the end of the scene, so the casters in between stay inside it
+glm::mat4 computeLightSpaceTrMatrix() {
+    glm::mat4 lightView = glm::lookAt(lightDir, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 
-    faces.push_back("skybox/daySkybox/posx.jpg");
-    faces.push_back("skybox/daySkybox/negx.jpg");
-    faces.push_back("skybox/daySkybox/posy.jpg");
-    faces.push_back("skybox/daySkybox/negy.jpg");
-    faces.push_back("skybox/daySkybox/posz.jpg");
-    faces.push_back("skybox/daySkybox/negz.jpg");
-}
+    // the camera frustum cut at the shadow distance, from the corners of clip space
+    glm::mat4 inverseProjection = glm::inverse(projection);
+    glm::mat4 inverseView = glm::inverse(view);
+    gps::AABB frustumBounds;
+    for (int corner = 0; corner < 8; corner++) {
+        glm::vec4 clip = glm::vec4(corner & 1 ? 1.0f : -1.0f, corner & 2 ? 1.0f : -1.0f, corner & 4 ? 1.0f : -1.0f, 1.0f);
+        glm::vec4 eye = inverseProjection * clip;
+        glm::vec3 position = glm::vec3(eye) / eye.w;
+        if (-position.z > SHADOW_DISTANCE) {
+            position *= SHADOW_DISTANCE / -position.z;
+        }
+        frustumBounds.expand(glm::vec3(inverseView * glm::vec4(position, 1.0f)));
+    }
 
+    // the visible receivers, clipped to the cut frustum
+    std::vector<size_t> visible;
+    sceneBvh.queryFrustum(projection * view, visible);
+    gps::AABB receivers;
+    for (size_t i = 0; i < visible.size(); i++) {
+        const SceneInstance& instance = sceneInstances[visible[i]];
+        if (isSceneInstanceDrawn(instance)) {
+            receivers.expand(instance.mesh->getBounds().transformed(instance.modelMatrix));
+        }
+    }
+    receivers.min = glm::max(receivers.min, frustumBounds.min);
+    receivers.max = glm::min(receivers.max, frustumBounds.max);
+    if (receivers.isEmpty()) {
+        receivers = frustumBounds;
+    }
 
-void initDarkFaces()
-{
-    darkFaces.push_back("skybox/nightSkybox/posx.tga");
-    darkFaces.push_back("skybox/nightSkybox/negx.tga");
-    darkFaces.push_back("skybox/nightSkybox/posy.tga");
-    darkFaces.push_back("skybox/nightSkybox/negy.tga");
-    darkFaces.push_back("skybox/nightSkybox/posz.tga");
-    darkFaces.push_back("skybox/nightSkybox/negz.tga");
+    // the light looks down -z: the far plane is behind the last receiver, the near one before the first caster
+    gps::AABB lightReceivers = receivers.transformed(lightView);
+    gps::AABB lightScene = sceneBvh.getBounds().transformed(lightView);
+    float nearPlane = -std::max(lightReceivers.max.z, lightScene.isEmpty() ? lightReceivers.max.z : lightScene.max.z);
+    float farPlane = -lightReceivers.min.z;
+
+    // a square of whole steps, its corner moved by whole texels, keeps the shadow edges from crawling
+    GLsizei resolution = useVarianceShadows ? gps::VSM_SIZE : SHADOW_WIDTH;
+    glm::vec3 extents = lightReceivers.max - lightReceivers.min;
+    float size = std::ceil(std::max(extents.x, extents.y) / SHADOW_FIT_STEP) * SHADOW_FIT_STEP;
+    float texel = size / resolution;
+    float left = std::floor(lightReceivers.min.x / texel) * texel;
+    float bottom = std::floor(lightReceivers.min.y / texel) * texel;
+
+    glm::mat4 lightProjection = glm::ortho(left, left + size, bottom, bottom + size, nearPlane, farPlane);
+    glm::mat4 lightSpaceTrMatrix = lightProjection * lightView;
+    sunShadowBias = SHADOW_BIAS / std::max(farPlane - nearPlane, SHADOW_BIAS);
+    return lightSpaceTrMatrix;
 }
 
-glm::mat4 computeLightSpaceTrMatrix() {
-    //TODO - Return the light-space transformation matrix
+// std140 layout of the ObjectConstants block of basic.vert, depth.vert and shadow.vert
+struct ObjectConstants {
+    glm::mat4 model;
+    // the columns of the normal matrix, each padded to a vec4
+    glm::vec4 normalMatrix[3];
+    GLint isTransparent;
+    GLint pad[3];
+};
+
+// binding of the ObjectConstants block
+const GLuint OBJECT_CONSTANTS_BINDING = 0;
+// set while a draw reads its constants from the ring
+bool drawsObjectConstants = false;
+
+// useObjectConstants of a program as last set, a run of draws from the ring sets it once
+struct ObjectConstantsSwitch {
+    GLuint program;
+    GLint location;
+    bool enabled;
+};
+std::vector<ObjectConstantsSwitch> objectConstantsSwitches;
+
+// the shader has to be in use, only the draws that change the path touch the uniform
+void setObjectConstantsEnabled(gps::Shader shader, bool enabled) {
+    ObjectConstantsSwitch* found = NULL;
+    for (size_t i = 0; i < objectConstantsSwitches.size(); i++) {
+        if (objectConstantsSwitches[i].program == shader.shaderProgram) {
+            found = &objectConstantsSwitches[i];
+        }
+    }
+    if (found == NULL) {
+        ObjectConstantsSwitch added = { shader.shaderProgram, glGetUniformLocation(shader.shaderProgram, "useObjectConstants"), false };
+        objectConstantsSwitches.push_back(added);
+        found = &objectConstantsSwitches.back();
+    }
+    if (found->enabled != enabled) {
+        glUniform1i(found->location, enabled);
+        found->enabled = enabled;
+    }
+}
 
-    glm::mat4 lightView = glm::lookAt(lightDir, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-    const GLfloat near_plane = -8.0f, far_plane = 8.0f;
-    glm::mat4 lightProjection = glm::ortho(-8.0f, 8.0f, -8.0f, 8.0f, near_plane, far_plane);
-    glm::mat4 lightSpaceTrMatrix = lightProjection * lightView;
-    return lightSpaceTrMatrix;
+// the constants of the next draw: written into the frame's ring and bound by their offset, through the
+// uniforms when the ring is missing or full. Consecutive ring draws only rebind the range
+void beginObjectDraw(gps::Shader shader, const glm::mat4& modelMatrix, const glm::mat3& normal, bool isTransparent) {
+    if (useFrameAllocator) {
+        ObjectConstants constants;
+        constants.model = modelMatrix;
+        for (int i = 0; i < 3; i++) {
+            constants.normalMatrix[i] = glm::vec4(normal[i], 0.0f);
+        }
+        constants.isTransparent = isTransparent;
+        gps::FrameAllocation allocation = frameAllocator.upload(constants);
+        if (allocation.data != NULL) {
+            glBindBufferRange(GL_UNIFORM_BUFFER, OBJECT_CONSTANTS_BINDING, frameAllocator.getBuffer(), allocation.offset, allocation.size);
+            setObjectConstantsEnabled(shader, true);
+            drawsObjectConstants = true;
+            return;
+        }
+    }
+    setObjectConstantsEnabled(shader, false);
+    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(modelMatrix));
+    glUniformMatrix3fv(glGetUniformLocation(shader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normal));
+    glUniform1i(glGetUniformLocation(shader.shaderProgram, "isTransparent"), isTransparent);
+}
+
+void endObjectDraw(gps::Shader shader, bool isTransparent) {
+    if (drawsObjectConstants) {
+        drawsObjectConstants = false;
+    }
+    else if (isTransparent) {
+        glUniform1i(glGetUniformLocation(shader.shaderProgram, "isTransparent"), false);
+    }
 }
 
 void renderTeapot(gps::Shader shader, bool depthPass) {
@@ -620,17 +1511,15 @@ void renderTeapot(gps::Shader shader, bool depthPass) {
     model = glm::mat4(1.0f);
     model = glm::translate(model, glm::vec3(0.0f, 0.7f, 0.0f));
 
-    //send teapot model matrix data to shader
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-
-    // do not send the normal matrix if we are rendering in the depth map
+    // the depth map does not need the normal matrix
     if (!depthPass) {
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
     }
 
     // draw teapot
+    beginObjectDraw(shader, model, normalMatrix, false);
     teapot.RenderModel(shader);
+    endObjectDraw(shader, false);
 }
 
 
@@ -638,58 +1527,64 @@ void renderTerrain(gps::Shader shader, bool depthPass) {
     // select active shader program
     shader.useShaderProgram();
 
-    model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));
-    model = glm::scale(model, glm::vec3(2.0f, 2.0f, 2.0f));
+    model = terrainModelMatrix();
 
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-
-    // do not send the normal matrix if we are rendering in the depth map
+    // the depth map does not need the normal matrix
     if (!depthPass) {
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
     }
 
     // draw teapot
+    beginObjectDraw(shader, model, normalMatrix, false);
     terrain.RenderModel(shader);
+    endObjectDraw(shader, false);
 }
 
-void renderTree(gps::Shader shader, bool depthPass) {
+void renderTreeBark(gps::Shader shader, bool depthPass) {
     // select active shader program
     shader.useShaderProgram();
 
-    model = glm::mat4(1.0f);
-    model = glm::scale(model, glm::vec3(2.0f, 2.0f, 2.0f));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-
-    // do not send the normal matrix if we are rendering in the depth map
+    model = forestModelMatrix();
+    // the depth map does not need the normal matrix
     if (!depthPass) {
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-        
     }
+    beginObjectDraw(shader, model, normalMatrix, false);
     tree_bark1.RenderModel(shader);
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "isTransparent"), true);
+    endObjectDraw(shader, false);
+}
+
+void renderTreeLeaves(gps::Shader shader, bool depthPass) {
+    // select active shader program
+    shader.useShaderProgram();
+
+    model = forestModelMatrix();
+    // the depth map does not need the normal matrix
+    if (!depthPass) {
+        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
+    }
+    beginObjectDraw(shader, model, normalMatrix, true);
     tree_leaves1.RenderModel(shader);
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "isTransparent"), false);
+    endObjectDraw(shader, true);
+}
 
+void renderTree(gps::Shader shader, bool depthPass) {
+    renderTreeBark(shader, depthPass);
+    renderTreeLeaves(shader, depthPass);
 }
 
 void renderClover(gps::Shader shader, bool depthPass) {
     // select active shader program
     shader.useShaderProgram();
 
-    model = glm::mat4(1.0f);
-    model = glm::scale(model, glm::vec3(2.0f, 1.0f, 2.0f));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-
-    // do not send the normal matrix if we are rendering in the depth map
+    model = cloverModelMatrix();
+    // the depth map does not need the normal matrix
     if (!depthPass) {
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-
     }
+    beginObjectDraw(shader, model, normalMatrix, false);
     clover.RenderModel(shader);
+    endObjectDraw(shader, false);
 
 }
 
@@ -697,19 +1592,14 @@ void renderGrass(gps::Shader shader, bool depthPass) {
     // select active shader program
     shader.useShaderProgram();
 
-    model = glm::mat4(1.0f);
-    model = glm::scale(model, glm::vec3(2.0f, 2.0f, 2.0f));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-
-    // do not send the normal matrix if we are rendering in the depth map
+    model = forestModelMatrix();
+    // the depth map does not need the normal matrix
     if (!depthPass) {
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-
     }
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "isTransparent"), true);
+    beginObjectDraw(shader, model, normalMatrix, true);
     grass.RenderModel(shader);
-    glUniform1i(glGetUniformLocation(shader.shaderProgram, "isTransparent"), false);
+    endObjectDraw(shader, true);
 
 }
 
@@ -724,20 +1614,21 @@ void renderArrow(gps::Shader shader) {
     
     
     //glm::inverse(view)
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(glm::inverse(view) * model));
-    
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    beginObjectDraw(shader, glm::inverse(view) * model, normalMatrix, false);
 
     // draw teapot
     arrow.RenderModel(shader);
+    endObjectDraw(shader, false);
 }
 
-void renderShootingArrow(gps::Shader shader) {
-    // select active shader program
-    shader.useShaderProgram();
+glm::mat4 arrowModelMatrix(const glm::vec3& position, float rotation) {
+    glm::mat4 arrowModel = glm::translate(glm::mat4(1.0f), position);
+    return glm::rotate(arrowModel, rotation, glm::vec3(1.0f, 0.0f, 0.0f));
+}
 
-    model = glm::mat4(1.0f);
-   
+// one tick of the arrow's flight: gravity, then the target it may hit
+void tickShootingArrow(float tickSeconds) {
+    bool launched = getInitialPosition;
     if (getInitialPosition) {
         getInitialPosition = false;
         arrowPosition = myCamera.getPosition();
@@ -746,6 +1637,8 @@ void renderShootingArrow(gps::Shader shader) {
         float shooting_angle = glm::dot(front_direction, glm::vec3(0.0f, 1.0f, 0.0f));
         vert_velocity = sin(shooting_angle);
     }
+    previousArrowPosition = arrowPosition;
+    previousArrowRotation = arrowRotation;
 
     glm::vec3 velocity_vector = glm::vec3(0.0f, vert_velocity, 0.0f);
     float rot_angle = glm::dot(velocity_vector, glm::normalize(glm::vec3(0.0f, 1.0f, 0.0f)));
@@ -753,9 +1646,9 @@ void renderShootingArrow(gps::Shader shader) {
     if (goingUp) {
         acceleration = -gravity / mass;
         
-        vert_velocity = vert_velocity + acceleration * deltaTime;
+        vert_velocity = vert_velocity + acceleration * tickSeconds;
         if (vert_velocity > 0) {
-            arrowPosition.y += vert_velocity * deltaTime + acceleration * deltaTime * deltaTime / 2;
+            arrowPosition.y += vert_velocity * tickSeconds + acceleration * tickSeconds * tickSeconds / 2;
         }
         else { //velocity is zero, ball will begin to fall down
             goingUp = false;
@@ -764,9 +1657,9 @@ void renderShootingArrow(gps::Shader shader) {
     }
     else {
         acceleration = gravity / mass;
-        vert_velocity = vert_velocity + acceleration * deltaTime;
+        vert_velocity = vert_velocity + acceleration * tickSeconds;
         if (arrowPosition.y > 0.01f) {
-            arrowPosition.y -= vert_velocity * deltaTime + acceleration * deltaTime * deltaTime / 2;
+            arrowPosition.y -= vert_velocity * tickSeconds + acceleration * tickSeconds * tickSeconds / 2;
         }
         else {
             //arrow hits the floor
@@ -777,27 +1670,52 @@ void renderShootingArrow(gps::Shader shader) {
         }
     }
  
-    arrowPosition += glm::vec3(0.0f, 0.0f, 0.1f * horiz_velocity);
-    //printf("%f %f\n", rot_angle, velocity_vector.y);
-    model = glm::translate(model, arrowPosition);
-    model = glm::rotate(model, rot_angle , glm::vec3(1.0f, 0.0f, 0.0f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    arrowPosition += glm::vec3(0.0f, 0.0f, 0.1f * horiz_velocity * TUNED_FRAME_RATE * tickSeconds);
+    arrowRotation = rot_angle;
+    // nothing to interpolate from on the first tick of a flight
+    if (launched) {
+        previousArrowPosition = arrowPosition;
+        previousArrowRotation = arrowRotation;
+    }
 
     //collision detection
-    if (arrowPosition.z >= 4.9f && arrowPosition.z <= 5.1f && arrowPosition.x > -0.1f + target_state*0.5f && 
-        arrowPosition.x < 0.1f + target_state * 0.5f
-        && arrowPosition.y > 0.23f && arrowPosition.y < 0.43f) {
+    // the tick's step is tested where it crosses the target's plane, a low tick rate cannot step over it
+    const float targetPlaneZ = 5.0f;
+    glm::vec3 crossing = arrowPosition;
+    bool reachesTarget = arrowPosition.z >= 4.9f && arrowPosition.z <= 5.1f;
+    if (previousArrowPosition.z < targetPlaneZ && arrowPosition.z >= targetPlaneZ) {
+        float t = (targetPlaneZ - previousArrowPosition.z) / (arrowPosition.z - previousArrowPosition.z);
+        crossing = glm::mix(previousArrowPosition, arrowPosition, t);
+        reachesTarget = true;
+    }
+    if (reachesTarget && crossing.x > -0.1f + target_state*0.5f && 
+        crossing.x < 0.1f + target_state * 0.5f
+        && crossing.y > 0.23f && crossing.y < 0.43f) {
         target_state ++;
         if (target_state > 5) {
             target_state = 0;
         }
+        moveSceneInstances(target, targetModelMatrix());
         
         shotArrow = false;
     }
 
+    // the culling bounds follow the ticks, the drawn arrow is at most one tick's step behind them
+    moveSceneInstances(arrow, arrowModelMatrix(arrowPosition, arrowRotation));
+}
+
+void renderShootingArrow(gps::Shader shader) {
+    // select active shader program
+    shader.useShaderProgram();
+
+    // between the last two ticks of the flight
+    float alpha = simulationClock.getAlpha();
+    model = arrowModelMatrix(glm::mix(previousArrowPosition, arrowPosition, alpha), glm::mix(previousArrowRotation, arrowRotation, alpha));
+
     // draw teapot
+    beginObjectDraw(shader, model, normalMatrix, false);
     arrow.RenderModel(shader);
+    endObjectDraw(shader, false);
 
 }
 
@@ -805,40 +1723,31 @@ void renderTarget(gps::Shader shader, bool depthPass) {
     // select active shader program
     shader.useShaderProgram();
 
-    model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(target_state * 0.5f, 0.2f, 5.0f));
-    model = glm::scale(model, glm::vec3(0.3f, 0.3f, 0.3f));
-
-    //send teapot model matrix data to shader
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+    model = targetModelMatrix();
 
-    // do not send the normal matrix if we are rendering in the depth map
+    // the depth map does not need the normal matrix
     if (!depthPass) {
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
     }
 
     // draw teapot
+    beginObjectDraw(shader, model, normalMatrix, false);
     target.RenderModel(shader);
+    endObjectDraw(shader, false);
 }
 
 void renderBowInCottage(gps::Shader shader) {
 
     shader.useShaderProgram();
 
-    model = glm::mat4(1.0f);
-    model = glm::rotate(model, 90 * toRadians, glm::vec3(1.0f, 0.0f, 0.0f));
-    model = glm::translate(model, glm::vec3(-2.6f, 3.9f, -0.27f));
-    model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f));
+    model = bowInCottageModelMatrix();
 
     //send teapot model matrix data to shader
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-
+    beginObjectDraw(shader, model, normalMatrix, false);
 
     // draw teapot
     bow.RenderModel(shader);
+    endObjectDraw(shader, false);
 
 }
 
@@ -852,13 +1761,11 @@ void renderBow(gps::Shader shader) {
     model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f));
 
     //send teapot model matrix data to shader
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr( glm::inverse(view) * model));
-
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-
+    beginObjectDraw(shader, glm::inverse(view) * model, normalMatrix, false);
 
     // draw teapot
     bow.RenderModel(shader);
+    endObjectDraw(shader, false);
 }
 
 
@@ -866,78 +1773,605 @@ void renderCottage(gps::Shader shader, bool depthPass) {
     // select active shader program
     shader.useShaderProgram();
 
-    model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(-3.0f,0.0f, 3.0f));
-    model = glm::rotate(model, 180 * toRadians, glm::vec3(0.0f, 1.0f, 0.0f));
-    model = glm::scale(model, glm::vec3(0.7f, 0.7f, 0.7f));
+    model = cottageModelMatrix();
 
-    //send teapot model matrix data to shader
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-
-    // do not send the normal matrix if we are rendering in the depth map
+    // the depth map does not need the normal matrix
     if (!depthPass) {
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
     }
 
     // draw teapot
+    beginObjectDraw(shader, model, normalMatrix, false);
     cottage.RenderModel(shader);
+    endObjectDraw(shader, false);
 }
 
-void renderScene() {
-    
+void renderImpostorForest() {
+    impostorShader.useShaderProgram();
+    glUniformMatrix4fv(glGetUniformLocation(impostorShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniform3fv(glGetUniformLocation(impostorShader.shaderProgram, "cameraPosition"), 1, glm::value_ptr(myCamera.getPosition()));
 
-	//render the scene
-    float currentFrame = glfwGetTime();
-    deltaTime = currentFrame - lastFrame;
-    lastFrame = currentFrame;
+    // follow the projection and lighting of the main shader (day/night, fog)
+    glUniformMatrix4fv(glGetUniformLocation(impostorShader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    glUniform3fv(glGetUniformLocation(impostorShader.shaderProgram, "lightDir"), 1, glm::value_ptr(lightDir));
+    glUniform3fv(glGetUniformLocation(impostorShader.shaderProgram, "lightColor"), 1, glm::value_ptr(lightColor));
+    glUniform1i(glGetUniformLocation(impostorShader.shaderProgram, "showFog"), showFog);
 
-    //render shadows
-    if (showShadows) {
-        depthMapShader.useShaderProgram();
-        glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram, "lightSpaceTrMatrix"),
-            1,
-            GL_FALSE,
-            glm::value_ptr(computeLightSpaceTrMatrix()));
-        glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-        glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-        glClear(GL_DEPTH_BUFFER_BIT);
+    treeImpostor.Draw(impostorShader);
+    myBasicShader.useShaderProgram();
+}
+
+// static scenery through the selected submission path, the filter splits off the alpha tested foliage
+void renderScenery(gps::Shader shader, bool depthPass, gps::DrawFilter filter) {
+    if (useIndirectDraws) {
+        indirectScenery.Draw(shader, filter);
+    }
+    else if (useStaticBatching) {
+        // the batches set the model through the uniforms
+        shader.useShaderProgram();
+        setObjectConstantsEnabled(shader, false);
+        staticScenery.Draw(shader, view, filter);
+    }
+    else {
+        if (filter != gps::DRAW_ALPHA_TESTED) {
+            renderTerrain(shader, depthPass);
+            renderClover(shader, depthPass);
+            renderTreeBark(shader, depthPass);
+            renderCottage(shader, depthPass);
+        }
+        if (filter != gps::DRAW_OPAQUE) {
+            renderTreeLeaves(shader, depthPass);
+            renderGrass(shader, depthPass);
+        }
+    }
+    shader.useShaderProgram();
+}
+
+// geometry the lit pass draws with GL_EQUAL after the pre-pass, the target is static enough to join
+void renderPrepassedGeometry(gps::Shader shader, bool depthPass, gps::DrawFilter filter) {
+    renderScenery(shader, depthPass, filter);
+    if (filter == gps::DRAW_ALL) {
+        renderTarget(shader, depthPass);
+    }
+    shader.useShaderProgram();
+}
+
+void renderDepthPrepass(gps::DrawFilter filter) {
+    depthPrepassShader.useShaderProgram();
+    // the same matrices as the lit pass, its GL_EQUAL test depends on it
+    glUniformMatrix4fv(glGetUniformLocation(depthPrepassShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(glGetUniformLocation(depthPrepassShader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    glUniform1i(glGetUniformLocation(depthPrepassShader.shaderProgram, "useAlphaToCoverage"), useAlphaToCoverage);
+
+    // depth only. With alpha to coverage the alpha picks which of the 4 samples of a pixel a leaf covers,
+    // otherwise depth.frag applies the same alpha test as basic.frag
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    if (useAlphaToCoverage) {
+        glEnable(GL_SAMPLE_ALPHA_TO_COVERAGE);
+    }
+    renderPrepassedGeometry(depthPrepassShader, true, filter);
+    glDisable(GL_SAMPLE_ALPHA_TO_COVERAGE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    myBasicShader.useShaderProgram();
+}
+
+void cullOutsideView() {
+    cullSceneInstances(projection * view, false);
+}
+
+void cullOccludedScenery() {
+    // the same view and projection as the main pass
+    occlusionCuller.setEnabled(useOcclusionCulling);
+    occlusionCuller.setOccluderMatrix(targetOccluder, targetModelMatrix());
+    occlusionCuller.update(projection * view);
+
+    // batches are tested as a whole, the indirect draws and the individual calls per mesh
+    if (!useIndirectDraws && useStaticBatching) {
+        const std::vector<gps::StaticBatch>& batches = staticScenery.getBatches();
+        for (size_t i = 0; i < batches.size(); i++) {
+            occlusionCuller.cullMesh(*batches[i].mesh, glm::mat4(1.0f));
+        }
+    }
+    else {
+        occlusionCuller.cullModel(terrain, terrainModelMatrix());
+        occlusionCuller.cullModel(clover, cloverModelMatrix());
+        occlusionCuller.cullModel(tree_bark1, forestModelMatrix());
+        occlusionCuller.cullModel(tree_leaves1, forestModelMatrix());
+        occlusionCuller.cullModel(grass, forestModelMatrix());
+        occlusionCuller.cullModel(cottage, cottageModelMatrix());
+    }
+    occlusionCuller.printStats();
+}
+
+void cullThroughPortals() {
+    portalCuller.setEnabled(usePortalCulling);
+    portalCuller.update(projection * view, myCamera.getPosition());
+
+    if (!useIndirectDraws && useStaticBatching) {
+        const std::vector<gps::StaticBatch>& batches = staticScenery.getBatches();
+        for (size_t i = 0; i < batches.size(); i++) {
+            portalCuller.cullMesh(*batches[i].mesh, glm::mat4(1.0f), portalCuller.getMeshCells(batches[i].mesh->name));
+        }
+    }
+    else {
+        portalCuller.cullModel(terrain, terrainModelMatrix());
+        portalCuller.cullModel(clover, cloverModelMatrix());
+        portalCuller.cullModel(tree_bark1, forestModelMatrix());
+        portalCuller.cullModel(tree_leaves1, forestModelMatrix());
+        portalCuller.cullModel(grass, forestModelMatrix());
+        portalCuller.cullModel(cottage, cottageModelMatrix());
+    }
+    portalCuller.cullModel(target, targetModelMatrix());
+    if (!bowAquired) {
+        portalCuller.cullModel(bow, bowInCottageModelMatrix(), 1u << cottageCell);
+    }
+    portalCuller.printStats();
+}
+
+void initFrameAllocator() {
+    useFrameAllocator = frameAllocator.init();
+    if (useFrameAllocator) {
+        clusteredLights.setFrameAllocator(&frameAllocator);
+        printf("frame allocator: %d regions of %.1f KB in a persistently mapped ring\n",
+            gps::FRAME_ALLOCATOR_FRAMES, gps::FRAME_ALLOCATOR_REGION_SIZE / 1024.0);
+    }
+}
+
+void initClusteredLights() {
+    clusteredLights.init(workerPool.get());
+
+    // the cottage lamp basic.frag used to hard code, cut off where its falloff fades into the night
+    gps::Light lamp;
+    lamp.position = glm::vec3(-2.5f, 0.3f, 4.1f);
+    lamp.color = glm::vec3(0.5f, 0.3f, 0.0f);
+    lamp.range = 6.0f;
+    lamp.linear = 0.9f;
+    lamp.quadratic = 0.32f;
+    lamp.isSpot = false;
+    lamp.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+    lamp.cutOff = 1.0f;
+    lamp.outerCutOff = 0.0f;
+    lamp.isBaked = rangeLightmap.isLoaded();
+    lamp.castsShadow = false;
+    cottageLamp = clusteredLights.addLight(lamp);
+
+    // the cottage keeps its floor clear
+    gps::AABB cottageBounds;
+    const std::vector<Mesh*>& cottageMeshes = cottage.GetMeshes();
+    for (size_t i = 0; i < cottageMeshes.size(); i++) {
+        cottageBounds.expand(cottageMeshes[i]->getBounds().transformed(cottageModelMatrix()));
+    }
+
+    // lanterns standing on the ground around the range, same seed every run
+    std::mt19937 generator(11);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (int i = 0; i < LANTERN_COUNT; i++) {
+        glm::vec3 position;
+        do {
+            float inner2 = LANTERN_INNER_RADIUS * LANTERN_INNER_RADIUS;
+            float outer2 = LANTERN_OUTER_RADIUS * LANTERN_OUTER_RADIUS;
+            float radius = glm::sqrt(inner2 + unit(generator) * (outer2 - inner2));
+            float angle = unit(generator) * glm::radians(360.0f);
+            position = glm::vec3(radius * glm::cos(angle), 0.0f, radius * glm::sin(angle));
+        } while (position.x > cottageBounds.min.x && position.x < cottageBounds.max.x &&
+            position.z > cottageBounds.min.z && position.z < cottageBounds.max.z);
+
+        float groundDistance;
+        if (raycastScenery(position + glm::vec3(0.0f, 10.0f, 0.0f), position - glm::vec3(0.0f, 10.0f, 0.0f), groundDistance)) {
+            position.y = 10.0f - groundDistance;
+        }
+
+        gps::Light lantern = lamp;
+        lantern.position = position + glm::vec3(0.0f, 0.25f, 0.0f);
+        lantern.color = glm::vec3(0.6f, 0.25f + 0.1f * unit(generator), 0.08f);
+        lantern.range = 1.5f;
+        lantern.linear = 0.7f;
+        lantern.quadratic = 1.8f;
+        lantern.isBaked = false;
+        size_t light = clusteredLights.addLight(lantern);
+        if (i == 0) {
+            firstLantern = light;
+        }
+    }
+    printf("clustered lights: the cottage lamp and %d lanterns, %dx%dx%d clusters\n",
+        LANTERN_COUNT, gps::CLUSTER_GRID_X, gps::CLUSTER_GRID_Y, gps::CLUSTER_GRID_Z);
+}
+
+// the lamp's shadow cubemap, drawn on the first frame and again only when a caster moves near the lamp
+void initLampShadow() {
+    gps::Light& lamp = clusteredLights.getLight(cottageLamp);
+    lamp.castsShadow = lampShadowMap.init(lamp.position, lamp.range);
+
+    // the shadow sampler keeps its own unit even without the map
+    myBasicShader.useShaderProgram();
+    glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "pointShadowMap"), gps::POINT_SHADOW_UNIT);
+    deferredShader.useShaderProgram();
+    glUniform1i(glGetUniformLocation(deferredShader.shaderProgram, "pointShadowMap"), gps::POINT_SHADOW_UNIT);
+    if (lamp.castsShadow) {
+        lampShadowMap.bind(deferredShader);
+        lampShadowMap.bind(myBasicShader);
+        printf("point shadow map: cottage lamp, %dx%d faces in one layered pass\n", gps::POINT_SHADOW_SIZE, gps::POINT_SHADOW_SIZE);
+    }
+    myBasicShader.useShaderProgram();
+}
+
+void updateLampShadow() {
+    if (!clusteredLights.getLight(cottageLamp).castsShadow || !lampShadowMap.needsUpdate()) {
+        return;
+    }
+    std::vector<size_t> casters;
+    sceneBvh.queryBox(lampShadowMap.getBounds(), casters);
+
+    // the map outlives the camera's level of detail, the casters are drawn at their finest
+    lampShadowMap.beginShadowPass(pointShadowShader);
+    GLint modelLocation = glGetUniformLocation(pointShadowShader.shaderProgram, "model");
+    GLint transparentLocation = glGetUniformLocation(pointShadowShader.shaderProgram, "isTransparent");
+    for (size_t i = 0; i < casters.size(); i++) {
+        const SceneInstance& instance = sceneInstances[casters[i]];
+        if (!instance.castsShadow || !isSceneInstanceDrawn(instance)) {
+            continue;
+        }
+        glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(instance.modelMatrix));
+        glUniform1i(transparentLocation, instance.isTransparent);
+        size_t lod = instance.mesh->getCurrentLod();
+        instance.mesh->setCurrentLod(0);
+        instance.mesh->Draw(pointShadowShader);
+        instance.mesh->setCurrentLod(lod);
+    }
+    lampShadowMap.endShadowPass();
+}
+
+// the atlas is bound once, the shadows are off until a spotlight gets a tile
+void initSpotShadows() {
+    useSpotShadows = spotShadowAtlas.init();
+
+    // the shadow sampler keeps its own unit even without the atlas
+    deferredShader.useShaderProgram();
+    glUniform1i(glGetUniformLocation(deferredShader.shaderProgram, "spotShadowAtlas"), gps::SHADOW_ATLAS_UNIT);
+    glUniform1i(glGetUniformLocation(deferredShader.shaderProgram, "spotShadowEnabled"), false);
+    myBasicShader.useShaderProgram();
+    glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "spotShadowAtlas"), gps::SHADOW_ATLAS_UNIT);
+    glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "spotShadowEnabled"), false);
+    if (useSpotShadows) {
+        glActiveTexture(GL_TEXTURE0 + gps::SHADOW_ATLAS_UNIT);
+        glBindTexture(GL_TEXTURE_2D, spotShadowAtlas.getTexture());
+        glActiveTexture(GL_TEXTURE0);
+        printf("shadow atlas: %dx%d, spotlight tiles of %d to %d texels\n",
+            gps::SHADOW_ATLAS_SIZE, gps::SHADOW_ATLAS_SIZE, gps::SHADOW_ATLAS_MIN_TILE, gps::SHADOW_ATLAS_MAX_TILE);
+    }
+}
+
+// the flashlight's tile, sized by how much of the screen its cone covers, false when it has no shadow
+bool updateSpotShadows() {
+    GLuint basic = myBasicShader.shaderProgram;
+
+    bool hasShadow = false;
+    glm::mat4 tileMatrix = glm::mat4(1.0f);
+    glm::vec4 tileRect = glm::vec4(0.0f);
+    if (useSpotShadows && showSpotLight) {
+        glm::vec3 spotPosition = spotLightPosition;
+        glm::vec3 spotDirection = glm::normalize(spotLightDirection);
+
+        // the sphere around the cone, from the middle of its axis to the rim of its far end
+        float halfRange = 0.5f * SPOT_SHADOW_RANGE;
+        float rimRadius = SPOT_SHADOW_RANGE * std::sqrt(1.0f - spotOuterCutOff * spotOuterCutOff) / spotOuterCutOff;
+        float coverage = gps::sphereScreenCoverage(spotPosition + spotDirection * halfRange,
+            glm::length(glm::vec2(halfRange, rimRadius)), view, projection);
+
+        spotShadowAtlas.beginFrame();
+        hasShadow = spotShadowAtlas.allocate(coverage, spotShadowTile);
+        if (hasShadow) {
+            glm::vec3 up = std::abs(spotDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            spotShadowViewProjection = glm::perspective(2.0f * glm::acos(spotOuterCutOff), 1.0f, SPOT_SHADOW_NEAR, SPOT_SHADOW_RANGE) *
+                glm::lookAt(spotPosition, spotPosition + spotDirection, up);
+            tileMatrix = spotShadowAtlas.getTileMatrix(spotShadowTile, spotShadowViewProjection);
+            tileRect = spotShadowAtlas.getTileRect(spotShadowTile);
+        }
+    }
+
+    deferredShader.useShaderProgram();
+    glUniform1i(glGetUniformLocation(deferredShader.shaderProgram, "spotShadowEnabled"), hasShadow);
+    glUniformMatrix4fv(glGetUniformLocation(deferredShader.shaderProgram, "spotShadowMatrix"), 1, GL_FALSE, glm::value_ptr(tileMatrix));
+    glUniform4fv(glGetUniformLocation(deferredShader.shaderProgram, "spotShadowRect"), 1, glm::value_ptr(tileRect));
+    myBasicShader.useShaderProgram();
+    glUniform1i(glGetUniformLocation(basic, "spotShadowEnabled"), hasShadow);
+    glUniformMatrix4fv(glGetUniformLocation(basic, "spotShadowMatrix"), 1, GL_FALSE, glm::value_ptr(tileMatrix));
+    glUniform4fv(glGetUniformLocation(basic, "spotShadowRect"), 1, glm::value_ptr(tileRect));
+    return hasShadow;
+}
+
+// the casters are the ones the scene BVH finds inside the flashlight's frustum
+void renderSpotShadows() {
+    std::vector<size_t> casters;
+    sceneBvh.queryFrustum(spotShadowViewProjection, casters);
+
+    depthMapShader.useShaderProgram();
+    glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram, "lightSpaceTrMatrix"), 1, GL_FALSE, glm::value_ptr(spotShadowViewProjection));
+    spotShadowAtlas.beginShadowPass();
+    spotShadowAtlas.beginTile(spotShadowTile);
+    for (size_t i = 0; i < casters.size(); i++) {
+        const SceneInstance& instance = sceneInstances[casters[i]];
+        if (!instance.castsShadow || !isSceneInstanceDrawn(instance)) {
+            continue;
+        }
+        beginObjectDraw(depthMapShader, instance.modelMatrix, normalMatrix, instance.isTransparent);
+        instance.mesh->Draw(depthMapShader);
+        endObjectDraw(depthMapShader, instance.isTransparent);
+    }
+    spotShadowAtlas.endShadowPass();
+}
+
+void updateClusteredLights() {
+    for (size_t i = firstLantern; i < firstLantern + LANTERN_COUNT; i++) {
+        clusteredLights.setLightEnabled(i, showLanterns);
+    }
+    clusteredLights.update(view, projection, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+    clusteredLights.bind(myBasicShader);
+    clusteredLights.printStats();
+}
+
+void updateLightmaps() {
+    glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "useLightmap"), useLightmaps && rangeLightmap.isLoaded());
+    if (rangeLightmap.isLoaded()) {
+        rangeLightmap.bind(myBasicShader, lightDir);
+    }
+}
+
+// a few more tiles of the sky each frame, the ambient light follows each finished sweep
+void updateSky() {
+    proceduralSky.update(lightDir, skyNightWeight());
+    gps::SphericalHarmonics skyAmbient = proceduralSky.getAmbient();
+    skyAmbient.upload(impostorShader);
+    if (useDeferredShading) {
+        skyAmbient.upload(deferredShader);
+    }
+    skyAmbient.upload(myBasicShader);
+}
+
+void initDeferredShading() {
+    if (!useDeferredShading) {
+        return;
+    }
+    if (!gBuffer.init(frameGraph, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height)) {
+        printf("deferred shading: falling back to forward shading\n");
+        useDeferredShading = false;
+        return;
+    }
+    deferredShader.useShaderProgram();
+    glUniform1i(glGetUniformLocation(deferredShader.shaderProgram, "gAlbedo"), gps::GBUFFER_ALBEDO_UNIT);
+    glUniform1i(glGetUniformLocation(deferredShader.shaderProgram, "gNormal"), gps::GBUFFER_NORMAL_UNIT);
+    glUniform1i(glGetUniformLocation(deferredShader.shaderProgram, "gSpecular"), gps::GBUFFER_SPECULAR_UNIT);
+    glUniform1i(glGetUniformLocation(deferredShader.shaderProgram, "gDepth"), gps::GBUFFER_DEPTH_UNIT);
+    glUniform1i(glGetUniformLocation(deferredShader.shaderProgram, "shadowMap"), 3);
+    myBasicShader.useShaderProgram();
+    printf("deferred shading: G-buffer of %dx%d (albedo, normal, specular, depth) from the render graph's pool\n",
+        myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+}
+
+// the lighting pass follows the toggles and the day/night state of the main shader
+void updateDeferredUniforms(bool showsShadows, const glm::mat4& lightSpaceTrMatrix) {
+    deferredShader.useShaderProgram();
+    GLuint deferred = deferredShader.shaderProgram;
+    glUniformMatrix4fv(glGetUniformLocation(deferred, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(glGetUniformLocation(deferred, "inverseView"), 1, GL_FALSE, glm::value_ptr(glm::inverse(view)));
+    glUniformMatrix4fv(glGetUniformLocation(deferred, "inverseProjection"), 1, GL_FALSE, glm::value_ptr(glm::inverse(projection)));
+    glUniformMatrix4fv(glGetUniformLocation(deferred, "lightSpaceTrMatrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceTrMatrix));
+    glUniform1f(glGetUniformLocation(deferred, "shadowBias"), sunShadowBias);
+    glUniform3fv(glGetUniformLocation(deferred, "lightDir"), 1, glm::value_ptr(lightDir));
+    glUniform3fv(glGetUniformLocation(deferred, "lightColor"), 1, glm::value_ptr(lightColor));
+    glUniform3fv(glGetUniformLocation(deferred, "spotLightPos"), 1, glm::value_ptr(spotLightPosition));
+    glUniform3fv(glGetUniformLocation(deferred, "spotLightDir"), 1, glm::value_ptr(spotLightDirection));
+    glUniform1f(glGetUniformLocation(deferred, "cutOff"), spotCutOff);
+    glUniform1f(glGetUniformLocation(deferred, "outerCutOff"), spotOuterCutOff);
+    glUniform1i(glGetUniformLocation(deferred, "showShadow"), showsShadows);
+    glUniform1i(glGetUniformLocation(deferred, "showFog"), showFog);
+    glUniform1i(glGetUniformLocation(deferred, "nightModeEnabled"), nightModeEnabled);
+    glUniform1i(glGetUniformLocation(deferred, "showSpotLight"), showSpotLight);
+}
+
+// the scenery and the target go through the G-buffer, the pre-pass and alpha to coverage do not apply:
+// the foliage is alpha tested and every pixel is lit once whatever the depth complexity
+void renderGBuffer() {
+    myBasicShader.useShaderProgram();
+    glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "gBufferPass"), true);
+    renderScenery(myBasicShader, false, gps::DRAW_ALL);
+    renderTarget(myBasicShader, false);
+    glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "gBufferPass"), false);
+}
+
+void renderDeferredLighting(bool showsShadows, const glm::mat4& lightSpaceTrMatrix) {
+    updateDeferredUniforms(showsShadows, lightSpaceTrMatrix);
+    clusteredLights.bind(deferredShader);
+    gBuffer.drawLightingPass(frameGraph, deferredShader);
+    myBasicShader.useShaderProgram();
+}
+
+// alpha to coverage needs the foliage in the pre-pass, the full pre-pass takes everything
+bool runsDepthPrepass() {
+    return !useDeferredShading && (useDepthPrepass || useAlphaToCoverage);
+}
+
+// marks the queried meshes from the results read back so far, the indirect draws can
+// only drop the skipped ones, a multi-draw cannot be rendered conditionally per command.
+// With a pre-pass the pre-pass and the lit pass have to agree, only results already read back count
+void beginOcclusionQueries() {
+    bool batched = !useIndirectDraws && useStaticBatching;
+    sceneryQueries.setEnabled(useOcclusionQueries && !batched);
+    batchQueries.setEnabled(useOcclusionQueries && batched);
+    bowQueries.setEnabled(useOcclusionQueries && !bowAquired);
+    bool conditionalRender = !runsDepthPrepass();
+    sceneryQueries.setConditionalRender(conditionalRender);
+    batchQueries.setConditionalRender(conditionalRender);
+    bowQueries.setConditionalRender(conditionalRender);
+
+    glm::vec3 cameraPosition = myCamera.getPosition();
+    sceneryQueries.beginFrame(cameraPosition);
+    batchQueries.beginFrame(cameraPosition);
+    bowQueries.beginFrame(cameraPosition);
+}
+
+// the boxes are tested against the scenery depth of this frame, the results are used in the next one
+void issueOcclusionQueries() {
+    glm::mat4 viewProjection = projection * view;
+    sceneryQueries.issueQueries(boundingBoxShader, viewProjection);
+    batchQueries.issueQueries(boundingBoxShader, viewProjection);
+    bowQueries.issueQueries(boundingBoxShader, viewProjection);
+    sceneryQueries.printStats();
+    batchQueries.printStats();
+    bowQueries.printStats();
+    myBasicShader.useShaderProgram();
+}
+
+// draws that only show the outside (sky, distant forest) are skipped or scissored to the openings
+bool beginOutsideDraw() {
+    if (!portalCuller.isCellVisible(outsideCell)) {
+        return false;
+    }
+    GLint rect[4];
+    if (portalCuller.getCellScissor(outsideCell, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height, rect)) {
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(rect[0], rect[1], rect[2], rect[3]);
+    }
+    return true;
+}
+
+void endOutsideDraw() {
+    glDisable(GL_SCISSOR_TEST);
+}
+
+void selectLods() {
+    // one selection per frame, the shadow and main passes draw the same levels
+    lodSelector.setEnabled(useLod);
+    lodSelector.update(myCamera.getPosition(), glm::radians(45.0f), (float)myWindow.getWindowDimensions().height);
+    lodSelector.selectLods(terrain, terrainModelMatrix());
+    lodSelector.selectLods(clover, cloverModelMatrix());
+    lodSelector.selectLods(tree_bark1, forestModelMatrix());
+    lodSelector.selectLods(tree_leaves1, forestModelMatrix());
+    lodSelector.selectLods(grass, forestModelMatrix());
+    lodSelector.selectLods(cottage, cottageModelMatrix());
+    if (!useIndirectDraws && useStaticBatching) {
+        staticScenery.selectLods(lodSelector);
+    }
+}
+
+// the casters outside the fitted light volume are skipped, the indirect shadow draws keep all of theirs.
+// The hard shadow map is bound and cleared by the render graph, the variance one binds its own targets
+void renderSunShadow(const glm::mat4& lightSpaceTrMatrix) {
+    cullSceneInstances(lightSpaceTrMatrix, true);
+    reportShadowCasters();
+    depthMapShader.useShaderProgram();
+    glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram, "lightSpaceTrMatrix"),
+        1,
+        GL_FALSE,
+        glm::value_ptr(lightSpaceTrMatrix));
+    if (useVarianceShadows) {
+        varianceShadowMap.beginShadowPass();
+    }
 
-        renderTerrain(myBasicShader, false);
-        renderTarget(depthMapShader, true);
+    renderTerrain(depthMapShader, true);
+    renderTarget(depthMapShader, true);
+    if (useIndirectDraws) {
+        indirectScenery.DrawShadowCasters(depthMapShader);
+    }
+    else {
         renderTree(depthMapShader, true);
         renderCottage(depthMapShader, true);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        //render scene
-        glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        myBasicShader.useShaderProgram();
-       
+    }
+    restoreSceneInstances();
+    if (useVarianceShadows) {
+        varianceShadowMap.endShadowPass(vsmBlurShader);
+    }
+}
+
+// what the camera sees, the first pass drawing the view calls it once the shadow passes restored the scene
+void prepareMainView() {
+    cullOutsideView();
+    cullOccludedScenery();
+    cullThroughPortals();
+    beginOcclusionQueries();
+    updateClusteredLights();
+    updateLightmaps();
+    updateSky();
+}
+
+std::string currentRenderMode() {
+    std::string renderMode = useDepthPrepass ? "full pre-pass" : (useAlphaToCoverage ? "foliage pre-pass" : "no pre-pass");
+    renderMode += useAlphaToCoverage ? ", alpha to coverage" : ", alpha test";
+    if (useDeferredShading) {
+        renderMode = "deferred";
+    }
+    return renderMode;
+}
+
+// the deferred overdraw is counted over the geometry and the lighting passes
+void renderGeometryPass() {
+    prepareMainView();
+    sceneryOverdraw.begin(currentRenderMode(), myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+    renderGBuffer();
+}
+
+void renderMainPass(bool showsShadows, const glm::mat4& lightSpaceTrMatrix) {
+    if (!useDeferredShading) {
+        prepareMainView();
+    }
+    myBasicShader.useShaderProgram();
+    if (showsShadows) {
         //bind the shadow map
         glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, depthMapTexture);
+        glBindTexture(GL_TEXTURE_2D, useVarianceShadows ? varianceShadowMap.getTexture() : depthMapTexture);
         glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "shadowMap"), 3);
 
         glUniformMatrix4fv(glGetUniformLocation(myBasicShader.shaderProgram, "lightSpaceTrMatrix"),
             1,
             GL_FALSE,
-            glm::value_ptr(computeLightSpaceTrMatrix()));
+            glm::value_ptr(lightSpaceTrMatrix));
+        glUniform1f(glGetUniformLocation(myBasicShader.shaderProgram, "shadowBias"), sunShadowBias);
     }
-    else {
 
-        //render scene
-        glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        myBasicShader.useShaderProgram();
+    std::string renderMode = currentRenderMode();
+    GLsizei viewportWidth = myWindow.getWindowDimensions().width;
+    GLsizei viewportHeight = myWindow.getWindowDimensions().height;
+
+    bool runPrepass = runsDepthPrepass();
+    gps::DrawFilter prepassFilter = useDepthPrepass ? gps::DRAW_ALL : gps::DRAW_ALPHA_TESTED;
+    if (runPrepass) {
+        prepassOverdraw.begin(renderMode, viewportWidth, viewportHeight);
+        renderDepthPrepass(prepassFilter);
+        prepassOverdraw.end();
     }
 
-    
-    renderTerrain(myBasicShader, false);
-    renderClover(myBasicShader, false);
-    renderTree(myBasicShader, false);
-    renderTarget(myBasicShader, false);
-    renderCottage(myBasicShader, false);
-    renderGrass(myBasicShader, false);
+    if (useDeferredShading) {
+        renderDeferredLighting(showsShadows, lightSpaceTrMatrix);
+    }
+    else if (runPrepass) {
+        sceneryOverdraw.begin(renderMode, viewportWidth, viewportHeight);
+        if (prepassFilter == gps::DRAW_ALPHA_TESTED) {
+            renderScenery(myBasicShader, false, gps::DRAW_OPAQUE);
+            renderTarget(myBasicShader, false);
+        }
+        // lit once per pixel, only where the pre-pass depth survived. With depth
+        // writes off the discard left in basic.frag does not disable the early depth test
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "depthPrepassed"), true);
+        renderPrepassedGeometry(myBasicShader, false, prepassFilter);
+        glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "depthPrepassed"), false);
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+    }
+    else {
+        sceneryOverdraw.begin(renderMode, viewportWidth, viewportHeight);
+        renderScenery(myBasicShader, false, gps::DRAW_ALL);
+        renderTarget(myBasicShader, false);
+    }
+    sceneryOverdraw.end();
+    issueOcclusionQueries();
+
+    if (showImpostorForest && beginOutsideDraw()) {
+        renderImpostorForest();
+        endOutsideDraw();
+    }
 
     if (!bowAquired) {
         renderBowInCottage(myBasicShader);
@@ -945,7 +2379,8 @@ void renderScene() {
     else {
         if (showBowAndArrow) {
             renderBow(myBasicShader);
-            if (shotArrow) {
+            // a flight starts on its first tick, until then the arrow is still held
+            if (shotArrow && !getInitialPosition) {
                 renderShootingArrow(myBasicShader);
             }
             else {
@@ -953,8 +2388,93 @@ void renderScene() {
             }
         }
     }
-    mySkyBox.Draw(skyboxShader, view, projection);
+}
+
+void renderSky() {
+    if (beginOutsideDraw()) {
+        mySkyBox.Draw(skyboxShader, view, skyboxProjection);
+        endOutsideDraw();
+    }
+}
+
+void renderScene() {
     
+
+	//render the scene
+    float currentFrame = glfwGetTime();
+    deltaTime = currentFrame - lastFrame;
+    lastFrame = currentFrame;
+
+    // the ring region the GPU finished reading three frames ago
+    frameAllocator.beginFrame();
+    selectLods();
+
+    // the passes of the frame: the shadow passes come first, nothing the view draws is culled yet. The
+    // ones whose map the view does not read this frame are dropped by the graph
+    int width = myWindow.getWindowDimensions().width;
+    int height = myWindow.getWindowDimensions().height;
+    bool showsShadows = showShadows;
+    bool hasSpotShadow = updateSpotShadows();
+    glm::mat4 lightSpaceTrMatrix = showsShadows ? computeLightSpaceTrMatrix() : glm::mat4(1.0f);
+
+    frameGraph.reset();
+    gps::RenderGraphResource window = frameGraph.importTarget("window", 0, width, height);
+    gps::RenderGraphResource lampShadow = frameGraph.importTexture("lamp shadow", lampShadowMap.getTexture());
+    gps::RenderGraphResource spotShadows = frameGraph.importTexture("spot shadows", spotShadowAtlas.getTexture());
+    gps::RenderGraphResource sunShadow = useVarianceShadows ?
+        frameGraph.importTexture("sun shadow", varianceShadowMap.getTexture()) :
+        frameGraph.importTarget("sun shadow", shadowMapFBO, SHADOW_WIDTH, SHADOW_HEIGHT);
+
+    gps::RenderGraphPass lampShadowPass = frameGraph.addPass("lamp shadow", 0, updateLampShadow);
+    frameGraph.write(lampShadowPass, lampShadow);
+    gps::RenderGraphPass spotShadowPass = frameGraph.addPass("spot shadows", 0, renderSpotShadows);
+    frameGraph.write(spotShadowPass, spotShadows);
+    gps::RenderGraphPass sunShadowPass = frameGraph.addPass("sun shadow", useVarianceShadows ? 0 : GL_DEPTH_BUFFER_BIT,
+        [lightSpaceTrMatrix]() { renderSunShadow(lightSpaceTrMatrix); });
+    frameGraph.write(sunShadowPass, sunShadow);
+
+    if (useDeferredShading) {
+        gBuffer.addGeometryPass(frameGraph, width, height, renderGeometryPass);
+    }
+    gps::RenderGraphPass mainPass = frameGraph.addPass("main", GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT,
+        [showsShadows, lightSpaceTrMatrix]() { renderMainPass(showsShadows, lightSpaceTrMatrix); });
+    frameGraph.write(mainPass, window);
+    if (clusteredLights.getLight(cottageLamp).castsShadow) {
+        frameGraph.read(mainPass, lampShadow);
+    }
+    if (hasSpotShadow) {
+        frameGraph.read(mainPass, spotShadows);
+    }
+    if (showsShadows) {
+        frameGraph.read(mainPass, sunShadow);
+    }
+    if (useDeferredShading) {
+        gBuffer.readTargets(frameGraph, mainPass);
+    }
+
+    // the sky fills what the scene left at the far plane
+    gps::RenderGraphPass skyPass = frameGraph.addPass("sky", 0, renderSky);
+    frameGraph.read(skyPass, window);
+    frameGraph.write(skyPass, window);
+
+    frameGraph.markOutput(window);
+    frameGraph.execute();
+    // a G-buffer the window's new size cannot be rendered to leaves the next frames to the forward path
+    if (useDeferredShading && !frameGraph.targetsComplete()) {
+        printf("deferred shading: falling back to forward shading\n");
+        useDeferredShading = false;
+    }
+    frameGraph.printStats();
+    frameAllocator.endFrame();
+    frameAllocator.printStats();
+
+    // the shadow pass of the next frame draws everything
+    restoreSceneInstances();
+    occlusionCuller.restore();
+    portalCuller.restore();
+    sceneryQueries.restore();
+    batchQueries.restore();
+    bowQueries.restore();
 }
 
 void checkIfInsideCottage() {
@@ -1002,31 +2522,15 @@ void checkIfBowAquired() {
     }
 }
 
-void dayNightCycle() {
-    myBasicShader.useShaderProgram();
-
-    //chenage day night mode
-    if (changeDayNightMode) {
-        if (dayCycleCompleted) {
-            glm::vec3 lightColor = glm::vec3(0.05f, 0.05f, 0.05f); //dark light
-            glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
-            glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "nightModeEnabled"), true);
-            mySkyBox.Load(darkFaces);
-            changeDayNightMode = false;   
-        }
-        else {
-            glm::vec3 lightColor = glm::vec3(1.0f, 1.0f, 1.0f); //white light
-            glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
-            glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "nightModeEnabled"), false);
-            mySkyBox.Load(faces);
-            changeDayNightMode = false;
-        }
-    }
+// one tick of the sun's path, applyDayNightCycle sends it to the shaders once the frame's ticks ran
+void tickDayNightCycle(float tickSeconds) {
+    previousSunDirection = glm::vec3(0.0f, sun_position_y, sun_position_z);
+    float step = SUN_SPEED * tickSeconds;
 
     //compute new light coordinates
     if (inc_y) {
         if (sun_position_y <= 1.0f) {
-            sun_position_y += 0.002f;
+            sun_position_y += step;
         }
         else {
             inc_y = false;
@@ -1034,26 +2538,65 @@ void dayNightCycle() {
     }
     else {
         if (sun_position_y >= 0.0f) {
-            sun_position_y -= 0.002f;
+            sun_position_y -= step;
         }
         else {
             inc_y = true;
         }
     }
     if (sun_position_z >= -1.0f) {
-        sun_position_z -= 0.002f;
+        sun_position_z -= step;
     }
     else {
         sun_position_z = 1.0f;
         sun_position_y = 0.0f;
         dayCycleCompleted = !dayCycleCompleted;
         changeDayNightMode = true;
+        // the sun rises again, it is not swept back across the sky
+        previousSunDirection = glm::vec3(0.0f, sun_position_y, sun_position_z);
     }
-    //set the light direction (direction towards the light)
-    lightDir = glm::vec3(0.0f, 0.0f + sun_position_y, 0.0f + sun_position_z);
+}
+
+void applyDayNightCycle(float alpha) {
+    myBasicShader.useShaderProgram();
+
+    //chenage day night mode
+    if (changeDayNightMode) {
+        if (dayCycleCompleted) {
+            lightColor = glm::vec3(0.05f, 0.05f, 0.05f); //dark light
+            glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
+            nightModeEnabled = true;
+            glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "nightModeEnabled"), nightModeEnabled);
+            changeDayNightMode = false;   
+        }
+        else {
+            lightColor = glm::vec3(1.0f, 1.0f, 1.0f); //white light
+            glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
+            nightModeEnabled = false;
+            glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "nightModeEnabled"), nightModeEnabled);
+            changeDayNightMode = false;
+        }
+    }
+
+    //set the light direction (direction towards the light), between the last two ticks
+    lightDir = glm::mix(previousSunDirection, glm::vec3(0.0f, sun_position_y, sun_position_z), alpha);
     // send light dir to shader
     glUniform3fv(lightDirLoc, 1, glm::value_ptr(lightDir));
 }
+
+// one tick of everything that moves on its own, the render functions only draw the result
+void tickSimulation(float tickSeconds) {
+    if (bowAquired && showBowAndArrow && shotArrow) {
+        tickShootingArrow(tickSeconds);
+    }
+    if (enableDayNightCycle) {
+        tickDayNightCycle(tickSeconds);
+    }
+    checkIfInsideCottage();
+    if (!bowAquired) {
+        checkIfBowAquired();
+    }
+}
  
 void cleanup() {
     myWindow.Delete();
@@ -1062,6 +2605,26 @@ void cleanup() {
 
 int main(int argc, const char * argv[]) {
 
+    bool bvhBenchmark = false;
+    bool bakeAndExit = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--deferred") {
+            useDeferredShading = true;
+        }
+        if (std::string(argv[i]) == "--variance-shadows") {
+            useVarianceShadows = true;
+        }
+        if (std::string(argv[i]) == "--tick-rate" && i + 1 < argc) {
+            simulationTickRate = std::max(1.0, atof(argv[++i]));
+        }
+        if (std::string(argv[i]) == "--bvh-benchmark") {
+            bvhBenchmark = true;
+        }
+        if (std::string(argv[i]) == "--bake-lightmaps") {
+            bakeAndExit = true;
+        }
+    }
+
     try {
         initOpenGLWindow();
     } catch (const std::exception& e) {
@@ -1069,27 +2632,64 @@ int main(int argc, const char * argv[]) {
         return EXIT_FAILURE;
     }
     initOpenGLState();
+    workerPool.reset(new gps::ThreadPool());
 	initModels();
+    initLightmaps();
+    initStaticBatches();
+    initIndirectDraws();
 	initShaders();
 	initUniforms();
+    initOverdrawMeters();
+    initOcclusionCulling();
+    initPortals();
+    initOcclusionQueries();
+    initSceneBvh();
+    // the forest is planted with rays against the terrain
+    initImpostors();
+    initFrameAllocator();
+    initClusteredLights();
+    initLampShadow();
+    initSpotShadows();
+    initDeferredShading();
     initFBO();
-    initFaces();
-    initDarkFaces();
     initSkyBoxShader();
     setWindowCallbacks();
 
+    // --bvh-benchmark times the scene BVH against a plain loop over the instances and exits
+    if (bvhBenchmark) {
+        std::vector<gps::AABB> bounds;
+        for (size_t i = 0; i < sceneInstances.size(); i++) {
+            if (sceneInstances[i].path != DRAWN_BY_BATCHES) {
+                bounds.push_back(sceneInstances[i].mesh->getBounds().transformed(sceneInstances[i].modelMatrix));
+            }
+        }
+        gps::runBvhBenchmark(bounds, projection * myCamera.getViewMatrix());
+        cleanup();
+        return EXIT_SUCCESS;
+    }
+
+    // --bake-lightmaps path traces the lightmap of the terrain and the cottage, saves it and exits
+    if (bakeAndExit) {
+        bakeLightmaps();
+        cleanup();
+        return EXIT_SUCCESS;
+    }
+
 	glCheckError();
 	// application loop
+    simulationClock.init(simulationTickRate, glfwGetTime());
 	while (!glfwWindowShouldClose(myWindow.getWindow())) {
         processInputs();
-	    renderScene();
-        if (enableDayNightCycle) {
-            dayNightCycle();
+        // the simulation catches up with the clock, then the frame draws between its last two ticks
+        int ticks = simulationClock.advance(glfwGetTime());
+        for (int i = 0; i < ticks; i++) {
+            tickSimulation(simulationClock.getTickSeconds());
         }
-        checkIfInsideCottage();
-        if (!bowAquired) {
-            checkIfBowAquired();
+        if (enableDayNightCycle) {
+            applyDayNightCycle(simulationClock.getAlpha());
         }
+	    renderScene();
+        simulationClock.printStats();
 
 		glfwPollEvents();
 		glfwSwapBuffers(myWindow.getWindow());
@@ -1,25 +1,99 @@
-#version 410 core
+#version 430 core
 
 layout(location=0) in vec3 vPosition;
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
+//index of the indirect draw (baseInstance), only read when useDrawData is set
+layout(location=3) in uint vDrawId;
+//position in the lightmap atlas, negative for meshes without a lightmap
+layout(location=4) in vec2 vLightmapCoords;
+
+//the depth pre-pass (depth.vert) computes the same position, the lit pass then tests GL_EQUAL
+invariant gl_Position;
 
 out vec3 fPosition;
 out vec3 fNormal;
 out vec2 fTexCoords;
+out vec2 fLightmapCoords;
+flat out mat4 fModel;
+flat out mat3 fNormalMatrix;
+flat out int fIsTransparent;
+flat out ivec2 fMaterialLayers;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform mat3 normalMatrix;
+uniform bool isTransparent;
 
 out vec4 fragPosLightSpace;
 uniform mat4 lightSpaceTrMatrix;
 
-void main() 
+//per-object constants written into the frame allocator's ring, read instead of the uniforms above when
+//useObjectConstants is set. std140: the mat3 takes three vec4 columns
+uniform bool useObjectConstants;
+
+layout(std140, binding = 0) uniform ObjectConstants {
+	mat4 model;
+	mat3 normalMatrix;
+	int isTransparent;
+} perObject;
+
+//per-draw data for multi-draw indirect
+uniform bool useDrawData;
+
+struct DrawData {
+	uint matrixIndex;
+	uint materialIndex;
+	uint isTransparent;
+	uint pad;
+};
+
+struct Material {
+	int diffuseLayer;
+	int specularLayer;
+	int pad0;
+	int pad1;
+};
+
+layout(std430, binding = 0) readonly buffer DrawBuffer {
+	DrawData draws[];
+};
+
+//model matrix followed by its inverse transpose
+layout(std430, binding = 1) readonly buffer MatrixBuffer {
+	mat4 modelMatrices[];
+};
+
+layout(std430, binding = 2) readonly buffer MaterialBuffer {
+	Material materials[];
+};
+
+void main()
 {
-	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
+	if(useDrawData) {
+		DrawData draw = draws[vDrawId];
+		fModel = modelMatrices[draw.matrixIndex * 2];
+		//inverseTranspose(view * model) == mat3(view) * inverseTranspose(model) for a rigid view
+		fNormalMatrix = mat3(view) * mat3(modelMatrices[draw.matrixIndex * 2 + 1]);
+		fIsTransparent = int(draw.isTransparent);
+		fMaterialLayers = ivec2(materials[draw.materialIndex].diffuseLayer, materials[draw.materialIndex].specularLayer);
+	} else if(useObjectConstants) {
+		fModel = perObject.model;
+		fNormalMatrix = perObject.normalMatrix;
+		fIsTransparent = perObject.isTransparent;
+		fMaterialLayers = ivec2(0);
+	} else {
+		fModel = model;
+		fNormalMatrix = normalMatrix;
+		fIsTransparent = isTransparent ? 1 : 0;
+		fMaterialLayers = ivec2(0);
+	}
+
+	gl_Position = projection * view * fModel * vec4(vPosition, 1.0f);
 	fPosition = vPosition;
 	fNormal = vNormal;
 	fTexCoords = vTexCoords;
-	fragPosLightSpace = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
+	fLightmapCoords = vLightmapCoords;
+	fragPosLightSpace = lightSpaceTrMatrix * fModel * vec4(vPosition, 1.0f);
 }
@@ -0,0 +1,9 @@
+#version 430 core
+
+//color writes are masked, the query only counts samples
+out vec4 fColor;
+
+void main()
+{
+	fColor = vec4(1.0f);
+}
@@ -0,0 +1,13 @@
+#version 430 core
+
+//corner of the unit cube, stretched over the box
+layout(location=0) in vec3 vPosition;
+
+uniform mat4 viewProjection;
+uniform vec3 boxMin;
+uniform vec3 boxMax;
+
+void main()
+{
+	gl_Position = viewProjection * vec4(mix(boxMin, boxMax, vPosition), 1.0f);
+}
@@ -0,0 +1,48 @@
+#version 430 core
+
+in vec2 fTexCoords;
+
+out vec4 fColor;
+
+//G-buffer written by basic.frag
+uniform sampler2D gAlbedo;
+//view space normal, w 1 for the alpha tested foliage
+uniform sampler2D gNormal;
+uniform sampler2D gSpecular;
+uniform sampler2D gDepth;
+
+//matrices
+uniform mat4 inverseView;
+uniform mat4 inverseProjection;
+uniform mat4 lightSpaceTrMatrix;
+
+//the same lighting as basic.frag, fed per pixel
+#include "lighting.glsl"
+
+void main()
+{
+	//nothing was drawn here, the skybox fills it later
+	float depth = texture(gDepth, fTexCoords).r;
+	if(depth >= 1.0f) {
+		discard;
+	}
+	gl_FragDepth = depth;
+
+	//view space position from the depth and the inverse of the scene projection
+	vec4 ndc = vec4(vec3(fTexCoords, depth) * 2.0f - 1.0f, 1.0f);
+	fPosEye = inverseProjection * ndc;
+	fPosEye /= fPosEye.w;
+
+	positionWorld = vec3(inverseView * fPosEye);
+
+	diffuseColor = texture(gAlbedo, fTexCoords);
+	specularColor = texture(gSpecular, fTexCoords);
+	vec4 normal = texture(gNormal, fTexCoords);
+	normalEye = normalize(normal.xyz);
+	isTransparent = normal.w > 0.5f;
+
+    computeDirLight();
+	//the light space position of the pixel, rebuilt from its view space one
+	color = computeSunColor(lightSpaceTrMatrix * vec4(positionWorld, 1.0f));
+	fColor = finishLighting(color);
+}
@@ -0,0 +1,11 @@
+#version 430 core
+
+//one triangle covering the screen, no vertex buffer
+out vec2 fTexCoords;
+
+void main()
+{
+	vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	fTexCoords = corner;
+	gl_Position = vec4(corner * 2.0f - 1.0f, 0.0f, 1.0f);
+}
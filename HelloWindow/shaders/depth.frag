@@ -0,0 +1,29 @@
+#version 430 core
+
+in vec2 fTexCoords;
+flat in int fIsTransparent;
+flat in int fDiffuseLayer;
+
+//color writes are masked, only the alpha matters for alpha to coverage
+out vec4 fColor;
+
+uniform sampler2D diffuseTexture;
+uniform bool useDrawData;
+uniform sampler2DArray diffuseTextureArray;
+uniform bool useAlphaToCoverage;
+
+void main()
+{
+	float alpha = 1.0f;
+	if(fIsTransparent != 0) {
+		alpha = useDrawData ? texture(diffuseTextureArray, vec3(fTexCoords, fDiffuseLayer)).a : texture(diffuseTexture, fTexCoords).a;
+		if(useAlphaToCoverage) {
+			//sharpen the alpha around the 0.4 cutoff to about one pixel, the samples then give the edge a smooth coverage
+			alpha = clamp((alpha - 0.4f) / max(fwidth(alpha), 0.0001f) + 0.5f, 0.0f, 1.0f);
+		}
+		else if(alpha < 0.4f) {
+			discard;
+		}
+	}
+	fColor = vec4(0.0f, 0.0f, 0.0f, alpha);
+}
@@ -0,0 +1,75 @@
+#version 430 core
+
+layout(location=0) in vec3 vPosition;
+layout(location=2) in vec2 vTexCoords;
+layout(location=3) in uint vDrawId;
+
+//must match basic.vert exactly so the lit pass can test GL_EQUAL against this depth
+invariant gl_Position;
+
+out vec2 fTexCoords;
+flat out int fIsTransparent;
+flat out int fDiffuseLayer;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+uniform bool isTransparent;
+
+//per-object constants, see basic.vert
+uniform bool useObjectConstants;
+
+layout(std140, binding = 0) uniform ObjectConstants {
+	mat4 model;
+	mat3 normalMatrix;
+	int isTransparent;
+} perObject;
+
+//per-draw data for multi-draw indirect, see basic.vert
+uniform bool useDrawData;
+
+struct DrawData {
+	uint matrixIndex;
+	uint materialIndex;
+	uint isTransparent;
+	uint pad;
+};
+
+struct Material {
+	int diffuseLayer;
+	int specularLayer;
+	int pad0;
+	int pad1;
+};
+
+layout(std430, binding = 0) readonly buffer DrawBuffer {
+	DrawData draws[];
+};
+
+layout(std430, binding = 1) readonly buffer MatrixBuffer {
+	mat4 modelMatrices[];
+};
+
+layout(std430, binding = 2) readonly buffer MaterialBuffer {
+	Material materials[];
+};
+
+void main()
+{
+	mat4 fModel = model;
+	fIsTransparent = isTransparent ? 1 : 0;
+	fDiffuseLayer = 0;
+	if(useObjectConstants) {
+		fModel = perObject.model;
+		fIsTransparent = perObject.isTransparent;
+	}
+	if(useDrawData) {
+		DrawData draw = draws[vDrawId];
+		fModel = modelMatrices[draw.matrixIndex * 2];
+		fIsTransparent = int(draw.isTransparent);
+		fDiffuseLayer = materials[draw.materialIndex].diffuseLayer;
+	}
+
+	gl_Position = projection * view * fModel * vec4(vPosition, 1.0f);
+	fTexCoords = vTexCoords;
+}
@@ -0,0 +1,102 @@
+#version 430 core
+
+in vec2 fTexCoords;
+in vec3 fViewPosition;
+flat in ivec4 fTiles;
+flat in vec4 fWeights;
+flat in vec3 fViewDirection;
+flat in float fYaw;
+flat in float fScale;
+
+out vec4 fColor;
+
+uniform mat4 projection;
+uniform sampler2D colorAtlas;
+uniform sampler2D normalDepthAtlas;
+uniform ivec2 atlasViews;
+uniform float impostorRadius;
+
+//lighting, same values as basic.frag
+uniform vec3 lightDir;
+uniform vec3 lightColor;
+uniform bool showFog;
+float ambientStrength = 0.2f;
+//diffuse light of the sky, as in basic.frag
+uniform vec3 shAmbient[9];
+
+vec2 tileCoords(int tile)
+{
+	return (vec2(tile % atlasViews.x, tile / atlasViews.x) + fTexCoords) / vec2(atlasViews);
+}
+
+vec3 rotateY(vec3 v, float angle)
+{
+	float s = sin(angle);
+	float c = cos(angle);
+	return vec3(c * v.x + s * v.z, v.y, -s * v.x + c * v.z);
+}
+
+vec3 computeSkyAmbient(vec3 n)
+{
+	vec3 irradiance = shAmbient[0]
+		+ shAmbient[1] * n.y + shAmbient[2] * n.z + shAmbient[3] * n.x
+		+ shAmbient[4] * (n.x * n.y) + shAmbient[5] * (n.y * n.z) + shAmbient[6] * (3.0f * n.z * n.z - 1.0f)
+		+ shAmbient[7] * (n.x * n.z) + shAmbient[8] * (n.x * n.x - n.y * n.y);
+	return max(irradiance, 0.0f);
+}
+
+float computeFog(vec3 positionEye)
+{
+	float fogDensity = 0.1f;
+	float fragmentDistance = length(positionEye);
+	float fogFactor = exp(-pow(fragmentDistance * fogDensity, 2));
+	return clamp(fogFactor, 0.0f, 1.0f);
+}
+
+void main()
+{
+	vec4 color = vec4(0.0f);
+	vec3 normal = vec3(0.0f);
+	float depth = 0.5f;
+	float bestWeight = 0.0f;
+	for(int i = 0; i < 4; i++) {
+		if(fWeights[i] <= 0.0f) {
+			continue;
+		}
+		vec2 coords = tileCoords(fTiles[i]);
+		vec4 tileColor = texture(colorAtlas, coords);
+		vec4 tileNormalDepth = texture(normalDepthAtlas, coords);
+		//both atlases are averaged with the empty texels around the edges, so they are
+		//premultiplied by the coverage: encoded * a decodes to normal * a as 2 * encoded - a
+		color += fWeights[i] * tileColor;
+		normal += fWeights[i] * (tileNormalDepth.xyz * 2.0f - tileColor.a);
+		//depth of the view that covers the texel the most
+		if(fWeights[i] * tileColor.a > bestWeight) {
+			bestWeight = fWeights[i] * tileColor.a;
+			depth = tileNormalDepth.w / tileColor.a;
+		}
+	}
+
+	if(color.a < 0.4f) {
+		discard;
+	}
+	vec3 albedo = color.rgb / color.a;
+
+	vec3 normalWorld = rotateY(normalize(normal), fYaw);
+	vec3 ambient = ambientStrength * computeSkyAmbient(normalWorld);
+	//foliage is lit from both sides, like the transparent path of basic.frag
+	vec3 diffuse = abs(dot(normalWorld, normalize(lightDir))) * lightColor;
+	vec3 result = min((ambient + diffuse) * albedo, 1.0f);
+
+	//push the quad to the baked surface so impostors intersect the terrain and each other
+	vec3 positionEye = fViewPosition + fViewDirection * impostorRadius * fScale * (1.0f - 2.0f * depth);
+	vec4 clip = projection * vec4(positionEye, 1.0f);
+	gl_FragDepth = clip.z / clip.w * 0.5f + 0.5f;
+
+	if(showFog) {
+		vec4 fogColor = vec4(0.8f, 0.8f, 1.0f, 1.0f);
+		fColor = mix(fogColor, vec4(result, 1.0f), computeFog(positionEye));
+	} else {
+		fColor = vec4(result, 1.0f);
+	}
+}
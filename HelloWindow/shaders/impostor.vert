@@ -0,0 +1,72 @@
+#version 430 core
+
+layout(location=0) in vec2 vCorner;
+//position of the instance and its scale
+layout(location=1) in vec4 vInstance;
+layout(location=2) in float vYaw;
+
+out vec2 fTexCoords;
+out vec3 fViewPosition;
+//the four nearest baked views and their blend weights
+flat out ivec4 fTiles;
+flat out vec4 fWeights;
+flat out vec3 fViewDirection;
+flat out float fYaw;
+flat out float fScale;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 cameraPosition;
+
+uniform vec3 impostorCenter;
+uniform float impostorRadius;
+uniform ivec2 atlasViews;
+uniform float maxElevation;
+
+const float PI = 3.14159265f;
+
+vec3 rotateY(vec3 v, float angle)
+{
+	float s = sin(angle);
+	float c = cos(angle);
+	return vec3(c * v.x + s * v.z, v.y, -s * v.x + c * v.z);
+}
+
+void main()
+{
+	float scale = vInstance.w;
+	vec3 center = vInstance.xyz + rotateY(impostorCenter * scale, vYaw);
+	vec3 toCamera = normalize(cameraPosition - center);
+
+	//view direction in the frame the views were baked in, see impostorViewDirection
+	vec3 local = rotateY(toCamera, -vYaw);
+	float azimuth = atan(local.x, local.z);
+	if(azimuth < 0.0f) {
+		azimuth += 2.0f * PI;
+	}
+	float elevation = clamp(asin(clamp(local.y, -1.0f, 1.0f)), 0.0f, maxElevation);
+
+	float a = azimuth / (2.0f * PI) * float(atlasViews.x);
+	float e = elevation / maxElevation * float(atlasViews.y - 1);
+	int a0 = int(floor(a)) % atlasViews.x;
+	int a1 = (a0 + 1) % atlasViews.x;
+	int e0 = min(int(floor(e)), atlasViews.y - 1);
+	int e1 = min(e0 + 1, atlasViews.y - 1);
+	float fa = fract(a);
+	float fe = e - float(e0);
+
+	fTiles = ivec4(a0 + e0 * atlasViews.x, a1 + e0 * atlasViews.x, a0 + e1 * atlasViews.x, a1 + e1 * atlasViews.x);
+	fWeights = vec4((1.0f - fa) * (1.0f - fe), fa * (1.0f - fe), (1.0f - fa) * fe, fa * fe);
+
+	//camera facing quad with the same framing as the orthographic bake
+	vec3 right = normalize(cross(vec3(0.0f, 1.0f, 0.0f), toCamera));
+	vec3 up = cross(toCamera, right);
+	vec3 position = center + (vCorner.x * right + vCorner.y * up) * impostorRadius * scale;
+
+	fTexCoords = vCorner * 0.5f + 0.5f;
+	fViewPosition = vec3(view * vec4(position, 1.0f));
+	fViewDirection = mat3(view) * toCamera;
+	fYaw = vYaw;
+	fScale = scale;
+	gl_Position = projection * vec4(fViewPosition, 1.0f);
+}
@@ -0,0 +1,28 @@
+#version 430 core
+
+in vec3 fNormal;
+in vec2 fTexCoords;
+
+//atlas tiles: albedo, and the normal in model space with the depth across the bounding sphere
+layout(location=0) out vec4 fColor;
+layout(location=1) out vec4 fNormalDepth;
+
+uniform sampler2D diffuseTexture;
+uniform bool isTransparent;
+
+void main()
+{
+	vec4 diffuseColor = texture(diffuseTexture, fTexCoords);
+	if(isTransparent && diffuseColor.a < 0.4f) {
+		discard;
+	}
+
+	vec3 normal = normalize(fNormal);
+	if(!gl_FrontFacing) {
+		normal = -normal;
+	}
+
+	fColor = vec4(diffuseColor.rgb, 1.0f);
+	//orthographic projection, gl_FragCoord.z is linear in the distance
+	fNormalDepth = vec4(normal * 0.5f + 0.5f, gl_FragCoord.z);
+}
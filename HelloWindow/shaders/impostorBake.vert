@@ -0,0 +1,21 @@
+#version 430 core
+
+layout(location=0) in vec3 vPosition;
+layout(location=1) in vec3 vNormal;
+layout(location=2) in vec2 vTexCoords;
+
+out vec3 fNormal;
+out vec2 fTexCoords;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+uniform mat3 normalMatrix;
+
+void main()
+{
+	//the normals are stored flipped, like basic.frag undo it
+	fNormal = normalMatrix * -vNormal;
+	fTexCoords = vTexCoords;
+	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
+}
@@ -0,0 +1,308 @@
+//lighting shared by basic.frag and deferred.frag, pulled in with #include by Shader::readShaderFile.
+//The including shader sets fPosEye, positionWorld, normalEye, the material colors and isTransparent
+//before calling the compute functions
+
+//matrices
+uniform mat4 view;
+
+//lighting
+uniform vec3 lightDir;
+uniform vec3 lightColor;
+
+//spot light
+uniform vec3 spotLightPos;
+uniform vec3 spotLightDir;
+uniform float cutOff;
+uniform float outerCutOff;
+
+//control
+uniform bool showShadow;
+uniform bool showFog;
+uniform bool nightModeEnabled;
+uniform bool showSpotLight;
+
+//the surface being lit
+vec4 fPosEye;
+vec3 positionWorld;
+vec3 normalEye;
+vec4 diffuseColor;
+vec4 specularColor;
+bool isTransparent;
+//the lightmap already holds the lights marked as baked
+bool lightmapped = false;
+
+//components
+vec3 ambient;
+float ambientStrength = 0.2f;
+vec3 diffuse;
+vec3 specular;
+float specularStrength = 0.5f;
+
+//shadows
+uniform sampler2D shadowMap;
+//the shadow map holds the blurred depth moments of a VarianceShadowMap
+uniform bool useVarianceShadows;
+//depth bias of the hard shadow, a fixed world distance over the light volume's depth range
+uniform float shadowBias;
+
+vec3 color;
+
+vec3 whiteColor = vec3(1,1,1);
+
+//clustered point and spot lights (cottage lamp, lanterns), in view space
+struct ClusterLight {
+	vec4 positionRange;
+	vec4 colorIsSpot;
+	vec4 directionOuterCutOff;
+	//x linear, y quadratic, z cutOff, w 1 when the lightmap holds the light
+	vec4 falloff;
+	//x 1 when the light is the one of the point shadow map
+	vec4 shadow;
+};
+
+layout(std430, binding = 3) readonly buffer LightBuffer {
+	ClusterLight lights[];
+};
+
+//per cluster: first index and count in lightIndices
+layout(std430, binding = 4) readonly buffer ClusterGridBuffer {
+	uvec2 clusters[];
+};
+
+layout(std430, binding = 5) readonly buffer ClusterIndexBuffer {
+	uint lightIndices[];
+};
+
+uniform ivec3 clusterGrid;
+uniform vec2 clusterTileSize;
+//depth slice = log(view depth) * x + y
+uniform vec2 clusterDepthScaleBias;
+
+//diffuse light of the sky, spherical harmonics with the cosine lobe and the basis constants folded in
+uniform vec3 shAmbient[9];
+
+vec3 computeSkyAmbient(vec3 normalEye) {
+	vec3 n = transpose(mat3(view)) * normalEye;
+	vec3 irradiance = shAmbient[0]
+		+ shAmbient[1] * n.y + shAmbient[2] * n.z + shAmbient[3] * n.x
+		+ shAmbient[4] * (n.x * n.y) + shAmbient[5] * (n.y * n.z) + shAmbient[6] * (3.0f * n.z * n.z - 1.0f)
+		+ shAmbient[7] * (n.x * n.z) + shAmbient[8] * (n.x * n.x - n.y * n.y);
+	return max(irradiance, 0.0f);
+}
+
+void computeDirLight()
+{
+    //normalize light direction
+    vec3 lightDirN = vec3(normalize(view * vec4(lightDir, 0.0f)));
+
+    //compute view direction (in eye coordinates, the viewer is situated at the origin
+    vec3 viewDir = normalize(- fPosEye.xyz);
+
+    //compute ambient light, from the sky around the normal
+    ambient = ambientStrength * computeSkyAmbient(normalEye);
+
+    //compute diffuse light
+    if(isTransparent) {
+		diffuse = max(abs(dot(normalEye, lightDirN)), 0.0f) * lightColor; //abs helps with transparency
+	}
+	else {
+		diffuse = max(dot(normalEye, lightDirN), 0.0f) * lightColor;
+	}
+
+    //compute specular light
+    vec3 reflectDir = reflect(-lightDirN, normalEye);
+    float specCoeff = pow(max(dot(viewDir, reflectDir), 0.0f), 32);
+    specular = specularStrength * specCoeff * lightColor;
+}
+
+//shadow cubemap of a point light, the distance to the light over its range (PointShadowMap)
+uniform samplerCubeShadow pointShadowMap;
+uniform vec3 pointShadowPosition;
+uniform float pointShadowRange;
+
+//lit fraction, from the 4 nearest texels of the cubemap
+float computePointShadow(vec3 positionWorld) {
+	vec3 fromLight = positionWorld - pointShadowPosition;
+	float depth = length(fromLight) / pointShadowRange;
+	return texture(pointShadowMap, vec4(fromLight, depth - 0.005f));
+}
+
+vec3 computeClusteredLights() {
+
+	vec3 viewDir = normalize(- fPosEye.xyz);
+
+	//the cluster of the fragment: its screen tile and depth slice
+	ivec2 tile = min(ivec2(gl_FragCoord.xy / clusterTileSize), clusterGrid.xy - 1);
+	int slice = clamp(int(log(max(-fPosEye.z, 1e-4f)) * clusterDepthScaleBias.x + clusterDepthScaleBias.y), 0, clusterGrid.z - 1);
+	uvec2 cluster = clusters[(slice * clusterGrid.y + tile.y) * clusterGrid.x + tile.x];
+
+	vec3 color = vec3(0.0f);
+	for(uint i = 0u; i < cluster.y; i++) {
+		ClusterLight light = lights[lightIndices[cluster.x + i]];
+		if(lightmapped && light.falloff.w > 0.0f) {
+			continue;
+		}
+		vec3 toLight = light.positionRange.xyz - fPosEye.xyz;
+		float distance = length(toLight);
+		if(distance >= light.positionRange.w) {
+			continue;
+		}
+		vec3 lightDirN = toLight / distance;
+
+		// attenuation, faded to zero at the range the cluster lists were built for
+		float attenuation = 1.0 / (1.0f + light.falloff.x * distance + light.falloff.y * (distance * distance));
+		float fade = clamp(1.0f - pow(distance / light.positionRange.w, 4.0f), 0.0f, 1.0f);
+		attenuation *= fade * fade;
+		if(light.colorIsSpot.w > 0.0f) {
+			float theta = dot(-lightDirN, light.directionOuterCutOff.xyz);
+			attenuation *= clamp((theta - light.directionOuterCutOff.w) / (light.falloff.z - light.directionOuterCutOff.w), 0.0f, 1.0f);
+		}
+
+		float lit = light.shadow.x > 0.0f ? computePointShadow(positionWorld) : 1.0f;
+
+		//ambient
+		vec3 ambient = ambientStrength * light.colorIsSpot.rgb;
+		// diffuse shading
+		vec3 diffuse = lit * max(dot(normalEye, lightDirN), 0.0f) * light.colorIsSpot.rgb;
+		// specular shading
+		vec3 reflectDir = reflect(-lightDirN, normalEye);
+		float specCoeff = pow(max(dot(viewDir, reflectDir), 0.0f), 32);
+		vec3 specular = lit * specularStrength * specCoeff * light.colorIsSpot.rgb;
+
+		color += ((ambient + diffuse) * diffuseColor.rgb + specular * specularColor.rgb) * attenuation;
+	}
+	return min(color, 1.0f);
+}
+
+//shadow of the flashlight, its tile of the depth atlas shared by the spotlights (ShadowAtlas)
+uniform sampler2DShadow spotShadowAtlas;
+uniform bool spotShadowEnabled;
+uniform mat4 spotShadowMatrix;
+//the tile's texture coordinates, min in xy, max in zw
+uniform vec4 spotShadowRect;
+
+//lit fraction, from the 4 nearest texels of the tile. The depths were offset when drawn
+float computeSpotShadow(vec3 positionWorld) {
+	if(!spotShadowEnabled) {
+		return 1.0f;
+	}
+	vec4 coords = spotShadowMatrix * vec4(positionWorld, 1.0f);
+	if(coords.w <= 0.0f) {
+		return 1.0f;
+	}
+	vec3 normalizedCoords = coords.xyz / coords.w;
+	if(normalizedCoords.z > 1.0f) {
+		return 1.0f;
+	}
+	vec2 uv = clamp(normalizedCoords.xy, spotShadowRect.xy, spotShadowRect.zw);
+	return texture(spotShadowAtlas, vec3(uv, normalizedCoords.z));
+}
+
+vec3 computeSpotLight() {
+
+	vec3 spotLightPosToFragDir = normalize(spotLightPos - positionWorld); // dir from spot light pos to fragment
+
+	vec3 lightDirN = vec3(normalize(view * vec4(spotLightDir, 0.0f)));
+	vec3 viewDir = normalize(- fPosEye.xyz);
+
+    //ambient
+	vec3 ambient = ambientStrength * whiteColor;
+    // diffuse shading
+	vec3 diffuse = max(dot(normalEye, lightDirN), 0.0f) * whiteColor;
+    // specular shading
+    vec3 reflectDir = reflect(-lightDirN, normalEye);
+	float specCoeff = pow(max(dot(viewDir, reflectDir), 0.0f), 32);
+    vec3 specular = specularStrength * specCoeff * whiteColor;
+
+    // attenuation
+    float distance = length(spotLightPos - positionWorld);
+    float attenuation = 1.0 / (1.0f + 0.09 * distance + 0.032 * (distance * distance));
+
+    // spotlight intensity
+    float theta = dot(normalize(-spotLightDir), spotLightPosToFragDir);
+    float epsilon = cutOff - outerCutOff;
+    float intensity = clamp((theta - outerCutOff) / epsilon, 0.0, 1.0);
+
+	float lit = computeSpotShadow(positionWorld);
+	ambient *= attenuation * intensity;
+    diffuse *= lit * attenuation * intensity;
+    specular *= lit * attenuation * intensity;
+
+	vec3 color = min((ambient + diffuse) * diffuseColor.rgb + specular * specularColor.rgb, 1.0f);
+    return color;
+}
+
+//upper bound of the lit fraction from the mean and variance of the caster depths (Chebyshev)
+float computeVarianceShadow(vec3 normalizedCoords) {
+	vec2 moments = texture(shadowMap, normalizedCoords.xy).rg;
+	float depth = normalizedCoords.z;
+	if(depth <= moments.x) {
+		return 0.0f;
+	}
+	float variance = max(moments.y - moments.x * moments.x, 1e-5f);
+	float d = depth - moments.x;
+	float lit = variance / (variance + d * d);
+	//drops the tail of the bound, which bleeds light where shadows overlap
+	lit = clamp((lit - 0.3f) / 0.7f, 0.0f, 1.0f);
+	return 1.0f - lit;
+}
+
+float computeShadow(vec4 fragPosLightSpace) {
+	// perform perspective divide
+	vec3 normalizedCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+
+	// Transform to [0,1] range
+	normalizedCoords = normalizedCoords * 0.5 + 0.5;
+
+	if(useVarianceShadows) {
+		return normalizedCoords.z > 1.0f ? 0.0f : computeVarianceShadow(normalizedCoords);
+	}
+
+	// Get closest depth value from light's perspective
+	float closestDepth = texture(shadowMap, normalizedCoords.xy).r;
+
+	// Get depth of current fragment from light's perspective
+	float currentDepth = normalizedCoords.z;
+
+	float shadow = currentDepth - shadowBias > closestDepth ? 1.0 : 0.0;
+	if (normalizedCoords.z > 1.0f)
+		return 0.0f;
+
+	return shadow;
+}
+
+float computeFog()
+{
+ float fogDensity = 0.1f;
+ float fragmentDistance = length(fPosEye);
+ float fogFactor = exp(-pow(fragmentDistance * fogDensity, 2));
+
+ return clamp(fogFactor, 0.0f, 1.0f);
+}
+
+//sun with its shadow, unless the caller lit the surface from the lightmap
+vec3 computeSunColor(vec4 fragPosLightSpace) {
+	if(showShadow && (!nightModeEnabled)) {
+		float shadow = computeShadow(fragPosLightSpace);
+		return min((ambient + (1.0f - shadow)*diffuse) * diffuseColor.rgb + ((1.0f - shadow)*specular) * specularColor.rgb, 1.0f);
+	}
+	return min((ambient + diffuse) * diffuseColor.rgb + specular * specularColor.rgb, 1.0f);
+}
+
+//adds the lamps and the flashlight to the color, then the fog
+vec4 finishLighting(vec3 color) {
+	if(nightModeEnabled) { //when in night mode, show the cottage light and the lanterns
+		color += computeClusteredLights();
+	}
+
+	if(showSpotLight) {
+		color += computeSpotLight();
+	}
+
+	if(showFog) {
+		float fogFactor = computeFog();
+	    vec4 fogColor = vec4(0.8f, 0.8f, 1.0f, 1.0f);
+	    return mix(fogColor, vec4(color, 1.0f), fogFactor);
+	}
+	return vec4(color, 1.0f);
+}
@@ -0,0 +1,19 @@
+#version 430 core
+
+in vec3 fPosition;
+in vec2 fTexCoords;
+
+uniform vec3 lightPosition;
+uniform float lightRange;
+
+uniform sampler2D diffuseTexture;
+uniform bool isTransparent;
+
+//the distance to the light over its range, the same for every face
+void main()
+{
+	if(isTransparent && texture(diffuseTexture, fTexCoords).a < 0.4f) {
+		discard;
+	}
+	gl_FragDepth = length(fPosition - lightPosition) / lightRange;
+}
@@ -0,0 +1,14 @@
+#version 430 core
+layout(location=0) in vec3 vPosition;
+layout(location=2) in vec2 vTexCoords;
+
+uniform mat4 model;
+
+out vec2 gTexCoords;
+
+//world space, the geometry shader projects it onto each face
+void main()
+{
+	gl_Position = model * vec4(vPosition, 1.0f);
+	gTexCoords = vTexCoords;
+}
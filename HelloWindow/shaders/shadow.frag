@@ -1,14 +1,22 @@
-#version 410 core
+#version 430 core
 out vec4 fColor;
 uniform sampler2D diffuseTexture;
-uniform bool isTransparent;
+uniform bool useDrawData;
+uniform sampler2DArray diffuseTextureArray;
 in vec2 fTexCoords;
+flat in int fIsTransparent;
+flat in int fDiffuseLayer;
 void main()
 {
-	if(isTransparent) {
-		if(texture(diffuseTexture, fTexCoords).a < 0.4f) {
+	if(fIsTransparent != 0) {
+		float alpha = useDrawData ? texture(diffuseTextureArray, vec3(fTexCoords, fDiffuseLayer)).a : texture(diffuseTexture, fTexCoords).a;
+		if(alpha < 0.4f) {
 			discard;
 		}
 	}
-	fColor = vec4(0.3f);
-}
\ No newline at end of file
+	//the moments of the variance shadow map, the hard shadow map has no color target and keeps only the depth
+	float depth = gl_FragCoord.z;
+	float dx = dFdx(depth);
+	float dy = dFdy(depth);
+	fColor = vec4(depth, depth * depth + 0.25f * (dx * dx + dy * dy), 0.0f, 1.0f);
+}
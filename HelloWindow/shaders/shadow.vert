@@ -1,11 +1,61 @@
-#version 410 core
+#version 430 core
 layout(location=0) in vec3 vPosition;
 uniform mat4 lightSpaceTrMatrix;
 uniform mat4 model;
+uniform bool isTransparent;
 layout(location=2) in vec2 vTexCoords;
+layout(location=3) in uint vDrawId;
 out vec2 fTexCoords;
+flat out int fIsTransparent;
+flat out int fDiffuseLayer;
+
+//per-object constants, see basic.vert
+uniform bool useObjectConstants;
+layout(std140, binding = 0) uniform ObjectConstants {
+	mat4 model;
+	mat3 normalMatrix;
+	int isTransparent;
+} perObject;
+
+//per-draw data for multi-draw indirect, see basic.vert
+uniform bool useDrawData;
+struct DrawData {
+	uint matrixIndex;
+	uint materialIndex;
+	uint isTransparent;
+	uint pad;
+};
+struct Material {
+	int diffuseLayer;
+	int specularLayer;
+	int pad0;
+	int pad1;
+};
+layout(std430, binding = 0) readonly buffer DrawBuffer {
+	DrawData draws[];
+};
+layout(std430, binding = 1) readonly buffer MatrixBuffer {
+	mat4 modelMatrices[];
+};
+layout(std430, binding = 2) readonly buffer MaterialBuffer {
+	Material materials[];
+};
+
 void main()
 {
- gl_Position = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
+ mat4 drawModel = model;
+ fIsTransparent = isTransparent ? 1 : 0;
+ fDiffuseLayer = 0;
+ if(useObjectConstants) {
+	drawModel = perObject.model;
+	fIsTransparent = perObject.isTransparent;
+ }
+ if(useDrawData) {
+	DrawData draw = draws[vDrawId];
+	drawModel = modelMatrices[draw.matrixIndex * 2];
+	fIsTransparent = int(draw.isTransparent);
+	fDiffuseLayer = materials[draw.materialIndex].diffuseLayer;
+ }
+ gl_Position = lightSpaceTrMatrix * drawModel * vec4(vPosition, 1.0f);
  fTexCoords = vTexCoords;
-}
\ No newline at end of file
+}
@@ -0,0 +1,24 @@
+#version 430 core
+
+in vec2 fTexCoords;
+
+out vec4 fColor;
+
+//depth moments of the variance shadow map
+uniform sampler2D moments;
+//one texel along the blurred axis
+uniform vec2 blurStep;
+
+//9 tap Gaussian in 5 filtered reads, the outer offsets fall between two texels weighted together
+const float offsets[3] = float[](0.0f, 1.3846153846f, 3.2307692308f);
+const float weights[3] = float[](0.2270270270f, 0.3162162162f, 0.0702702703f);
+
+void main()
+{
+	vec2 sum = texture(moments, fTexCoords).rg * weights[0];
+	for(int i = 1; i < 3; i++) {
+		sum += texture(moments, fTexCoords + blurStep * offsets[i]).rg * weights[i];
+		sum += texture(moments, fTexCoords - blurStep * offsets[i]).rg * weights[i];
+	}
+	fColor = vec4(sum, 0.0f, 1.0f);
+}